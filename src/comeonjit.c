@@ -1,14 +1,19 @@
 #include "comeonjit.h"
 #include "kvm.h"
+#include "kjitdebug.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 
 #ifdef _WIN32
 #include <windows.h>
 #else
 #include <sys/mman.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #endif
 
 // --- 輔助宏 ---
@@ -33,16 +38,225 @@
 #define OFFSET_KVALUE_AS   8
 #define SIZE_KVALUE        16
 
-/** @brief KVM 偏移量 */
-/**< registers 指針在偏移量 16 (64 位 KVM 結構體) */
-/**< 但我們將其加載到 RSI，因此相對偏移量為 0 */
-#define OFFSET_KVM_REGISTERS 0
-
 /** @brief 內存管理 */
 
+#define JIT_INITIAL_REGION (256 * 1024)        /**< 首個區段大小 */
+#define JIT_DEFAULT_LIMIT  (64 * 1024 * 1024)  /**< 默認緩存上限 */
+#define JIT_CODE_ALIGN     16                  /**< 代碼塊對齊 */
+
+static size_t jit_page_size(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (size_t)info.dwAllocationGranularity;
+#else
+    long page = sysconf(_SC_PAGESIZE);
+    return page > 0 ? (size_t)page : 4096;
+#endif
+}
+
+/** @brief 映射一個雙視圖區段 (RW + RX 指向同一物理頁) */
+static JitCodeRegion* jit_map_region(size_t size) {
+    JitCodeRegion* region = (JitCodeRegion*)calloc(1, sizeof(JitCodeRegion));
+    if (!region) return NULL;
+    region->size = size;
+
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_EXECUTE_READWRITE,
+                                        (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+    if (!mapping) { free(region); return NULL; }
+    region->rw_base = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+    region->rx_base = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_EXECUTE, 0, 0, size);
+    if (!region->rw_base || !region->rx_base) {
+        if (region->rw_base) UnmapViewOfFile(region->rw_base);
+        if (region->rx_base) UnmapViewOfFile(region->rx_base);
+        CloseHandle(mapping);
+        free(region);
+        return NULL;
+    }
+    region->mapping = mapping;
+#else
+    int fd = -1;
+#if defined(__linux__) && defined(SYS_memfd_create)
+    fd = (int)syscall(SYS_memfd_create, "korelin-jit", 1u /* MFD_CLOEXEC */);
+#endif
+    if (fd < 0) {
+        // 無 memfd 時退回到已刪除的臨時文件
+        char path[] = "/tmp/korelin-jit-XXXXXX";
+        fd = mkstemp(path);
+        if (fd >= 0) unlink(path);
+    }
+    if (fd < 0 || ftruncate(fd, (off_t)size) != 0) {
+        if (fd >= 0) close(fd);
+        free(region);
+        return NULL;
+    }
+    void* rw = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    void* rx = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    close(fd);
+    if (rw == MAP_FAILED || rx == MAP_FAILED) {
+        if (rw != MAP_FAILED) munmap(rw, size);
+        if (rx != MAP_FAILED) munmap(rx, size);
+        free(region);
+        return NULL;
+    }
+    region->rw_base = (uint8_t*)rw;
+    region->rx_base = (uint8_t*)rx;
+#endif
+    return region;
+}
+
+static void jit_unmap_region(JitCodeRegion* region) {
+#ifdef _WIN32
+    UnmapViewOfFile(region->rw_base);
+    UnmapViewOfFile(region->rx_base);
+    CloseHandle((HANDLE)region->mapping);
+#else
+    munmap(region->rw_base, region->size);
+    munmap(region->rx_base, region->size);
+#endif
+    free(region);
+}
+
+/** @brief 將片段插回空閒鏈表，並與相鄰片段合併 */
+static void jit_insert_free(ComeOnJIT* jit, JitCodeRegion* region, size_t offset, size_t size) {
+    JitFreeSpan** link = &jit->free_spans;
+    JitFreeSpan* prev = NULL;
+    while (*link && ((*link)->region < region ||
+                     ((*link)->region == region && (*link)->offset < offset))) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+
+    JitFreeSpan* next = *link;
+    if (prev && prev->region == region && prev->offset + prev->size == offset) {
+        prev->size += size;
+        if (next && next->region == region && prev->offset + prev->size == next->offset) {
+            prev->size += next->size;
+            prev->next = next->next;
+            free(next);
+        }
+        return;
+    }
+    if (next && next->region == region && offset + size == next->offset) {
+        next->offset = offset;
+        next->size += size;
+        return;
+    }
+
+    JitFreeSpan* span = (JitFreeSpan*)malloc(sizeof(JitFreeSpan));
+    if (!span) return; // 片段丟失只會浪費空間
+    span->region = region;
+    span->offset = offset;
+    span->size = size;
+    span->next = next;
+    *link = span;
+}
+
+/** @brief 申請新區段，大小按幾何增長，受 cache_limit 限制 */
+static bool jit_grow(ComeOnJIT* jit, size_t min_size) {
+    size_t page = jit_page_size();
+    size_t size = jit->next_region_size;
+    if (size < min_size) size = min_size;
+    size = (size + page - 1) / page * page;
+    if (jit->cache_reserved + size > jit->cache_limit) {
+        // 接近上限時只映射剩餘額度
+        size_t remaining = jit->cache_limit > jit->cache_reserved ? jit->cache_limit - jit->cache_reserved : 0;
+        remaining = remaining / page * page;
+        if (remaining < min_size) return false;
+        size = remaining;
+    }
+
+    JitCodeRegion* region = jit_map_region(size);
+    if (!region) return false;
+
+    region->next = jit->regions;
+    jit->regions = region;
+    jit->cache_reserved += size;
+    jit->next_region_size = size * 2;
+    jit_insert_free(jit, region, 0, size);
+    return true;
+}
+
+/** @brief offset 所在的最外層函數體，不在任何函數體中時返回 NULL */
+static KLazyBody* find_lazy_body(KBytecodeChunk* chunk, size_t offset) {
+    size_t lo = 0, hi = chunk->lazy_body_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (chunk->lazy_bodies[mid].entry <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return NULL;
+    KLazyBody* body = &chunk->lazy_bodies[lo - 1];
+    return offset < body->end ? body : NULL;
+}
+
+/** @brief 代碼塊釋放前清除所屬字節碼塊中指向它的入口 */
+static void jit_detach_block(JitCodeBlock* block) {
+    KBytecodeChunk* chunk = block->owner;
+    if (!chunk) return;
+    if (chunk->jit_block == block) {
+        chunk->jit_code = NULL; // 下次調用時回退解釋執行或重新編譯
+        chunk->jit_block = NULL;
+    }
+    if (chunk->jit_entries) {
+        for (size_t i = block->bc_base; i < block->bc_base + block->bc_count && i < chunk->count; i++) {
+            uint8_t* entry = chunk->jit_entries[i];
+            if (entry >= block->code && entry < block->code + block->size) chunk->jit_entries[i] = NULL;
+        }
+    }
+    KLazyBody* body = find_lazy_body(chunk, block->bc_base);
+    if (body && body->jit_block == block) body->jit_block = NULL; // 再次執行到時重新生成
+    block->owner = NULL;
+}
+
+/** @brief 驅逐最久未使用的代碼塊 (所屬字節碼塊正在執行機器碼時跳過，見 jit_active) */
+static bool jit_evict_one(ComeOnJIT* jit) {
+    JitCodeBlock* victim = NULL;
+    for (JitCodeBlock* b = jit->blocks; b; b = b->next) {
+        if (b->owner && b->owner->jit_active > 0) continue;
+        if (!victim || b->last_used < victim->last_used) victim = b;
+    }
+    if (!victim) return false;
+    jit->evictions++;
+    jit_free_exec(jit, victim->code);
+    return true;
+}
+
+static JitCodeBlock* jit_take_span(ComeOnJIT* jit, size_t size) {
+    JitFreeSpan** link = &jit->free_spans;
+    while (*link && (*link)->size < size) link = &(*link)->next;
+    if (!*link) return NULL;
+
+    JitFreeSpan* span = *link;
+    JitCodeBlock* block = (JitCodeBlock*)calloc(1, sizeof(JitCodeBlock));
+    if (!block) return NULL;
+    block->region = span->region;
+    block->offset = span->offset;
+    block->size = size;
+    block->code = span->region->rx_base + span->offset;
+
+    span->offset += size;
+    span->size -= size;
+    if (span->size == 0) {
+        *link = span->next;
+        free(span);
+    }
+    return block;
+}
+
 void jit_init(ComeOnJIT* jit) {
     jit->enabled = true;
     jit->compiled_functions = 0;
+    jit->regions = NULL;
+    jit->free_spans = NULL;
+    jit->blocks = NULL;
+    jit->cache_reserved = 0;
+    jit->cache_limit = JIT_DEFAULT_LIMIT;
+    jit->next_region_size = JIT_INITIAL_REGION;
+    jit->clock = 0;
+    jit->evictions = 0;
+    jit_debug_init(jit);
     
 #ifdef __x86_64__
     jit->arch = JIT_ARCH_X64;
@@ -57,36 +271,114 @@ void jit_init(ComeOnJIT* jit) {
     return;
 #endif
 
-    jit->exec_memory_size = 1024 * 1024 * 4; // 4MB
-    jit->exec_memory_used = 0;
-
-#ifdef _WIN32
-    jit->exec_memory = (uint8_t*)VirtualAlloc(NULL, jit->exec_memory_size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
-#else
-    jit->exec_memory = (uint8_t*)mmap(NULL, jit->exec_memory_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-#endif
-
-    if (jit->exec_memory == NULL) {
+    if (!jit_grow(jit, JIT_INITIAL_REGION)) {
         printf("[ComeOnJIT] Failed to allocate executable memory.\n");
         jit->enabled = false;
     }
 }
 
 void jit_cleanup(ComeOnJIT* jit) {
-    if (jit->exec_memory) {
-#ifdef _WIN32
-        VirtualFree(jit->exec_memory, 0, MEM_RELEASE);
-#else
-        munmap(jit->exec_memory, jit->exec_memory_size);
-#endif
+    jit_debug_cleanup(jit);
+    while (jit->blocks) {
+        JitCodeBlock* next = jit->blocks->next;
+        KBytecodeChunk* owner = jit->blocks->owner;
+        if (owner) {
+            // 字節碼塊比 JIT 存活得久 (如模塊)，不能再指向已解除映射的代碼
+            if (owner->jit == jit) owner->jit = NULL;
+            jit_detach_block(jit->blocks);
+        }
+        free(jit->blocks);
+        jit->blocks = next;
+    }
+    while (jit->free_spans) {
+        JitFreeSpan* next = jit->free_spans->next;
+        free(jit->free_spans);
+        jit->free_spans = next;
+    }
+    while (jit->regions) {
+        JitCodeRegion* next = jit->regions->next;
+        jit_unmap_region(jit->regions);
+        jit->regions = next;
+    }
+    jit->cache_reserved = 0;
+}
+
+uint8_t* jit_alloc_exec(ComeOnJIT* jit, size_t size, uint8_t** rw_out) {
+    if (size == 0) return NULL;
+    size = (size + JIT_CODE_ALIGN - 1) & ~(size_t)(JIT_CODE_ALIGN - 1);
+
+    JitCodeBlock* block = jit_take_span(jit, size);
+    while (!block) {
+        // 先嘗試增長，達到上限後再驅逐冷代碼
+        if (!jit_grow(jit, size) && !jit_evict_one(jit)) return NULL;
+        block = jit_take_span(jit, size);
+    }
+
+    block->last_used = ++jit->clock;
+    block->next = jit->blocks;
+    jit->blocks = block;
+
+    if (rw_out) *rw_out = block->region->rw_base + block->offset;
+    return block->code;
+}
+
+void jit_free_exec(ComeOnJIT* jit, void* code) {
+    JitCodeBlock** link = &jit->blocks;
+    while (*link && (*link)->code != (uint8_t*)code) link = &(*link)->next;
+    if (!*link) return;
+
+    JitCodeBlock* block = *link;
+    *link = block->next;
+    jit_detach_block(block);
+    jit_debug_unregister(jit, block);
+    jit_insert_free(jit, block->region, block->offset, block->size);
+    free(block);
+}
+
+void jit_release_chunk(ComeOnJIT* jit, KBytecodeChunk* chunk) {
+    if (!jit || !chunk) return;
+    JitCodeBlock* b = jit->blocks;
+    while (b) {
+        JitCodeBlock* next = b->next;
+        if (b->owner == chunk) jit_free_exec(jit, b->code);
+        b = next;
+    }
+    chunk->jit_code = NULL;
+    chunk->jit_block = NULL;
+    if (chunk->jit == jit) chunk->jit = NULL;
+}
+
+void jit_touch(ComeOnJIT* jit, JitCodeBlock* block) {
+    // 其他虛擬機的代碼塊由其所屬實例計時
+    if (block->owner && block->owner->jit == jit) block->last_used = ++jit->clock;
+}
+
+void jit_get_stats(ComeOnJIT* jit, JitCacheStats* stats) {
+    memset(stats, 0, sizeof(JitCacheStats));
+    stats->reserved_bytes = jit->cache_reserved;
+    stats->evictions = jit->evictions;
+    for (JitCodeRegion* r = jit->regions; r; r = r->next) stats->region_count++;
+    for (JitCodeBlock* b = jit->blocks; b; b = b->next) {
+        stats->block_count++;
+        stats->used_bytes += b->size;
+    }
+    for (JitFreeSpan* s = jit->free_spans; s; s = s->next) {
+        stats->free_bytes += s->size;
+        if (s->size > stats->largest_free) stats->largest_free = s->size;
+    }
+    if (stats->free_bytes > 0) {
+        stats->fragmentation = 1.0 - (double)stats->largest_free / (double)stats->free_bytes;
     }
 }
 
-static uint8_t* jit_alloc(ComeOnJIT* jit, size_t size) {
-    if (jit->exec_memory_used + size > jit->exec_memory_size) return NULL;
-    uint8_t* ptr = jit->exec_memory + jit->exec_memory_used;
-    jit->exec_memory_used += size;
-    return ptr;
+void jit_print_stats(ComeOnJIT* jit) {
+    JitCacheStats stats;
+    jit_get_stats(jit, &stats);
+    printf("[ComeOnJIT] code cache: %zu regions, %zu bytes reserved\n", stats.region_count, stats.reserved_bytes);
+    printf("[ComeOnJIT]   live code: %zu blocks, %zu bytes\n", stats.block_count, stats.used_bytes);
+    printf("[ComeOnJIT]   free: %zu bytes (largest %zu), fragmentation %.1f%%\n",
+           stats.free_bytes, stats.largest_free, stats.fragmentation * 100.0);
+    printf("[ComeOnJIT]   evictions: %zu, compiled: %zu\n", stats.evictions, jit->compiled_functions);
 }
 
 /** @brief x64 發射器 */
@@ -95,24 +387,42 @@ static uint8_t* jit_alloc(ComeOnJIT* jit, size_t size) {
 #define EMIT_2(b1, b2) { *code++ = (b1); *code++ = (b2); }
 #define EMIT_3(b1, b2, b3) { *code++ = (b1); *code++ = (b2); *code++ = (b3); }
 #define EMIT_4(b1, b2, b3, b4) { *code++ = (b1); *code++ = (b2); *code++ = (b3); *code++ = (b4); }
-#define EMIT_INT32(val) { *(int32_t*)code = (val); code += 4; }
+#define EMIT_INT32(val) { int32_t v32_ = (int32_t)(val); memcpy(code, &v32_, 4); code += 4; }
+#define EMIT_INT64(val) { uint64_t v64_ = (uint64_t)(val); memcpy(code, &v64_, 8); code += 8; }
 
 /** @brief ModR/M 輔助宏 */
 /**< mod: 2 位, reg: 3 位, rm: 3 位 */
 #define MODRM(mod, reg, rm) ((mod << 6) | (reg << 3) | rm)
 
+/** @brief VM 寄存器 idx 的字段位移 (相對 RBX = vm->registers) */
+#define KV_BASE(idx) ((int32_t)((idx) * SIZE_KVALUE))
+#define KV_TYPE(idx) ((int32_t)((idx) * SIZE_KVALUE + OFFSET_KVALUE_TYPE))
+#define KV_AS(idx)   ((int32_t)((idx) * SIZE_KVALUE + OFFSET_KVALUE_AS))
+
+/** @brief 棧幀佈局: [rbp-8] 保存的 RBX，[rbp-16] KVM 指針 */
+#define FRAME_VM_SLOT 0xF0 /**< disp8 = -16 */
+
+/** @brief 偽標籤 (跳轉修復目標) */
+#define LABEL_DISPATCH -1 /**< 按 vm->ip 重新分派 */
+#define LABEL_EPILOGUE -2 /**< 以 EAX 為返回值退出 */
+#define LABEL_TABLE    -3 /**< 分派表 (RIP 相對) */
+#define LABEL_START    -4 /**< 代碼塊起始 (RIP 相對) */
+
+/** @brief 發射 [base + disp32] 形式的 ModR/M (base 不能為 RSP) */
+static void emit_mem(uint8_t** ptr, int reg, int base, int32_t disp) {
+    uint8_t* code = *ptr;
+    EMIT_1(MODRM(2, reg, base));
+    EMIT_INT32(disp);
+    *ptr = code;
+}
+
 /** @brief 加載寄存器值到 CPU 寄存器 */
-/**< mov cpu_reg, [vm_base + OFFSET_REGISTERS + vm_reg_idx * 16 + 8] */
+/**< mov cpu_reg, [vm_base + vm_reg_idx * 16 + 8] */
 static void emit_load_reg(uint8_t** ptr, int cpu_reg, int vm_reg_idx, int vm_base_reg) {
     uint8_t* code = *ptr;
-    int32_t offset = OFFSET_KVM_REGISTERS + vm_reg_idx * SIZE_KVALUE + OFFSET_KVALUE_AS;
-    
     EMIT_1(REX_W); // 64-bit
     EMIT_1(0x8B);  // MOV r64, r/m64
-    // ModR/M: [vm_base + disp32]
-    EMIT_1(MODRM(2, cpu_reg, vm_base_reg)); 
-    EMIT_INT32(offset);
-    
+    emit_mem(&code, cpu_reg, vm_base_reg, KV_AS(vm_reg_idx));
     *ptr = code;
 }
 
@@ -120,28 +430,30 @@ static void emit_load_reg(uint8_t** ptr, int cpu_reg, int vm_reg_idx, int vm_bas
 /**< mov [vm_base + ... + 8], cpu_reg */
 static void emit_store_reg(uint8_t** ptr, int cpu_reg, int vm_reg_idx, int vm_base_reg) {
     uint8_t* code = *ptr;
-    int32_t offset = OFFSET_KVM_REGISTERS + vm_reg_idx * SIZE_KVALUE + OFFSET_KVALUE_AS;
-    
     EMIT_1(REX_W);
     EMIT_1(0x89); // MOV r/m64, r64
-    EMIT_1(MODRM(2, cpu_reg, vm_base_reg));
-    EMIT_INT32(offset);
-    
+    emit_mem(&code, cpu_reg, vm_base_reg, KV_AS(vm_reg_idx));
     *ptr = code;
 }
 
-/** @brief 設置 VM 寄存器類型為 INT */
-/**< mov dword ptr [vm_base + ...], VAL_INT */
-static void emit_set_type_int(uint8_t** ptr, int vm_reg_idx, int vm_base_reg) {
+/** @brief 設置 VM 寄存器類型 */
+/**< mov dword ptr [vm_base + ...], type */
+static void emit_set_type(uint8_t** ptr, int vm_reg_idx, KValueType type, int vm_base_reg) {
     uint8_t* code = *ptr;
-    int32_t offset = OFFSET_KVM_REGISTERS + vm_reg_idx * SIZE_KVALUE + OFFSET_KVALUE_TYPE;
-    
     // MOV r/m32, imm32 (C7 /0 id)
     EMIT_1(0xC7);
-    EMIT_1(MODRM(2, 0, vm_base_reg));
-    EMIT_INT32(offset);
-    EMIT_INT32(VAL_INT);
-    
+    emit_mem(&code, 0, vm_base_reg, KV_TYPE(vm_reg_idx));
+    EMIT_INT32(type);
+    *ptr = code;
+}
+
+/** @brief 複製整個 KValue (16 字節，經 XMM0) */
+static void emit_copy_value(uint8_t** ptr, int dst_idx, int src_idx) {
+    uint8_t* code = *ptr;
+    EMIT_3(0xF3, 0x0F, 0x6F); // movdqu xmm0, [rbx + src]
+    emit_mem(&code, 0, RBX, KV_BASE(src_idx));
+    EMIT_3(0xF3, 0x0F, 0x7F); // movdqu [rbx + dst], xmm0
+    emit_mem(&code, 0, RBX, KV_BASE(dst_idx));
     *ptr = code;
 }
 
@@ -149,260 +461,1327 @@ static void emit_set_type_int(uint8_t** ptr, int vm_reg_idx, int vm_base_reg) {
 
 /** @brief 跳轉修復結構體 */
 typedef struct {
-    int jump_inst_offset; /**< 機器碼中相對跳轉開始的偏移量 */
-    int target_bytecode_offset; /**< 目標字節碼索引 */
+    int jump_inst_offset; /**< 機器碼中 rel32 立即數的偏移量 */
+    int target_bytecode_offset; /**< 目標字節碼索引，或 LABEL_* 偽標籤 */
 } JumpFixup;
 
-void* jit_compile(ComeOnJIT* jit, KBytecodeChunk* chunk) {
-    if (!jit->enabled || jit->arch != JIT_ARCH_X64) return NULL;
+/** @brief 單次編譯的代碼生成狀態 */
+typedef struct {
+    KBytecodeChunk* chunk; /**< 正在編譯的字節碼塊 (讀取常量池) */
+    uint8_t* start;       /**< 臨時緩衝區 */
+    uint8_t* code;        /**< 當前寫入位置 */
+    uint8_t* end;         /**< 緩衝區末尾 */
+    JumpFixup* fixups;
+    int fixup_count;
+    int fixup_capacity;
+    JitReloc* relocs;     /**< 絕對地址重定位 (安裝或 AOT 加載時修補) */
+    int reloc_count;
+    int reloc_capacity;
+    uint8_t* slow[8];     /**< 當前指令中跳往慢路徑的 rel32 位置 */
+    int slow_count;
+    uint8_t* done[8];     /**< 當前指令中跳過慢路徑的 rel32 位置 */
+    int done_count;
+} JitCodegen;
 
-    size_t max_size = chunk->count * 64 + 1024; // Conservative estimate
-    uint8_t* start_addr = jit_alloc(jit, max_size);
-    if (!start_addr) return NULL;
+/** @brief 快路徑生成結果 */
+typedef enum {
+    FAST_NONE,     /**< 無快路徑，整條指令走輔助函數 */
+    FAST_GUARDED,  /**< 有快路徑，守衛失敗時走輔助函數 */
+    FAST_COMPLETE  /**< 完全內聯，無需慢路徑 */
+} FastPathResult;
 
-    uint8_t* code = start_addr;
-    
-    // 映射字節碼偏移到機器碼偏移
-    // -1 表示尚未生成
-    int* bc_to_mc = (int*)malloc(chunk->count * sizeof(int));
-    for(size_t i=0; i<chunk->count; i++) bc_to_mc[i] = -1;
+static void add_fixup(JitCodegen* cg, int target) {
+    if (cg->fixup_count >= cg->fixup_capacity) {
+        cg->fixup_capacity = cg->fixup_capacity < 64 ? 64 : cg->fixup_capacity * 2;
+        cg->fixups = (JumpFixup*)realloc(cg->fixups, cg->fixup_capacity * sizeof(JumpFixup));
+    }
+    cg->fixups[cg->fixup_count].jump_inst_offset = (int)(cg->code - cg->start);
+    cg->fixups[cg->fixup_count].target_bytecode_offset = target;
+    cg->fixup_count++;
+}
+
+/** @brief 發射 64 位絕對地址佔位符，並記錄重定位 */
+static void emit_reloc64(JitCodegen* cg, JitRelocKind kind, uint64_t addend) {
+    if (cg->reloc_count >= cg->reloc_capacity) {
+        cg->reloc_capacity = cg->reloc_capacity < 64 ? 64 : cg->reloc_capacity * 2;
+        cg->relocs = (JitReloc*)realloc(cg->relocs, cg->reloc_capacity * sizeof(JitReloc));
+    }
+    cg->relocs[cg->reloc_count].offset = (uint32_t)(cg->code - cg->start);
+    cg->relocs[cg->reloc_count].kind = (uint32_t)kind;
+    cg->relocs[cg->reloc_count].addend = addend;
+    cg->reloc_count++;
+    uint8_t* code = cg->code;
+    EMIT_INT64(0);
+    cg->code = code;
+}
 
-    // 跳轉修復
-    JumpFixup fixups[256]; // 演示用的簡單固定大小
-    int fixup_count = 0;
+/** @brief 發射 rel32 跳轉 (E9 或 0F 8x)，目標 (字節碼偏移或 LABEL_*) 稍後修復 */
+static void emit_jump_to(JitCodegen* cg, uint8_t op1, uint8_t op2, int target) {
+    uint8_t* code = cg->code;
+    EMIT_1(op1);
+    if (op2) EMIT_1(op2);
+    cg->code = code;
+    add_fixup(cg, target);
+    code = cg->code;
+    EMIT_INT32(0);
+    cg->code = code;
+}
+
+/** @brief 發射指令內部的前向 rel32 跳轉，返回待修補位置 */
+static uint8_t* emit_local_jump(JitCodegen* cg, uint8_t op1, uint8_t op2) {
+    uint8_t* code = cg->code;
+    EMIT_1(op1);
+    if (op2) EMIT_1(op2);
+    uint8_t* patch = code;
+    EMIT_INT32(0);
+    cg->code = code;
+    return patch;
+}
+
+static void patch_local_jump(uint8_t* patch, uint8_t* target) {
+    int32_t rel = (int32_t)(target - (patch + 4));
+    memcpy(patch, &rel, 4);
+}
 
-    // 確定 VM 指針寄存器
+/** @brief 條件跳往慢路徑 */
+static void emit_jump_slow(JitCodegen* cg, uint8_t jcc) {
+    cg->slow[cg->slow_count++] = emit_local_jump(cg, 0x0F, jcc);
+}
+
+/** @brief 跳過慢路徑 (快路徑完成) */
+static void emit_jump_done(JitCodegen* cg) {
+    cg->done[cg->done_count++] = emit_local_jump(cg, 0xE9, 0);
+}
+
+/** @brief 比較 VM 寄存器類型，結果留在標誌位 */
+static void emit_type_cmp(JitCodegen* cg, int vm_reg_idx, KValueType type) {
+    uint8_t* code = cg->code;
+    EMIT_1(0x83); // cmp dword [rbx + type], imm8
+    emit_mem(&code, 7, RBX, KV_TYPE(vm_reg_idx));
+    EMIT_1((uint8_t)type);
+    cg->code = code;
+}
+
+/** @brief 類型守衛：VM 寄存器類型不符時跳往慢路徑 */
+static void emit_type_guard(JitCodegen* cg, int vm_reg_idx, KValueType type) {
+    emit_type_cmp(cg, vm_reg_idx, type);
+    emit_jump_slow(cg, 0x85); // jne slow
+}
+
+/**
+ * @brief 運行時輔助：用解釋器執行一條指令 (慢路徑)
+ * 調用、分配、字段訪問、字符串運算等都經由此處，語義與 kvm_run 完全一致。
+ */
+static int jit_helper_step(KVM* vm, uint8_t* ip) {
+    vm->ip = ip;
+    return kvm_step(vm);
+}
+
+/**
+ * @brief 發射慢路徑：調用 jit_helper_step，然後檢查控制流
+ * 若 vm->ip 恰為下一條指令則順序執行，否則經分派表跳轉 (調用、返回、異常)。
+ */
+static void emit_helper_call(JitCodegen* cg, int bc_offset, int bc_next) {
+    uint8_t* code = cg->code;
 #ifdef _WIN32
-    int vm_reg = RCX; // Windows: 第 1 個參數在 RCX
+    EMIT_4(REX_W, 0x8B, MODRM(1, RCX, RBP), FRAME_VM_SLOT); // mov rcx, [rbp-16]
+    EMIT_2(REX_W, 0xB8 + RDX); // mov rdx, ip
 #else
-    int vm_reg = RDI; // SysV: 第 1 個參數在 RDI
+    EMIT_4(REX_W, 0x8B, MODRM(1, RDI, RBP), FRAME_VM_SLOT); // mov rdi, [rbp-16]
+    EMIT_2(REX_W, 0xB8 + RSI); // mov rsi, ip
 #endif
+    cg->code = code;
+    emit_reloc64(cg, JIT_RELOC_BYTECODE, (uint64_t)bc_offset);
+    code = cg->code;
+    EMIT_2(REX_W, 0xB8); // mov rax, helper
+    cg->code = code;
+    emit_reloc64(cg, JIT_RELOC_HELPER, 0);
+    code = cg->code;
+    EMIT_2(0xFF, 0xD0);             // call rax
+    EMIT_3(0x83, 0xF8, KVM_STEP_CONTINUE); // cmp eax, KVM_STEP_CONTINUE
+    cg->code = code;
+    emit_jump_to(cg, 0x0F, 0x85, LABEL_EPILOGUE); // jne epilogue (返回 eax)
+    code = cg->code;
 
-    // 序言 (Prologue)
-    EMIT_1(0x55); // push rbp
-    EMIT_3(0x48, 0x89, 0xE5); // mov rbp, rsp
-    EMIT_1(0x53); // push rbx (被調用者保存)
-    EMIT_1(0x56); // push rsi (Windows 上被調用者保存，SysV 上為臨時，用作基址)
+    EMIT_4(REX_W, 0x8B, MODRM(1, RCX, RBP), FRAME_VM_SLOT); // mov rcx, [rbp-16]
+    EMIT_2(REX_W, 0x8B); emit_mem(&code, RBX, RCX, (int32_t)offsetof(KVM, registers)); // 寄存器窗口可能已改變
+    EMIT_2(REX_W, 0x8B); emit_mem(&code, RAX, RCX, (int32_t)offsetof(KVM, ip));
+    EMIT_2(REX_W, 0xB8 + RDX); // mov rdx, next_ip
+    cg->code = code;
+    emit_reloc64(cg, JIT_RELOC_BYTECODE, (uint64_t)bc_next);
+    code = cg->code;
+    EMIT_3(REX_W, 0x39, 0xD0);      // cmp rax, rdx
+    cg->code = code;
+    emit_jump_to(cg, 0x0F, 0x85, LABEL_DISPATCH); // jne dispatch
+}
 
-    // 加載 vm->registers (偏移 16) 到 RSI
-    // MOV RSI, [vm_reg + 16]
-    EMIT_1(REX_W);
-    EMIT_1(0x8B);
-    EMIT_1(MODRM(1, RSI, vm_reg)); // Mod=1 用於 8 位偏移
-    EMIT_1(16); // 偏移
+/** @brief JTAB 第 slot 個槽的目標：槽仍是 JMP 時直接跳到 JMP 的目標，否則跳到槽本身 */
+static int jtab_slot_target(const uint8_t* ip, int bc_offset, int slot) {
+    const uint8_t* slot_ip = ip + 6 + slot * 4;
+    int slot_offset = bc_offset + 6 + slot * 4;
+    if (slot_ip[0] != KOP_JMP) return slot_offset;
+    return slot_offset + 4 + (int16_t)((slot_ip[2] << 8) | slot_ip[3]);
+}
 
-    uint8_t* ip = chunk->code;
-    uint8_t* end = chunk->code + chunk->count;
+/** @brief 整數二元運算的 ALU 操作碼 (op r64, r/m64) */
+static int int_alu_opcode(uint8_t opcode) {
+    switch (opcode) {
+        case KOP_ADD: case KOP_ADD_INT: return 0x03;
+        case KOP_SUB: case KOP_SUB_INT: return 0x2B;
+        case KOP_AND: return 0x23;
+        case KOP_OR:  return 0x0B;
+        case KOP_XOR: return 0x33;
+        default: return 0;
+    }
+}
 
-    while (ip < end) {
-        int bc_offset = (int)(ip - chunk->code);
-        bc_to_mc[bc_offset] = (int)(code - start_addr);
+/** @brief 雙精度運算的 SSE2 操作碼 (addsd/subsd/mulsd/divsd) */
+static int sse_opcode(uint8_t opcode) {
+    switch (opcode) {
+        case KOP_ADD: case KOP_FADD_D: return 0x58;
+        case KOP_SUB: case KOP_FSUB_D: return 0x5C;
+        case KOP_MUL: case KOP_FMUL_D: return 0x59;
+        case KOP_FDIV_D: return 0x5E;
+        default: return 0;
+    }
+}
 
-        uint8_t opcode = *ip++;
+/** @brief 比較運算的 SETcc 操作碼 */
+static int setcc_opcode(uint8_t opcode) {
+    switch (opcode) {
+        case KOP_EQ: case KOP_EQ_INT: return 0x94;
+        case KOP_NE: return 0x95;
+        case KOP_LT: return 0x9C;
+        case KOP_LE: return 0x9E;
+        case KOP_GT: return 0x9F;
+        case KOP_GE: return 0x9D;
+        default: return 0;
+    }
+}
 
-        switch (opcode) {
-            case KOP_HALT:
-                EMIT_1(0xB8); EMIT_INT32(0); // mov eax, 0
-                EMIT_1(0x5E); // pop rsi
-                EMIT_1(0x5B); // pop rbx
-                EMIT_1(0xC9); // leave
-                EMIT_1(0xC3); // ret
-                break;
-            
-            case KOP_RET:
-                EMIT_1(0xB8); EMIT_INT32(0); // mov eax, 0 (Return 0 for now)
-                EMIT_1(0x5E); // pop rsi
-                EMIT_1(0x5B); // pop rbx
-                EMIT_1(0xC9); // leave
-                EMIT_1(0xC3); // ret
-                break;
+/** @brief 內聯整數運算：rd = ra op rb (兩者均為 VAL_INT) */
+static void emit_int_binary(JitCodegen* cg, uint8_t opcode, uint8_t rd, uint8_t ra, uint8_t rb) {
+    uint8_t* code = cg->code;
+    emit_load_reg(&code, RAX, ra, RBX);
+    if (opcode == KOP_MUL || opcode == KOP_MUL_INT) {
+        EMIT_3(REX_W, 0x0F, 0xAF); emit_mem(&code, RAX, RBX, KV_AS(rb)); // imul rax, [rb]
+    } else {
+        EMIT_2(REX_W, (uint8_t)int_alu_opcode(opcode)); emit_mem(&code, RAX, RBX, KV_AS(rb));
+    }
+    emit_store_reg(&code, RAX, rd, RBX);
+    emit_set_type(&code, rd, VAL_INT, RBX);
+    cg->code = code;
+}
 
-            case KOP_LDI: { // LDI Rd, Imm8
-                uint8_t rd = *ip++;
-                int8_t imm = (int8_t)(*ip++);
-                // MOV RAX, imm
-                EMIT_1(REX_W); EMIT_1(0xC7); EMIT_1(0xC0); EMIT_INT32(imm); 
-                emit_store_reg(&code, RAX, rd, RSI);
-                emit_set_type_int(&code, rd, RSI);
-                break;
-            }
+/** @brief 內聯整數比較：rd = (ra cmp rb) (兩者均為 VAL_INT) */
+static void emit_int_compare(JitCodegen* cg, uint8_t opcode, uint8_t rd, uint8_t ra, uint8_t rb) {
+    uint8_t* code = cg->code;
+    emit_load_reg(&code, RAX, ra, RBX);
+    EMIT_2(REX_W, 0x3B); emit_mem(&code, RAX, RBX, KV_AS(rb)); // cmp rax, [rb]
+    EMIT_3(0x0F, (uint8_t)setcc_opcode(opcode), 0xC0);     // setcc al
+    EMIT_3(0x0F, 0xB6, 0xC0);                              // movzx eax, al
+    emit_store_reg(&code, RAX, rd, RBX);
+    emit_set_type(&code, rd, VAL_BOOL, RBX);
+    cg->code = code;
+}
 
-            case KOP_ADDI: { // ADDI Rd, Ra, Imm
-                uint8_t rd = *ip++;
-                uint8_t ra = *ip++;
-                int8_t imm = (int8_t)(*ip++);
-                
-                // Load Ra -> RAX
-                emit_load_reg(&code, RAX, ra, RSI);
-                // ADD RAX, Imm
-                EMIT_1(REX_W); EMIT_1(0x83); EMIT_1(0xC0); EMIT_1((uint8_t)imm);
-                // Store RAX -> Rd
-                emit_store_reg(&code, RAX, rd, RSI);
-                // Set Type
-                emit_set_type_int(&code, rd, RSI);
-                break;
-            }
+/**
+ * @brief 內聯整數大小比較：rd = (ra cmp rb) (兩者均為 VAL_INT)
+ * 與 CMP_OP_NUM 一致，兩邊先轉換為 double 再比較，超過 2^53 的整數與解釋器得到相同結果。
+ */
+static void emit_int_compare_as_double(JitCodegen* cg, uint8_t opcode, uint8_t rd, uint8_t ra, uint8_t rb) {
+    uint8_t setcc;
+    switch (opcode) {
+        case KOP_LT: case KOP_LT_INT: setcc = 0x92; break; // setb
+        case KOP_LE: case KOP_LE_INT: setcc = 0x96; break; // setbe
+        case KOP_GT: setcc = 0x97; break; // seta
+        default:     setcc = 0x93; break; // setae
+    }
+    uint8_t* code = cg->code;
+    EMIT_4(0xF2, REX_W, 0x0F, 0x2A); emit_mem(&code, 0, RBX, KV_AS(ra)); // cvtsi2sd xmm0, [ra]
+    EMIT_4(0xF2, REX_W, 0x0F, 0x2A); emit_mem(&code, 1, RBX, KV_AS(rb)); // cvtsi2sd xmm1, [rb]
+    EMIT_4(0x66, 0x0F, 0x2E, 0xC1);                                      // ucomisd xmm0, xmm1
+    EMIT_3(0x0F, setcc, 0xC0);                                           // setcc al
+    EMIT_3(0x0F, 0xB6, 0xC0);                                            // movzx eax, al
+    emit_store_reg(&code, RAX, rd, RBX);
+    emit_set_type(&code, rd, VAL_BOOL, RBX);
+    cg->code = code;
+}
 
-            case KOP_ADD: { // ADD Rd, Ra, Rb
-                uint8_t rd = *ip++;
-                uint8_t ra = *ip++;
-                uint8_t rb = *ip++;
-
-                emit_load_reg(&code, RAX, ra, RSI);
-                emit_load_reg(&code, RBX, rb, RSI); // Use RBX as temp
-                
-                // ADD RAX, RBX
-                EMIT_3(REX_W, 0x01, 0xD8); 
-                
-                emit_store_reg(&code, RAX, rd, RSI);
-                emit_set_type_int(&code, rd, RSI);
-                break;
-            }
-            
-            case KOP_SUB: {
-                uint8_t rd = *ip++;
-                uint8_t ra = *ip++;
-                uint8_t rb = *ip++;
-                emit_load_reg(&code, RAX, ra, RSI);
-                emit_load_reg(&code, RBX, rb, RSI);
-                // SUB RAX, RBX
-                EMIT_3(REX_W, 0x29, 0xD8);
-                emit_store_reg(&code, RAX, rd, RSI);
-                emit_set_type_int(&code, rd, RSI);
-                break;
+/** @brief 內聯雙精度運算：rd = ra op rb (兩者均為 VAL_DOUBLE) */
+static void emit_sse_binary(JitCodegen* cg, int sse_op, uint8_t rd, uint8_t ra, uint8_t rb) {
+    uint8_t* code = cg->code;
+    EMIT_3(0xF2, 0x0F, 0x10); emit_mem(&code, 0, RBX, KV_AS(ra)); // movsd xmm0, [ra]
+    EMIT_3(0xF2, 0x0F, (uint8_t)sse_op); emit_mem(&code, 0, RBX, KV_AS(rb)); // op xmm0, [rb]
+    EMIT_3(0xF2, 0x0F, 0x11); emit_mem(&code, 0, RBX, KV_AS(rd)); // movsd [rd], xmm0
+    emit_set_type(&code, rd, VAL_DOUBLE, RBX);
+    cg->code = code;
+}
+
+/** @brief 加載數組對象到 RAX，ra 不是數組時跳往慢路徑 */
+static void emit_load_array(JitCodegen* cg, uint8_t ra) {
+    emit_type_guard(cg, ra, VAL_OBJ);
+    uint8_t* code = cg->code;
+    emit_load_reg(&code, RAX, ra, RBX);
+    EMIT_3(REX_W, 0x85, 0xC0);                       // test rax, rax
+    cg->code = code;
+    emit_jump_slow(cg, 0x84);
+    code = cg->code;
+    EMIT_1(0x83); emit_mem(&code, 7, RAX, (int32_t)offsetof(KObjHeader, type)); EMIT_1(OBJ_ARRAY);
+    cg->code = code;
+    emit_jump_slow(cg, 0x85);
+}
+
+/**
+ * @brief 加載數組對象到 RAX、元素存儲到 RDX，並校驗索引 (RCX) 在界內
+ * 任一條件不滿足 (非數組、索引非整數或越界) 都跳往慢路徑，由解釋器拋出對應異常。
+ * checked 為 false 時 (GETFA_U / PUTFA_U) 編譯器已證明索引是界內的整數，只校驗數組。
+ */
+static void emit_array_index(JitCodegen* cg, uint8_t ra, uint8_t rb, bool checked) {
+    if (checked) emit_type_guard(cg, rb, VAL_INT);
+    emit_load_array(cg, ra);
+    uint8_t* code = cg->code;
+    emit_load_reg(&code, RCX, rb, RBX);
+    if (checked) {
+        EMIT_2(REX_W, 0x63); emit_mem(&code, RDX, RAX, (int32_t)offsetof(KObjArray, length)); // movsxd rdx, [length]
+        EMIT_3(REX_W, 0x39, 0xD1);                   // cmp rcx, rdx
+        cg->code = code;
+        emit_jump_slow(cg, 0x83);                    // jae slow (負數按無符號比較同樣越界)
+        code = cg->code;
+    }
+    EMIT_2(REX_W, 0x8B); emit_mem(&code, RDX, RAX, (int32_t)offsetof(KObjArray, elements));
+    cg->code = code;
+}
+
+/** @brief 比較 RAX 中數組的存儲方式 */
+static void emit_array_kind_cmp(JitCodegen* cg, KArrayKind kind) {
+    uint8_t* code = cg->code;
+    EMIT_1(0x83); emit_mem(&code, 7, RAX, (int32_t)offsetof(KObjArray, kind)); EMIT_1((uint8_t)kind);
+    cg->code = code;
+}
+
+/**
+ * @brief 計算結構體數組元素字段的槽位地址到 RDX
+ * 調用前 emit_array_index 已將數組放在 RAX、下標放在 RCX；數組不是 ARRAY_STRUCT
+ * 或布局與字段內聯緩存 (由解釋器填寫) 不符時跳往慢路徑。
+ */
+static void emit_struct_slot(JitCodegen* cg, uint16_t field) {
+    uint64_t entry = (uint64_t)field * sizeof(KFieldCache);
+    emit_array_kind_cmp(cg, ARRAY_STRUCT);
+    emit_jump_slow(cg, 0x85);
+    uint8_t* code = cg->code;
+    EMIT_3(REX_W, 0x89, 0xC2);                                // mov rdx, rax
+    EMIT_1(0xA1);                                             // mov eax, [cache.layout_id]
+    cg->code = code;
+    emit_reloc64(cg, JIT_RELOC_FIELD_CACHE, entry + offsetof(KFieldCache, layout_id));
+    code = cg->code;
+    EMIT_1(0x3B); emit_mem(&code, RAX, RDX, (int32_t)offsetof(KObjArray, layout_id)); // cmp eax, [layout_id]
+    cg->code = code;
+    emit_jump_slow(cg, 0x85);
+    code = cg->code;
+    EMIT_2(REX_W, 0xA1);                                      // mov rax, [cache.stride]
+    cg->code = code;
+    emit_reloc64(cg, JIT_RELOC_FIELD_CACHE, entry + offsetof(KFieldCache, stride));
+    code = cg->code;
+    EMIT_4(REX_W, 0x0F, 0xAF, 0xC8);                          // imul rcx, rax
+    EMIT_2(REX_W, 0xA1);                                      // mov rax, [cache.index]
+    cg->code = code;
+    emit_reloc64(cg, JIT_RELOC_FIELD_CACHE, entry + offsetof(KFieldCache, index));
+    code = cg->code;
+    EMIT_3(REX_W, 0x01, 0xC1);                                // add rcx, rax
+    EMIT_4(REX_W, 0xC1, 0xE1, 4);                             // shl rcx, 4 (sizeof(KValue))
+    EMIT_2(REX_W, 0x8B); emit_mem(&code, RDX, RDX, (int32_t)offsetof(KObjArray, slots));
+    EMIT_4(REX_W, 0x8D, 0x14, 0x0A);                          // lea rdx, [rdx + rcx]
+    cg->code = code;
+}
+
+/**
+ * @brief 為單條字節碼生成快路徑
+ * 守衛失敗的跳轉記錄在 cg->slow，提前完成的跳轉記錄在 cg->done；
+ * 快路徑末尾直接落入下一段，由調用者補上跳過慢路徑的跳轉。
+ */
+static FastPathResult emit_fast_path(JitCodegen* cg, uint8_t* ip, int bc_offset) {
+    uint8_t opcode = ip[0];
+    uint8_t* code = cg->code;
+
+    switch (opcode) {
+        case KOP_LDI:
+        case KOP_LDB: { // Rd, Imm8, _
+            uint8_t rd = ip[1];
+            int32_t imm = (int8_t)ip[2];
+            if (opcode == KOP_LDB) imm = imm != 0;
+            EMIT_2(REX_W, 0xC7); emit_mem(&code, 0, RBX, KV_AS(rd)); EMIT_INT32(imm);
+            emit_set_type(&code, rd, opcode == KOP_LDI ? VAL_INT : VAL_BOOL, RBX);
+            cg->code = code;
+            return FAST_COMPLETE;
+        }
+
+        case KOP_LDN:
+            emit_set_type(&code, ip[1], VAL_NULL, RBX);
+            cg->code = code;
+            return FAST_COMPLETE;
+
+        case KOP_LDI64:
+        case KOP_LDCD: { // Rd, Index16：常量在編譯時取出，作為立即數嵌入
+            uint8_t rd = ip[1];
+            uint16_t index = (uint16_t)((ip[2] << 8) | ip[3]);
+            uint64_t bits;
+            if (opcode == KOP_LDI64) {
+                if (index >= cg->chunk->int_count) return FAST_NONE; // 越界錯誤交給解釋器報告
+                memcpy(&bits, &cg->chunk->int_constants[index], sizeof(bits));
+            } else {
+                if (index >= cg->chunk->double_count) return FAST_NONE;
+                memcpy(&bits, &cg->chunk->double_constants[index], sizeof(bits));
             }
+            EMIT_2(REX_W, 0xB8); EMIT_INT64(bits); // mov rax, imm64
+            emit_store_reg(&code, RAX, rd, RBX);
+            emit_set_type(&code, rd, opcode == KOP_LDI64 ? VAL_INT : VAL_DOUBLE, RBX);
+            cg->code = code;
+            return FAST_COMPLETE;
+        }
 
-            case KOP_MUL: {
-                uint8_t rd = *ip++;
-                uint8_t ra = *ip++;
-                uint8_t rb = *ip++;
-                emit_load_reg(&code, RAX, ra, RSI);
-                emit_load_reg(&code, RBX, rb, RSI);
-                // IMUL RAX, RBX
-                EMIT_4(REX_W, 0x0F, 0xAF, 0xC3);
-                emit_store_reg(&code, RAX, rd, RSI);
-                emit_set_type_int(&code, rd, RSI);
-                break;
+        case KOP_MOVE:
+        case KOP_LOAD:
+            emit_copy_value(&code, ip[1], ip[2]);
+            cg->code = code;
+            return FAST_COMPLETE;
+
+        case KOP_JMP: {
+            int16_t offset = (int16_t)((ip[2] << 8) | ip[3]);
+            emit_jump_to(cg, 0xE9, 0, bc_offset + 4 + offset);
+            return FAST_COMPLETE;
+        }
+
+        case KOP_JZ:
+        case KOP_JNZ: { // 與解釋器一致：只有 BOOL / INT 參與判斷，其他類型不跳轉
+            uint8_t ra = ip[1];
+            int16_t offset = (int16_t)((ip[2] << 8) | ip[3]);
+            int target = bc_offset + 4 + offset;
+            uint8_t jcc = opcode == KOP_JZ ? 0x84 : 0x85;
+
+            EMIT_1(0x8B); emit_mem(&code, RAX, RBX, KV_TYPE(ra)); // mov eax, [type]
+            EMIT_3(0x83, 0xF8, VAL_BOOL);                          // cmp eax, VAL_BOOL
+            cg->code = code;
+            uint8_t* not_bool = emit_local_jump(cg, 0x0F, 0x85);
+            code = cg->code;
+            EMIT_1(0x80); emit_mem(&code, 7, RBX, KV_AS(ra)); EMIT_1(0); // cmp byte [as], 0
+            cg->code = code;
+            emit_jump_to(cg, 0x0F, jcc, target);
+            uint8_t* done = emit_local_jump(cg, 0xE9, 0);
+            code = cg->code;
+
+            patch_local_jump(not_bool, code);
+            EMIT_3(0x83, 0xF8, VAL_INT);                           // cmp eax, VAL_INT
+            cg->code = code;
+            uint8_t* not_int = emit_local_jump(cg, 0x0F, 0x85);
+            code = cg->code;
+            EMIT_2(REX_W, 0x83); emit_mem(&code, 7, RBX, KV_AS(ra)); EMIT_1(0); // cmp qword [as], 0
+            cg->code = code;
+            emit_jump_to(cg, 0x0F, jcc, target);
+            patch_local_jump(done, cg->code);
+            patch_local_jump(not_int, cg->code);
+            return FAST_COMPLETE;
+        }
+
+        case KOP_FORLOOP: { // 循環變量已證明為整數；與 forloop_test 一致，上界 (整數或 double) 與循環變量都按 double 比較
+            uint8_t ri = ip[1], rl = ip[2];
+            uint8_t cmp = ip[3] & (uint8_t)~KFORLOOP_INT_LIMIT;
+            int target = bc_offset + 6 + (int16_t)((ip[4] << 8) | ip[5]);
+            bool up = cmp == KOP_LT || cmp == KOP_LE;
+            uint8_t* not_int = NULL;
+            uint8_t* is_int = NULL;
+
+            // xmm0 = 上界。整數上界轉換為 double；double 上界直接讀取；其他類型交給輔助函數
+            cg->code = code;
+            if (!(ip[3] & KFORLOOP_INT_LIMIT)) {
+                emit_type_cmp(cg, rl, VAL_INT);
+                not_int = emit_local_jump(cg, 0x0F, 0x85);
             }
-            
-            case KOP_DIV: {
-                uint8_t rd = *ip++;
-                uint8_t ra = *ip++;
-                uint8_t rb = *ip++;
-                emit_load_reg(&code, RAX, ra, RSI); // Dividend
-                emit_load_reg(&code, RBX, rb, RSI); // Divisor
-                // CQO (Sign extend RAX to RDX:RAX)
-                EMIT_2(REX_W, 0x99);
-                // IDIV RBX
-                EMIT_3(REX_W, 0xF7, 0xFB);
-                emit_store_reg(&code, RAX, rd, RSI);
-                emit_set_type_int(&code, rd, RSI);
-                break;
+            code = cg->code;
+            EMIT_4(0xF2, REX_W, 0x0F, 0x2A); emit_mem(&code, 0, RBX, KV_AS(rl)); // cvtsi2sd xmm0, [rl]
+            cg->code = code;
+            if (not_int) {
+                is_int = emit_local_jump(cg, 0xE9, 0);
+                patch_local_jump(not_int, cg->code);
+                emit_type_guard(cg, rl, VAL_DOUBLE);
+                code = cg->code;
+                EMIT_3(0xF2, 0x0F, 0x10); emit_mem(&code, 0, RBX, KV_AS(rl));    // movsd xmm0, [rl]
+                cg->code = code;
+                patch_local_jump(is_int, cg->code);
             }
 
-            case KOP_JMP: { // JMP Imm24 (Absolute bytecode offset)
-                uint8_t b1 = *ip++; uint8_t b2 = *ip++; uint8_t b3 = *ip++;
-                int target = (b1 << 16) | (b2 << 8) | b3;
-                
-                // JMP rel32 (E9 cd)
-                EMIT_1(0xE9);
-                // Record fixup
-                fixups[fixup_count].jump_inst_offset = (int)(code - start_addr);
-                fixups[fixup_count].target_bytecode_offset = target;
-                fixup_count++;
-                EMIT_INT32(0); // Placeholder
-                break;
+            code = cg->code;
+            emit_load_reg(&code, RAX, ri, RBX);
+            EMIT_4(REX_W, 0x83, 0xC0, up ? 1 : 0xFF);                // add rax, ±1
+            emit_store_reg(&code, RAX, ri, RBX);
+            EMIT_4(0xF2, REX_W, 0x0F, 0x2A); EMIT_1(0xC8);           // cvtsi2sd xmm1, rax
+            // i < limit 即 limit > i；無序 (NaN) 時 CF=1，ja / jae 均不跳轉
+            if (up) {
+                EMIT_4(0x66, 0x0F, 0x2E, 0xC1);                      // ucomisd xmm0, xmm1
+            } else {
+                EMIT_4(0x66, 0x0F, 0x2E, 0xC8);                      // ucomisd xmm1, xmm0
             }
-            
-            case KOP_JZ: { // JZ Ra, Imm16 (Relative bytecode offset)
-                uint8_t ra = *ip++;
-                uint8_t b1 = *ip++; uint8_t b2 = *ip++;
-                int16_t offset = (int16_t)((b1 << 8) | b2);
-                int target = bc_offset + 3 + offset; // Current inst start + 3 + offset ?? 
-                // Wait, logic in interpreter: ip += offset. ip is AFTER reading args.
-                // So target = (ip index) + offset. ip index is bc_offset + 4.
-                target = (bc_offset + 4) + offset;
-
-                emit_load_reg(&code, RAX, ra, vm_reg);
-                // TEST RAX, RAX
-                EMIT_3(REX_W, 0x85, 0xC0);
-                
-                // JZ rel32 (0F 84 cd)
-                EMIT_2(0x0F, 0x84);
-                fixups[fixup_count].jump_inst_offset = (int)(code - start_addr);
-                fixups[fixup_count].target_bytecode_offset = target;
-                fixup_count++;
+            cg->code = code;
+            emit_jump_to(cg, 0x0F, (cmp == KOP_LT || cmp == KOP_GT) ? 0x87 : 0x83, target);
+            return not_int ? FAST_GUARDED : FAST_COMPLETE;
+        }
+
+        case KOP_JTAB: { // 整數值查機器碼跳轉表；浮點數等其他類型交給解釋器
+            uint8_t ra = ip[1];
+            int32_t low = (int16_t)((ip[2] << 8) | ip[3]);
+            int count = (ip[4] << 8) | ip[5];
+            if ((size_t)bc_offset + 6 + (size_t)(count + 1) * 4 > cg->chunk->count ||
+                code + 64 + (size_t)(count + 1) * 4 > cg->end) return FAST_NONE;
+
+            cg->code = code;
+            emit_type_guard(cg, ra, VAL_INT);
+            code = cg->code;
+            emit_load_reg(&code, RAX, ra, RBX);
+            if (low != 0) { EMIT_2(REX_W, 0x2D); EMIT_INT32(low); } // sub rax, low
+            EMIT_2(REX_W, 0x3D); EMIT_INT32(count);                 // cmp rax, count
+            cg->code = code;
+            emit_jump_to(cg, 0x0F, 0x83, jtab_slot_target(ip, bc_offset, count)); // jae 落空槽 (含負數)
+            code = cg->code;
+            // 表項為相對於表項末尾的 rel32，與跳轉修復共用同一套計算
+            EMIT_3(REX_W, 0x8D, 0x15); EMIT_INT32(14);  // lea rdx, [rip + table]
+            EMIT_4(REX_W, 0x8D, 0x54, 0x82); EMIT_1(4); // lea rdx, [rdx + rax*4 + 4]
+            EMIT_4(REX_W, 0x63, 0x42, 0xFC);            // movsxd rax, [rdx - 4]
+            EMIT_3(REX_W, 0x01, 0xD0);                  // add rax, rdx
+            EMIT_2(0xFF, 0xE0);                         // jmp rax
+            cg->code = code;
+            for (int slot = 0; slot < count; slot++) {
+                add_fixup(cg, jtab_slot_target(ip, bc_offset, slot));
+                code = cg->code;
                 EMIT_INT32(0);
-                break;
+                cg->code = code;
             }
-            
-            case KOP_JNZ: { // JNZ Ra, Imm16
-                uint8_t ra = *ip++;
-                uint8_t b1 = *ip++; uint8_t b2 = *ip++;
-                int16_t offset = (int16_t)((b1 << 8) | b2);
-                int target = (bc_offset + 4) + offset;
-
-                emit_load_reg(&code, RAX, ra, vm_reg);
-                EMIT_3(REX_W, 0x85, 0xC0);
-                
-                // JNZ rel32 (0F 85 cd)
-                EMIT_2(0x0F, 0x85);
-                fixups[fixup_count].jump_inst_offset = (int)(code - start_addr);
-                fixups[fixup_count].target_bytecode_offset = target;
-                fixup_count++;
-                EMIT_INT32(0);
-                break;
+            return FAST_GUARDED;
+        }
+
+        case KOP_ADD: case KOP_SUB: case KOP_MUL:
+        case KOP_AND: case KOP_OR: case KOP_XOR: {
+            uint8_t rd = ip[1], ra = ip[2], rb = ip[3];
+            int sse_op = sse_opcode(opcode);
+            uint8_t* not_int[2];
+
+            // 整數快路徑
+            cg->code = code;
+            emit_type_cmp(cg, ra, VAL_INT);
+            not_int[0] = emit_local_jump(cg, 0x0F, 0x85);
+            emit_type_cmp(cg, rb, VAL_INT);
+            not_int[1] = emit_local_jump(cg, 0x0F, 0x85);
+            emit_int_binary(cg, opcode, rd, ra, rb);
+
+            if (!sse_op) {
+                cg->slow[cg->slow_count++] = not_int[0];
+                cg->slow[cg->slow_count++] = not_int[1];
+                return FAST_GUARDED;
             }
 
-            case KOP_XOR: {
-                uint8_t rd = *ip++; uint8_t ra = *ip++; uint8_t rb = *ip++;
-                emit_load_reg(&code, RAX, ra, vm_reg);
-                emit_load_reg(&code, RBX, rb, vm_reg);
-                EMIT_3(REX_W, 0x31, 0xD8); // XOR RAX, RBX
-                emit_store_reg(&code, RAX, rd, vm_reg);
-                emit_set_type_int(&code, rd, vm_reg);
-                break;
+            // 雙精度快路徑；字符串拼接與混合類型交給輔助函數
+            emit_jump_done(cg);
+            patch_local_jump(not_int[0], cg->code);
+            patch_local_jump(not_int[1], cg->code);
+            emit_type_guard(cg, ra, VAL_DOUBLE);
+            emit_type_guard(cg, rb, VAL_DOUBLE);
+            emit_sse_binary(cg, sse_op, rd, ra, rb);
+            return FAST_GUARDED;
+        }
+
+        case KOP_ADD_INT: case KOP_SUB_INT: case KOP_MUL_INT: // 編譯器已證明操作數為整數，無需守衛
+            cg->code = code;
+            emit_int_binary(cg, opcode, ip[1], ip[2], ip[3]);
+            return FAST_COMPLETE;
+
+        case KOP_LT_INT: case KOP_LE_INT:
+            cg->code = code;
+            emit_int_compare_as_double(cg, opcode, ip[1], ip[2], ip[3]);
+            return FAST_COMPLETE;
+
+        case KOP_EQ_INT:
+            cg->code = code;
+            emit_int_compare(cg, opcode, ip[1], ip[2], ip[3]);
+            return FAST_COMPLETE;
+
+        case KOP_FADD_D: case KOP_FSUB_D: case KOP_FMUL_D: case KOP_FDIV_D: {
+            // FLOAT 操作數需要先擴展，交給輔助函數
+            cg->code = code;
+            emit_type_guard(cg, ip[2], VAL_DOUBLE);
+            emit_type_guard(cg, ip[3], VAL_DOUBLE);
+            emit_sse_binary(cg, sse_opcode(opcode), ip[1], ip[2], ip[3]);
+            return FAST_GUARDED;
+        }
+
+        case KOP_FEQ_D: case KOP_FLT_D: case KOP_FLE_D: {
+            uint8_t rd = ip[1], ra = ip[2], rb = ip[3];
+            cg->code = code;
+            emit_type_guard(cg, ra, VAL_DOUBLE);
+            emit_type_guard(cg, rb, VAL_DOUBLE);
+            code = cg->code;
+            if (opcode == KOP_FEQ_D) {
+                EMIT_3(0xF2, 0x0F, 0x10); emit_mem(&code, 0, RBX, KV_AS(ra)); // movsd xmm0, [ra]
+                EMIT_3(0x66, 0x0F, 0x2E); emit_mem(&code, 0, RBX, KV_AS(rb)); // ucomisd xmm0, [rb]
+                EMIT_3(0x0F, 0x94, 0xC0);                                     // sete al
+                EMIT_3(0x0F, 0x9B, 0xC1);                                     // setnp cl (NaN 不相等)
+                EMIT_2(0x20, 0xC8);                                           // and al, cl
+            } else {
+                // ra < rb 即 rb > ra；無序 (NaN) 時 CF=1，seta/setae 均得 0
+                EMIT_3(0xF2, 0x0F, 0x10); emit_mem(&code, 0, RBX, KV_AS(rb)); // movsd xmm0, [rb]
+                EMIT_3(0x66, 0x0F, 0x2E); emit_mem(&code, 0, RBX, KV_AS(ra)); // ucomisd xmm0, [ra]
+                EMIT_3(0x0F, opcode == KOP_FLT_D ? 0x97 : 0x93, 0xC0);        // seta / setae al
             }
+            EMIT_3(0x0F, 0xB6, 0xC0);                                         // movzx eax, al
+            emit_store_reg(&code, RAX, rd, RBX);
+            emit_set_type(&code, rd, VAL_BOOL, RBX);
+            cg->code = code;
+            return FAST_GUARDED;
+        }
 
-            default:
-                // Unsupported opcode, abort JIT
-                // printf("[ComeOnJIT] Unsupported opcode: %d\n", opcode);
-                if (start_addr) {
+        case KOP_DIV:
+        case KOP_MOD: { // 除數為 0 (拋異常) 或 -1 (溢出) 時走慢路徑
+            uint8_t rd = ip[1], ra = ip[2], rb = ip[3];
+            cg->code = code;
+            emit_type_guard(cg, ra, VAL_INT);
+            emit_type_guard(cg, rb, VAL_INT);
+            code = cg->code;
+            emit_load_reg(&code, RCX, rb, RBX);
+            EMIT_3(REX_W, 0x85, 0xC9);                 // test rcx, rcx
+            cg->code = code;
+            emit_jump_slow(cg, 0x84);
+            code = cg->code;
+            EMIT_4(REX_W, 0x83, 0xF9, 0xFF);           // cmp rcx, -1
+            cg->code = code;
+            emit_jump_slow(cg, 0x84);
+            code = cg->code;
+            emit_load_reg(&code, RAX, ra, RBX);
+            EMIT_2(REX_W, 0x99);                       // cqo
+            EMIT_3(REX_W, 0xF7, 0xF9);                 // idiv rcx
+            emit_store_reg(&code, opcode == KOP_DIV ? RAX : RDX, rd, RBX);
+            emit_set_type(&code, rd, VAL_INT, RBX);
+            cg->code = code;
+            return FAST_GUARDED;
+        }
+
+        case KOP_ADDI: {
+            uint8_t rd = ip[1], ra = ip[2];
+            cg->code = code;
+            emit_type_guard(cg, ra, VAL_INT);
+            code = cg->code;
+            emit_load_reg(&code, RAX, ra, RBX);
+            EMIT_4(REX_W, 0x83, 0xC0, ip[3]);          // add rax, imm8
+            emit_store_reg(&code, RAX, rd, RBX);
+            emit_set_type(&code, rd, VAL_INT, RBX);
+            cg->code = code;
+            return FAST_GUARDED;
+        }
+
+        case KOP_NEG: {
+            uint8_t rd = ip[1], ra = ip[2];
+            cg->code = code;
+            emit_type_guard(cg, ra, VAL_INT);
+            code = cg->code;
+            emit_load_reg(&code, RAX, ra, RBX);
+            EMIT_3(REX_W, 0xF7, 0xD8);                 // neg rax
+            emit_store_reg(&code, RAX, rd, RBX);
+            emit_set_type(&code, rd, VAL_INT, RBX);
+            cg->code = code;
+            return FAST_GUARDED;
+        }
+
+        case KOP_EQ: case KOP_NE: case KOP_LT: case KOP_LE: case KOP_GT: case KOP_GE: {
+            uint8_t rd = ip[1], ra = ip[2], rb = ip[3];
+            cg->code = code;
+            emit_type_guard(cg, ra, VAL_INT);
+            emit_type_guard(cg, rb, VAL_INT);
+            // 相等判斷與 values_equal 一樣精確比較，大小比較與 CMP_OP_NUM 一樣按 double 比較
+            if (opcode == KOP_EQ || opcode == KOP_NE) emit_int_compare(cg, opcode, rd, ra, rb);
+            else emit_int_compare_as_double(cg, opcode, rd, ra, rb);
+            return FAST_GUARDED;
+        }
+
+        case KOP_PUSH: { // PUSH _, Ra, _
+            uint8_t ra = ip[2];
+            EMIT_4(REX_W, 0x8B, MODRM(1, RCX, RBP), FRAME_VM_SLOT);   // mov rcx, [rbp-16]
+            EMIT_2(REX_W, 0x8B); emit_mem(&code, RAX, RCX, (int32_t)offsetof(KVM, stack_top));
+            EMIT_2(REX_W, 0x8D); emit_mem(&code, RDX, RCX, (int32_t)(offsetof(KVM, stack) + KVM_STACK_SIZE * SIZE_KVALUE));
+            EMIT_3(REX_W, 0x39, 0xD0);                                // cmp rax, rdx
+            cg->code = code;
+            emit_jump_slow(cg, 0x83);                                 // jae slow (棧溢出)
+            code = cg->code;
+            EMIT_3(0xF3, 0x0F, 0x6F); emit_mem(&code, 0, RBX, KV_BASE(ra)); // movdqu xmm0, [ra]
+            EMIT_4(0xF3, 0x0F, 0x7F, 0x00);                           // movdqu [rax], xmm0
+            EMIT_4(REX_W, 0x83, 0xC0, SIZE_KVALUE);                   // add rax, 16
+            EMIT_2(REX_W, 0x89); emit_mem(&code, RAX, RCX, (int32_t)offsetof(KVM, stack_top));
+            cg->code = code;
+            return FAST_GUARDED;
+        }
+
+        case KOP_POP: { // POP Rd, _, _
+            uint8_t rd = ip[1];
+            EMIT_4(REX_W, 0x8B, MODRM(1, RCX, RBP), FRAME_VM_SLOT);   // mov rcx, [rbp-16]
+            EMIT_2(REX_W, 0x8B); emit_mem(&code, RAX, RCX, (int32_t)offsetof(KVM, stack_top));
+            EMIT_2(REX_W, 0x8D); emit_mem(&code, RDX, RCX, (int32_t)offsetof(KVM, stack));
+            EMIT_3(REX_W, 0x39, 0xD0);                                // cmp rax, rdx
+            cg->code = code;
+            emit_jump_slow(cg, 0x86);                                 // jbe slow (棧下溢)
+            code = cg->code;
+            EMIT_4(REX_W, 0x83, 0xE8, SIZE_KVALUE);                   // sub rax, 16
+            EMIT_4(0xF3, 0x0F, 0x6F, 0x00);                           // movdqu xmm0, [rax]
+            EMIT_3(0xF3, 0x0F, 0x7F); emit_mem(&code, 0, RBX, KV_BASE(rd)); // movdqu [rd], xmm0
+            EMIT_2(REX_W, 0x89); emit_mem(&code, RAX, RCX, (int32_t)offsetof(KVM, stack_top));
+            cg->code = code;
+            return FAST_GUARDED;
+        }
+
+        case KOP_GETFA: case KOP_GETFA_U: { // GETFA Rd, Arr, Idx：KValue、int 與 double 存儲直接讀取，bool 存儲交給解釋器
+            uint8_t rd = ip[1];
+            cg->code = code;
+            emit_array_index(cg, ip[2], ip[3], opcode == KOP_GETFA);
+            emit_array_kind_cmp(cg, ARRAY_VALUES);
+            uint8_t* typed = emit_local_jump(cg, 0x0F, 0x85);
+            code = cg->code;
+            EMIT_4(REX_W, 0xC1, 0xE1, 4);                             // shl rcx, 4 (sizeof(KValue))
+            EMIT_4(0xF3, 0x0F, 0x6F, 0x04); EMIT_1(0x0A);             // movdqu xmm0, [rdx + rcx]
+            EMIT_3(0xF3, 0x0F, 0x7F); emit_mem(&code, 0, RBX, KV_BASE(rd));
+            cg->code = code;
+            uint8_t* done_values = emit_local_jump(cg, 0xE9, 0);
+
+            patch_local_jump(typed, cg->code);
+            emit_array_kind_cmp(cg, ARRAY_INT);
+            uint8_t* not_int = emit_local_jump(cg, 0x0F, 0x85);
+            code = cg->code;
+            EMIT_4(REX_W, 0x8B, 0x04, 0xCA);                          // mov rax, [rdx + rcx*8]
+            emit_store_reg(&code, RAX, rd, RBX);
+            emit_set_type(&code, rd, VAL_INT, RBX);
+            cg->code = code;
+            uint8_t* done_int = emit_local_jump(cg, 0xE9, 0);
+
+            patch_local_jump(not_int, cg->code);
+            emit_array_kind_cmp(cg, ARRAY_DOUBLE);
+            emit_jump_slow(cg, 0x85);
+            code = cg->code;
+            EMIT_4(REX_W, 0x8B, 0x04, 0xCA);                          // mov rax, [rdx + rcx*8]
+            emit_store_reg(&code, RAX, rd, RBX);
+            emit_set_type(&code, rd, VAL_DOUBLE, RBX);
+            cg->code = code;
+            patch_local_jump(done_values, cg->code);
+            patch_local_jump(done_int, cg->code);
+            return FAST_GUARDED;
+        }
+
+        case KOP_PUTFA: case KOP_PUTFA_U: { // PUTFA Arr, Idx, Val：類型與無標籤存儲不符時由解釋器轉換數組
+            uint8_t rv = ip[3];
+            cg->code = code;
+            emit_array_index(cg, ip[1], ip[2], opcode == KOP_PUTFA);
+            emit_array_kind_cmp(cg, ARRAY_VALUES);
+            uint8_t* typed = emit_local_jump(cg, 0x0F, 0x85);
+            code = cg->code;
+            EMIT_4(REX_W, 0xC1, 0xE1, 4);                             // shl rcx, 4 (sizeof(KValue))
+            EMIT_3(0xF3, 0x0F, 0x6F); emit_mem(&code, 0, RBX, KV_BASE(rv));
+            EMIT_4(0xF3, 0x0F, 0x7F, 0x04); EMIT_1(0x0A);             // movdqu [rdx + rcx], xmm0
+            cg->code = code;
+            uint8_t* done_values = emit_local_jump(cg, 0xE9, 0);
+
+            patch_local_jump(typed, cg->code);
+            emit_array_kind_cmp(cg, ARRAY_INT);
+            uint8_t* not_int = emit_local_jump(cg, 0x0F, 0x85);
+            emit_type_guard(cg, rv, VAL_INT);
+            code = cg->code;
+            emit_load_reg(&code, RAX, rv, RBX);
+            EMIT_4(REX_W, 0x89, 0x04, 0xCA);                          // mov [rdx + rcx*8], rax
+            cg->code = code;
+            uint8_t* done_int = emit_local_jump(cg, 0xE9, 0);
+
+            patch_local_jump(not_int, cg->code);
+            emit_array_kind_cmp(cg, ARRAY_DOUBLE);
+            emit_jump_slow(cg, 0x85);
+            emit_type_guard(cg, rv, VAL_DOUBLE);
+            code = cg->code;
+            emit_load_reg(&code, RAX, rv, RBX);
+            EMIT_4(REX_W, 0x89, 0x04, 0xCA);                          // mov [rdx + rcx*8], rax
+            cg->code = code;
+            patch_local_jump(done_values, cg->code);
+            patch_local_jump(done_int, cg->code);
+            return FAST_GUARDED;
+        }
+
+        case KOP_GETAF: { // GETAF Rd, Arr, Idx, Field16：已賦值的結構體字段直接讀取槽位
+            uint8_t rd = ip[1];
+            uint16_t field = (uint16_t)((ip[4] << 8) | ip[5]);
+            cg->code = code;
+            emit_array_index(cg, ip[2], ip[3], true);
+            if (field == KGETAF_CHECK) return FAST_GUARDED;
+            emit_struct_slot(cg, field);
+            code = cg->code;
+            EMIT_1(0x81); emit_mem(&code, 7, RDX, OFFSET_KVALUE_TYPE); EMIT_INT32(KFIELD_UNSET);
+            cg->code = code;
+            emit_jump_slow(cg, 0x84);                                 // 未賦值的字段由解釋器處理
+            code = cg->code;
+            EMIT_3(0xF3, 0x0F, 0x6F); emit_mem(&code, 0, RDX, 0);     // movdqu xmm0, [rdx]
+            EMIT_3(0xF3, 0x0F, 0x7F); emit_mem(&code, 0, RBX, KV_BASE(rd));
+            cg->code = code;
+            return FAST_GUARDED;
+        }
+
+        case KOP_PUTAF: { // PUTAF Arr, Idx, Val, Field16：結構體字段直接寫入槽位
+            uint8_t rv = ip[3];
+            cg->code = code;
+            emit_array_index(cg, ip[1], ip[2], true);
+            emit_struct_slot(cg, (uint16_t)((ip[4] << 8) | ip[5]));
+            code = cg->code;
+            EMIT_3(0xF3, 0x0F, 0x6F); emit_mem(&code, 0, RBX, KV_BASE(rv));
+            EMIT_3(0xF3, 0x0F, 0x7F); emit_mem(&code, 0, RDX, 0);     // movdqu [rdx], xmm0
+            cg->code = code;
+            return FAST_GUARDED;
+        }
+
+        case KOP_ARRAYLEN: {
+            uint8_t rd = ip[1], ra = ip[2];
+            cg->code = code;
+            emit_load_array(cg, ra);
+            code = cg->code;
+            EMIT_2(REX_W, 0x63); emit_mem(&code, RDX, RAX, (int32_t)offsetof(KObjArray, length));
+            emit_store_reg(&code, RDX, rd, RBX);
+            emit_set_type(&code, rd, VAL_INT, RBX);
+            cg->code = code;
+            return FAST_GUARDED;
+        }
+
+        case KOP_APUSH: { // APUSH Rd, Arr, Val：容量足夠且值符合存儲方式時直接追加，擴容與轉換交給解釋器
+            uint8_t rd = ip[1], rv = ip[3];
+            cg->code = code;
+            emit_load_array(cg, ip[2]);
+            code = cg->code;
+            EMIT_1(0x8B); emit_mem(&code, RCX, RAX, (int32_t)offsetof(KObjArray, length));   // mov ecx, [length]
+            EMIT_1(0x3B); emit_mem(&code, RCX, RAX, (int32_t)offsetof(KObjArray, capacity)); // cmp ecx, [capacity]
+            cg->code = code;
+            emit_jump_slow(cg, 0x8D);                                 // jge slow
+            code = cg->code;
+            EMIT_2(REX_W, 0x8B); emit_mem(&code, RDX, RAX, (int32_t)offsetof(KObjArray, elements));
+            cg->code = code;
+            emit_array_kind_cmp(cg, ARRAY_VALUES);
+            uint8_t* typed = emit_local_jump(cg, 0x0F, 0x85);
+            code = cg->code;
+            EMIT_4(REX_W, 0xC1, 0xE1, 4);                             // shl rcx, 4 (sizeof(KValue))
+            EMIT_3(0xF3, 0x0F, 0x6F); emit_mem(&code, 0, RBX, KV_BASE(rv));
+            EMIT_4(0xF3, 0x0F, 0x7F, 0x04); EMIT_1(0x0A);             // movdqu [rdx + rcx], xmm0
+            cg->code = code;
+            uint8_t* done_values = emit_local_jump(cg, 0xE9, 0);
+
+            patch_local_jump(typed, cg->code);
+            emit_array_kind_cmp(cg, ARRAY_INT);
+            uint8_t* not_int = emit_local_jump(cg, 0x0F, 0x85);
+            emit_type_guard(cg, rv, VAL_INT);
+            uint8_t* store = emit_local_jump(cg, 0xE9, 0);
+
+            patch_local_jump(not_int, cg->code);
+            emit_array_kind_cmp(cg, ARRAY_DOUBLE);
+            emit_jump_slow(cg, 0x85);
+            emit_type_guard(cg, rv, VAL_DOUBLE);
+            patch_local_jump(store, cg->code);
+            code = cg->code;
+            EMIT_3(0xF3, 0x0F, 0x7E); emit_mem(&code, 0, RBX, KV_AS(rv)); // movq xmm0, [rv.as]
+            EMIT_4(0x66, 0x0F, 0xD6, 0x04); EMIT_1(0xCA);             // movq [rdx + rcx*8], xmm0
+            cg->code = code;
+            patch_local_jump(done_values, cg->code);
+            code = cg->code;
+            EMIT_1(0x83); emit_mem(&code, 0, RAX, (int32_t)offsetof(KObjArray, length)); EMIT_1(1); // add [length], 1
+            emit_set_type(&code, rd, VAL_NULL, RBX);
+            cg->code = code;
+            return FAST_GUARDED;
+        }
+
+        case KOP_APOP: { // APOP Rd, Arr, _：非空且不需要縮小容量時直接取出最後一個元素
+            uint8_t rd = ip[1];
+            cg->code = code;
+            emit_load_array(cg, ip[2]);
+            code = cg->code;
+            EMIT_1(0x8B); emit_mem(&code, RCX, RAX, (int32_t)offsetof(KObjArray, length));   // mov ecx, [length]
+            EMIT_2(0x85, 0xC9);                                       // test ecx, ecx
+            cg->code = code;
+            emit_jump_slow(cg, 0x84);                                 // 空數組
+            code = cg->code;
+            EMIT_2(0xFF, 0xC9);                                       // dec ecx
+            EMIT_1(0x8B); emit_mem(&code, RDX, RAX, (int32_t)offsetof(KObjArray, capacity)); // mov edx, [capacity]
+            EMIT_3(0x83, 0xFA, 8);                                    // cmp edx, 8
+            cg->code = code;
+            uint8_t* keep = emit_local_jump(cg, 0x0F, 0x8E);          // jle keep
+            code = cg->code;
+            EMIT_3(0xC1, 0xFA, 2);                                    // sar edx, 2
+            EMIT_2(0x39, 0xD1);                                       // cmp ecx, edx
+            cg->code = code;
+            emit_jump_slow(cg, 0x8C);                                 // 需要縮小容量 (見 array_shrink)
+            patch_local_jump(keep, cg->code);
+            code = cg->code;
+            EMIT_2(REX_W, 0x8B); emit_mem(&code, RDX, RAX, (int32_t)offsetof(KObjArray, elements));
+            cg->code = code;
+            emit_array_kind_cmp(cg, ARRAY_VALUES);
+            uint8_t* typed = emit_local_jump(cg, 0x0F, 0x85);
+            code = cg->code;
+            EMIT_1(0x89); emit_mem(&code, RCX, RAX, (int32_t)offsetof(KObjArray, length));   // mov [length], ecx
+            EMIT_4(REX_W, 0xC1, 0xE1, 4);                             // shl rcx, 4 (sizeof(KValue))
+            EMIT_4(0xF3, 0x0F, 0x6F, 0x04); EMIT_1(0x0A);             // movdqu xmm0, [rdx + rcx]
+            EMIT_3(0xF3, 0x0F, 0x7F); emit_mem(&code, 0, RBX, KV_BASE(rd));
+            cg->code = code;
+            uint8_t* done_values = emit_local_jump(cg, 0xE9, 0);
+
+            patch_local_jump(typed, cg->code);
+            emit_array_kind_cmp(cg, ARRAY_INT);
+            uint8_t* not_int = emit_local_jump(cg, 0x0F, 0x85);
+            code = cg->code;
+            emit_set_type(&code, rd, VAL_INT, RBX);
+            cg->code = code;
+            uint8_t* load = emit_local_jump(cg, 0xE9, 0);
+
+            patch_local_jump(not_int, cg->code);
+            emit_array_kind_cmp(cg, ARRAY_DOUBLE);
+            emit_jump_slow(cg, 0x85);
+            code = cg->code;
+            emit_set_type(&code, rd, VAL_DOUBLE, RBX);
+            cg->code = code;
+            patch_local_jump(load, cg->code);
+            code = cg->code;
+            EMIT_1(0x89); emit_mem(&code, RCX, RAX, (int32_t)offsetof(KObjArray, length));   // mov [length], ecx
+            EMIT_4(0xF3, 0x0F, 0x7E, 0x04); EMIT_1(0xCA);             // movq xmm0, [rdx + rcx*8]
+            EMIT_3(0x66, 0x0F, 0xD6); emit_mem(&code, 0, RBX, KV_AS(rd)); // movq [rd.as], xmm0
+            cg->code = code;
+            patch_local_jump(done_values, cg->code);
+            return FAST_GUARDED;
+        }
+
+        default:
+            return FAST_NONE;
+    }
+}
+
+/**
+ * @brief 為字節碼範圍 [base, end) 生成機器碼映像
+ * @param skip_bodies 跳過 chunk->lazy_bodies 中的函數體 (它們由 jit_materialize 各自生成代碼塊)
+ */
+static bool jit_generate_span(ComeOnJIT* jit, KBytecodeChunk* chunk, size_t base, size_t end_offset,
+                              bool skip_bodies, JitImage* image) {
+    memset(image, 0, sizeof(*image));
+    if (jit->arch != JIT_ARCH_X64) return false;
+    if (chunk->count == 0 || chunk->count > INT32_MAX / 8) return false;
+    if (base >= end_offset || end_offset > chunk->count) return false;
+    size_t span = end_offset - base;
+
+    size_t max_size = span * 96 + 1024; // Conservative estimate
+    JitCodegen cg;
+    memset(&cg, 0, sizeof(cg));
+    cg.chunk = chunk;
+    cg.start = (uint8_t*)malloc(max_size);
+    if (!cg.start) return false;
+    cg.code = cg.start;
+    cg.end = cg.start + max_size;
+    uint8_t* limit = cg.start + max_size - 512; // 單條指令的最大機器碼長度餘量
+    uint8_t* code = cg.code;
+
+    // 映射字節碼偏移到機器碼偏移
+    // -1 表示不是指令起點
+    // 以 base 為起點索引
+    int* bc_to_mc = (int*)malloc(span * sizeof(int));
+    for(size_t i=0; i<span; i++) bc_to_mc[i] = -1;
+
+    // 序言 (Prologue)：RBX 緩存 vm->registers，[rbp-16] 保存 KVM*
+    EMIT_1(0x55); // push rbp
+    EMIT_3(REX_W, 0x89, 0xE5); // mov rbp, rsp
+    EMIT_1(0x53); // push rbx (被調用者保存)
 #ifdef _WIN32
-                    VirtualFree(start_addr, 0, MEM_RELEASE);
+    EMIT_1(0x51); // push rcx (vm)
+    EMIT_4(REX_W, 0x83, 0xEC, 0x20); // sub rsp, 32 (shadow space)
 #else
-                    munmap(start_addr, max_size);
+    EMIT_1(0x57); // push rdi (vm)
 #endif
-                }
-                free(bc_to_mc);
-                return NULL;
+    cg.code = code;
+    emit_jump_to(&cg, 0xE9, 0, LABEL_DISPATCH); // 從 vm->ip 開始執行
+
+    bool ok = true;
+    uint8_t* ip = chunk->code + base;
+    uint8_t* end = chunk->code + end_offset;
+    size_t next_body = 0; // chunk->lazy_bodies 中下一個入口不在 ip 之前的函數體
+
+    while (ip < end) {
+        int bc_offset = (int)(ip - chunk->code);
+        // 函數體不生成到本塊中，分派表中保持 0，經 jit_entries 找到它自己的代碼塊或返回 kvm_run (見 jit_materialize)
+        while (skip_bodies && next_body < chunk->lazy_body_count &&
+               chunk->lazy_bodies[next_body].entry < (uint32_t)bc_offset) {
+            next_body++;
         }
+        if (skip_bodies && next_body < chunk->lazy_body_count &&
+            chunk->lazy_bodies[next_body].entry == (uint32_t)bc_offset) {
+            ip = chunk->code + chunk->lazy_bodies[next_body++].end;
+            continue;
+        }
+        int len = opcode_length(*ip);
+        if (len == 0 || ip + len > end || cg.code >= limit) {
+            // printf("[ComeOnJIT] Unsupported opcode: %d\n", *ip);
+            ok = false;
+            break;
+        }
+        bc_to_mc[bc_offset - base] = (int)(cg.code - cg.start);
+
+        cg.slow_count = 0;
+        cg.done_count = 0;
+        FastPathResult fast = emit_fast_path(&cg, ip, bc_offset);
+        if (fast != FAST_COMPLETE) {
+            if (fast == FAST_GUARDED) emit_jump_done(&cg);
+            for (int i = 0; i < cg.slow_count; i++) patch_local_jump(cg.slow[i], cg.code);
+            emit_helper_call(&cg, bc_offset, bc_offset + len);
+            for (int i = 0; i < cg.done_count; i++) patch_local_jump(cg.done[i], cg.code);
+        }
+        ip += len;
+    }
+
+    // 分派：根據 vm->ip 查本塊的表跳轉；不在本塊內時查 chunk->jit_entries (同一字節碼塊的其他代碼塊，棧幀佈局相同)，
+    // 仍沒有機器碼時返回 KVM_STEP_CONTINUE，交給 kvm_run
+    int label_dispatch = (int)(cg.code - cg.start);
+    code = cg.code;
+    EMIT_4(REX_W, 0x8B, MODRM(1, RCX, RBP), FRAME_VM_SLOT);  // mov rcx, [rbp-16]
+    EMIT_2(REX_W, 0x8B); emit_mem(&code, RBX, RCX, (int32_t)offsetof(KVM, registers));
+    EMIT_2(REX_W, 0x8B); emit_mem(&code, RAX, RCX, (int32_t)offsetof(KVM, chunk));
+    EMIT_2(REX_W, 0xB8 + RDX);                               // mov rdx, chunk
+    cg.code = code;
+    emit_reloc64(&cg, JIT_RELOC_CHUNK, 0);
+    code = cg.code;
+    EMIT_3(REX_W, 0x39, 0xD0);                               // cmp rax, rdx
+    cg.code = code;
+    uint8_t* leave1 = emit_local_jump(&cg, 0x0F, 0x85);
+    code = cg.code;
+    EMIT_2(REX_W, 0x8B); emit_mem(&code, RAX, RCX, (int32_t)offsetof(KVM, ip));
+    EMIT_2(REX_W, 0x8B); emit_mem(&code, RCX, RDX, (int32_t)offsetof(KBytecodeChunk, code));
+    EMIT_3(REX_W, 0x29, 0xC8);                               // sub rax, rcx
+    EMIT_2(REX_W, 0x3D); EMIT_INT32((int32_t)chunk->count);  // cmp rax, count
+    cg.code = code;
+    uint8_t* leave2 = emit_local_jump(&cg, 0x0F, 0x83);      // jae (含負數)
+    code = cg.code;
+    EMIT_3(REX_W, 0x89, 0xC1);                               // mov rcx, rax
+    EMIT_3(REX_W, 0x81, 0xE9); EMIT_INT32((int32_t)base);    // sub rcx, base
+    EMIT_3(REX_W, 0x81, 0xF9); EMIT_INT32((int32_t)span);    // cmp rcx, span
+    cg.code = code;
+    uint8_t* other1 = emit_local_jump(&cg, 0x0F, 0x83);      // jae other
+    code = cg.code;
+    EMIT_3(REX_W, 0x8D, 0x15);                               // lea rdx, [rip + table]
+    cg.code = code;
+    add_fixup(&cg, LABEL_TABLE);
+    code = cg.code;
+    EMIT_INT32(0);
+    EMIT_4(REX_W, 0x63, 0x0C, 0x8A);                         // movsxd rcx, [rdx + rcx*4]
+    EMIT_3(REX_W, 0x85, 0xC9);                               // test rcx, rcx
+    cg.code = code;
+    uint8_t* other2 = emit_local_jump(&cg, 0x0F, 0x84);      // jz other
+    code = cg.code;
+    EMIT_3(REX_W, 0x8D, 0x15);                               // lea rdx, [rip + start]
+    cg.code = code;
+    add_fixup(&cg, LABEL_START);
+    code = cg.code;
+    EMIT_INT32(0);
+    EMIT_3(REX_W, 0x01, 0xD1);                               // add rcx, rdx
+    EMIT_2(0xFF, 0xE1);                                      // jmp rcx
+    // other: RAX 仍為字節碼偏移
+    patch_local_jump(other1, code);
+    patch_local_jump(other2, code);
+    EMIT_4(REX_W, 0x8B, MODRM(1, RCX, RBP), FRAME_VM_SLOT);  // mov rcx, [rbp-16]
+    EMIT_2(REX_W, 0x8B); emit_mem(&code, RDX, RCX, (int32_t)offsetof(KVM, chunk));
+    EMIT_2(REX_W, 0x8B); emit_mem(&code, RDX, RDX, (int32_t)offsetof(KBytecodeChunk, jit_entries));
+    EMIT_3(REX_W, 0x85, 0xD2);                               // test rdx, rdx
+    cg.code = code;
+    uint8_t* leave3 = emit_local_jump(&cg, 0x0F, 0x84);
+    code = cg.code;
+    EMIT_4(REX_W, 0x8B, 0x04, 0xC2);                         // mov rax, [rdx + rax*8]
+    EMIT_3(REX_W, 0x85, 0xC0);                               // test rax, rax
+    cg.code = code;
+    uint8_t* leave4 = emit_local_jump(&cg, 0x0F, 0x84);
+    code = cg.code;
+    EMIT_2(0xFF, 0xE0);                                      // jmp rax
+    patch_local_jump(leave1, code);
+    patch_local_jump(leave2, code);
+    patch_local_jump(leave3, code);
+    patch_local_jump(leave4, code);
+    EMIT_1(0xB8); EMIT_INT32(KVM_STEP_CONTINUE);             // mov eax, KVM_STEP_CONTINUE
+
+    // 尾聲 (Epilogue)：EAX 為返回值
+    int label_epilogue = (int)(code - cg.start);
+    EMIT_4(REX_W, 0x8B, MODRM(1, RBX, RBP), 0xF8);           // mov rbx, [rbp-8]
+    EMIT_1(0xC9); // leave
+    EMIT_1(0xC3); // ret
+
+    // 分派表：每個字節碼偏移對應的機器碼偏移 (0 表示非指令起點)
+    while ((code - cg.start) % 4) EMIT_1(0xCC);
+    int label_table = (int)(code - cg.start);
+    for (size_t i = 0; i < span; i++) {
+        EMIT_INT32(bc_to_mc[i] > 0 ? bc_to_mc[i] : 0);
     }
+    cg.code = code;
 
-finish_compilation:
     // Resolve Fixups
-    for (int i = 0; i < fixup_count; i++) {
-        int jump_src = fixups[i].jump_inst_offset; // This points to the 4-byte immediate
-        int target_bc = fixups[i].target_bytecode_offset;
-        
-        if (target_bc >= 0 && target_bc < chunk->count && bc_to_mc[target_bc] != -1) {
-            int target_mc = bc_to_mc[target_bc];
-            // Calculate relative offset: target - (src + 4)
-            int rel_offset = target_mc - (jump_src + 4);
-            
-            // Patch code
-            *(int32_t*)(start_addr + jump_src) = rel_offset;
-        } else {
-            // printf("[ComeOnJIT] Failed to resolve jump target %d\n", target_bc);
+    for (int i = 0; ok && i < cg.fixup_count; i++) {
+        int jump_src = cg.fixups[i].jump_inst_offset; // This points to the 4-byte immediate
+        int target = cg.fixups[i].target_bytecode_offset;
+        int target_mc = -1;
+
+        if (target == LABEL_DISPATCH) target_mc = label_dispatch;
+        else if (target == LABEL_EPILOGUE) target_mc = label_epilogue;
+        else if (target == LABEL_TABLE) target_mc = label_table;
+        else if (target == LABEL_START) target_mc = 0;
+        else if (target >= 0 && (size_t)target >= base && (size_t)target < end_offset) target_mc = bc_to_mc[target - base];
+
+        if (target_mc < 0) {
+            // printf("[ComeOnJIT] Failed to resolve jump target %d\n", target);
+            ok = false;
+            break;
         }
+        // Calculate relative offset: target - (src + 4)
+        int32_t rel_offset = target_mc - (jump_src + 4);
+        memcpy(cg.start + jump_src, &rel_offset, 4);
     }
 
     free(bc_to_mc);
+    free(cg.fixups);
+    if (!ok) {
+        free(cg.start);
+        free(cg.relocs);
+        return false;
+    }
+
+    image->code = cg.start;
+    image->size = (size_t)(cg.code - cg.start);
+    image->relocs = cg.relocs;
+    image->reloc_count = (size_t)cg.reloc_count;
+    image->bc_base = base;
+    image->bc_count = span;
+    return true;
+}
+
+bool jit_generate(ComeOnJIT* jit, KBytecodeChunk* chunk, JitImage* image) {
+    return jit_generate_span(jit, chunk, 0, chunk->count, true, image);
+}
+
+void jit_free_image(JitImage* image) {
+    free(image->code);
+    free(image->relocs);
+    memset(image, 0, sizeof(*image));
+}
+
+static int compare_function_entry(const void* a, const void* b) {
+    uint32_t x = (*(const KFunctionInfo* const*)a)->entry, y = (*(const KFunctionInfo* const*)b)->entry;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * @brief 按腳本函數劃分代碼塊並註冊到分析器 / 調試器
+ * 每條指令歸屬包含它的最內層函數 (函數表項 [entry, insn))，歸屬改變處開始新的一段；
+ * 最後一段延伸到塊末尾 (分派代碼與分派表)。沒有函數表時整塊作為頂層代碼註冊。
+ * @param table 分派表 (count 項，相對塊起始的機器碼偏移，0 表示非指令起點)
+ */
+static void jit_register_ranges(ComeOnJIT* jit, JitCodeBlock* block, KBytecodeChunk* chunk,
+                                const uint8_t* table, size_t base, size_t count, size_t code_size) {
+    if (!jit->profile_flags) return;
+
+    size_t n = chunk->functions ? chunk->function_count : 0;
+    const KFunctionInfo** sorted = (const KFunctionInfo**)malloc((n + 1) * sizeof(KFunctionInfo*));
+    const KFunctionInfo** open = (const KFunctionInfo**)malloc((n + 1) * sizeof(KFunctionInfo*));
+    JitDebugRange* ranges = (JitDebugRange*)malloc((n * 2 + 2) * sizeof(JitDebugRange));
+    if (!sorted || !open || !ranges) {
+        free(sorted);
+        free(open);
+        free(ranges);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) sorted[i] = &chunk->functions[i];
+    qsort(sorted, n, sizeof(KFunctionInfo*), compare_function_entry);
+
+    size_t range_count = 0, next = 0, depth = 0;
+    const KFunctionInfo* current = NULL;
+    for (size_t i = 0; i < count; i++) {
+        int32_t mc;
+        memcpy(&mc, table + i * 4, 4);
+        if (mc <= 0) continue;
+        size_t offset = base + i;
+
+        // 函數正確嵌套，用棧維護包含 offset 的函數
+        while (depth > 0 && offset >= open[depth - 1]->insn) depth--;
+        while (next < n && sorted[next]->entry <= offset) {
+            if (offset < sorted[next]->insn) open[depth++] = sorted[next];
+            next++;
+        }
+        const KFunctionInfo* owner = depth > 0 ? open[depth - 1] : NULL;
+        if (range_count > 0 && owner == current) continue;
+
+        // 每個函數至多被嵌套函數切成兩段，範圍數量不超過 2n + 1
+        if (range_count > 0) ranges[range_count - 1].size = (size_t)mc - ranges[range_count - 1].offset;
+        JitDebugRange* range = &ranges[range_count++];
+        range->offset = range_count == 1 ? 0 : (size_t)mc; // 第一段包含序言
+        range->name = "<chunk>";
+        range->line = line_table_lookup(&chunk->lines, owner ? owner->entry : offset);
+        if (owner) range->name = owner->name < chunk->string_count ? chunk->string_table[owner->name] : NULL;
+        current = owner;
+    }
+    if (range_count == 0) {
+        ranges[0].offset = 0;
+        ranges[0].name = "<chunk>";
+        ranges[0].line = line_table_lookup(&chunk->lines, base);
+        range_count = 1;
+    }
+    ranges[range_count - 1].size = code_size - ranges[range_count - 1].offset;
+
+    jit_debug_register(jit, block, chunk->filename, ranges, range_count);
+    free(sorted);
+    free(open);
+    free(ranges);
+}
+
+/** @brief 安裝覆蓋字節碼範圍 [base, base + count) 的機器碼，分派表位於 code 末尾，返回新的代碼塊 */
+static JitCodeBlock* jit_install_span(ComeOnJIT* jit, KBytecodeChunk* chunk, const uint8_t* code, size_t code_size,
+                              const JitReloc* relocs, size_t reloc_count, size_t base, size_t count) {
+    if (count * 4 > code_size || base + count > chunk->count) return NULL;
+    uint8_t* rw = NULL;
+    uint8_t* exec = jit_alloc_exec(jit, code_size, &rw);
+    if (!exec) return NULL;
+    memcpy(rw, code, code_size);
+
+    // 修補絕對地址 (字節碼指針、字節碼塊、運行時輔助函數)
+    for (size_t i = 0; i < reloc_count; i++) {
+        uint64_t value;
+        switch (relocs[i].kind) {
+            case JIT_RELOC_BYTECODE: value = (uintptr_t)(chunk->code + relocs[i].addend); break;
+            case JIT_RELOC_CHUNK:    value = (uintptr_t)chunk; break;
+            case JIT_RELOC_HELPER:   value = (uintptr_t)&jit_helper_step; break;
+            case JIT_RELOC_FIELD_CACHE: {
+                uint8_t* cache = (uint8_t*)chunk_field_cache(chunk);
+                if (!cache) {
+                    jit_free_exec(jit, exec);
+                    return NULL;
+                }
+                value = (uintptr_t)(cache + relocs[i].addend);
+                break;
+            }
+            default:
+                jit_free_exec(jit, exec);
+                return NULL;
+        }
+        if (relocs[i].offset + 8 > code_size) {
+            jit_free_exec(jit, exec);
+            return NULL;
+        }
+        memcpy(rw + relocs[i].offset, &value, 8);
+    }
+
+    // 記錄所屬字節碼塊，驅逐時清空 chunk->jit_code
+    JitCodeBlock* block = NULL;
+    for (JitCodeBlock* b = jit->blocks; b; b = b->next) {
+        if (b->code == exec) {
+            b->owner = chunk;
+            b->bc_base = base;
+            b->bc_count = count;
+            chunk->jit = jit;
+            jit_register_ranges(jit, b, chunk, code + code_size - count * 4, base, count, code_size);
+            block = b;
+            break;
+        }
+    }
 
 #ifdef _WIN32
-    FlushInstructionCache(GetCurrentProcess(), start_addr, code - start_addr);
+    FlushInstructionCache(GetCurrentProcess(), exec, code_size);
+#else
+    __builtin___clear_cache((char*)exec, (char*)exec + code_size);
 #endif
 
+    // 登記入口，同一字節碼塊的其他代碼塊分派時直接跳入
+    if (chunk->jit_entries) {
+        const uint8_t* table = code + code_size - count * 4;
+        for (size_t i = 0; i < count; i++) {
+            int32_t mc;
+            memcpy(&mc, table + i * 4, 4);
+            if (mc > 0) chunk->jit_entries[base + i] = exec + mc;
+        }
+    }
+
     jit->compiled_functions++;
-    return (void*)start_addr;
+    return block;
+}
+
+void* jit_install(ComeOnJIT* jit, KBytecodeChunk* chunk, const uint8_t* code, size_t code_size,
+                  const JitReloc* relocs, size_t reloc_count) {
+    JitCodeBlock* block = jit_install_span(jit, chunk, code, code_size, relocs, reloc_count, 0, chunk->count);
+    if (!block) return NULL;
+    chunk->jit_block = block;
+    return block->code;
+}
+
+/** @brief 生成並安裝字節碼範圍 [base, end) 的機器碼 */
+static JitCodeBlock* jit_compile_span(ComeOnJIT* jit, KBytecodeChunk* chunk, size_t base, size_t end, bool skip_bodies) {
+    // 先在普通堆內存中生成機器碼，完成後再複製到代碼緩存 (W^X)
+    JitImage image;
+    if (!jit_generate_span(jit, chunk, base, end, skip_bodies, &image)) return NULL;
+    JitCodeBlock* block = jit_install_span(jit, chunk, image.code, image.size, image.relocs, image.reloc_count,
+                                           image.bc_base, image.bc_count);
+    jit_free_image(&image);
+    return block;
+}
+
+void* jit_compile(ComeOnJIT* jit, KBytecodeChunk* chunk) {
+    if (!jit->enabled) return NULL;
+    JitCodeBlock* block = jit_compile_span(jit, chunk, 0, chunk->count, true);
+    if (!block) return NULL;
+    chunk->jit_block = block;
+    return block->code;
+}
+
+static int compare_lazy_body(const void* a, const void* b) {
+    uint32_t x = ((const KLazyBody*)a)->entry, y = ((const KLazyBody*)b)->entry;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/** @brief 由函數表建立按入口排序的最外層函數體列表，並分配 jit_entries */
+static bool build_lazy_bodies(KBytecodeChunk* chunk) {
+    KLazyBody* bodies = (KLazyBody*)malloc(chunk->function_count * sizeof(KLazyBody));
+    uint8_t** entries = (uint8_t**)calloc(chunk->count, sizeof(uint8_t*));
+    if (!bodies || !entries) {
+        free(bodies);
+        free(entries);
+        return false;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < chunk->function_count; i++) {
+        const KFunctionInfo* info = &chunk->functions[i];
+        // 函數體之後必須緊跟它的 KOP_FUNCTION，否則跳過該項 (函數體照常生成)
+        if (info->entry >= info->insn || info->insn >= chunk->count || chunk->code[info->insn] != KOP_FUNCTION) continue;
+        bodies[count].entry = info->entry;
+        bodies[count].end = info->insn;
+        bodies[count].jit_block = NULL;
+        count++;
+    }
+    qsort(bodies, count, sizeof(KLazyBody), compare_lazy_body);
+
+    // 去掉嵌套在其他函數體中的函數
+    size_t outer = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (outer > 0 && bodies[i].entry < bodies[outer - 1].end) continue;
+        bodies[outer++] = bodies[i];
+    }
+    chunk->lazy_bodies = bodies;
+    chunk->lazy_body_count = outer;
+    chunk->jit_entries = entries;
+    return true;
+}
+
+void* jit_compile_lazy(ComeOnJIT* jit, KBytecodeChunk* chunk) {
+    if (!jit->enabled) return NULL;
+    if (chunk->function_count > 0 && !chunk->lazy_bodies) build_lazy_bodies(chunk);
+    return jit_compile(jit, chunk);
+}
+
+JitCodeBlock* jit_materialize(ComeOnJIT* jit, KBytecodeChunk* chunk, size_t offset) {
+    JitCodeBlock* block = chunk->jit_code ? chunk->jit_block : NULL;
+    if (!block || !chunk->lazy_bodies) return block;
+
+    KLazyBody* body = find_lazy_body(chunk, offset);
+    if (!body) return block;
+    if (!body->jit_block) {
+        // 機器碼屬於其他虛擬機 (線程共享字節碼塊) 時不能補充，交給解釋器
+        if (!jit->enabled || chunk->jit != jit) return NULL;
+        body->jit_block = jit_compile_span(jit, chunk, body->entry, body->end, false);
+    }
+    return body->jit_block;
 }
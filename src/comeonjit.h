@@ -19,6 +19,92 @@ typedef enum {
     JIT_ARCH_UNKNOWN
 } JitArch;
 
+/**
+ * @brief 代碼緩存區段
+ * 同一塊共享內存被映射兩次：RW 視圖用於寫入機器碼，RX 視圖用於執行 (W^X)。
+ */
+typedef struct JitCodeRegion {
+    uint8_t* rw_base;             /**< 可寫視圖基址 */
+    uint8_t* rx_base;             /**< 可執行視圖基址 */
+    size_t size;                  /**< 區段大小 (頁對齊) */
+#ifdef _WIN32
+    void* mapping;                /**< 文件映射句柄 */
+#endif
+    struct JitCodeRegion* next;
+} JitCodeRegion;
+
+/**
+ * @brief 空閒代碼片段 (按區段與偏移排序，便於合併)
+ */
+typedef struct JitFreeSpan {
+    JitCodeRegion* region;
+    size_t offset;
+    size_t size;
+    struct JitFreeSpan* next;
+} JitFreeSpan;
+
+/**
+ * @brief 已分配的代碼塊
+ */
+typedef struct JitCodeBlock {
+    JitCodeRegion* region;
+    size_t offset;
+    size_t size;
+    uint8_t* code;                /**< RX 視圖中的入口地址 */
+    KBytecodeChunk* owner;        /**< 所屬字節碼塊 (驅逐時清空其 jit_code；free_chunk 釋放代碼塊，不會懸空) */
+    size_t bc_base;               /**< 覆蓋的字節碼範圍 [bc_base, bc_base + bc_count) */
+    size_t bc_count;
+    uint64_t last_used;           /**< 最近使用時刻 (LRU 驅逐) */
+    void* debug_entry;            /**< GDB JIT 接口條目 */
+    struct JitCodeBlock* next;
+} JitCodeBlock;
+
+/**
+ * @brief 代碼緩存統計
+ */
+typedef struct {
+    size_t reserved_bytes;        /**< 已映射的總字節數 */
+    size_t used_bytes;            /**< 存活代碼佔用字節數 */
+    size_t free_bytes;            /**< 空閒字節數 */
+    size_t largest_free;          /**< 最大連續空閒片段 */
+    size_t region_count;          /**< 區段數量 */
+    size_t block_count;           /**< 存活代碼塊數量 */
+    size_t evictions;             /**< 累計驅逐次數 */
+    double fragmentation;         /**< 碎片率: 1 - largest_free / free_bytes */
+} JitCacheStats;
+
+/**
+ * @brief 機器碼中的絕對地址重定位類型
+ */
+typedef enum {
+    JIT_RELOC_BYTECODE,           /**< chunk->code + addend */
+    JIT_RELOC_CHUNK,              /**< 字節碼塊本身 */
+    JIT_RELOC_HELPER,             /**< 解釋器單步輔助函數 */
+    JIT_RELOC_FIELD_CACHE         /**< (uint8_t*)chunk_field_cache(chunk) + addend */
+} JitRelocKind;
+
+/**
+ * @brief 重定位項 (修補 offset 處的 8 字節立即數)
+ */
+typedef struct {
+    uint32_t offset;              /**< 機器碼內偏移 */
+    uint32_t kind;                /**< JitRelocKind */
+    uint64_t addend;              /**< 附加值 (字節碼偏移) */
+} JitReloc;
+
+/**
+ * @brief 與地址無關的機器碼映像
+ * 由 jit_generate 生成，經 jit_install 重定位後才可執行；AOT 將其保存到共享庫中。
+ */
+typedef struct {
+    uint8_t* code;
+    size_t size;
+    JitReloc* relocs;
+    size_t reloc_count;
+    size_t bc_base;               /**< 覆蓋的字節碼範圍，分派表位於 code 末尾 bc_count 項 */
+    size_t bc_count;
+} JitImage;
+
 /**
  * @brief JIT 編譯器狀態結構
  */
@@ -26,10 +112,22 @@ typedef struct ComeOnJIT {
     bool enabled;
     JitArch arch;
     
-    /* 可執行內存區域 */
-    uint8_t* exec_memory;      /**< 可執行內存指針 */
-    size_t exec_memory_size;   /**< 分配的內存大小 */
-    size_t exec_memory_used;   /**< 已使用的內存大小 */
+    /* 代碼緩存 */
+    JitCodeRegion* regions;       /**< 已映射區段鏈表 */
+    JitFreeSpan* free_spans;      /**< 空閒片段鏈表 */
+    JitCodeBlock* blocks;         /**< 存活代碼塊鏈表 */
+    size_t cache_reserved;        /**< 已映射總大小 */
+    size_t cache_limit;           /**< 緩存上限，超出時驅逐冷代碼 */
+    size_t next_region_size;      /**< 下一個區段的大小 (幾何增長) */
+    uint64_t clock;               /**< LRU 時鐘 */
+    size_t evictions;             /**< 累計驅逐次數 */
+    
+    /* 性能分析器 / 調試器集成 (見 kjitdebug.h) */
+    unsigned int profile_flags;   /**< JIT_PROFILE_* 位掩碼 */
+    void* perf_map;               /**< /tmp/perf-<pid>.map 文件 */
+    void* jitdump;                /**< /tmp/jit-<pid>.dump 文件 */
+    void* jitdump_marker;         /**< jitdump 文件的可執行映射 */
+    uint64_t code_index;          /**< jitdump 代碼序號 */
     
     /* 統計 */
     size_t compiled_functions; /**< 已編譯函數數量 */
@@ -63,6 +161,50 @@ typedef int (*JitFunction)(void* vm);
  */
 void* jit_compile(ComeOnJIT* jit, KBytecodeChunk* chunk);
 
+/**
+ * @brief 延遲編譯字節碼塊
+ * 塊帶有函數表時只為頂層代碼生成機器碼，函數體在第一次執行到時由 jit_materialize 生成各自的代碼塊；
+ * 導入的大模塊中從未調用的函數因此不佔用編譯時間與代碼緩存。沒有函數表時等同 jit_compile。
+ * 同一字節碼塊的代碼塊棧幀佈局相同，分派時經 chunk->jit_entries 直接互相跳轉。
+ * @return 編譯後的函數指針，失敗返回 NULL
+ */
+void* jit_compile_lazy(ComeOnJIT* jit, KBytecodeChunk* chunk);
+
+/**
+ * @brief 取得覆蓋字節碼偏移 offset 的代碼塊
+ * offset 落在尚未生成的函數體中時只為該函數體生成一個代碼塊，已有的代碼塊不受影響。
+ * 代碼塊直接記錄在 chunk->jit_block 與 KLazyBody 中，不需要查找。
+ * @return 代碼塊 (入口為其 code)，塊沒有機器碼或無法生成時返回 NULL
+ */
+JitCodeBlock* jit_materialize(ComeOnJIT* jit, KBytecodeChunk* chunk, size_t offset);
+
+/**
+ * @brief 生成可重定位的機器碼映像 (不安裝，不受 enabled 開關影響)
+ * @param jit JIT 實例
+ * @param chunk 字節碼塊
+ * @param image 輸出映像，使用後需 jit_free_image
+ * @return 成功返回 true
+ */
+bool jit_generate(ComeOnJIT* jit, KBytecodeChunk* chunk, JitImage* image);
+
+/**
+ * @brief 釋放 jit_generate 生成的映像
+ */
+void jit_free_image(JitImage* image);
+
+/**
+ * @brief 將機器碼映像安裝到代碼緩存並完成重定位
+ * @param jit JIT 實例
+ * @param chunk 目標字節碼塊 (必須與生成映像時的字節碼一致)
+ * @param code 機器碼
+ * @param code_size 機器碼大小
+ * @param relocs 重定位表
+ * @param reloc_count 重定位項數量
+ * @return 可執行入口，失敗返回 NULL
+ */
+void* jit_install(ComeOnJIT* jit, KBytecodeChunk* chunk, const uint8_t* code, size_t code_size,
+                  const JitReloc* relocs, size_t reloc_count);
+
 // --- 內部輔助 (IR & Codegen) ---
 
 /**
@@ -72,7 +214,41 @@ void* jit_compile(ComeOnJIT* jit, KBytecodeChunk* chunk);
 
 /**
  * @brief 分配可執行內存
+ * @param jit JIT 實例
+ * @param size 所需字節數
+ * @param rw_out 輸出：對應的可寫地址 (寫入機器碼用)
+ * @return 可執行地址，失敗返回 NULL
+ */
+uint8_t* jit_alloc_exec(ComeOnJIT* jit, size_t size, uint8_t** rw_out);
+
+/**
+ * @brief 釋放一段由 jit_alloc_exec 分配的代碼
+ * @param jit JIT 實例
+ * @param code 可執行地址
+ */
+void jit_free_exec(ComeOnJIT* jit, void* code);
+
+/**
+ * @brief 釋放字節碼塊的全部機器碼 (free_chunk 與重新安裝 AOT 代碼時調用)
+ * @param jit JIT 實例
+ * @param chunk 字節碼塊，其 jit_code 會被清空
+ */
+void jit_release_chunk(ComeOnJIT* jit, KBytecodeChunk* chunk);
+
+/**
+ * @brief 標記代碼塊被使用 (更新 LRU 時鐘)
+ */
+void jit_touch(ComeOnJIT* jit, JitCodeBlock* block);
+
+/**
+ * @brief 獲取代碼緩存統計
+ */
+void jit_get_stats(ComeOnJIT* jit, JitCacheStats* stats);
+
+/**
+ * @brief 打印代碼緩存統計
+ * 設置環境變量 KORELIN_JIT_STATS 時由 kvm_free 在銷毀 JIT 前調用。
  */
-uint8_t* jit_alloc_exec(ComeOnJIT* jit, size_t size);
+void jit_print_stats(ComeOnJIT* jit);
 
 #endif //KORELIN_COMEONJIT_H
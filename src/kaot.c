@@ -0,0 +1,168 @@
+#include "kaot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define KAOT_DEFAULT_CC "gcc"
+#else
+#include <dlfcn.h>
+#include <unistd.h>
+#define KAOT_DEFAULT_CC "cc"
+#endif
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief 字節碼 FNV-1a 哈希，用於確認映像與字節碼一致
+ * 數值常量以立即數形式嵌入機器碼，因此一併計入。
+ */
+static uint64_t bytecode_hash(const KBytecodeChunk* chunk) {
+    uint64_t hash = fnv1a(1469598103934665603ULL, chunk->code, chunk->count);
+    hash = fnv1a(hash, chunk->int_constants, chunk->int_count * sizeof(int64_t));
+    return fnv1a(hash, chunk->double_constants, chunk->double_count * sizeof(double));
+}
+
+/** @brief 以 C 數組形式寫出字節 */
+static void write_bytes(FILE* fp, const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        fprintf(fp, "%s0x%02x,", (i % 16 == 0) ? "\n    " : "", data[i]);
+    }
+    fprintf(fp, "\n");
+}
+
+/** @brief 生成嵌入映像的 C 源碼 */
+static int write_image_source(const char* path, KBytecodeChunk* chunk, JitImage* image) {
+    FILE* fp = fopen(path, "w");
+    if (!fp) return -1;
+
+    fprintf(fp, "/* Generated by korelin aot from %s. Do not edit. */\n",
+            chunk->filename ? chunk->filename : "<chunk>");
+    fprintf(fp, "#include <stdint.h>\n\n");
+    fprintf(fp, "typedef struct { uint32_t offset; uint32_t kind; uint64_t addend; } JitReloc;\n");
+    fprintf(fp, "typedef struct {\n"
+                "    uint32_t magic, version, arch, reserved;\n"
+                "    uint64_t bytecode_size, bytecode_hash, code_size, reloc_count;\n"
+                "    const uint8_t* code;\n"
+                "    const JitReloc* relocs;\n"
+                "} KAotImage;\n\n");
+
+    fprintf(fp, "static const uint8_t korelin_aot_code[%zu] = {", image->size);
+    write_bytes(fp, image->code, image->size);
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "static const JitReloc korelin_aot_relocs[%zu] = {\n", image->reloc_count);
+    for (size_t i = 0; i < image->reloc_count; i++) {
+        fprintf(fp, "    {%u, %u, %lluULL},\n", image->relocs[i].offset, image->relocs[i].kind,
+                (unsigned long long)image->relocs[i].addend);
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "#ifdef _WIN32\n__declspec(dllexport)\n#endif\n");
+    fprintf(fp, "const KAotImage %s = {\n", KAOT_SYMBOL);
+    fprintf(fp, "    0x%08Xu, %du, %du, 0u,\n", KAOT_MAGIC, KAOT_VERSION, (int)JIT_ARCH_X64);
+    fprintf(fp, "    %zuULL, 0x%016llxULL, %zuULL, %zuULL,\n", chunk->count,
+            (unsigned long long)bytecode_hash(chunk), image->size, image->reloc_count);
+    fprintf(fp, "    korelin_aot_code,\n    korelin_aot_relocs\n};\n");
+
+    int failed = ferror(fp);
+    if (fclose(fp) != 0) failed = 1;
+    return failed ? -1 : 0;
+}
+
+int kaot_build(KBytecodeChunk* chunk, const char* output) {
+    if (!chunk || !output || chunk->count == 0) return -1;
+
+    ComeOnJIT jit;
+    jit_init(&jit);
+    JitImage image;
+    bool ok = jit_generate(&jit, chunk, &image);
+    jit_cleanup(&jit);
+    if (!ok) {
+        printf("AOT Error: Unsupported target or bytecode.\n");
+        return -1;
+    }
+
+    size_t len = strlen(output);
+    char* source_path = (char*)malloc(len + 3);
+    memcpy(source_path, output, len);
+    memcpy(source_path + len, ".c", 3);
+
+    if (write_image_source(source_path, chunk, &image) != 0) {
+        printf("AOT Error: Could not write \"%s\".\n", source_path);
+        jit_free_image(&image);
+        free(source_path);
+        return -1;
+    }
+    jit_free_image(&image);
+
+    const char* cc = getenv("KORELIN_CC");
+    if (!cc || !*cc) cc = KAOT_DEFAULT_CC;
+    size_t cmd_len = strlen(cc) + strlen(source_path) + len + 64;
+    char* command = (char*)malloc(cmd_len);
+    snprintf(command, cmd_len, "%s -shared -fPIC -O0 -o \"%s\" \"%s\"", cc, output, source_path);
+
+    int status = system(command);
+    remove(source_path);
+    free(command);
+    free(source_path);
+
+    if (status != 0) {
+        printf("AOT Error: C compiler \"%s\" failed (set KORELIN_CC to override).\n", cc);
+        return -1;
+    }
+    return 0;
+}
+
+int kaot_load(KVM* vm, KBytecodeChunk* chunk, const char* path) {
+    if (!vm || !vm->jit || !chunk || !path) return -1;
+
+#ifdef _WIN32
+    HMODULE lib = LoadLibraryA(path);
+    if (!lib) return -1;
+    const KAotImage* image = (const KAotImage*)GetProcAddress(lib, KAOT_SYMBOL);
+#else
+    // 路徑不含 '/' 時 dlopen 會搜索系統庫目錄，這裡總是按文件路徑加載
+    char* lib_path = NULL;
+    if (!strchr(path, '/')) {
+        lib_path = (char*)malloc(strlen(path) + 3);
+        strcpy(lib_path, "./");
+        strcat(lib_path, path);
+    }
+    void* lib = dlopen(lib_path ? lib_path : path, RTLD_NOW | RTLD_LOCAL);
+    free(lib_path);
+    if (!lib) return -1;
+    const KAotImage* image = (const KAotImage*)dlsym(lib, KAOT_SYMBOL);
+#endif
+
+    int result = 0;
+    if (!image) {
+        result = -1;
+    } else if (image->magic != KAOT_MAGIC || image->version != KAOT_VERSION ||
+               image->arch != (uint32_t)vm->jit->arch ||
+               image->bytecode_size != chunk->count ||
+               image->bytecode_hash != bytecode_hash(chunk)) {
+        result = 1; /**< 映像過期或不屬於該字節碼 */
+    } else {
+        if (chunk->jit_code) jit_release_chunk(vm->jit, chunk);
+        chunk->jit_code = jit_install(vm->jit, chunk, image->code, (size_t)image->code_size,
+                                      image->relocs, (size_t)image->reloc_count);
+        if (!chunk->jit_code) result = -1;
+    }
+
+    // 機器碼已複製到代碼緩存，共享庫可以卸載
+#ifdef _WIN32
+    FreeLibrary(lib);
+#else
+    dlclose(lib);
+#endif
+    return result;
+}
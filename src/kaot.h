@@ -0,0 +1,59 @@
+#ifndef KORELIN_KAOT_H
+#define KORELIN_KAOT_H
+
+#include <stdint.h>
+#include "kcode.h"
+#include "kvm.h"
+#include "comeonjit.h"
+
+/**
+ * @brief 預先編譯 (AOT)
+ * 使用 ComeOnJIT 後端把整個字節碼塊編譯為與地址無關的機器碼映像，
+ * 並打包進本地共享庫 (.so / .dll)。運行時 dlopen 該庫，校驗字節碼後
+ * 把映像重定位到代碼緩存並綁定到字節碼塊，從而無需 JIT 預熱；
+ * 快路徑無法處理的指令照常回退到解釋器。
+ */
+
+/** @brief AOT 映像魔數 "KAOT" */
+#define KAOT_MAGIC 0x544F414B
+/** @brief AOT 映像版本號 (機器碼約定改變時遞增) */
+#define KAOT_VERSION 6
+/** @brief 共享庫中導出的映像符號名 */
+#define KAOT_SYMBOL "korelin_aot_image"
+
+/**
+ * @brief 共享庫導出的映像描述
+ * 佈局與 kaot_build 生成的 C 源碼一致，不可單獨修改。
+ */
+typedef struct {
+    uint32_t magic;               /**< KAOT_MAGIC */
+    uint32_t version;             /**< KAOT_VERSION */
+    uint32_t arch;                /**< JitArch */
+    uint32_t reserved;
+    uint64_t bytecode_size;       /**< 字節碼大小 */
+    uint64_t bytecode_hash;       /**< 字節碼 FNV-1a 哈希 */
+    uint64_t code_size;           /**< 機器碼大小 */
+    uint64_t reloc_count;         /**< 重定位項數量 */
+    const uint8_t* code;          /**< 機器碼 */
+    const JitReloc* relocs;       /**< 重定位表 */
+} KAotImage;
+
+/**
+ * @brief 將字節碼塊編譯為本地共享庫
+ * 生成臨時 C 源碼並調用系統 C 編譯器 (環境變量 KORELIN_CC，默認 cc)。
+ * @param chunk 字節碼塊
+ * @param output 輸出共享庫路徑
+ * @return 0 成功, 非0 失敗
+ */
+int kaot_build(KBytecodeChunk* chunk, const char* output);
+
+/**
+ * @brief 加載共享庫並綁定到字節碼塊
+ * @param vm 虛擬機 (使用其 JIT 代碼緩存)
+ * @param chunk 字節碼塊，成功後其 jit_code 指向 AOT 代碼
+ * @param path 共享庫路徑
+ * @return 0 成功, 1 映像與字節碼不匹配, -1 加載錯誤
+ */
+int kaot_load(KVM* vm, KBytecodeChunk* chunk, const char* path);
+
+#endif //KORELIN_KAOT_H
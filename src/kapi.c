@@ -23,6 +23,9 @@ __thread KVM* g_current_vm = NULL;
 static KVM g_internal_vm; // Only used if KInit/KRun manages lifecycle (Main thread only?)
 static bool g_initialized = false;
 
+/** @brief 本地函數登記表：限定名 -> 函數指針 (存放在 as.obj 中) */
+static KTable g_natives;
+
 
 /**
  * @brief 內部輔助
@@ -86,6 +89,37 @@ static void register_native(const char* name, void* func) {
     // Using KObjInstance of an empty class is easiest.
 }
 
+/** @brief 按限定名登記本地函數，package 為 NULL 時直接使用 name */
+static void record_native(const char* package, const char* name, void* func) {
+    char qualified[256];
+    snprintf(qualified, sizeof(qualified), "%s%s%s", package ? package : "", package ? "." : "", name);
+    KValue val;
+    val.type = VAL_OBJ;
+    val.as.obj = func;
+    table_set(&g_natives, qualified, val);
+}
+
+NativeFunc KNativeLookup(const char* qualified_name) {
+    KValue val;
+    if (!table_get(&g_natives, qualified_name, &val)) return NULL;
+    return (NativeFunc)val.as.obj;
+}
+
+const char* KNativeName(NativeFunc func) {
+    for (int i = 0; i < g_natives.capacity; i++) {
+        KTableEntry* entry = &g_natives.entries[i];
+        if (entry->key && (NativeFunc)entry->value.as.obj == func) return entry->key;
+    }
+    return NULL;
+}
+
+void KCollectNatives(void (*register_libs)(void)) {
+    KVM* saved = g_current_vm;
+    g_current_vm = NULL; // KLib* 在沒有 VM 時只登記
+    register_libs();
+    g_current_vm = saved;
+}
+
 /**
  * @brief API 實現
  */
@@ -128,6 +162,7 @@ void KLibNew(const char* package_name) {
 }
 
 void KLibAdd(const char* package_name, const char* type, const char* name, void* value) {
+    record_native(package_name, name, value);
     if (!g_current_vm) return;
     
     // Find module
@@ -162,6 +197,9 @@ void KLibNewClass(const char* class_name) {
     klass->name = strdup(class_name);
     klass->parent = NULL;
     init_table(&klass->methods);
+    klass->fields = NULL;
+    klass->field_count = 0;
+    klass->layout_id = 0; // 沒有字段，不會內聯存放
     
     KValue val;
     val.type = VAL_OBJ;
@@ -172,6 +210,7 @@ void KLibNewClass(const char* class_name) {
 }
 
 void KLibAddMethod(const char* class_name, const char* method_name, void* func) {
+    record_native(class_name, method_name, func);
     if (!g_current_vm) return;
     
     // Find class in globals
@@ -198,6 +237,7 @@ void KLibAddMethod(const char* class_name, const char* method_name, void* func)
 }
 
 void KLibAddGlobal(const char* name, void* func) {
+    record_native(NULL, name, func);
     if (!g_current_vm) return;
     
     // Create Native Function
@@ -68,6 +68,28 @@ void KLibAddMethod(const char* class_name, const char* method_name, void* func);
  */
 void KLibAddGlobal(const char* name, void* func);
 
+// --- 本地函數登記表 ---
+
+/**
+ * @brief 按限定名查找已登記的本地函數
+ * KLibAdd 登記為 "包.名字"，KLibAddMethod 為 "類.方法"，KLibAddGlobal 為全局名字。
+ * 登記表是進程級的，不依賴綁定的 VM。
+ * @return 未登記時返回 NULL
+ */
+NativeFunc KNativeLookup(const char* qualified_name);
+
+/**
+ * @brief 本地函數的限定名 (KNativeLookup 的反向查詢)
+ * @return 未登記時返回 NULL
+ */
+const char* KNativeName(NativeFunc func);
+
+/**
+ * @brief 只登記本地函數而不創建任何對象
+ * 在沒有綁定 VM 的狀態下執行 register_libs (例如 kstd_register)，用於從堆快照啟動前填充登記表。
+ */
+void KCollectNatives(void (*register_libs)(void));
+
 // --- 類管理 ---
 
 /**
@@ -1,192 +1,346 @@
 #include "kcache.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "kconst.h"
 
-/** @brief 輔助函數：寫入字符串 */
-static int write_string(FILE* fp, const char* str) {
-    if (!str) {
-        uint32_t len = 0;
-        if (fwrite(&len, sizeof(len), 1, fp) != 1) return -1;
-        return 0;
-    }
-    
-    uint32_t len = (uint32_t)strlen(str);
-    if (fwrite(&len, sizeof(len), 1, fp) != 1) return -1;
-    
-    if (len > 0) {
-        if (fwrite(str, 1, len, fp) != len) return -1;
-    }
-    return 0;
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+uint64_t kcache_hash(const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/** @brief 用固定的幾項生成一張行號表，編碼方式改變時結果隨之改變 */
+static uint64_t line_table_probe(void) {
+    static const int lines[] = { 1, 3, 2, 200, 70000, 5 };
+    KLineTable table = {0};
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        line_table_add(&table, i * 150, lines[i]);
+    }
+    uint64_t hash = kcache_hash(table.data, table.size);
+    free(table.data);
+    return hash;
+}
+
+uint64_t kcache_fingerprint(void) {
+    uint8_t lengths[256];
+    for (int i = 0; i < 256; i++) lengths[i] = (uint8_t)opcode_length((uint8_t)i);
+    uint32_t versions[2] = { KCACHE_VERSION, KCODE_VERSION };
+    // 段佈局：段的數量與各段元素的大小、字段位置
+    uint32_t layout[] = {
+        KCACHE_SECTION_COUNT, KCACHE_PAGE_SIZE,
+        (uint32_t)sizeof(KCacheHeader), (uint32_t)sizeof(KCacheSection),
+        (uint32_t)sizeof(uint32_t), (uint32_t)sizeof(int64_t), (uint32_t)sizeof(double),
+        (uint32_t)sizeof(KFunctionInfo),
+        (uint32_t)offsetof(KFunctionInfo, name), (uint32_t)offsetof(KFunctionInfo, insn),
+        (uint32_t)offsetof(KFunctionInfo, entry), (uint32_t)offsetof(KFunctionInfo, arity),
+    };
+    uint64_t hash = kcache_hash(KORELIN_SDK_VERSION, strlen(KORELIN_SDK_VERSION));
+    hash ^= kcache_hash(versions, sizeof(versions)) * 31;
+    hash ^= kcache_hash(lengths, sizeof(lengths)) * 131;
+    hash ^= kcache_hash(layout, sizeof(layout)) * 137;
+    return hash ^ line_table_probe() * 139;
 }
 
-/** @brief 輔助函數：讀取字符串 */
-static char* read_string(FILE* fp) {
-    uint32_t len;
-    if (fread(&len, sizeof(len), 1, fp) != 1) return NULL;
-    
-    if (len == 0) {
-        return strdup("");
-    }
-    
-    char* str = (char*)malloc(len + 1);
-    if (!str) return NULL;
-    
-    if (fread(str, 1, len, fp) != len) {
-        free(str);
+char* kcache_path(const char* source_path) {
+    size_t len = strlen(source_path);
+    char* path = (char*)malloc(len + 4);
+    if (!path) return NULL;
+    memcpy(path, source_path, len);
+    memcpy(path + len, ".kc", 4);
+    return path;
+}
+
+/** @brief 向上對齊到 KCACHE_PAGE_SIZE */
+static uint64_t page_align(uint64_t offset) {
+    return (offset + KCACHE_PAGE_SIZE - 1) & ~(uint64_t)(KCACHE_PAGE_SIZE - 1);
+}
+
+/** @brief 用零填充到 offset */
+static bool pad_to(FILE* fp, uint64_t* position, uint64_t offset) {
+    static const uint8_t zeros[KCACHE_PAGE_SIZE];
+    while (*position < offset) {
+        size_t n = (size_t)(offset - *position);
+        if (n > sizeof(zeros)) n = sizeof(zeros);
+        if (fwrite(zeros, 1, n, fp) != n) return false;
+        *position += n;
+    }
+    return true;
+}
+
+FILE* kcache_create_temp(const char* filename, char** temp_path) {
+    *temp_path = NULL;
+    size_t size = strlen(filename) + 32;
+    char* path = (char*)malloc(size);
+    if (!path) return NULL;
+#ifdef _WIN32
+    snprintf(path, size, "%s.%d.tmp", filename, (int)_getpid());
+#else
+    snprintf(path, size, "%s.%d.tmp", filename, (int)getpid());
+#endif
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        free(path);
         return NULL;
     }
-    str[len] = '\0';
-    return str;
+    *temp_path = path;
+    return fp;
+}
+
+int kcache_replace(FILE* fp, char* temp_path, const char* filename, bool ok) {
+    if (fflush(fp) != 0) ok = false;
+#ifdef _WIN32
+    if (ok && _commit(_fileno(fp)) != 0) ok = false;
+#else
+    if (ok && fsync(fileno(fp)) != 0) ok = false;
+#endif
+    if (fclose(fp) != 0) ok = false;
+
+    if (ok) {
+#ifdef _WIN32
+        // 目標仍被其他進程映射時替換失敗，保留舊文件
+        ok = MoveFileExA(temp_path, filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        ok = rename(temp_path, filename) == 0;
+#endif
+    }
+    if (!ok) remove(temp_path);
+    free(temp_path);
+    return ok ? 0 : -1;
 }
 
-int kcache_save(const char* filename, KBytecodeChunk* chunk, uint64_t source_timestamp, uint64_t source_size) {
+int kcache_save(const char* filename, KBytecodeChunk* chunk, uint64_t source_hash, uint64_t source_size) {
     if (!filename || !chunk) return -1;
 
-    FILE* fp = fopen(filename, "wb");
-    if (!fp) return -1;
+    // 字符串區：偏移表 + 依次排列的字符串
+    uint32_t* string_offsets = NULL;
+    char* strings = NULL;
+    size_t strings_size = 0;
+    if (chunk->string_count > 0) {
+        string_offsets = (uint32_t*)malloc(chunk->string_count * sizeof(uint32_t));
+        for (size_t i = 0; i < chunk->string_count; i++) {
+            strings_size += strlen(chunk->string_table[i] ? chunk->string_table[i] : "") + 1;
+        }
+        strings = (char*)malloc(strings_size);
+        if (!string_offsets || !strings || strings_size > UINT32_MAX) {
+            free(string_offsets);
+            free(strings);
+            return -1;
+        }
+        size_t position = 0;
+        for (size_t i = 0; i < chunk->string_count; i++) {
+            const char* str = chunk->string_table[i] ? chunk->string_table[i] : "";
+            size_t len = strlen(str) + 1;
+            string_offsets[i] = (uint32_t)position;
+            memcpy(strings + position, str, len);
+            position += len;
+        }
+    }
+
+    size_t function_count = chunk->function_count;
+    KFunctionInfo* owned_functions = NULL;
+    if (!chunk->functions) owned_functions = build_function_table(chunk, &function_count);
+    const KFunctionInfo* functions = chunk->functions ? chunk->functions : owned_functions;
+
+    const void* data[KCACHE_SECTION_COUNT] = {
+        chunk->code, chunk->lines.data, string_offsets, strings,
+        chunk->int_constants, chunk->double_constants, functions
+    };
+    uint64_t sizes[KCACHE_SECTION_COUNT] = {
+        chunk->count,
+        chunk->lines.size,
+        chunk->string_count * sizeof(uint32_t),
+        strings_size,
+        chunk->int_count * sizeof(int64_t),
+        chunk->double_count * sizeof(double),
+        function_count * sizeof(KFunctionInfo)
+    };
 
     KCacheHeader header;
     memset(&header, 0, sizeof(header));
     header.magic = KCACHE_MAGIC;
     header.version = KCACHE_VERSION;
-    header.timestamp = source_timestamp;
+    header.fingerprint = kcache_fingerprint();
+    header.source_hash = source_hash;
     header.source_size = source_size;
-    
-    header.code_size = (uint32_t)chunk->count; /**< 字節碼實際字節數 */
-    header.string_count = (uint32_t)chunk->string_count;
-    header.lines_size = (uint32_t)(chunk->count * sizeof(int)); /**< lines 數組大小通常與 code count 一致 */
 
-    // 1. 寫入頭部
-    if (fwrite(&header, sizeof(header), 1, fp) != 1) {
-        fclose(fp);
-        return -1;
+    // 每個非空段從新的一頁開始
+    uint64_t end = sizeof(header);
+    for (int i = 0; i < KCACHE_SECTION_COUNT; i++) {
+        if (sizes[i] == 0) continue;
+        header.sections[i].offset = page_align(end);
+        header.sections[i].size = sizes[i];
+        end = header.sections[i].offset + sizes[i];
     }
+    header.file_size = end;
 
-    // 2. 寫入字節碼指令
-    if (header.code_size > 0) {
-        if (fwrite(chunk->code, 1, header.code_size, fp) != header.code_size) {
-            fclose(fp);
-            return -1;
-        }
+    // 不能就地改寫：其他進程可能正映射著舊文件並直接執行其中的字節碼
+    char* temp_path = NULL;
+    FILE* fp = kcache_create_temp(filename, &temp_path);
+    bool ok = fp != NULL;
+    uint64_t position = 0;
+    if (ok) {
+        ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+        position = sizeof(header);
+    }
+    for (int i = 0; ok && i < KCACHE_SECTION_COUNT; i++) {
+        if (sizes[i] == 0) continue;
+        ok = pad_to(fp, &position, header.sections[i].offset) &&
+             fwrite(data[i], 1, (size_t)sizes[i], fp) == sizes[i];
+        position += sizes[i];
     }
 
-    // 3. 寫入行號信息
-    if (header.lines_size > 0) {
-        if (fwrite(chunk->lines, 1, header.lines_size, fp) != header.lines_size) {
-            fclose(fp);
-            return -1;
-        }
+    if (fp && kcache_replace(fp, temp_path, filename, ok) != 0) ok = false;
+    free(string_offsets);
+    free(strings);
+    free(owned_functions);
+    return ok ? 0 : -1;
+}
+
+#ifdef _WIN32
+static void release_image(void* image, size_t size) {
+    (void)size;
+    free(image);
+}
+
+/** @brief 沒有 mmap 時把整個文件讀入一塊內存 */
+static void* map_file(const char* filename, size_t* size) {
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) return NULL;
+    fseek(fp, 0L, SEEK_END);
+    long file_size = ftell(fp);
+    rewind(fp);
+    void* image = file_size > 0 ? malloc((size_t)file_size) : NULL;
+    if (image && fread(image, 1, (size_t)file_size, fp) != (size_t)file_size) {
+        free(image);
+        image = NULL;
     }
+    fclose(fp);
+    *size = image ? (size_t)file_size : 0;
+    return image;
+}
+#else
+static void release_image(void* image, size_t size) {
+    munmap(image, size);
+}
 
-    // 4. 寫入字符串常量池
-    for (size_t i = 0; i < chunk->string_count; i++) {
-        if (write_string(fp, chunk->string_table[i]) != 0) {
-            fclose(fp);
-            return -1;
-        }
+/** @brief 只讀映射整個文件，映射在關閉文件描述符後仍然有效 */
+static void* map_file(const char* filename, size_t* size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat sb;
+    void* image = NULL;
+    if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+        image = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (image == MAP_FAILED) image = NULL;
     }
+    close(fd);
+    *size = image ? (size_t)sb.st_size : 0;
+    return image;
+}
+#endif
 
-    fclose(fp);
-    return 0;
+/** @brief 段在文件範圍內、按頁對齊且大小是 element_size 的整數倍 */
+static bool section_valid(const KCacheHeader* header, KCacheSectionKind kind, size_t element_size) {
+    const KCacheSection* section = &header->sections[kind];
+    if (section->size == 0) return true;
+    return section->offset % KCACHE_PAGE_SIZE == 0 && section->offset >= sizeof(KCacheHeader) &&
+           section->offset <= header->file_size && section->size <= header->file_size - section->offset &&
+           section->size % element_size == 0;
 }
 
-int kcache_load(const char* filename, KBytecodeChunk* chunk, uint64_t source_timestamp, uint64_t source_size) {
+int kcache_load(const char* filename, KBytecodeChunk* chunk, uint64_t source_hash, uint64_t source_size) {
     if (!filename || !chunk) return -1;
 
-    FILE* fp = fopen(filename, "rb");
-    if (!fp) return -1; // 文件不存在或無法讀取
+    size_t image_size = 0;
+    uint8_t* image = (uint8_t*)map_file(filename, &image_size);
+    if (!image) return -1; // 文件不存在或無法讀取
 
-    KCacheHeader header;
-    if (fread(&header, sizeof(header), 1, fp) != 1) {
-        fclose(fp);
-        return -1;
-    }
+    const KCacheHeader* header = (const KCacheHeader*)image;
+    static const size_t element_sizes[KCACHE_SECTION_COUNT] = {
+        1, 1, sizeof(uint32_t), 1, sizeof(int64_t), sizeof(double), sizeof(KFunctionInfo)
+    };
 
-    // 驗證魔數和版本
-    if (header.magic != KCACHE_MAGIC || header.version != KCACHE_VERSION) {
-        fclose(fp);
-        return 1; /**< 格式無效或版本不匹配 */
+    // 驗證格式、編譯器指紋與源碼 (source_hash 與 source_size 均為 0 時不校驗源碼)
+    bool source_checked = source_hash != 0 || source_size != 0;
+    bool valid = image_size >= sizeof(KCacheHeader) && header->magic == KCACHE_MAGIC &&
+                 header->version == KCACHE_VERSION && header->fingerprint == kcache_fingerprint() &&
+                 header->file_size == image_size &&
+                 (!source_checked || (header->source_hash == source_hash && header->source_size == source_size));
+    for (int i = 0; valid && i < KCACHE_SECTION_COUNT; i++) {
+        valid = section_valid(header, (KCacheSectionKind)i, element_sizes[i]);
     }
-
-    // 驗證源文件一致性 (如果提供了 timestamp/size)
-    if (source_timestamp != 0 && header.timestamp != source_timestamp) {
-        fclose(fp);
-        return 1; /**< 緩存過期 */
-    }
-    if (source_size != 0 && header.source_size != source_size) {
-        fclose(fp);
-        return 1; /**< 緩存過期 */
+    if (!valid) {
+        release_image(image, image_size);
+        return 1; /**< 格式無效、版本不匹配或緩存過期 */
     }
 
-    // 開始加載數據
-    // 確保 chunk 已初始化（通常調用者已調用 init_chunk）
-    // 我們需要根據 header 分配內存
+    const KCacheSection* sections = header->sections;
+    size_t code_size = (size_t)sections[KCACHE_SECTION_CODE].size;
+    size_t lines_size = (size_t)sections[KCACHE_SECTION_LINES].size;
+    size_t string_count = (size_t)(sections[KCACHE_SECTION_STRING_OFFSETS].size / sizeof(uint32_t));
+    size_t strings_size = (size_t)sections[KCACHE_SECTION_STRINGS].size;
+    const uint32_t* string_offsets = (const uint32_t*)(image + sections[KCACHE_SECTION_STRING_OFFSETS].offset);
+    const char* strings = (const char*)(image + sections[KCACHE_SECTION_STRINGS].offset);
+    const KFunctionInfo* functions = (const KFunctionInfo*)(image + sections[KCACHE_SECTION_FUNCTIONS].offset);
+    size_t function_count = (size_t)(sections[KCACHE_SECTION_FUNCTIONS].size / sizeof(KFunctionInfo));
 
-    // 1. 加載字節碼
-    if (header.code_size > 0) {
-        chunk->capacity = header.code_size; /**< 精確分配 */
-        chunk->count = header.code_size;
-        chunk->code = (uint8_t*)malloc(chunk->capacity);
-        if (!chunk->code) { fclose(fp); return -1; }
-        
-        if (fread(chunk->code, 1, header.code_size, fp) != header.code_size) {
-            free(chunk->code);
-            fclose(fp);
-            return -1;
-        }
+    // 字符串區以 '\0' 結尾，保證每個偏移處都是完整的字符串 (行號表的查詢自帶越界檢查)
+    valid = (string_count == 0 || (strings_size > 0 && strings[strings_size - 1] == '\0'));
+    for (size_t i = 0; valid && i < string_count; i++) {
+        valid = string_offsets[i] < strings_size;
     }
-
-    // 2. 加載行號
-    if (header.lines_size > 0) {
-        // lines 數組的元素個數應該等於 code count
-        size_t lines_count = header.lines_size / sizeof(int);
-        if (lines_count != chunk->count) {
-             // 簡單校驗：lines 大小應該匹配
-        }
-        
-        chunk->lines = (int*)malloc(header.lines_size);
-        if (!chunk->lines) {
-            // 清理已分配的 code
-            if (chunk->code) free(chunk->code);
-            fclose(fp);
-            return -1;
-        }
-
-        if (fread(chunk->lines, 1, header.lines_size, fp) != header.lines_size) {
-            free(chunk->code);
-            free(chunk->lines);
-            fclose(fp);
-            return -1;
-        }
+    for (size_t i = 0; valid && i < function_count; i++) {
+        valid = functions[i].name < string_count && functions[i].insn < code_size && functions[i].entry <= functions[i].insn;
     }
 
-    // 3. 加載字符串常量池
-    if (header.string_count > 0) {
-        chunk->string_count = header.string_count;
-        chunk->string_table = (char**)malloc(header.string_count * sizeof(char*));
-        if (!chunk->string_table) {
-            if (chunk->code) free(chunk->code);
-            if (chunk->lines) free(chunk->lines);
-            fclose(fp);
+    char** string_table = NULL;
+    if (valid && string_count > 0) {
+        string_table = (char**)malloc(string_count * sizeof(char*));
+        if (!string_table) {
+            release_image(image, image_size);
             return -1;
         }
-
-        for (uint32_t i = 0; i < header.string_count; i++) {
-            char* str = read_string(fp);
-            if (!str) {
-                // 加載失敗，需要清理
-                for (uint32_t j = 0; j < i; j++) free(chunk->string_table[j]);
-                free(chunk->string_table);
-                if (chunk->code) free(chunk->code);
-                if (chunk->lines) free(chunk->lines);
-                fclose(fp);
-                return -1;
-            }
-            chunk->string_table[i] = str;
+        for (size_t i = 0; i < string_count; i++) {
+            string_table[i] = (char*)(strings + string_offsets[i]);
         }
     }
+    if (!valid) {
+        release_image(image, image_size);
+        return 1;
+    }
 
-    fclose(fp);
+    // 映像只讀，塊中的數據在運行時不會被修改
+    chunk->code = code_size > 0 ? image + sections[KCACHE_SECTION_CODE].offset : NULL;
+    chunk->count = chunk->capacity = code_size;
+    chunk->lines.data = lines_size > 0 ? image + sections[KCACHE_SECTION_LINES].offset : NULL;
+    chunk->lines.size = lines_size;
+    chunk->string_table = string_table;
+    chunk->string_count = string_count;
+    chunk->int_count = (size_t)(sections[KCACHE_SECTION_INTS].size / sizeof(int64_t));
+    chunk->int_constants = chunk->int_count > 0 ? (int64_t*)(image + sections[KCACHE_SECTION_INTS].offset) : NULL;
+    chunk->double_count = (size_t)(sections[KCACHE_SECTION_DOUBLES].size / sizeof(double));
+    chunk->double_constants = chunk->double_count > 0 ? (double*)(image + sections[KCACHE_SECTION_DOUBLES].offset) : NULL;
+    chunk->functions = function_count > 0 ? functions : NULL;
+    chunk->function_count = function_count;
+    chunk->image = image;
+    chunk->image_size = image_size;
+    chunk->image_release = release_image;
     return 0; // 成功
 }
@@ -3,47 +3,107 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include "kcode.h"
 
 /** @brief 緩存文件魔數 "KORE" */
 #define KCACHE_MAGIC 0x45524F4B
 /** @brief 緩存版本號 */
-#define KCACHE_VERSION 1
+#define KCACHE_VERSION 6
+/** @brief 段對齊 (文件格式常量，與運行平台的頁大小無關) */
+#define KCACHE_PAGE_SIZE 4096
+
+/** @brief 緩存文件中的段 */
+typedef enum {
+    KCACHE_SECTION_CODE,           /**< 字節碼 */
+    KCACHE_SECTION_LINES,          /**< 行號表 (KLineTable 的編碼數據) */
+    KCACHE_SECTION_STRING_OFFSETS, /**< 每個字符串在字符串區中的偏移 (uint32_t) */
+    KCACHE_SECTION_STRINGS,        /**< 以 '\0' 結尾依次排列的字符串 */
+    KCACHE_SECTION_INTS,           /**< 整數常量 (int64_t) */
+    KCACHE_SECTION_DOUBLES,        /**< 浮點常量 (double) */
+    KCACHE_SECTION_FUNCTIONS,      /**< 函數表 (KFunctionInfo) */
+    KCACHE_SECTION_COUNT
+} KCacheSectionKind;
+
+/** @brief 段位置，偏移相對文件開頭 */
+typedef struct {
+    uint64_t offset;
+    uint64_t size;  /**< 字節數 */
+} KCacheSection;
 
 /**
  * @brief 緩存文件頭部結構
+ * 頭部之後每個段都從 KCACHE_PAGE_SIZE 的整數倍偏移開始，段內只有偏移沒有指針，
+ * 加載時把整個文件只讀映射，KBytecodeChunk 直接指向映射中的各段。
  */
 typedef struct {
     uint32_t magic;         /**< 文件標識 */
     uint32_t version;       /**< 版本號 */
-    uint64_t timestamp;     /**< 源文件最後修改時間戳 */
-    uint64_t source_size;   /**< 源文件大小（用於簡單校驗） */
-    
-    uint32_t code_size;     /**< 字節碼大小 (bytes) */
-    uint32_t string_count;  /**< 字符串常量數量 */
-    uint32_t lines_size;    /**< 行號表大小 (bytes) */
-    
-    uint32_t reserved[4];   /**< 保留字段 */
+    uint64_t fingerprint;   /**< 編譯器指紋 (kcache_fingerprint) */
+    uint64_t source_hash;   /**< 源碼內容哈希 (kcache_hash) */
+    uint64_t source_size;   /**< 源碼字節數 */
+    uint64_t file_size;     /**< 文件總字節數 */
+    KCacheSection sections[KCACHE_SECTION_COUNT];
 } KCacheHeader;
 
+/** @brief 64 位 FNV-1a 哈希，用於校驗源碼內容 */
+uint64_t kcache_hash(const void* data, size_t size);
+
+/**
+ * @brief 編譯器指紋
+ * 由 SDK 版本、KCACHE_VERSION、KCODE_VERSION、操作碼長度表、段佈局 (段數、元素大小與
+ * KFunctionInfo 的字段位置) 和行號表的編碼結果計算，任何一項改變時舊緩存都會被視為過期。
+ */
+uint64_t kcache_fingerprint(void);
+
+/**
+ * @brief 源文件對應的緩存文件路徑 (source.kri -> source.kri.kc)
+ * @return 新分配的字符串，由調用者 free
+ */
+char* kcache_path(const char* source_path);
+
+/**
+ * @brief 在 filename 所在目錄創建臨時文件 (<filename>.<pid>.tmp)，用於原子替換
+ * @param filename 最終文件名
+ * @param temp_path 輸出：臨時文件路徑，由 kcache_replace 釋放
+ * @return 以 "wb" 打開的臨時文件，失敗返回 NULL
+ */
+FILE* kcache_create_temp(const char* filename, char** temp_path);
+
+/**
+ * @brief 關閉 kcache_create_temp 創建的臨時文件，寫入成功時刷到磁盤並重命名覆蓋 filename
+ * 舊文件不會被就地改寫：其他進程已映射的舊緩存在解除映射前保持完整，讀取者只會看到完整的舊文件或新文件。
+ * 失敗時刪除臨時文件，原文件保持不變。
+ * @param fp 臨時文件
+ * @param temp_path 臨時文件路徑 (釋放)
+ * @param filename 最終文件名
+ * @param ok 內容是否已完整寫入
+ * @return 0 成功, -1 失敗
+ */
+int kcache_replace(FILE* fp, char* temp_path, const char* filename, bool ok);
+
 /**
  * @brief 將字節碼塊保存到緩存文件
- * @param filename 輸出文件名 (通常是 source.k.kc)
+ * 先寫入同目錄的臨時文件再原子替換 (見 kcache_replace)，失敗時不留下不完整的文件。
+ * @param filename 輸出文件名 (通常由 kcache_path 得到)
  * @param chunk 編譯好的字節碼塊
- * @param source_timestamp 源文件時間戳
- * @param source_size 源文件大小
+ * @param source_hash 源碼內容哈希
+ * @param source_size 源碼字節數
  * @return 0 成功, 非0 失敗
  */
-int kcache_save(const char* filename, KBytecodeChunk* chunk, uint64_t source_timestamp, uint64_t source_size);
+int kcache_save(const char* filename, KBytecodeChunk* chunk, uint64_t source_hash, uint64_t source_size);
 
 /**
  * @brief 從緩存文件加載字節碼
+ * 格式、版本、編譯器指紋與源碼都匹配時才加載；失敗時 chunk 保持初始狀態。
+ * 文件被只讀映射 (不支持 mmap 的平台整體讀入一塊內存)，除 string_table 指針數組外不再逐項分配，
+ * 映射的頁可以在多個進程間共享。
  * @param filename 緩存文件名
  * @param chunk 用於存儲加載數據的塊（需要預先 init_chunk）
- * @param source_timestamp 源文件當前時間戳（用於校驗）
- * @param source_size 源文件當前大小（用於校驗）
+ * @param source_hash 源碼當前哈希，與 source_size 均為 0 時不校驗源碼 (直接加載 .kc 文件)
+ * @param source_size 源碼當前字節數
  * @return 0 成功, 1 緩存無效/過期, -1 讀取錯誤
  */
-int kcache_load(const char* filename, KBytecodeChunk* chunk, uint64_t source_timestamp, uint64_t source_size);
+int kcache_load(const char* filename, KBytecodeChunk* chunk, uint64_t source_hash, uint64_t source_size);
 
 #endif //KORELIN_KCACHE_H
@@ -1,17 +1,29 @@
 #include "kcode.h"
+#include "comeonjit.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "kconst.h" 
+#include "kopt.h"
 
 /**
  * @brief 內部結構定義
  */
 
+/** @brief 標量替換的對象：不創建實例，每個字段佔用一個寄存器 */
+typedef struct {
+    char** fields;      /**< 借用語法樹中的名字 */
+    int* regs;
+    size_t field_count;
+} ScalarObject;
+
 typedef struct {
     char* name;
     int depth;
     int reg_index;
+    bool released;  /**< 已過最後一次使用，寄存器已歸還 */
+    KStaticType type; /**< 推斷出的靜態類型 */
+    ScalarObject* scalar; /**< 標量替換的對象，普通變量為 NULL */
 } Local;
 
 typedef struct {
@@ -25,17 +37,92 @@ typedef struct {
     int scope_depth;
 } LoopState;
 
+/** @brief 提到循環外的讀取所處的階段 */
+typedef enum {
+    HOIST_GUARD,     /**< 在循環入口的首次條件判斷中讀取 */
+    HOIST_PREHEADER, /**< 在進入循環體之前讀取 */
+    HOIST_READY,     /**< 寄存器中已有值 */
+    HOIST_DEAD       /**< 首次條件判斷沒有讀取它，放棄 */
+} HoistState;
+
+/** @brief 提到循環外的全局變量或字段讀取 */
+typedef struct {
+    const char* name;  /**< 全局名字或字段名 */
+    int object;        /**< 字段所屬局部變量在 locals 中的下標，全局名字為 -1 */
+    int reg;           /**< 整個循環期間保存讀取結果 */
+    HoistState state;
+} HoistedLoad;
+
+/** @brief 已證明在界內的 `數組[下標]`，數組與下標都是局部變量 */
+typedef struct {
+    int array;  /**< 數組變量在 locals 中的下標 */
+    int index;  /**< 下標變量在 locals 中的下標 */
+} SafeIndex;
+
+/** @brief 正在內聯展開的函數體：return 寫入結果寄存器後跳到展開結束處 */
+typedef struct {
+    int result_reg;
+    int* exits;            /**< 待回填的 JMP 偏移 */
+    int exit_count;
+    int exit_capacity;
+} InlineFrame;
+
+/**
+ * @brief 常量池哈希索引
+ * 開放定址表，槽位存放常量下標 + 1 (0 表示空槽)，負載不超過 3/4。
+ */
+typedef struct {
+    int* slots;
+    size_t slot_count; /**< 槽位數，2 的冪 */
+    size_t capacity;   /**< 對應常量數組已分配的元素數 */
+} ConstIndex;
+
+/** @brief 常量池類別 */
+typedef enum {
+    POOL_STRING,
+    POOL_INT,
+    POOL_DOUBLE
+} PoolKind;
+
 typedef struct {
     KBytecodeChunk* chunk;
+    ConstIndex pools[3];   /**< 按 PoolKind 索引，整個模塊的編譯共用 */
+    KTypeEnv* types;       /**< 當前函數 (或頂層代碼) 的局部變量類型 */
     Local locals[256];
     int local_count;
     int scope_depth;
-    int current_reg_count;
-    char* current_class_name;
+    uint8_t reg_live[256]; /**< 寄存器佔用標記 (局部變量或臨時值) */
+    int reg_peak;          /**< 當前函數用到的寄存器數量峰值 (即幀大小) */
+    const char* current_class_name;
     LoopState loops[16];
     int loop_depth;
+    KInlineSet inlines;         /**< 可內聯的函數 */
+    InlineFrame* inline_frame;  /**< 當前展開的函數體，不在展開中時為 NULL */
+    int inline_depth;
+    int local_base;             /**< 名字解析只查找此下標之後的局部變量 (內聯函數體看不到調用者的局部變量) */
+    KGlobalSet globals;         /**< 綁定後不再改變的全局名字 */
+    KScalarClassSet scalar_classes; /**< 實例可以標量替換的類 */
+    HoistedLoad hoisted[64];    /**< 提到循環外的讀取，按循環嵌套入棧 */
+    int hoisted_count;
+    int hoist_base;             /**< 當前函數的第一條，外層函數的寄存器在函數體中無效 */
+    bool hoist_guard;           /**< 正在生成循環入口的首次條件判斷 */
+    SafeIndex safe_indices[16]; /**< 已證明在界內的數組訪問，按循環嵌套入棧 */
+    int safe_index_count;
+    int safe_index_base;        /**< 當前函數的第一條，局部變量下標在函數之間不通用 */
+    bool array_builtins;        /**< 數組方法調用可以生成 KOP_APUSH 等指令 (見 kopt_array_methods_builtin) */
+    int line;                   /**< 當前語句的源碼行號，寫入行號表 */
 } CompilerState;
 
+/**
+ * @brief 進入函數體前保存的寄存器分配狀態
+ */
+typedef struct {
+    uint8_t reg_live[256];
+    int reg_peak;
+    int hoist_base;
+    int safe_index_base;
+} RegisterSnapshot;
+
 /**
  * @brief 前向聲明
  */
@@ -43,6 +130,8 @@ typedef struct {
 static void compile_statement(CompilerState* compiler, KastStatement* stmt);
 static void compile_expression(CompilerState* compiler, KastExpression* expr, int target_reg);
 static int add_string_constant(CompilerState* compiler, const char* str);
+static int add_int_constant(CompilerState* compiler, int64_t value);
+static int add_double_constant(CompilerState* compiler, double value);
 static void patch_jump(CompilerState* compiler, int offset, int target);
 
 /**
@@ -55,50 +144,357 @@ void init_chunk(KBytecodeChunk* chunk) {
     chunk->code = NULL;
     chunk->string_table = NULL;
     chunk->string_count = 0;
-    chunk->lines = NULL;
+    chunk->int_constants = NULL;
+    chunk->int_count = 0;
+    chunk->double_constants = NULL;
+    chunk->double_count = 0;
+    memset(&chunk->lines, 0, sizeof(chunk->lines));
+    chunk->jit_code = NULL;
+    chunk->jit_block = NULL;
+    chunk->jit = NULL;
+    chunk->jit_active = 0;
+    chunk->lazy_bodies = NULL;
+    chunk->lazy_body_count = 0;
+    chunk->jit_entries = NULL;
+    chunk->field_cache = NULL;
+    chunk->field_cache_count = 0;
+    chunk->filename = NULL;
+    chunk->functions = NULL;
+    chunk->function_count = 0;
+    chunk->image = NULL;
+    chunk->image_size = 0;
+    chunk->image_release = NULL;
 }
 
 void free_chunk(KBytecodeChunk* chunk) {
-    free(chunk->code);
-    free(chunk->lines);
-    for (size_t i = 0; i < chunk->string_count; i++) {
-        free(chunk->string_table[i]);
+    // 機器碼塊記錄著所屬字節碼塊，必須先歸還，否則驅逐時會寫入已釋放的內存
+    if (chunk->jit) jit_release_chunk(chunk->jit, chunk);
+    if (chunk->image) {
+        chunk->image_release(chunk->image, chunk->image_size);
+    } else {
+        free(chunk->code);
+        free(chunk->lines.data);
+        for (size_t i = 0; i < chunk->string_count; i++) {
+            free(chunk->string_table[i]);
+        }
+        free(chunk->int_constants);
+        free(chunk->double_constants);
+        free((void*)chunk->functions);
     }
     free(chunk->string_table);
+    free(chunk->lazy_bodies);
+    free(chunk->jit_entries);
+    free(chunk->field_cache);
+    free(chunk->filename);
     init_chunk(chunk);
 }
 
+KFieldCache* chunk_field_cache(KBytecodeChunk* chunk) {
+    if (!chunk->field_cache) {
+        size_t count = chunk->string_count > 0 ? chunk->string_count : 1;
+        chunk->field_cache = (KFieldCache*)calloc(count, sizeof(KFieldCache));
+        if (chunk->field_cache) chunk->field_cache_count = chunk->string_count;
+    }
+    return chunk->field_cache;
+}
+
+KFunctionInfo* build_function_table(const KBytecodeChunk* chunk, size_t* count) {
+    KFunctionInfo* table = NULL;
+    size_t capacity = 0;
+    *count = 0;
+
+    size_t offset = 0;
+    while (offset < chunk->count) {
+        const uint8_t* insn = chunk->code + offset;
+        int length = opcode_length(insn[0]);
+        if (length <= 0 || offset + (size_t)length > chunk->count) break;
+
+        if (insn[0] == KOP_FUNCTION) {
+            if (*count == capacity) {
+                capacity = capacity < 8 ? 8 : capacity * 2;
+                KFunctionInfo* grown = (KFunctionInfo*)realloc(table, capacity * sizeof(KFunctionInfo));
+                if (!grown) {
+                    free(table);
+                    *count = 0;
+                    return NULL;
+                }
+                table = grown;
+            }
+            // FUNCTION NameIdx16, Entry24, Arity8, Access8, FrameSize16 (大端序)
+            KFunctionInfo* info = &table[(*count)++];
+            info->name = (uint32_t)((insn[1] << 8) | insn[2]);
+            info->insn = (uint32_t)offset;
+            info->entry = (uint32_t)((insn[3] << 16) | (insn[4] << 8) | insn[5]);
+            info->arity = insn[6];
+        }
+        offset += (size_t)length;
+    }
+    return table;
+}
+
+/** @brief 追加一個 LEB128 無符號變長整數 */
+static void line_table_write(KLineTable* table, uint64_t value) {
+    if (table->capacity < table->size + 10) {
+        table->capacity = table->capacity < 16 ? 16 : table->capacity * 2;
+        uint8_t* new_data = (uint8_t*)realloc(table->data, table->capacity);
+        if (!new_data) {
+            printf("FATAL: Out of memory in line_table_add\n");
+            exit(1);
+        }
+        table->data = new_data;
+    }
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        table->data[table->size++] = value ? (byte | 0x80) : byte;
+    } while (value);
+}
+
+/** @brief 讀取一個 LEB128 無符號變長整數，越界或過長時返回 false */
+static bool line_table_read(const KLineTable* table, size_t* pos, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*pos >= table->size) return false;
+        uint8_t byte = table->data[(*pos)++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void line_table_add(KLineTable* table, size_t offset, int line) {
+    if (line == table->last_line) return;
+    int64_t delta = (int64_t)line - table->last_line;
+    line_table_write(table, offset - table->last_offset);
+    line_table_write(table, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63)); // zigzag
+    table->last_offset = offset;
+    table->last_line = line;
+}
+
+int line_table_lookup(const KLineTable* table, size_t offset) {
+    size_t pos = 0, current = 0;
+    int line = 0;
+    uint64_t offset_delta, line_delta;
+    while (line_table_read(table, &pos, &offset_delta) && line_table_read(table, &pos, &line_delta)) {
+        current += offset_delta;
+        if (current > offset) break;
+        line += (int)((int64_t)(line_delta >> 1) ^ -(int64_t)(line_delta & 1));
+    }
+    return line;
+}
+
+int* line_table_expand(const KLineTable* table, size_t count) {
+    int* lines = (int*)malloc((count + 1) * sizeof(int));
+    if (!lines) return NULL;
+    size_t pos = 0, current = 0, filled = 0;
+    int line = 0;
+    uint64_t offset_delta, line_delta;
+    while (line_table_read(table, &pos, &offset_delta) && line_table_read(table, &pos, &line_delta)) {
+        current += offset_delta;
+        for (; filled < current && filled < count; filled++) lines[filled] = line;
+        line += (int)((int64_t)(line_delta >> 1) ^ -(int64_t)(line_delta & 1));
+    }
+    for (; filled < count; filled++) lines[filled] = line;
+    return lines;
+}
+
+void line_table_reset(KLineTable* table) {
+    table->size = 0;
+    table->last_offset = 0;
+    table->last_line = 0;
+}
+
 void write_chunk(KBytecodeChunk* chunk, uint8_t byte, int line) {
     if (chunk->capacity < chunk->count + 1) {
         chunk->capacity = chunk->capacity < 8 ? 8 : chunk->capacity * 2;
         uint8_t* new_code = (uint8_t*)realloc(chunk->code, chunk->capacity);
-        int* new_lines = (int*)realloc(chunk->lines, chunk->capacity * sizeof(int));
-        if (!new_code || !new_lines) {
+        if (!new_code) {
             printf("FATAL: Out of memory in write_chunk\n");
             exit(1);
         }
         chunk->code = new_code;
-        chunk->lines = new_lines;
     }
+    line_table_add(&chunk->lines, chunk->count, line);
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
 }
 
-static int add_string_constant(CompilerState* compiler, const char* str) {
-    for (size_t i = 0; i < compiler->chunk->string_count; i++) {
-        if (strcmp(compiler->chunk->string_table[i], str) == 0) {
-            return (int)i;
-        }
+int opcode_length(uint8_t opcode) {
+    switch (opcode) {
+        case KOP_ENDTRY:
+            return 1;
+        case KOP_THROW: case KOP_GETEXCEPTION:
+            return 2;
+        case KOP_NEW: case KOP_NEWA: case KOP_GETF: case KOP_PUTF:
+        case KOP_METHOD: case KOP_INHERIT: case KOP_FIELD: case KOP_AINSERT:
+            return 5;
+        case KOP_INVOKE: case KOP_JTAB: case KOP_FORLOOP: case KOP_GETAF: case KOP_PUTAF:
+            return 6;
+        case KOP_GETSUPER:
+            return 7;
+        case KOP_FUNCTION:
+            return 10;
+        case KOP_ADD: case KOP_SUB: case KOP_MUL: case KOP_DIV: case KOP_MOD: case KOP_NEG:
+        case KOP_EQ: case KOP_NE: case KOP_LT: case KOP_LE: case KOP_GT: case KOP_GE:
+        case KOP_ADDI: case KOP_LDI: case KOP_LDB: case KOP_MOVE:
+        case KOP_AND: case KOP_OR: case KOP_XOR: case KOP_NOT:
+        case KOP_FADD_D: case KOP_FSUB_D: case KOP_FMUL_D: case KOP_FDIV_D:
+        case KOP_FEQ_D: case KOP_FLT_D: case KOP_FLE_D:
+        case KOP_ADD_INT: case KOP_SUB_INT: case KOP_MUL_INT:
+        case KOP_LT_INT: case KOP_LE_INT: case KOP_EQ_INT:
+        case KOP_LOAD: case KOP_PUSH: case KOP_POP:
+        case KOP_JMP: case KOP_JZ: case KOP_JNZ: case KOP_CALL: case KOP_CALLR: case KOP_RET:
+        case KOP_JHASH:
+        case KOP_GET_GLOBAL: case KOP_SET_GLOBAL: case KOP_LDN: case KOP_INSTANCEOF:
+        case KOP_TRY: case KOP_LDC: case KOP_LDS: case KOP_LDI64: case KOP_LDCD:
+        case KOP_GETFA: case KOP_PUTFA: case KOP_GETFA_U: case KOP_PUTFA_U: case KOP_ARRAYLEN: case KOP_CLASS:
+        case KOP_APUSH: case KOP_APOP: case KOP_AREMOVE:
+        case KOP_IMPORT: case KOP_SYSCALL: case KOP_HALT: case KOP_DEBUG:
+            return 4;
+        default:
+            return 0;
     }
-    
-    compiler->chunk->string_count++;
-    compiler->chunk->string_table = (char**)realloc(compiler->chunk->string_table, 
-                                                    compiler->chunk->string_count * sizeof(char*));
-    compiler->chunk->string_table[compiler->chunk->string_count - 1] = strdup(str);
-    return (int)compiler->chunk->string_count - 1;
 }
 
+int switch_slot_count(const uint8_t* insn) {
+    switch (insn[0]) {
+        case KOP_JTAB: return ((insn[4] << 8) | insn[5]) + 1;
+        case KOP_JHASH: return ((insn[2] << 8) | insn[3]) + 1;
+        default: return 0;
+    }
+}
+
+uint32_t switch_hash(const char* str) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; str[i]; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/** @brief FNV-1a 哈希 */
+static uint64_t hash_bytes(const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static size_t pool_count(KBytecodeChunk* chunk, PoolKind kind) {
+    switch (kind) {
+        case POOL_STRING: return chunk->string_count;
+        case POOL_INT: return chunk->int_count;
+        default: return chunk->double_count;
+    }
+}
+
+/** @brief 池中第 i 個常量的哈希；浮點數按位比較，0.0 與 -0.0 是不同常量 */
+static uint64_t pool_entry_hash(KBytecodeChunk* chunk, PoolKind kind, size_t i) {
+    switch (kind) {
+        case POOL_STRING: return hash_bytes(chunk->string_table[i], strlen(chunk->string_table[i]));
+        case POOL_INT: return hash_bytes(&chunk->int_constants[i], sizeof(int64_t));
+        default: return hash_bytes(&chunk->double_constants[i], sizeof(double));
+    }
+}
+
+static bool pool_entry_equals(KBytecodeChunk* chunk, PoolKind kind, size_t i, const void* key) {
+    switch (kind) {
+        case POOL_STRING: return strcmp(chunk->string_table[i], (const char*)key) == 0;
+        case POOL_INT: return chunk->int_constants[i] == *(const int64_t*)key;
+        default: return memcmp(&chunk->double_constants[i], key, sizeof(double)) == 0;
+    }
+}
+
+/** @brief 擴大槽位表並重新插入已有常量 */
+static void pool_rehash(CompilerState* compiler, PoolKind kind) {
+    ConstIndex* index = &compiler->pools[kind];
+    size_t slot_count = index->slot_count < 64 ? 64 : index->slot_count * 2;
+    int* slots = (int*)calloc(slot_count, sizeof(int));
+    if (!slots) {
+        printf("FATAL: Out of memory in constant pool\n");
+        exit(1);
+    }
+    size_t count = pool_count(compiler->chunk, kind);
+    for (size_t i = 0; i < count; i++) {
+        size_t slot = (size_t)pool_entry_hash(compiler->chunk, kind, i) & (slot_count - 1);
+        while (slots[slot] != 0) slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = (int)i + 1;
+    }
+    free(index->slots);
+    index->slots = slots;
+    index->slot_count = slot_count;
+}
+
+/** @brief 按需倍增常量數組 */
+static void* pool_grow(void* array, ConstIndex* index, size_t count, size_t elem_size) {
+    if (count < index->capacity) return array;
+    index->capacity = index->capacity < 16 ? 16 : index->capacity * 2;
+    if (index->capacity <= count) index->capacity = count * 2; // 塊中已有常量
+    void* grown = realloc(array, index->capacity * elem_size);
+    if (!grown) {
+        printf("FATAL: Out of memory in constant pool\n");
+        exit(1);
+    }
+    return grown;
+}
+
+/**
+ * @brief 在常量池中查找常量，不存在時追加
+ * @return 常量下標；超出 16 位索引範圍時報錯並返回 0
+ */
+static int pool_intern(CompilerState* compiler, PoolKind kind, const void* key, uint64_t hash) {
+    KBytecodeChunk* chunk = compiler->chunk;
+    ConstIndex* index = &compiler->pools[kind];
+    size_t count = pool_count(chunk, kind);
+    if ((count + 1) * 4 > index->slot_count * 3) pool_rehash(compiler, kind);
+
+    size_t mask = index->slot_count - 1;
+    size_t slot = (size_t)hash & mask;
+    while (index->slots[slot] != 0) {
+        size_t i = (size_t)index->slots[slot] - 1;
+        if (pool_entry_equals(chunk, kind, i, key)) return (int)i;
+        slot = (slot + 1) & mask;
+    }
+
+    if (count > UINT16_MAX) {
+        printf("Compile Error: Too many constants\n");
+        return 0;
+    }
+    switch (kind) {
+        case POOL_STRING:
+            chunk->string_table = (char**)pool_grow(chunk->string_table, index, count, sizeof(char*));
+            chunk->string_table[chunk->string_count++] = strdup((const char*)key);
+            break;
+        case POOL_INT:
+            chunk->int_constants = (int64_t*)pool_grow(chunk->int_constants, index, count, sizeof(int64_t));
+            chunk->int_constants[chunk->int_count++] = *(const int64_t*)key;
+            break;
+        case POOL_DOUBLE:
+            chunk->double_constants = (double*)pool_grow(chunk->double_constants, index, count, sizeof(double));
+            chunk->double_constants[chunk->double_count++] = *(const double*)key;
+            break;
+    }
+    index->slots[slot] = (int)count + 1;
+    return (int)count;
+}
+
+static int add_string_constant(CompilerState* compiler, const char* str) {
+    return pool_intern(compiler, POOL_STRING, str, hash_bytes(str, strlen(str)));
+}
+
+static int add_int_constant(CompilerState* compiler, int64_t value) {
+    return pool_intern(compiler, POOL_INT, &value, hash_bytes(&value, sizeof(value)));
+}
+
+static int add_double_constant(CompilerState* compiler, double value) {
+    return pool_intern(compiler, POOL_DOUBLE, &value, hash_bytes(&value, sizeof(value)));
+}
+
+
 static void patch_jump(CompilerState* compiler, int offset, int target) {
     int jump = target - offset - 2;
     if (jump > UINT16_MAX) {
@@ -110,11 +506,27 @@ static void patch_jump(CompilerState* compiler, int offset, int target) {
 
 static void init_compiler(CompilerState* compiler, KBytecodeChunk* chunk) {
     compiler->chunk = chunk;
+    memset(compiler->pools, 0, sizeof(compiler->pools));
+    compiler->types = NULL;
     compiler->local_count = 0;
     compiler->scope_depth = 0;
-    compiler->current_reg_count = 0;
+    memset(compiler->reg_live, 0, sizeof(compiler->reg_live));
+    compiler->reg_peak = 0;
     compiler->current_class_name = NULL;
     compiler->loop_depth = 0;
+    memset(&compiler->inlines, 0, sizeof(compiler->inlines));
+    compiler->inline_frame = NULL;
+    compiler->inline_depth = 0;
+    compiler->local_base = 0;
+    memset(&compiler->globals, 0, sizeof(compiler->globals));
+    memset(&compiler->scalar_classes, 0, sizeof(compiler->scalar_classes));
+    compiler->hoisted_count = 0;
+    compiler->hoist_base = 0;
+    compiler->hoist_guard = false;
+    compiler->safe_index_count = 0;
+    compiler->safe_index_base = 0;
+    compiler->array_builtins = false;
+    compiler->line = 0;
 }
 
 static void enter_loop(CompilerState* compiler, int continue_target) {
@@ -143,86 +555,955 @@ static void exit_loop(CompilerState* compiler) {
     if (loop->continue_jumps) free(loop->continue_jumps);
 }
 
-static void add_break(CompilerState* compiler, int jump_offset) {
-    if (compiler->loop_depth == 0) return;
-    LoopState* loop = &compiler->loops[compiler->loop_depth - 1];
-    
-    if (loop->break_count >= loop->break_capacity) {
-        loop->break_capacity = loop->break_capacity < 8 ? 8 : loop->break_capacity * 2;
-        loop->break_jumps = (int*)realloc(loop->break_jumps, loop->break_capacity * sizeof(int));
+static void add_break(CompilerState* compiler, int jump_offset) {
+    if (compiler->loop_depth == 0) return;
+    LoopState* loop = &compiler->loops[compiler->loop_depth - 1];
+    
+    if (loop->break_count >= loop->break_capacity) {
+        loop->break_capacity = loop->break_capacity < 8 ? 8 : loop->break_capacity * 2;
+        loop->break_jumps = (int*)realloc(loop->break_jumps, loop->break_capacity * sizeof(int));
+    }
+    loop->break_jumps[loop->break_count++] = jump_offset;
+}
+
+static void add_continue(CompilerState* compiler, int jump_offset) {
+    if (compiler->loop_depth == 0) return;
+    LoopState* loop = &compiler->loops[compiler->loop_depth - 1];
+    
+    if (loop->continue_target != -1) {
+        patch_jump(compiler, jump_offset, loop->continue_target);
+        return;
+    }
+    
+    if (loop->continue_count >= loop->continue_capacity) {
+        loop->continue_capacity = loop->continue_capacity < 8 ? 8 : loop->continue_capacity * 2;
+        loop->continue_jumps = (int*)realloc(loop->continue_jumps, loop->continue_capacity * sizeof(int));
+    }
+    loop->continue_jumps[loop->continue_count++] = jump_offset;
+}
+
+static void resolve_continue(CompilerState* compiler, int target) {
+    if (compiler->loop_depth == 0) return;
+    LoopState* loop = &compiler->loops[compiler->loop_depth - 1];
+    loop->continue_target = target;
+    for (int i = 0; i < loop->continue_count; i++) {
+        patch_jump(compiler, loop->continue_jumps[i], target);
+    }
+}
+
+// --- Emitters ---
+
+static void emit_byte(CompilerState* compiler, uint8_t byte) {
+    write_chunk(compiler->chunk, byte, compiler->line);
+}
+
+static void emit_instruction(CompilerState* compiler, uint8_t op, uint8_t r1, uint8_t r2, uint8_t r3) {
+    emit_byte(compiler, op);
+    emit_byte(compiler, r1);
+    emit_byte(compiler, r2);
+    emit_byte(compiler, r3);
+}
+
+static int emit_jump(CompilerState* compiler, uint8_t op, uint8_t r1) {
+    emit_byte(compiler, op);
+    emit_byte(compiler, r1);
+    emit_byte(compiler, 0); emit_byte(compiler, 0); // 16-bit offset placeholder
+    return compiler->chunk->count - 2;
+}
+
+/** @brief 加載整數：能放進 Imm8 的用 LDI，其餘放入整數常量池 */
+static void emit_load_int(CompilerState* compiler, int reg, long long value) {
+    if (value >= -128 && value <= 127) {
+        emit_byte(compiler, KOP_LDI);
+        emit_byte(compiler, reg);
+        emit_byte(compiler, (uint8_t)(int8_t)value);
+        emit_byte(compiler, 0); // Padding
+    } else {
+        int idx = add_int_constant(compiler, (int64_t)value);
+        emit_byte(compiler, KOP_LDI64);
+        emit_byte(compiler, reg);
+        emit_byte(compiler, (uint8_t)(idx >> 8));
+        emit_byte(compiler, (uint8_t)(idx & 0xFF));
+    }
+}
+
+// --- Registers ---
+
+/**
+ * @brief 分配編號最小的空閒寄存器
+ * 已死亡的局部變量與臨時值歸還的寄存器會被優先復用，峰值即函數的幀大小。
+ */
+static int alloc_reg(CompilerState* compiler) {
+    for (int i = 0; i < 256; i++) {
+        if (!compiler->reg_live[i]) {
+            compiler->reg_live[i] = 1;
+            if (i + 1 > compiler->reg_peak) compiler->reg_peak = i + 1;
+            return i;
+        }
+    }
+    printf("Too many registers in function\n");
+    return 255;
+}
+
+static void free_reg(CompilerState* compiler, int reg) {
+    if (reg >= 0 && reg < 256) compiler->reg_live[reg] = 0;
+}
+
+/** @brief 進入新函數：保存外層分配狀態，從空寄存器窗口開始 */
+static void enter_function_registers(CompilerState* compiler, RegisterSnapshot* saved) {
+    memcpy(saved->reg_live, compiler->reg_live, sizeof(saved->reg_live));
+    saved->reg_peak = compiler->reg_peak;
+    saved->hoist_base = compiler->hoist_base;
+    saved->safe_index_base = compiler->safe_index_base;
+    memset(compiler->reg_live, 0, sizeof(compiler->reg_live));
+    compiler->reg_peak = 0;
+    compiler->hoist_base = compiler->hoisted_count;
+    compiler->safe_index_base = compiler->safe_index_count;
+}
+
+/** @brief 離開函數：恢復外層分配狀態，返回該函數的幀大小 */
+static int exit_function_registers(CompilerState* compiler, const RegisterSnapshot* saved) {
+    int frame_size = compiler->reg_peak;
+    memcpy(compiler->reg_live, saved->reg_live, sizeof(compiler->reg_live));
+    compiler->reg_peak = saved->reg_peak;
+    compiler->hoist_base = saved->hoist_base;
+    compiler->safe_index_base = saved->safe_index_base;
+    return frame_size;
+}
+
+// --- Liveness ---
+
+static bool statement_uses_name(KastStatement* stmt, const char* name);
+
+/**
+ * @brief 節點是否引用了給定名字
+ * 保守判斷：同名遮蔽、賦值目標也算作引用；未知節點一律視為引用。
+ */
+static bool node_uses_name(KastNode* node, const char* name) {
+    if (!node) return false;
+    switch (node->type) {
+        case KAST_NODE_LITERAL:
+            return false;
+        case KAST_NODE_IDENTIFIER:
+            return strcmp(((KastIdentifier*)node)->name, name) == 0;
+        case KAST_NODE_BINARY_OP:
+            return node_uses_name(((KastBinaryOp*)node)->left, name) ||
+                   node_uses_name(((KastBinaryOp*)node)->right, name);
+        case KAST_NODE_UNARY_OP:
+            return node_uses_name(((KastUnaryOp*)node)->operand, name);
+        case KAST_NODE_POSTFIX_OP:
+            return node_uses_name(((KastPostfixOp*)node)->operand, name);
+        case KAST_NODE_ASSIGNMENT:
+            return node_uses_name(((KastAssignment*)node)->lvalue, name) ||
+                   node_uses_name(((KastAssignment*)node)->value, name);
+        case KAST_NODE_MEMBER_ACCESS:
+            return node_uses_name(((KastMemberAccess*)node)->object, name);
+        case KAST_NODE_SCOPE_ACCESS:
+            return strcmp(((KastScopeAccess*)node)->class_name, name) == 0;
+        case KAST_NODE_ARRAY_ACCESS:
+            return node_uses_name(((KastArrayAccess*)node)->array, name) ||
+                   node_uses_name(((KastArrayAccess*)node)->index, name);
+        case KAST_NODE_ARRAY_LITERAL: {
+            KastArrayLiteral* lit = (KastArrayLiteral*)node;
+            for (size_t i = 0; i < lit->element_count; i++) {
+                if (node_uses_name(lit->elements[i], name)) return true;
+            }
+            return false;
+        }
+        case KAST_NODE_CALL: {
+            KastCall* call = (KastCall*)node;
+            if (node_uses_name(call->callee, name)) return true;
+            for (size_t i = 0; i < call->arg_count; i++) {
+                if (node_uses_name(call->args[i], name)) return true;
+            }
+            return false;
+        }
+        case KAST_NODE_NEW: {
+            KastNew* n = (KastNew*)node;
+            for (size_t i = 0; i < n->arg_count; i++) {
+                if (node_uses_name(n->args[i], name)) return true;
+            }
+            return false;
+        }
+        case KAST_NODE_VAR_DECL:
+            return node_uses_name(((KastVarDecl*)node)->init_value, name);
+        case KAST_NODE_BLOCK: {
+            KastBlock* block = (KastBlock*)node;
+            for (size_t i = 0; i < block->statement_count; i++) {
+                if (statement_uses_name(block->statements[i], name)) return true;
+            }
+            return false;
+        }
+        case KAST_NODE_IF: {
+            KastIf* kif = (KastIf*)node;
+            return node_uses_name(kif->condition, name) ||
+                   statement_uses_name(kif->then_branch, name) ||
+                   statement_uses_name(kif->else_branch, name);
+        }
+        case KAST_NODE_WHILE:
+            return node_uses_name(((KastWhile*)node)->condition, name) ||
+                   statement_uses_name(((KastWhile*)node)->body, name);
+        case KAST_NODE_DO_WHILE:
+            return node_uses_name(((KastDoWhile*)node)->condition, name) ||
+                   statement_uses_name(((KastDoWhile*)node)->body, name);
+        case KAST_NODE_FOR: {
+            KastFor* kfor = (KastFor*)node;
+            return statement_uses_name(kfor->init, name) ||
+                   node_uses_name(kfor->condition, name) ||
+                   node_uses_name(kfor->increment, name) ||
+                   statement_uses_name(kfor->body, name);
+        }
+        case KAST_NODE_SWITCH: {
+            KastSwitch* kswitch = (KastSwitch*)node;
+            if (node_uses_name(kswitch->condition, name)) return true;
+            for (size_t i = 0; i < kswitch->case_count; i++) {
+                if (node_uses_name(kswitch->cases[i].value, name) ||
+                    statement_uses_name(kswitch->cases[i].body, name)) return true;
+            }
+            return statement_uses_name(kswitch->default_branch, name);
+        }
+        case KAST_NODE_TRY_CATCH: {
+            KastTryCatch* try_catch = (KastTryCatch*)node;
+            if (statement_uses_name((KastStatement*)try_catch->try_block, name)) return true;
+            for (size_t i = 0; i < try_catch->catch_count; i++) {
+                if (statement_uses_name((KastStatement*)try_catch->catch_blocks[i].body, name)) return true;
+            }
+            return false;
+        }
+        case KAST_NODE_THROW:
+            return node_uses_name(((KastThrow*)node)->value, name);
+        case KAST_NODE_RETURN:
+            return node_uses_name(((KastReturn*)node)->value, name);
+        case KAST_NODE_STRUCT_DECL:
+            return statement_uses_name(((KastStructDecl*)node)->init_var, name);
+        case KAST_NODE_BREAK:
+        case KAST_NODE_CONTINUE:
+        case KAST_NODE_IMPORT:
+        case KAST_NODE_FUNCTION_DECL: // 函數體有自己的寄存器窗口，不捕獲外層局部變量
+        case KAST_NODE_CLASS_DECL:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static bool statement_uses_name(KastStatement* stmt, const char* name) {
+    return node_uses_name((KastNode*)stmt, name);
+}
+
+/** @brief 歸還局部變量 (及其標量字段) 佔用的寄存器 */
+static void release_local(CompilerState* compiler, Local* local) {
+    free_reg(compiler, local->reg_index);
+    if (local->scalar) {
+        for (size_t i = 0; i < local->scalar->field_count; i++) free_reg(compiler, local->scalar->regs[i]);
+    }
+    local->released = true;
+}
+
+/**
+ * @brief 歸還當前作用域中已死亡局部變量的寄存器
+ * 塊內後續語句 (rest) 不再引用的局部變量即為死亡。聲明總在使用之前，
+ * 所以即使處於循環體內，下一輪迭代也會先重新初始化該寄存器。
+ */
+static void release_dead_locals(CompilerState* compiler, KastStatement** rest, size_t rest_count) {
+    for (int i = compiler->local_count - 1; i >= 0; i--) {
+        Local* local = &compiler->locals[i];
+        if (local->depth < compiler->scope_depth) break;
+        if (local->released) continue;
+
+        bool live = false;
+        for (size_t j = 0; j < rest_count && !live; j++) {
+            live = statement_uses_name(rest[j], local->name);
+        }
+        if (!live) release_local(compiler, local);
+    }
+}
+
+/** @brief 彈出深於當前作用域的局部變量並歸還寄存器 */
+static void pop_locals(CompilerState* compiler) {
+    while (compiler->local_count > 0 &&
+           compiler->locals[compiler->local_count - 1].depth > compiler->scope_depth) {
+        Local* local = &compiler->locals[compiler->local_count - 1];
+        if (!local->released) release_local(compiler, local);
+        if (local->scalar) {
+            free(local->scalar->fields);
+            free(local->scalar->regs);
+            free(local->scalar);
+        }
+        free(local->name);
+        compiler->local_count--;
+    }
+}
+
+// --- Locals ---
+
+static void add_local(CompilerState* compiler, const char* name) {
+    if (compiler->local_count == 256) {
+        printf("Too many local variables\n");
+        return;
+    }
+    Local* local = &compiler->locals[compiler->local_count++];
+    local->name = strdup(name);
+    local->depth = compiler->scope_depth;
+    local->reg_index = alloc_reg(compiler); // Allocate register
+    local->released = false;
+    local->type = kopt_type_of(compiler->types, name); // 參數、catch 變量在推斷結果中均為未知
+    local->scalar = NULL;
+}
+
+/** @brief 名字對應的局部變量在 locals 中的下標，不是局部變量時返回 -1 */
+static int resolve_local_index(CompilerState* compiler, const char* name) {
+    for (int i = compiler->local_count - 1; i >= compiler->local_base; i--) {
+        if (strcmp(compiler->locals[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+static int resolve_local(CompilerState* compiler, const char* name) {
+    int index = resolve_local_index(compiler, name);
+    return index == -1 ? -1 : compiler->locals[index].reg_index;
+}
+
+/** @brief node 是標量替換對象的 `變量.字段` 時返回字段的寄存器，否則返回 -1 */
+static int scalar_field_reg(CompilerState* compiler, KastNode* node) {
+    if (node->type != KAST_NODE_MEMBER_ACCESS) return -1;
+    KastMemberAccess* acc = (KastMemberAccess*)node;
+    if (acc->object->type != KAST_NODE_IDENTIFIER) return -1;
+    int index = resolve_local_index(compiler, ((KastIdentifier*)acc->object)->name);
+    if (index == -1 || !compiler->locals[index].scalar) return -1;
+    ScalarObject* scalar = compiler->locals[index].scalar;
+    for (size_t i = 0; i < scalar->field_count; i++) {
+        if (strcmp(scalar->fields[i], acc->member_name) == 0) return scalar->regs[i];
+    }
+    return -1;
+}
+
+/**
+ * @brief 計算 `數組[下標].字段` 的數組與下標，供 GETAF / PUTAF 使用
+ * @return acc 的對象不是數組元素時返回 false，不生成代碼
+ */
+static bool compile_element_operands(CompilerState* compiler, KastMemberAccess* acc, int* arr_reg, int* idx_reg) {
+    if (acc->object->type != KAST_NODE_ARRAY_ACCESS) return false;
+    KastArrayAccess* element = (KastArrayAccess*)acc->object;
+    *arr_reg = alloc_reg(compiler);
+    compile_expression(compiler, (KastExpression*)element->array, *arr_reg);
+    *idx_reg = alloc_reg(compiler);
+    compile_expression(compiler, (KastExpression*)element->index, *idx_reg);
+    return true;
+}
+
+/** @brief GETAF Rd, Arr, Idx, Field16 / PUTAF Arr, Idx, Val, Field16 */
+static void emit_element_field(CompilerState* compiler, uint8_t op, int r1, int r2, int r3, int field_idx) {
+    emit_instruction(compiler, op, (uint8_t)r1, (uint8_t)r2, (uint8_t)r3);
+    emit_byte(compiler, (uint8_t)(field_idx >> 8));
+    emit_byte(compiler, (uint8_t)(field_idx & 0xFF));
+}
+
+/** @brief 標識符的靜態類型：只有局部變量可能有類型 (KTypeLookup 回調) */
+static KStaticType local_static_type(void* ctx, const char* name) {
+    CompilerState* compiler = (CompilerState*)ctx;
+    for (int i = compiler->local_count - 1; i >= compiler->local_base; i--) {
+        if (strcmp(compiler->locals[i].name, name) == 0) return compiler->locals[i].type;
+    }
+    return KTYPE_UNKNOWN;
+}
+
+static KStaticType expression_type(CompilerState* compiler, KastNode* expr) {
+    return kopt_expression_type(expr, local_static_type, compiler);
+}
+
+/**
+ * @brief 按操作數的靜態類型選擇特化指令
+ * 兩邊都是 int 時用 *_INT，都是 double 時用 F*_D；GT/GE 交換操作數後改寫為 LT/LE。
+ */
+static uint8_t specialize_binary(uint8_t op, KStaticType a, KStaticType b, bool* swap) {
+    *swap = false;
+    if (a == KTYPE_INT && b == KTYPE_INT) {
+        switch (op) {
+            case KOP_ADD: return KOP_ADD_INT;
+            case KOP_SUB: return KOP_SUB_INT;
+            case KOP_MUL: return KOP_MUL_INT;
+            case KOP_EQ: return KOP_EQ_INT;
+            case KOP_LT: return KOP_LT_INT;
+            case KOP_LE: return KOP_LE_INT;
+            case KOP_GT: *swap = true; return KOP_LT_INT;
+            case KOP_GE: *swap = true; return KOP_LE_INT;
+            default: return op;
+        }
+    }
+    if (a == KTYPE_DOUBLE && b == KTYPE_DOUBLE) {
+        switch (op) {
+            case KOP_ADD: return KOP_FADD_D;
+            case KOP_SUB: return KOP_FSUB_D;
+            case KOP_MUL: return KOP_FMUL_D;
+            case KOP_EQ: return KOP_FEQ_D;
+            case KOP_LT: return KOP_FLT_D;
+            case KOP_LE: return KOP_FLE_D;
+            case KOP_GT: *swap = true; return KOP_FLT_D;
+            case KOP_GE: *swap = true; return KOP_FLE_D;
+            default: return op; // DIV 除零時要拋異常，保持通用指令
+        }
+    }
+    return op;
+}
+
+// --- Compilation ---
+
+// --- 循環不變量外提 ---
+
+#define LOOP_HOIST_LIMIT 8 /**< 每個循環最多佔用的外提寄存器數 */
+
+static void mark_global_ready(CompilerState* compiler, KastNode* decl) {
+    for (size_t i = 0; i < compiler->globals.count; i++) {
+        if (compiler->globals.items[i].decl == decl) compiler->globals.items[i].ready = true;
+    }
+}
+
+static bool stable_global(CompilerState* compiler, const char* name) {
+    for (size_t i = 0; i < compiler->globals.count; i++) {
+        KStableGlobal* global = &compiler->globals.items[i];
+        if (global->ready && strcmp(global->name, name) == 0) return true;
+    }
+    return false;
+}
+
+static HoistedLoad* find_hoisted(CompilerState* compiler, const char* name, int object) {
+    for (int i = compiler->hoisted_count - 1; i >= compiler->hoist_base; i--) {
+        HoistedLoad* load = &compiler->hoisted[i];
+        if (load->state != HOIST_DEAD && load->object == object && strcmp(load->name, name) == 0) return load;
+    }
+    return NULL;
+}
+
+static void add_hoisted(CompilerState* compiler, int mark, const char* name, int object, HoistState state) {
+    if (compiler->hoisted_count - mark >= LOOP_HOIST_LIMIT || compiler->hoisted_count == 64 ||
+        find_hoisted(compiler, name, object)) return;
+    HoistedLoad* load = &compiler->hoisted[compiler->hoisted_count++];
+    load->name = name;
+    load->object = object;
+    load->reg = alloc_reg(compiler);
+    load->state = state;
+}
+
+static void emit_hoisted_load(CompilerState* compiler, HoistedLoad* load) {
+    int idx = add_string_constant(compiler, load->name);
+    if (load->object == -1) {
+        emit_byte(compiler, KOP_GET_GLOBAL);
+        emit_byte(compiler, load->reg);
+    } else {
+        emit_byte(compiler, KOP_GETF);
+        emit_byte(compiler, load->reg);
+        emit_byte(compiler, compiler->locals[load->object].reg_index);
+    }
+    emit_byte(compiler, (uint8_t)(idx >> 8));
+    emit_byte(compiler, (uint8_t)(idx & 0xFF));
+}
+
+/**
+ * @brief 用外提的寄存器代替全局變量或字段讀取
+ * 首次條件判斷中第一次遇到的讀取照常執行，只是結果寫入外提寄存器。
+ * @param object 字段所屬局部變量的下標，全局名字為 -1
+ * @return 已生成代碼返回 true，否則調用者照常生成讀取
+ */
+static bool use_hoisted(CompilerState* compiler, const char* name, int object, int target_reg) {
+    HoistedLoad* load = find_hoisted(compiler, name, object);
+    if (!load) return false;
+    if (load->state == HOIST_GUARD && compiler->hoist_guard) {
+        emit_hoisted_load(compiler, load);
+        load->state = HOIST_READY;
+    }
+    if (load->state != HOIST_READY) return false;
+    if (load->reg != target_reg) emit_instruction(compiler, KOP_LOAD, target_reg, load->reg, 0);
+    return true;
+}
+
+/**
+ * @brief 收集循環條件中可以外提的讀取
+ * 條件中沒有短路求值 (&& 與 || 兩邊都會求值)，每次判斷都會執行這些讀取。
+ * 循環中沒有調用、也沒有對同名變量或字段的寫入時，它們在整個循環中不變。
+ */
+static void collect_guard_loads(CompilerState* compiler, int mark, KastNode* node, const KWriteSet* writes) {
+    if (!node) return;
+    switch (node->type) {
+        case KAST_NODE_IDENTIFIER: {
+            const char* name = ((KastIdentifier*)node)->name;
+            if (resolve_local(compiler, name) != -1 || strcmp(name, "super") == 0 ||
+                kopt_writes_name(writes, name)) return;
+            add_hoisted(compiler, mark, name, -1, HOIST_GUARD);
+            break;
+        }
+        case KAST_NODE_MEMBER_ACCESS: {
+            KastMemberAccess* acc = (KastMemberAccess*)node;
+            if (acc->object->type == KAST_NODE_IDENTIFIER) {
+                const char* object_name = ((KastIdentifier*)acc->object)->name;
+                int object = resolve_local_index(compiler, object_name);
+                if (object != -1) {
+                    if (compiler->locals[object].scalar) return; // 字段本來就在寄存器中
+                    if (!kopt_writes_name(writes, object_name) && !kopt_writes_member(writes, acc->member_name)) {
+                        add_hoisted(compiler, mark, acc->member_name, object, HOIST_GUARD);
+                    }
+                    return;
+                }
+                if (strcmp(object_name, "super") == 0) return;
+            }
+            collect_guard_loads(compiler, mark, acc->object, writes);
+            break;
+        }
+        case KAST_NODE_BINARY_OP:
+            collect_guard_loads(compiler, mark, ((KastBinaryOp*)node)->left, writes);
+            collect_guard_loads(compiler, mark, ((KastBinaryOp*)node)->right, writes);
+            break;
+        case KAST_NODE_UNARY_OP:
+            collect_guard_loads(compiler, mark, ((KastUnaryOp*)node)->operand, writes);
+            break;
+        case KAST_NODE_ARRAY_ACCESS:
+            collect_guard_loads(compiler, mark, ((KastArrayAccess*)node)->array, writes);
+            collect_guard_loads(compiler, mark, ((KastArrayAccess*)node)->index, writes);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief 為循環分配外提寄存器
+ * - 穩定的全局名字 (見 kopt_find_stable_globals) 讀取不會失敗也不會改變，即使循環中有調用，
+ *   也在進入循環體之前讀取一次；
+ * - 條件中的全局變量與 `局部變量.字段` 讀取在循環入口的首次條件判斷中寫入寄存器，
+ *   之後的判斷與循環體直接使用。首次判斷本來就會執行這些讀取，因此不會多拋出錯誤。
+ * @param guard 循環體之前有首次條件判斷 (for / while)
+ * @return 外提記錄的起始位置，傳給 enter_hoisted_body 與 end_loop_hoisting
+ */
+static int begin_loop_hoisting(CompilerState* compiler, KastNode* loop, KastNode* condition, bool guard) {
+    int mark = compiler->hoisted_count;
+    if (guard && condition) {
+        KWriteSet writes;
+        kopt_collect_writes(loop, &writes);
+        if (!writes.calls) collect_guard_loads(compiler, mark, condition, &writes);
+        kopt_free_write_set(&writes);
+    }
+    for (size_t i = 0; i < compiler->globals.count; i++) {
+        KStableGlobal* global = &compiler->globals.items[i];
+        if (!global->ready || resolve_local(compiler, global->name) != -1) continue;
+        if (!node_uses_name(loop, global->name)) continue;
+        HoistedLoad* load = find_hoisted(compiler, global->name, -1);
+        if (load && load->state == HOIST_GUARD) {
+            load->state = HOIST_PREHEADER; // 不會失敗，不必等首次判斷
+        } else {
+            add_hoisted(compiler, mark, global->name, -1, HOIST_PREHEADER);
+        }
+    }
+    return mark;
+}
+
+/** @brief 進入循環體之前：讀取其餘的外提值，放棄首次判斷中沒有讀取的記錄 */
+static void enter_hoisted_body(CompilerState* compiler, int mark) {
+    for (int i = mark; i < compiler->hoisted_count; i++) {
+        HoistedLoad* load = &compiler->hoisted[i];
+        if (load->state == HOIST_PREHEADER) {
+            emit_hoisted_load(compiler, load);
+            load->state = HOIST_READY;
+        } else if (load->state == HOIST_GUARD) {
+            load->state = HOIST_DEAD;
+        }
+    }
+}
+
+static void end_loop_hoisting(CompilerState* compiler, int mark) {
+    while (compiler->hoisted_count > mark) {
+        free_reg(compiler, compiler->hoisted[--compiler->hoisted_count].reg);
+    }
+}
+
+// --- 計數循環 ---
+
+/** @brief 計數循環回邊所需的操作數 */
+typedef struct {
+    int counter;   /**< 循環變量的寄存器 */
+    int limit;     /**< 上界的寄存器 */
+    uint8_t cmp;   /**< FORLOOP 的 Cmp 字節 */
+    bool owns_limit; /**< 上界是字面量，寄存器由循環持有 */
+} CountedLoop;
+
+/** @brief 循環增量對 name 的步長：i++ / i-- / i = i + 1 / i = i - 1，其他形式返回 0 */
+static int counted_loop_step(KastNode* increment, const char* name) {
+    if (!increment) return 0;
+    if (increment->type == KAST_NODE_POSTFIX_OP) {
+        KastPostfixOp* post = (KastPostfixOp*)increment;
+        if (post->operand->type != KAST_NODE_IDENTIFIER ||
+            strcmp(((KastIdentifier*)post->operand)->name, name) != 0) return 0;
+        return post->operator == KORELIN_TOKEN_INC ? 1 : -1;
+    }
+    if (increment->type != KAST_NODE_ASSIGNMENT) return 0;
+    KastAssignment* assign = (KastAssignment*)increment;
+    if (assign->lvalue->type != KAST_NODE_IDENTIFIER ||
+        strcmp(((KastIdentifier*)assign->lvalue)->name, name) != 0 ||
+        assign->value->type != KAST_NODE_BINARY_OP) return 0;
+    KastBinaryOp* bin = (KastBinaryOp*)assign->value;
+    if (bin->left->type != KAST_NODE_IDENTIFIER || strcmp(((KastIdentifier*)bin->left)->name, name) != 0 ||
+        bin->right->type != KAST_NODE_LITERAL) return 0;
+    KastLiteral* lit = (KastLiteral*)bin->right;
+    if (lit->token.type != KORELIN_TOKEN_INT || atoll(lit->token.value) != 1) return 0;
+    if (bin->operator == KORELIN_TOKEN_ADD) return 1;
+    if (bin->operator == KORELIN_TOKEN_SUB) return -1;
+    return 0;
+}
+
+/** @brief 上界已在寄存器中時返回該寄存器：局部變量、標量字段或已外提的讀取 */
+static int counted_loop_limit_reg(CompilerState* compiler, KastNode* limit) {
+    HoistedLoad* load = NULL;
+    if (limit->type == KAST_NODE_IDENTIFIER) {
+        const char* name = ((KastIdentifier*)limit)->name;
+        int reg = resolve_local(compiler, name);
+        if (reg != -1) return reg;
+        load = find_hoisted(compiler, name, -1);
+    } else if (limit->type == KAST_NODE_MEMBER_ACCESS) {
+        int reg = scalar_field_reg(compiler, limit);
+        if (reg != -1) return reg;
+        KastMemberAccess* acc = (KastMemberAccess*)limit;
+        if (acc->object->type != KAST_NODE_IDENTIFIER) return -1;
+        int object = resolve_local_index(compiler, ((KastIdentifier*)acc->object)->name);
+        if (object != -1) load = find_hoisted(compiler, acc->member_name, object);
+    }
+    return load && load->state == HOIST_READY ? load->reg : -1;
+}
+
+/**
+ * @brief 識別計數循環 `for (...; i cmp limit; i++)`，在進入循環體之前調用
+ * 循環變量是已證明為整數的局部變量，< 與 <= 配合自增、> 與 >= 配合自減；
+ * 上界是局部變量、外提寄存器中的值或整數字面量 (此時在這裡加載到循環持有的寄存器)。
+ * 回邊的增量、條件與 JNZ 合併為一條 FORLOOP。
+ * @return 是計數循環時返回 true 並填寫 loop
+ */
+static bool begin_counted_loop(CompilerState* compiler, KastFor* kfor, CountedLoop* loop) {
+    if (!kfor->condition || kfor->condition->type != KAST_NODE_BINARY_OP) return false;
+    KastBinaryOp* cond = (KastBinaryOp*)kfor->condition;
+    if (cond->left->type != KAST_NODE_IDENTIFIER) return false;
+    const char* name = ((KastIdentifier*)cond->left)->name;
+    int counter = resolve_local(compiler, name);
+    if (counter == -1 || local_static_type(compiler, name) != KTYPE_INT) return false;
+
+    int step = counted_loop_step(kfor->increment, name);
+    uint8_t cmp;
+    switch (cond->operator) {
+        case KORELIN_TOKEN_LT: cmp = KOP_LT; break;
+        case KORELIN_TOKEN_LE: cmp = KOP_LE; break;
+        case KORELIN_TOKEN_GT: cmp = KOP_GT; break;
+        case KORELIN_TOKEN_GE: cmp = KOP_GE; break;
+        default: return false;
+    }
+    if (step != ((cmp == KOP_LT || cmp == KOP_LE) ? 1 : -1)) return false;
+
+    loop->counter = counter;
+    loop->owns_limit = false;
+    loop->limit = counted_loop_limit_reg(compiler, cond->right);
+    if (loop->limit == -1) {
+        if (cond->right->type != KAST_NODE_LITERAL ||
+            ((KastLiteral*)cond->right)->token.type != KORELIN_TOKEN_INT) return false;
+        loop->limit = alloc_reg(compiler);
+        loop->owns_limit = true;
+        compile_expression(compiler, (KastExpression*)cond->right, loop->limit);
+    }
+    loop->cmp = cmp;
+    if (expression_type(compiler, cond->right) == KTYPE_INT) loop->cmp |= KFORLOOP_INT_LIMIT;
+    return true;
+}
+
+/** @brief 生成回邊 FORLOOP，跳回 body_start */
+static void end_counted_loop(CompilerState* compiler, CountedLoop* loop, int body_start) {
+    emit_byte(compiler, KOP_FORLOOP);
+    emit_byte(compiler, (uint8_t)loop->counter);
+    emit_byte(compiler, (uint8_t)loop->limit);
+    emit_byte(compiler, loop->cmp);
+    emit_byte(compiler, 0); emit_byte(compiler, 0);
+    patch_jump(compiler, compiler->chunk->count - 2, body_start);
+    if (loop->owns_limit) free_reg(compiler, loop->limit);
+}
+
+// --- 邊界檢查消除 ---
+
+/** @brief node 是非負整數字面量 */
+static bool is_nonnegative_int_literal(KastNode* node) {
+    if (!node || node->type != KAST_NODE_LITERAL) return false;
+    KastLiteral* lit = (KastLiteral*)node;
+    return lit->token.type == KORELIN_TOKEN_INT && lit->token.value[0] != '-';
+}
+
+/**
+ * @brief 證明 `for (i = 非負整數; i < a.length; i++)` 的循環體中 a[i] 在界內，在進入循環體之前調用
+ * i 是已證明為整數的局部變量，a 是局部變量，循環體不寫入也不重新聲明 i 與 a，並且沒有調用
+ * (pop / removeAt 等方法與被調函數可能縮短數組)：每次進入循環體時 0 <= i < a.length，而數組的長度不會改變。
+ * a 不是數組時 GETFA_U / PUTFA_U 與 GETFA / PUTFA 報告相同的錯誤。
+ * @return 證明成立時壓入 safe_indices 並返回 true，由 end_bounds_proof 彈出
+ */
+static bool begin_bounds_proof(CompilerState* compiler, KastFor* kfor) {
+    if (compiler->safe_index_count >= 16) return false;
+    if (!kfor->condition || kfor->condition->type != KAST_NODE_BINARY_OP) return false;
+    KastBinaryOp* cond = (KastBinaryOp*)kfor->condition;
+    if (cond->operator != KORELIN_TOKEN_LT || cond->left->type != KAST_NODE_IDENTIFIER ||
+        cond->right->type != KAST_NODE_MEMBER_ACCESS) return false;
+    KastMemberAccess* limit = (KastMemberAccess*)cond->right;
+    if (strcmp(limit->member_name, "length") != 0 || limit->object->type != KAST_NODE_IDENTIFIER) return false;
+    const char* index_name = ((KastIdentifier*)cond->left)->name;
+    const char* array_name = ((KastIdentifier*)limit->object)->name;
+
+    int index = resolve_local_index(compiler, index_name);
+    int array = resolve_local_index(compiler, array_name);
+    if (index == -1 || array == -1 || compiler->locals[array].scalar) return false;
+    if (local_static_type(compiler, index_name) != KTYPE_INT) return false;
+    if (counted_loop_step(kfor->increment, index_name) != 1) return false;
+
+    // 初始值
+    KastNode* init = (KastNode*)kfor->init;
+    if (!init) return false;
+    if (init->type == KAST_NODE_VAR_DECL) {
+        KastVarDecl* decl = (KastVarDecl*)init;
+        if (strcmp(decl->name, index_name) != 0 || !is_nonnegative_int_literal(decl->init_value)) return false;
+    } else if (init->type == KAST_NODE_ASSIGNMENT) {
+        KastAssignment* assign = (KastAssignment*)init;
+        if (assign->lvalue->type != KAST_NODE_IDENTIFIER ||
+            strcmp(((KastIdentifier*)assign->lvalue)->name, index_name) != 0 ||
+            !is_nonnegative_int_literal(assign->value)) return false;
+    } else {
+        return false;
+    }
+
+    KWriteSet writes;
+    kopt_collect_writes((KastNode*)kfor->body, &writes);
+    bool written = writes.calls || kopt_writes_name(&writes, index_name) || kopt_writes_name(&writes, array_name);
+    kopt_free_write_set(&writes);
+    if (written) return false;
+
+    compiler->safe_indices[compiler->safe_index_count].array = array;
+    compiler->safe_indices[compiler->safe_index_count].index = index;
+    compiler->safe_index_count++;
+    return true;
+}
+
+static void end_bounds_proof(CompilerState* compiler) {
+    compiler->safe_index_count--;
+}
+
+/** @brief acc 是當前函數中已證明在界內的數組訪問 */
+static bool is_safe_index(CompilerState* compiler, KastArrayAccess* acc) {
+    if (acc->array->type != KAST_NODE_IDENTIFIER || acc->index->type != KAST_NODE_IDENTIFIER) return false;
+    int array = resolve_local_index(compiler, ((KastIdentifier*)acc->array)->name);
+    int index = resolve_local_index(compiler, ((KastIdentifier*)acc->index)->name);
+    if (array == -1 || index == -1) return false;
+    for (int i = compiler->safe_index_count - 1; i >= compiler->safe_index_base; i--) {
+        if (compiler->safe_indices[i].array == array && compiler->safe_indices[i].index == index) return true;
+    }
+    return false;
+}
+
+// --- 內聯 ---
+
+#define INLINE_MAX_DEPTH 3 /**< 內聯函數體中的調用最多再展開的層數 */
+
+static KInlineCandidate* find_inline_candidate(CompilerState* compiler, const char* name, const char* class_name) {
+    for (size_t i = 0; i < compiler->inlines.count; i++) {
+        KInlineCandidate* candidate = &compiler->inlines.items[i];
+        if (strcmp(candidate->name, name) != 0) continue;
+        if (class_name ? (candidate->class_name && strcmp(candidate->class_name, class_name) == 0)
+                       : !candidate->class_name) return candidate;
+    }
+    return NULL;
+}
+
+/** @brief 聲明已生成，之後的調用可以內聯 */
+static void mark_inline_ready(CompilerState* compiler, KastNode* decl, const char* class_name) {
+    for (size_t i = 0; i < compiler->inlines.count; i++) {
+        KInlineCandidate* candidate = &compiler->inlines.items[i];
+        if ((decl && candidate->decl == decl) ||
+            (class_name && candidate->class_name && strcmp(candidate->class_name, class_name) == 0)) {
+            candidate->ready = true;
+        }
     }
-    loop->break_jumps[loop->break_count++] = jump_offset;
 }
 
-static void add_continue(CompilerState* compiler, int jump_offset) {
-    if (compiler->loop_depth == 0) return;
-    LoopState* loop = &compiler->loops[compiler->loop_depth - 1];
-    
-    if (loop->continue_target != -1) {
-        patch_jump(compiler, jump_offset, loop->continue_target);
-        return;
+/**
+ * @brief 把對小函數的調用展開為函數體
+ * 實參按調用順序求值到新寄存器並綁定為形參，函數體在只能看到形參的作用域中生成，
+ * return 把值寫入 target_reg 後跳到展開結束處。展開後省去了 CALLR/INVOKE 的訪問檢查、
+ * 參數個數檢查、調用幀與寄存器窗口。
+ * @return 已展開返回 true；不滿足條件時不生成任何代碼並返回 false
+ */
+static bool try_inline_call(CompilerState* compiler, KastCall* call, int target_reg) {
+    if (compiler->inline_depth >= INLINE_MAX_DEPTH) return false;
+
+    KInlineCandidate* candidate = NULL;
+    KastNode* object = NULL;
+    if (call->callee->type == KAST_NODE_IDENTIFIER) {
+        const char* name = ((KastIdentifier*)call->callee)->name;
+        if (resolve_local(compiler, name) != -1) return false;
+        candidate = find_inline_candidate(compiler, name, NULL);
+        // 方法的訪問檢查看調用者所屬的類，展開到類的方法中可能放行原本會被拒絕的調用
+        if (candidate && candidate->invokes && compiler->current_class_name) return false;
+    } else if (call->callee->type == KAST_NODE_MEMBER_ACCESS && compiler->current_class_name) {
+        KastMemberAccess* acc = (KastMemberAccess*)call->callee;
+        if (acc->object->type != KAST_NODE_IDENTIFIER ||
+            strcmp(((KastIdentifier*)acc->object)->name, "self") != 0 ||
+            resolve_local(compiler, "self") == -1) return false;
+        candidate = find_inline_candidate(compiler, acc->member_name, compiler->current_class_name);
+        object = acc->object;
     }
-    
-    if (loop->continue_count >= loop->continue_capacity) {
-        loop->continue_capacity = loop->continue_capacity < 8 ? 8 : loop->continue_capacity * 2;
-        loop->continue_jumps = (int*)realloc(loop->continue_jumps, loop->continue_capacity * sizeof(int));
+    if (!candidate || !candidate->ready || candidate->active ||
+        candidate->param_count != call->arg_count + (object ? 1 : 0)) return false;
+
+    int arg_regs[256];
+    size_t param_index = 0;
+    if (object) {
+        arg_regs[param_index] = alloc_reg(compiler);
+        compile_expression(compiler, (KastExpression*)object, arg_regs[param_index++]);
+    }
+    for (size_t i = 0; i < call->arg_count; i++) {
+        arg_regs[param_index] = alloc_reg(compiler);
+        compile_expression(compiler, (KastExpression*)call->args[i], arg_regs[param_index++]);
     }
-    loop->continue_jumps[loop->continue_count++] = jump_offset;
-}
 
-static void resolve_continue(CompilerState* compiler, int target) {
-    if (compiler->loop_depth == 0) return;
-    LoopState* loop = &compiler->loops[compiler->loop_depth - 1];
-    loop->continue_target = target;
-    for (int i = 0; i < loop->continue_count; i++) {
-        patch_jump(compiler, loop->continue_jumps[i], target);
+    KTypeEnv types;
+    KTypeEnv* saved_types = compiler->types;
+    InlineFrame* saved_frame = compiler->inline_frame;
+    int saved_local_base = compiler->local_base;
+    kopt_infer_local_types(&types, candidate->params, candidate->param_count, (KastNode*)candidate->body);
+    compiler->types = &types;
+    compiler->local_base = compiler->local_count;
+    compiler->scope_depth++;
+
+    for (size_t i = 0; i < candidate->param_count; i++) {
+        if (compiler->local_count == 256) break;
+        Local* local = &compiler->locals[compiler->local_count++];
+        local->name = strdup(((KastVarDecl*)candidate->params[i])->name);
+        local->depth = compiler->scope_depth;
+        local->reg_index = arg_regs[i];
+        local->released = false;
+        local->type = KTYPE_UNKNOWN;
+        local->scalar = NULL;
     }
-}
 
-// --- Emitters ---
+    InlineFrame frame = { target_reg, NULL, 0, 0 };
+    compiler->inline_frame = &frame;
+    compiler->inline_depth++;
+    candidate->active = true;
+    compile_statement(compiler, (KastStatement*)candidate->body);
+    candidate->active = false;
+    compiler->inline_depth--;
 
-static void emit_byte(CompilerState* compiler, uint8_t byte) {
-    write_chunk(compiler->chunk, byte, 0); // Line number todo
-}
+    for (int i = 0; i < frame.exit_count; i++) patch_jump(compiler, frame.exits[i], compiler->chunk->count);
+    free(frame.exits);
 
-static void emit_instruction(CompilerState* compiler, uint8_t op, uint8_t r1, uint8_t r2, uint8_t r3) {
-    emit_byte(compiler, op);
-    emit_byte(compiler, r1);
-    emit_byte(compiler, r2);
-    emit_byte(compiler, r3);
+    compiler->inline_frame = saved_frame;
+    compiler->scope_depth--;
+    pop_locals(compiler);
+    compiler->local_base = saved_local_base;
+    compiler->types = saved_types;
+    kopt_free_type_env(&types);
+    return true;
 }
 
-static int emit_jump(CompilerState* compiler, uint8_t op, uint8_t r1) {
-    emit_byte(compiler, op);
-    emit_byte(compiler, r1);
-    emit_byte(compiler, 0); emit_byte(compiler, 0); // 16-bit offset placeholder
-    return compiler->chunk->count - 2;
-}
+// --- 數組方法 ---
 
-// --- Locals ---
+/**
+ * @brief 把 `x.push(v)` / `x.pop()` / `x.insert(i, v)` / `x.removeAt(i)` 生成為 KOP_APUSH 等指令
+ * x 在運行時是數組時指令原地修改它，否則與 INVOKE 一樣按名字調用方法；求值順序與 INVOKE 相同。
+ * @return 已生成返回 true；不是這些調用或 Array 可能被重新定義時返回 false
+ */
+static bool compile_array_method(CompilerState* compiler, KastCall* call, int target_reg) {
+    if (!compiler->array_builtins) return false;
+    KastMemberAccess* acc = (KastMemberAccess*)call->callee;
+    const char* name = acc->member_name;
+    uint8_t opcode;
+    if (strcmp(name, "push") == 0 && call->arg_count == 1) opcode = KOP_APUSH;
+    else if (strcmp(name, "pop") == 0 && call->arg_count == 0) opcode = KOP_APOP;
+    else if (strcmp(name, "insert") == 0 && call->arg_count == 2) opcode = KOP_AINSERT;
+    else if (strcmp(name, "removeAt") == 0 && call->arg_count == 1) opcode = KOP_AREMOVE;
+    else return false;
 
-static void add_local(CompilerState* compiler, const char* name) {
-    if (compiler->local_count == 256) {
-        printf("Too many local variables\n");
-        return;
+    int regs[3];
+    regs[0] = alloc_reg(compiler);
+    compile_expression(compiler, (KastExpression*)acc->object, regs[0]);
+    for (size_t i = 0; i < call->arg_count; i++) {
+        regs[i + 1] = alloc_reg(compiler);
+        compile_expression(compiler, (KastExpression*)call->args[i], regs[i + 1]);
     }
-    Local* local = &compiler->locals[compiler->local_count++];
-    local->name = strdup(name);
-    local->depth = compiler->scope_depth;
-    local->reg_index = compiler->current_reg_count++; // Allocate register
+    emit_byte(compiler, opcode);
+    emit_byte(compiler, (uint8_t)target_reg);
+    emit_byte(compiler, (uint8_t)regs[0]);
+    emit_byte(compiler, call->arg_count > 0 ? (uint8_t)regs[1] : 0);
+    if (opcode == KOP_AINSERT) emit_byte(compiler, (uint8_t)regs[2]);
+    for (size_t i = call->arg_count + 1; i-- > 0;) free_reg(compiler, regs[i]);
+    return true;
 }
 
-static int resolve_local(CompilerState* compiler, const char* name) {
-    for (int i = compiler->local_count - 1; i >= 0; i--) {
-        Local* local = &compiler->locals[i];
-        if (strcmp(local->name, name) == 0) {
-            return local->reg_index;
-        }
+// --- 標量替換 ---
+
+static KScalarClass* find_scalar_class(CompilerState* compiler, const char* name) {
+    for (size_t i = 0; i < compiler->scalar_classes.count; i++) {
+        if (strcmp(compiler->scalar_classes.items[i].name, name) == 0) return &compiler->scalar_classes.items[i];
     }
-    return -1;
+    return NULL;
 }
 
-// --- Compilation ---
+/**
+ * @brief 把不逃逸的對象拆成字段寄存器 (見 kopt_object_stays_local)
+ * block->statements[index] 是這樣的變量聲明時，不再生成 NEW：實參求值到新寄存器，
+ * 構造函數體在只能看到形參的作用域中展開，self.字段 的讀寫與之後塊中的 變量.字段 一樣
+ * 直接使用字段寄存器。省去了實例分配、字段表與每次讀寫字段的哈希查找。
+ * @return 已生成返回 true；不滿足條件時不生成任何代碼並返回 false
+ */
+static bool compile_scalar_object(CompilerState* compiler, KastBlock* block, size_t index) {
+    KastNode* node = (KastNode*)block->statements[index];
+    if (compiler->scope_depth == 0 || !node || node->type != KAST_NODE_VAR_DECL) return false;
+    KastVarDecl* decl = (KastVarDecl*)node;
+    const char* class_name = decl->init_value && decl->init_value->type == KAST_NODE_NEW
+        ? ((KastNew*)decl->init_value)->class_name : decl->type_name;
+    // 類名被局部變量遮蔽或聲明尚未執行時，NEW 的解析結果在編譯期不確定
+    if (!class_name || !stable_global(compiler, class_name) || resolve_local(compiler, class_name) != -1) return false;
+    KScalarClass* klass = find_scalar_class(compiler, class_name);
+    if (!klass || compiler->local_count + (klass->init ? (int)klass->init->arg_count : 0) >= 256) return false;
+
+    char** fields;
+    size_t field_count;
+    if (!kopt_object_stays_local(block, index, klass, &fields, &field_count)) return false;
+
+    add_local(compiler, decl->name);
+    ScalarObject* scalar = (ScalarObject*)malloc(sizeof(ScalarObject));
+    scalar->fields = fields;
+    scalar->field_count = field_count;
+    scalar->regs = (int*)malloc((field_count ? field_count : 1) * sizeof(int));
+    for (size_t i = 0; i < field_count; i++) scalar->regs[i] = alloc_reg(compiler);
+    compiler->locals[compiler->local_count - 1].scalar = scalar;
+    if (!klass->init) return true;
+
+    KastNew* n = (KastNew*)decl->init_value;
+    int arg_regs[256];
+    for (size_t i = 0; i < n->arg_count; i++) {
+        arg_regs[i] = alloc_reg(compiler);
+        compile_expression(compiler, (KastExpression*)n->args[i], arg_regs[i]);
+    }
+
+    int saved_local_base = compiler->local_base;
+    compiler->local_base = compiler->local_count;
+    compiler->scope_depth++;
+    for (size_t i = 0; i < klass->init->arg_count; i++) {
+        Local* local = &compiler->locals[compiler->local_count++];
+        local->name = strdup(((KastVarDecl*)klass->init->args[i])->name);
+        local->depth = compiler->scope_depth;
+        local->reg_index = i == 0 ? alloc_reg(compiler) : arg_regs[i - 1];
+        local->released = false;
+        local->type = KTYPE_UNKNOWN;
+        local->scalar = i == 0 ? scalar : NULL; // self 與變量共用字段寄存器
+    }
+    for (size_t i = 0; i < klass->init->body->statement_count; i++) {
+        compile_statement(compiler, klass->init->body->statements[i]);
+    }
+    // 字段寄存器屬於變量，彈出形參時只歸還 self 自己的寄存器
+    compiler->locals[compiler->local_base].scalar = NULL;
+    compiler->scope_depth--;
+    pop_locals(compiler);
+    compiler->local_base = saved_local_base;
+    return true;
+}
 
 static void compile_expression(CompilerState* compiler, KastExpression* expr, int target_reg) {
     if (!expr) return;
@@ -233,20 +1514,7 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
             if (lit->token.type == KORELIN_TOKEN_INT) {
                 // Parse int
                 long long val = atoll(lit->token.value);
-                // LDI target, imm
-                if (val >= -128 && val <= 127) {
-                     emit_byte(compiler, KOP_LDI);
-                     emit_byte(compiler, target_reg);
-                     emit_byte(compiler, (int8_t)val);
-                     emit_byte(compiler, 0); // Padding
-                } else {
-                     emit_byte(compiler, KOP_LDI64);
-                     emit_byte(compiler, target_reg);
-                     // Emit 8 bytes Big Endian
-                     for(int i=0; i<8; i++) {
-                         emit_byte(compiler, (uint8_t)((val >> ((7-i)*8)) & 0xFF));
-                     }
-                }
+                emit_load_int(compiler, target_reg, val);
             } else if (lit->token.type == KORELIN_TOKEN_STRING) {
                 int idx = add_string_constant(compiler, lit->token.value);
                 emit_byte(compiler, KOP_LDC); 
@@ -277,15 +1545,11 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
              } else if (lit->token.type == KORELIN_TOKEN_FLOAT) {
                 // Default to double for literals
                 double val = atof(lit->token.value);
+                int idx = add_double_constant(compiler, val);
                 emit_byte(compiler, KOP_LDCD);
                 emit_byte(compiler, target_reg);
-                // Emit 8 bytes (double representation)
-                uint64_t bits;
-                memcpy(&bits, &val, sizeof(bits));
-                // Big Endian emission
-                for(int i=0; i<8; i++) {
-                    emit_byte(compiler, (uint8_t)((bits >> ((7-i)*8)) & 0xFF));
-                }
+                emit_byte(compiler, (uint8_t)(idx >> 8));
+                emit_byte(compiler, (uint8_t)(idx & 0xFF));
             }
             break;
         }
@@ -293,23 +1557,10 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
             KastArrayLiteral* lit = (KastArrayLiteral*)expr;
             
             // 1. Create Size Register
-            int size_reg = compiler->current_reg_count++;
+            int size_reg = alloc_reg(compiler);
             
             // 2. Load Size
-            if (lit->element_count <= 127) {
-                emit_byte(compiler, KOP_LDI);
-                emit_byte(compiler, size_reg);
-                emit_byte(compiler, (int8_t)lit->element_count);
-                emit_byte(compiler, 0);
-            } else {
-                 emit_byte(compiler, KOP_LDI64);
-                 emit_byte(compiler, size_reg);
-                 // 8 bytes 
-                 long long val = lit->element_count;
-                 for(int i=0; i<8; i++) {
-                     emit_byte(compiler, (uint8_t)((val >> ((7-i)*8)) & 0xFF));
-                 }
-            }
+            emit_load_int(compiler, size_reg, lit->element_count);
 
             // 3. Create Array (NEWA)
             // Use "any" as type for now
@@ -321,29 +1572,17 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
             emit_byte(compiler, (uint8_t)(type_idx >> 8));
             emit_byte(compiler, (uint8_t)(type_idx & 0xFF));
             
-            compiler->current_reg_count--; // Free size_reg
+            free_reg(compiler, size_reg);
             
             // 4. Populate Elements
             for (int i=0; i<lit->element_count; i++) {
                 // Compile value to temp reg
-                int val_reg = compiler->current_reg_count++;
+                int val_reg = alloc_reg(compiler);
                 compile_expression(compiler, (KastExpression*)lit->elements[i], val_reg);
                 
                 // Load Index
-                int idx_reg = compiler->current_reg_count++;
-                if (i <= 127) {
-                    emit_byte(compiler, KOP_LDI);
-                    emit_byte(compiler, idx_reg);
-                    emit_byte(compiler, (int8_t)i);
-                    emit_byte(compiler, 0);
-                } else {
-                     emit_byte(compiler, KOP_LDI64);
-                     emit_byte(compiler, idx_reg);
-                     long long val = i;
-                     for(int k=0; k<8; k++) {
-                         emit_byte(compiler, (uint8_t)((val >> ((7-k)*8)) & 0xFF));
-                     }
-                }
+                int idx_reg = alloc_reg(compiler);
+                emit_load_int(compiler, idx_reg, i);
                 
                 // PUTFA Target(Arr), Idx, Val
                 emit_byte(compiler, KOP_PUTFA);
@@ -351,7 +1590,7 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                 emit_byte(compiler, idx_reg);
                 emit_byte(compiler, val_reg);
                 
-                compiler->current_reg_count -= 2; // Free val_reg, idx_reg
+                free_reg(compiler, val_reg); free_reg(compiler, idx_reg);
             }
             break;
         }
@@ -362,7 +1601,7 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                 if (reg != target_reg) {
                     emit_instruction(compiler, KOP_LOAD, target_reg, reg, 0);
                 }
-            } else {
+            } else if (!use_hoisted(compiler, ident->name, -1, target_reg)) {
                 // Global
                 int idx = add_string_constant(compiler, ident->name);
                 emit_byte(compiler, KOP_GET_GLOBAL);
@@ -374,8 +1613,10 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
         }
         case KAST_NODE_BINARY_OP: {
             KastBinaryOp* bin = (KastBinaryOp*)expr;
+            KStaticType left_type = expression_type(compiler, bin->left);
+            KStaticType right_type = expression_type(compiler, bin->right);
             compile_expression(compiler, (KastExpression*)bin->left, target_reg);
-            int right_reg = compiler->current_reg_count++;
+            int right_reg = alloc_reg(compiler);
             compile_expression(compiler, (KastExpression*)bin->right, right_reg);
             
             uint8_t op = KOP_ADD;
@@ -384,6 +1625,7 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                 case KORELIN_TOKEN_SUB: op = KOP_SUB; break;
                 case KORELIN_TOKEN_MUL: op = KOP_MUL; break;
                 case KORELIN_TOKEN_DIV: op = KOP_DIV; break;
+                case KORELIN_TOKEN_MOD: op = KOP_MOD; break;
                 case KORELIN_TOKEN_EQ: op = KOP_EQ; break;
                 case KORELIN_TOKEN_NE: op = KOP_NE; break;
                 case KORELIN_TOKEN_LT: op = KOP_LT; break;
@@ -395,8 +1637,14 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                 default: break;
             }
             
-            emit_instruction(compiler, op, target_reg, target_reg, right_reg);
-            compiler->current_reg_count--;
+            bool swap;
+            op = specialize_binary(op, left_type, right_type, &swap);
+            if (swap) {
+                emit_instruction(compiler, op, target_reg, right_reg, target_reg);
+            } else {
+                emit_instruction(compiler, op, target_reg, target_reg, right_reg);
+            }
+            free_reg(compiler, right_reg);
             break;
         }
         case KAST_NODE_UNARY_OP: {
@@ -429,11 +1677,37 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                     emit_byte(compiler, (uint8_t)(idx >> 8));
                     emit_byte(compiler, (uint8_t)(idx & 0xFF));
                 }
+            } else if (scalar_field_reg(compiler, assign->lvalue) != -1) {
+                int reg = scalar_field_reg(compiler, assign->lvalue);
+                compile_expression(compiler, (KastExpression*)assign->value, target_reg);
+                emit_instruction(compiler, KOP_LOAD, reg, target_reg, 0);
+            } else if (assign->lvalue->type == KAST_NODE_MEMBER_ACCESS &&
+                       ((KastMemberAccess*)assign->lvalue)->object->type == KAST_NODE_ARRAY_ACCESS) {
+                KastMemberAccess* acc = (KastMemberAccess*)assign->lvalue;
+                int arr_reg, idx_reg;
+                compile_element_operands(compiler, acc, &arr_reg, &idx_reg);
+                // 右側在元素之後計算：它可能有副作用或出錯時，先報告數組與下標的錯誤
+                KastNode* value = assign->value;
+                if (value->type != KAST_NODE_LITERAL &&
+                    !(value->type == KAST_NODE_IDENTIFIER && resolve_local(compiler, ((KastIdentifier*)value)->name) != -1)) {
+                    emit_element_field(compiler, KOP_GETAF, arr_reg, arr_reg, idx_reg, KGETAF_CHECK);
+                }
+                int val_reg = alloc_reg(compiler);
+                compile_expression(compiler, (KastExpression*)value, val_reg);
+                
+                int name_idx = add_string_constant(compiler, acc->member_name);
+                emit_element_field(compiler, KOP_PUTAF, arr_reg, idx_reg, val_reg, name_idx);
+                
+                if (target_reg != val_reg) {
+                    emit_instruction(compiler, KOP_LOAD, target_reg, val_reg, 0);
+                }
+                
+                free_reg(compiler, arr_reg); free_reg(compiler, idx_reg); free_reg(compiler, val_reg);
             } else if (assign->lvalue->type == KAST_NODE_MEMBER_ACCESS) {
                 KastMemberAccess* acc = (KastMemberAccess*)assign->lvalue;
-                int obj_reg = compiler->current_reg_count++;
+                int obj_reg = alloc_reg(compiler);
                 compile_expression(compiler, (KastExpression*)acc->object, obj_reg);
-                int val_reg = compiler->current_reg_count++;
+                int val_reg = alloc_reg(compiler);
                 compile_expression(compiler, (KastExpression*)assign->value, val_reg);
                 
                 int name_idx = add_string_constant(compiler, acc->member_name);
@@ -448,20 +1722,20 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                     emit_instruction(compiler, KOP_LOAD, target_reg, val_reg, 0);
                 }
                 
-                compiler->current_reg_count -= 2;
+                free_reg(compiler, obj_reg); free_reg(compiler, val_reg);
             } else if (assign->lvalue->type == KAST_NODE_ARRAY_ACCESS) {
                  KastArrayAccess* acc = (KastArrayAccess*)assign->lvalue;
                  
-                 int arr_reg = compiler->current_reg_count++;
+                 int arr_reg = alloc_reg(compiler);
                  compile_expression(compiler, (KastExpression*)acc->array, arr_reg);
                  
-                 int idx_reg = compiler->current_reg_count++;
+                 int idx_reg = alloc_reg(compiler);
                  compile_expression(compiler, (KastExpression*)acc->index, idx_reg);
                  
-                 int val_reg = compiler->current_reg_count++;
+                 int val_reg = alloc_reg(compiler);
                  compile_expression(compiler, (KastExpression*)assign->value, val_reg);
                  
-                 emit_byte(compiler, KOP_PUTFA);
+                 emit_byte(compiler, is_safe_index(compiler, acc) ? KOP_PUTFA_U : KOP_PUTFA);
                  emit_byte(compiler, arr_reg);
                  emit_byte(compiler, idx_reg);
                  emit_byte(compiler, val_reg);
@@ -470,29 +1744,30 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                       emit_instruction(compiler, KOP_LOAD, target_reg, val_reg, 0);
                  }
                  
-                 compiler->current_reg_count -= 3;
+                 free_reg(compiler, arr_reg); free_reg(compiler, idx_reg); free_reg(compiler, val_reg);
             }
             break;
         }
         case KAST_NODE_ARRAY_ACCESS: {
             KastArrayAccess* acc = (KastArrayAccess*)expr;
             
-            int arr_reg = compiler->current_reg_count++;
+            int arr_reg = alloc_reg(compiler);
             compile_expression(compiler, (KastExpression*)acc->array, arr_reg);
             
-            int idx_reg = compiler->current_reg_count++;
+            int idx_reg = alloc_reg(compiler);
             compile_expression(compiler, (KastExpression*)acc->index, idx_reg);
             
-            emit_byte(compiler, KOP_GETFA);
+            emit_byte(compiler, is_safe_index(compiler, acc) ? KOP_GETFA_U : KOP_GETFA);
             emit_byte(compiler, target_reg);
             emit_byte(compiler, arr_reg);
             emit_byte(compiler, idx_reg);
             
-            compiler->current_reg_count -= 2;
+            free_reg(compiler, arr_reg); free_reg(compiler, idx_reg);
             break;
         }
         case KAST_NODE_CALL: {
             KastCall* call = (KastCall*)expr;
+            if (try_inline_call(compiler, call, target_reg)) break;
             
             if (call->callee->type == KAST_NODE_MEMBER_ACCESS) {
                 KastMemberAccess* acc = (KastMemberAccess*)call->callee;
@@ -508,10 +1783,10 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                      
                      // Push Arguments
                      for (size_t i = 0; i < call->arg_count; i++) {
-                        int arg_reg = compiler->current_reg_count++;
+                        int arg_reg = alloc_reg(compiler);
                         compile_expression(compiler, (KastExpression*)call->args[i], arg_reg);
                         emit_instruction(compiler, KOP_PUSH, 0, arg_reg, 0);
-                        compiler->current_reg_count--;
+                        free_reg(compiler, arg_reg);
                      }
                      
                      int self_reg = resolve_local(compiler, "self");
@@ -536,8 +1811,8 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                      emit_byte(compiler, (uint8_t)call->arg_count);
                      emit_byte(compiler, 0);
                      
-                } else {
-                    int obj_reg = compiler->current_reg_count++;
+                } else if (!compile_array_method(compiler, call, target_reg)) {
+                    int obj_reg = alloc_reg(compiler);
                     compile_expression(compiler, (KastExpression*)acc->object, obj_reg);
                     
                     // Push Object (Self/Module)
@@ -545,10 +1820,10 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                     
                     // Push Arguments
                     for (size_t i = 0; i < call->arg_count; i++) {
-                        int arg_reg = compiler->current_reg_count++;
+                        int arg_reg = alloc_reg(compiler);
                         compile_expression(compiler, (KastExpression*)call->args[i], arg_reg);
                         emit_instruction(compiler, KOP_PUSH, 0, arg_reg, 0);
-                        compiler->current_reg_count--;
+                        free_reg(compiler, arg_reg);
                     }
                     
                     int name_idx = add_string_constant(compiler, acc->member_name);
@@ -561,7 +1836,7 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                     emit_byte(compiler, (uint8_t)(name_idx & 0xFF));
                     emit_byte(compiler, (uint8_t)call->arg_count);
                     
-                    compiler->current_reg_count--; // Release obj_reg
+                    free_reg(compiler, obj_reg); // Release obj_reg
                 }
 
             } else {
@@ -578,10 +1853,10 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                      
                      // Push Arguments
                      for (size_t i = 0; i < call->arg_count; i++) {
-                        int arg_reg = compiler->current_reg_count++;
+                        int arg_reg = alloc_reg(compiler);
                         compile_expression(compiler, (KastExpression*)call->args[i], arg_reg);
                         emit_instruction(compiler, KOP_PUSH, 0, arg_reg, 0);
-                        compiler->current_reg_count--;
+                        free_reg(compiler, arg_reg);
                      }
                      
                      int self_reg = resolve_local(compiler, "self");
@@ -610,10 +1885,10 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                 } else {
                     // Standard function call
                     for (size_t i = 0; i < call->arg_count; i++) {
-                        int arg_reg = compiler->current_reg_count++;
+                        int arg_reg = alloc_reg(compiler);
                         compile_expression(compiler, (KastExpression*)call->args[i], arg_reg);
                         emit_instruction(compiler, KOP_PUSH, 0, arg_reg, 0);
-                        compiler->current_reg_count--;
+                        free_reg(compiler, arg_reg);
                     }
                     
                     compile_expression(compiler, (KastExpression*)call->callee, target_reg);
@@ -637,7 +1912,7 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                     return;
                 }
                 
-                int size_reg = compiler->current_reg_count++;
+                int size_reg = alloc_reg(compiler);
                 compile_expression(compiler, (KastExpression*)n->args[0], size_reg);
                 
                 int type_idx = add_string_constant(compiler, n->class_name);
@@ -648,14 +1923,14 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                 emit_byte(compiler, (uint8_t)(type_idx >> 8));
                 emit_byte(compiler, (uint8_t)(type_idx & 0xFF));
                 
-                compiler->current_reg_count--;
+                free_reg(compiler, size_reg);
             } else {
                 // Push arguments first
                 for (size_t i = 0; i < n->arg_count; i++) {
-                    int arg_reg = compiler->current_reg_count++;
+                    int arg_reg = alloc_reg(compiler);
                     compile_expression(compiler, (KastExpression*)n->args[i], arg_reg);
                     emit_instruction(compiler, KOP_PUSH, 0, arg_reg, 0);
-                    compiler->current_reg_count--;
+                    free_reg(compiler, arg_reg);
                 }
 
                 // Strip generics from class name for runtime lookup (e.g., "Box<int>" -> "Box")
@@ -705,6 +1980,25 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                  return;
             }
 
+            int field_reg = scalar_field_reg(compiler, (KastNode*)expr);
+            if (field_reg != -1) {
+                if (field_reg != target_reg) emit_instruction(compiler, KOP_LOAD, target_reg, field_reg, 0);
+                break;
+            }
+
+            if (acc->object->type == KAST_NODE_IDENTIFIER) {
+                int object = resolve_local_index(compiler, ((KastIdentifier*)acc->object)->name);
+                if (object != -1 && use_hoisted(compiler, acc->member_name, object, target_reg)) break;
+            }
+
+            int arr_reg, idx_reg;
+            if (compile_element_operands(compiler, acc, &arr_reg, &idx_reg)) {
+                int idx = add_string_constant(compiler, acc->member_name);
+                emit_element_field(compiler, KOP_GETAF, target_reg, arr_reg, idx_reg, idx);
+                free_reg(compiler, arr_reg); free_reg(compiler, idx_reg);
+                break;
+            }
+
             compile_expression(compiler, (KastExpression*)acc->object, target_reg);
             int idx = add_string_constant(compiler, acc->member_name);
             emit_byte(compiler, KOP_GETF);
@@ -723,7 +2017,7 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                  if (reg != target_reg) {
                      emit_instruction(compiler, KOP_LOAD, target_reg, reg, 0);
                  }
-             } else {
+             } else if (!use_hoisted(compiler, acc->class_name, -1, target_reg)) {
                  // Global or Class Name
                  int idx = add_string_constant(compiler, acc->class_name);
                  emit_byte(compiler, KOP_GET_GLOBAL);
@@ -757,16 +2051,19 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                     }
                     
                     // 2. Increment/Decrement reg
-                    int temp_reg = compiler->current_reg_count++;
+                    int temp_reg = alloc_reg(compiler);
                     emit_byte(compiler, KOP_LDI);
                     emit_byte(compiler, temp_reg);
                     emit_byte(compiler, 1);
                     emit_byte(compiler, 0);
                     
                     uint8_t op = (post->operator == KORELIN_TOKEN_INC) ? KOP_ADD : KOP_SUB;
+                    if (local_static_type(compiler, ident->name) == KTYPE_INT) {
+                        op = (op == KOP_ADD) ? KOP_ADD_INT : KOP_SUB_INT;
+                    }
                     emit_instruction(compiler, op, reg, reg, temp_reg); // reg = reg +/- 1
                     
-                    compiler->current_reg_count--;
+                    free_reg(compiler, temp_reg);
                 } else {
                     // Global
                     // 1. Get Global to target_reg
@@ -777,8 +2074,8 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                     emit_byte(compiler, (uint8_t)(idx & 0xFF));
                     
                     // 2. Calc New Value
-                    int temp_reg = compiler->current_reg_count++;
-                    int one_reg = compiler->current_reg_count++;
+                    int temp_reg = alloc_reg(compiler);
+                    int one_reg = alloc_reg(compiler);
                     emit_byte(compiler, KOP_LDI);
                     emit_byte(compiler, one_reg);
                     emit_byte(compiler, 1);
@@ -793,13 +2090,34 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                     emit_byte(compiler, (uint8_t)(idx >> 8));
                     emit_byte(compiler, (uint8_t)(idx & 0xFF));
                     
-                    compiler->current_reg_count -= 2;
+                    free_reg(compiler, temp_reg); free_reg(compiler, one_reg);
                 }
+            } else if (post->operand->type == KAST_NODE_MEMBER_ACCESS &&
+                       ((KastMemberAccess*)post->operand)->object->type == KAST_NODE_ARRAY_ACCESS) {
+                KastMemberAccess* acc = (KastMemberAccess*)post->operand;
+                int arr_reg, idx_reg;
+                compile_element_operands(compiler, acc, &arr_reg, &idx_reg);
+                int idx = add_string_constant(compiler, acc->member_name);
+                emit_element_field(compiler, KOP_GETAF, target_reg, arr_reg, idx_reg, idx);
+                
+                int temp_reg = alloc_reg(compiler);
+                int one_reg = alloc_reg(compiler);
+                emit_byte(compiler, KOP_LDI);
+                emit_byte(compiler, one_reg);
+                emit_byte(compiler, 1);
+                emit_byte(compiler, 0);
+                
+                uint8_t op = (post->operator == KORELIN_TOKEN_INC) ? KOP_ADD : KOP_SUB;
+                emit_instruction(compiler, op, temp_reg, target_reg, one_reg);
+                emit_element_field(compiler, KOP_PUTAF, arr_reg, idx_reg, temp_reg, idx);
+                
+                free_reg(compiler, arr_reg); free_reg(compiler, idx_reg);
+                free_reg(compiler, temp_reg); free_reg(compiler, one_reg);
             } else if (post->operand->type == KAST_NODE_MEMBER_ACCESS) {
                 KastMemberAccess* acc = (KastMemberAccess*)post->operand;
                 
                 // 1. Compile Object
-                int obj_reg = compiler->current_reg_count++;
+                int obj_reg = alloc_reg(compiler);
                 compile_expression(compiler, (KastExpression*)acc->object, obj_reg);
                 
                 int idx = add_string_constant(compiler, acc->member_name);
@@ -812,8 +2130,8 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                 emit_byte(compiler, (uint8_t)(idx & 0xFF));
                 
                 // 3. Calc New Value
-                int temp_reg = compiler->current_reg_count++;
-                int one_reg = compiler->current_reg_count++;
+                int temp_reg = alloc_reg(compiler);
+                int one_reg = alloc_reg(compiler);
                 emit_byte(compiler, KOP_LDI);
                 emit_byte(compiler, one_reg);
                 emit_byte(compiler, 1);
@@ -829,7 +2147,7 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
                 emit_byte(compiler, (uint8_t)(idx >> 8));
                 emit_byte(compiler, (uint8_t)(idx & 0xFF));
                 
-                compiler->current_reg_count -= 3;
+                free_reg(compiler, obj_reg); free_reg(compiler, temp_reg); free_reg(compiler, one_reg);
             } else {
                 printf("Compile Error: Invalid lvalue for postfix operation\n");
             }
@@ -839,20 +2157,44 @@ static void compile_expression(CompilerState* compiler, KastExpression* expr, in
     }
 }
 
+/**
+ * @brief 發射 FUNCTION 指令 (創建函數對象並壓棧)
+ * FUNCTION NameIdx(16), Entry(24), Arity(8), Access(8), FrameSize(16)
+ */
+static void emit_function_object(CompilerState* compiler, int name_idx, uint32_t start_addr,
+                                 int arity, int access, int frame_size) {
+    if (frame_size < arity) frame_size = arity;
+    emit_byte(compiler, KOP_FUNCTION);
+    emit_byte(compiler, (uint8_t)(name_idx >> 8));
+    emit_byte(compiler, (uint8_t)(name_idx & 0xFF));
+    emit_byte(compiler, (uint8_t)(start_addr >> 16));
+    emit_byte(compiler, (uint8_t)(start_addr >> 8));
+    emit_byte(compiler, (uint8_t)(start_addr & 0xFF));
+    emit_byte(compiler, (uint8_t)arity);
+    emit_byte(compiler, (uint8_t)access);
+    emit_byte(compiler, (uint8_t)(frame_size >> 8));
+    emit_byte(compiler, (uint8_t)(frame_size & 0xFF));
+}
+
 static void compile_function_decl(CompilerState* compiler, KastFunctionDecl* func) {
     int jmp_patch = emit_jump(compiler, KOP_JMP, 0);
     uint32_t start_addr = compiler->chunk->count;
     
     Local saved_locals[256];
+    RegisterSnapshot saved_regs;
     int saved_local_count = compiler->local_count;
     int saved_scope_depth = compiler->scope_depth;
-    int saved_reg_count = compiler->current_reg_count;
-    char* saved_class_name = compiler->current_class_name;
+    const char* saved_class_name = compiler->current_class_name;
     memcpy(saved_locals, compiler->locals, sizeof(saved_locals));
     
     compiler->local_count = 0;
     compiler->scope_depth = 1;
-    compiler->current_reg_count = 0;
+    enter_function_registers(compiler, &saved_regs);
+
+    KTypeEnv types;
+    KTypeEnv* saved_types = compiler->types;
+    kopt_infer_local_types(&types, func->args, func->arg_count, (KastNode*)func->body);
+    compiler->types = &types;
     
     if (func->parent_class_name) {
         compiler->current_class_name = func->parent_class_name;
@@ -867,22 +2209,19 @@ static void compile_function_decl(CompilerState* compiler, KastFunctionDecl* fun
     emit_byte(compiler, KOP_RET);
     emit_byte(compiler, 0); emit_byte(compiler, 0); emit_byte(compiler, 0);
     
+    compiler->types = saved_types;
+    kopt_free_type_env(&types);
+    for (int i = 0; i < compiler->local_count; i++) free(compiler->locals[i].name);
     compiler->local_count = saved_local_count;
     compiler->scope_depth = saved_scope_depth;
-    compiler->current_reg_count = saved_reg_count;
+    int frame_size = exit_function_registers(compiler, &saved_regs);
     compiler->current_class_name = saved_class_name;
     memcpy(compiler->locals, saved_locals, sizeof(saved_locals));
     patch_jump(compiler, jmp_patch, compiler->chunk->count);
+    mark_inline_ready(compiler, (KastNode*)func, NULL); // 函數體生成之後才可內聯，遞歸調用保持真正的調用
     
     int name_idx = add_string_constant(compiler, func->name);
-    emit_byte(compiler, KOP_FUNCTION);
-    emit_byte(compiler, (uint8_t)(name_idx >> 8));
-    emit_byte(compiler, (uint8_t)(name_idx & 0xFF));
-    emit_byte(compiler, (uint8_t)(start_addr >> 16));
-    emit_byte(compiler, (uint8_t)(start_addr >> 8));
-    emit_byte(compiler, (uint8_t)(start_addr & 0xFF));
-    emit_byte(compiler, (uint8_t)func->arg_count);
-    emit_byte(compiler, (uint8_t)func->access);
+    emit_function_object(compiler, name_idx, start_addr, (int)func->arg_count, (int)func->access, frame_size);
     
     if (func->parent_class_name) {
         // Out-of-class method definition
@@ -924,7 +2263,7 @@ static void compile_function_decl(CompilerState* compiler, KastFunctionDecl* fun
         // However, if we are at top level script, we don't want to leave junk on stack.
         // KOP_SET_GLOBAL pops it (via POP instruction I added manually in previous version, or implicitly?)
         // In original code:
-        // int reg = compiler->current_reg_count++;
+        // int reg = alloc_reg(compiler);
         // emit_instruction(compiler, KOP_POP, reg, 0, 0); 
         // emit_byte(compiler, KOP_SET_GLOBAL); ...
         
@@ -939,13 +2278,13 @@ static void compile_function_decl(CompilerState* compiler, KastFunctionDecl* fun
         // Let's assume KOP_METHOD consumes it.
         
     } else {
-        int reg = compiler->current_reg_count++;
+        int reg = alloc_reg(compiler);
         emit_instruction(compiler, KOP_POP, reg, 0, 0); 
         emit_byte(compiler, KOP_SET_GLOBAL);
         emit_byte(compiler, reg);
         emit_byte(compiler, (uint8_t)(name_idx >> 8));
         emit_byte(compiler, (uint8_t)(name_idx & 0xFF));
-        compiler->current_reg_count--;
+        free_reg(compiler, reg);
     }
 }
 
@@ -959,7 +2298,7 @@ static void compile_field_initializers(CompilerState* compiler, KastClassDecl* c
     for (size_t i = 0; i < cls->member_count; i++) {
         KastClassMember* member = cls->members[i];
         if (member->member_type == KAST_MEMBER_PROPERTY && member->init_value != NULL) {
-            int val_reg = compiler->current_reg_count++;
+            int val_reg = alloc_reg(compiler);
             compile_expression(compiler, (KastExpression*)member->init_value, val_reg);
             
             int name_idx = add_string_constant(compiler, member->name);
@@ -969,7 +2308,7 @@ static void compile_field_initializers(CompilerState* compiler, KastClassDecl* c
             emit_byte(compiler, (uint8_t)(name_idx >> 8));
             emit_byte(compiler, (uint8_t)(name_idx & 0xFF));
             
-            compiler->current_reg_count--;
+            free_reg(compiler, val_reg);
         }
     }
 }
@@ -981,8 +2320,9 @@ static void compile_class_decl(CompilerState* compiler, KastClassDecl* cls) {
     emit_byte(compiler, (uint8_t)(name_idx >> 8));
     emit_byte(compiler, (uint8_t)(name_idx & 0xFF));
     
-    char* prev_class_name = compiler->current_class_name;
+    const char* prev_class_name = compiler->current_class_name;
     compiler->current_class_name = cls->name;
+    mark_inline_ready(compiler, NULL, cls->name); // 方法只能在類定義之後通過實例調用
     
     if (cls->parent_name) {
         int parent_idx = add_string_constant(compiler, cls->parent_name);
@@ -1006,9 +2346,9 @@ static void compile_class_decl(CompilerState* compiler, KastClassDecl* cls) {
             uint32_t start_addr = compiler->chunk->count;
             
             Local saved_locals[256];
+            RegisterSnapshot saved_regs;
             int saved_local_count = compiler->local_count;
             int saved_scope_depth = compiler->scope_depth;
-            int saved_reg_count = compiler->current_reg_count;
             
             if (saved_local_count > 0) {
                 memcpy(saved_locals, compiler->locals, saved_local_count * sizeof(Local));
@@ -1016,7 +2356,12 @@ static void compile_class_decl(CompilerState* compiler, KastClassDecl* cls) {
             
             compiler->local_count = 0;
             compiler->scope_depth = 1;
-            compiler->current_reg_count = 0;
+            enter_function_registers(compiler, &saved_regs);
+
+            KTypeEnv types;
+            KTypeEnv* saved_types = compiler->types;
+            kopt_infer_local_types(&types, member->args, member->arg_count, (KastNode*)member->body);
+            compiler->types = &types;
             
             for (size_t j = 0; j < member->arg_count; j++) {
                 KastVarDecl* arg = (KastVarDecl*)member->args[j];
@@ -1032,9 +2377,13 @@ static void compile_class_decl(CompilerState* compiler, KastClassDecl* cls) {
             emit_byte(compiler, KOP_RET);
             emit_byte(compiler, 0); emit_byte(compiler, 0); emit_byte(compiler, 0);
             
+            compiler->types = saved_types;
+            kopt_free_type_env(&types);
+
+            for (int k = 0; k < compiler->local_count; k++) free(compiler->locals[k].name);
             compiler->local_count = saved_local_count;
             compiler->scope_depth = saved_scope_depth;
-            compiler->current_reg_count = saved_reg_count;
+            int frame_size = exit_function_registers(compiler, &saved_regs);
             
             if (saved_local_count > 0) {
                 memcpy(compiler->locals, saved_locals, saved_local_count * sizeof(Local));
@@ -1042,14 +2391,8 @@ static void compile_class_decl(CompilerState* compiler, KastClassDecl* cls) {
             patch_jump(compiler, jmp_patch, compiler->chunk->count);
             
             int method_name_idx = add_string_constant(compiler, member->name);
-            emit_byte(compiler, KOP_FUNCTION);
-            emit_byte(compiler, (uint8_t)(method_name_idx >> 8));
-            emit_byte(compiler, (uint8_t)(method_name_idx & 0xFF));
-            emit_byte(compiler, (uint8_t)(start_addr >> 16));
-            emit_byte(compiler, (uint8_t)(start_addr >> 8));
-            emit_byte(compiler, (uint8_t)(start_addr & 0xFF));
-            emit_byte(compiler, (uint8_t)member->arg_count);
-            emit_byte(compiler, (uint8_t)member->access);
+            emit_function_object(compiler, method_name_idx, start_addr, (int)member->arg_count,
+                                 (int)member->access, frame_size);
             
             emit_byte(compiler, KOP_METHOD);
             emit_byte(compiler, (uint8_t)(name_idx >> 8));
@@ -1074,14 +2417,16 @@ static void compile_class_decl(CompilerState* compiler, KastClassDecl* cls) {
             uint32_t start_addr = compiler->chunk->count;
             
             Local saved_locals[256];
+            RegisterSnapshot saved_regs;
             int saved_local_count = compiler->local_count;
             int saved_scope_depth = compiler->scope_depth;
-            int saved_reg_count = compiler->current_reg_count;
             if (saved_local_count > 0) memcpy(saved_locals, compiler->locals, saved_local_count * sizeof(Local));
 
             compiler->local_count = 0;
             compiler->scope_depth = 1;
-            compiler->current_reg_count = 0;
+            enter_function_registers(compiler, &saved_regs);
+            KTypeEnv* saved_types = compiler->types;
+            compiler->types = NULL;
             
             add_local(compiler, "self");
             
@@ -1089,24 +2434,20 @@ static void compile_class_decl(CompilerState* compiler, KastClassDecl* cls) {
             
             emit_byte(compiler, KOP_RET);
             emit_byte(compiler, 0); emit_byte(compiler, 0); emit_byte(compiler, 0);
+            compiler->types = saved_types;
             
+            for (int k = 0; k < compiler->local_count; k++) free(compiler->locals[k].name);
             compiler->local_count = saved_local_count;
             compiler->scope_depth = saved_scope_depth;
-            compiler->current_reg_count = saved_reg_count;
+            int frame_size = exit_function_registers(compiler, &saved_regs);
             if (saved_local_count > 0) memcpy(compiler->locals, saved_locals, saved_local_count * sizeof(Local));
             
             patch_jump(compiler, jmp_patch, compiler->chunk->count);
              
              int method_name_idx = add_string_constant(compiler, "_init");
              
-             emit_byte(compiler, KOP_FUNCTION);
-            emit_byte(compiler, (uint8_t)(method_name_idx >> 8));
-            emit_byte(compiler, (uint8_t)(method_name_idx & 0xFF));
-            emit_byte(compiler, (uint8_t)(start_addr >> 16));
-            emit_byte(compiler, (uint8_t)(start_addr >> 8));
-            emit_byte(compiler, (uint8_t)(start_addr & 0xFF));
-            emit_byte(compiler, 1); // arg_count = 1 (self)
-            emit_byte(compiler, 0); // Access: Public
+             // arg_count = 1 (self), Access: Public
+             emit_function_object(compiler, method_name_idx, start_addr, 1, 0, frame_size);
             
             emit_byte(compiler, KOP_METHOD);
             emit_byte(compiler, (uint8_t)(name_idx >> 8));
@@ -1119,8 +2460,235 @@ static void compile_class_decl(CompilerState* compiler, KastClassDecl* cls) {
     compiler->current_class_name = prev_class_name;
 }
 
-static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
-    if (!stmt) return;
+// --- switch 分派 ---
+
+#define SWITCH_MIN_CASES 4     /**< case 少於此數時逐個比較 */
+#define SWITCH_TABLE_DENSITY 3 /**< 跳轉表槽數不超過 case 數的倍數 */
+#define SWITCH_SEARCH_LEAF 3   /**< 二分查找區間不超過此數時逐個比較 */
+#define SWITCH_SEARCH_LIMIT 9007199254740992LL /**< 2^53：通用比較按 double 進行，超出此範圍的值不能精確排序 */
+
+/** @brief 待修補的跳轉，case_index 為 -1 表示落空 (default 或 switch 結尾) */
+typedef struct {
+    int patch;
+    int case_index;
+} SwitchJump;
+
+typedef struct {
+    SwitchJump* items;
+    size_t count;
+    size_t capacity;
+} SwitchJumps;
+
+/** @brief case 的字面量值 */
+typedef struct {
+    int64_t key;     /**< 整數值；字符串 case 中為桶號 */
+    const char* str; /**< 字符串值，整數 case 中為 NULL */
+    int case_index;
+} SwitchKey;
+
+static void switch_add_jump(SwitchJumps* jumps, int patch, int case_index) {
+    if (jumps->count >= jumps->capacity) {
+        jumps->capacity = jumps->capacity == 0 ? 16 : jumps->capacity * 2;
+        jumps->items = (SwitchJump*)realloc(jumps->items, jumps->capacity * sizeof(SwitchJump));
+    }
+    jumps->items[jumps->count].patch = patch;
+    jumps->items[jumps->count].case_index = case_index;
+    jumps->count++;
+}
+
+static void switch_jump(CompilerState* compiler, SwitchJumps* jumps, uint8_t op, int reg, int case_index) {
+    switch_add_jump(jumps, emit_jump(compiler, op, (uint8_t)reg), case_index);
+}
+
+static int compare_int_keys(const void* a, const void* b) {
+    const SwitchKey* x = (const SwitchKey*)a;
+    const SwitchKey* y = (const SwitchKey*)b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return x->case_index - y->case_index;
+}
+
+static int compare_string_keys(const void* a, const void* b) {
+    const SwitchKey* x = (const SwitchKey*)a;
+    const SwitchKey* y = (const SwitchKey*)b;
+    int order = strcmp(x->str, y->str);
+    return order != 0 ? order : x->case_index - y->case_index;
+}
+
+/**
+ * @brief 收集 case 的字面量值
+ * 所有 case 都是整數字面量 (或都是字符串字面量) 時排序並去重，同值只保留第一個 case，
+ * 與逐個比較時先匹配者優先一致。
+ * @return 去重後的個數，有非字面量或類型混合的 case 時返回 -1
+ */
+static int collect_switch_keys(KastSwitch* kswitch, bool* strings, SwitchKey** out) {
+    size_t n = kswitch->case_count;
+    SwitchKey* keys = (SwitchKey*)malloc(n * sizeof(SwitchKey));
+    size_t string_count = 0;
+    for (size_t i = 0; i < n; i++) {
+        KastNode* value = kswitch->cases[i].value;
+        if (!value || value->type != KAST_NODE_LITERAL) {
+            free(keys);
+            return -1;
+        }
+        KastLiteral* lit = (KastLiteral*)value;
+        keys[i].key = 0;
+        keys[i].str = NULL;
+        keys[i].case_index = (int)i;
+        if (lit->token.type == KORELIN_TOKEN_INT) {
+            keys[i].key = atoll(lit->token.value);
+        } else if (lit->token.type == KORELIN_TOKEN_STRING) {
+            keys[i].str = lit->token.value;
+            string_count++;
+        } else {
+            free(keys);
+            return -1;
+        }
+    }
+    if (string_count != 0 && string_count != n) {
+        free(keys);
+        return -1;
+    }
+
+    *strings = string_count > 0;
+    qsort(keys, n, sizeof(SwitchKey), *strings ? compare_string_keys : compare_int_keys);
+    int count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (count > 0 && (*strings ? strcmp(keys[i].str, keys[count - 1].str) == 0
+                                   : keys[i].key == keys[count - 1].key)) continue;
+        keys[count++] = keys[i];
+    }
+    *out = keys;
+    return count;
+}
+
+/** @brief 逐個求值 case 表達式並用 EQ 比較 (任意 case 表達式) */
+static void compile_switch_chain(CompilerState* compiler, KastSwitch* kswitch, int val_reg, SwitchJumps* jumps) {
+    for (size_t i = 0; i < kswitch->case_count; i++) {
+        int case_reg = alloc_reg(compiler);
+        compile_expression(compiler, (KastExpression*)kswitch->cases[i].value, case_reg);
+        emit_instruction(compiler, KOP_EQ, case_reg, val_reg, case_reg);
+        switch_jump(compiler, jumps, KOP_JNZ, case_reg, (int)i);
+        free_reg(compiler, case_reg);
+    }
+    switch_jump(compiler, jumps, KOP_JMP, 0, -1);
+}
+
+/** @brief 稠密整數 case：JTAB 按 值 - low 直接跳到對應的 JMP 槽 */
+static void compile_switch_table(CompilerState* compiler, int val_reg, SwitchKey* keys, int key_count, SwitchJumps* jumps) {
+    int64_t low = keys[0].key;
+    int count = (int)(keys[key_count - 1].key - low + 1);
+    emit_byte(compiler, KOP_JTAB);
+    emit_byte(compiler, (uint8_t)val_reg);
+    emit_byte(compiler, (uint8_t)((low >> 8) & 0xFF));
+    emit_byte(compiler, (uint8_t)(low & 0xFF));
+    emit_byte(compiler, (uint8_t)(count >> 8));
+    emit_byte(compiler, (uint8_t)(count & 0xFF));
+    int k = 0;
+    for (int slot = 0; slot < count; slot++) {
+        int case_index = -1;
+        if (keys[k].key == low + slot) case_index = keys[k++].case_index;
+        switch_jump(compiler, jumps, KOP_JMP, 0, case_index);
+    }
+    switch_jump(compiler, jumps, KOP_JMP, 0, -1);
+}
+
+/**
+ * @brief 稀疏整數 case：按排序後的值二分查找
+ * LT 對非數值返回 false、EQ 對不同類型返回 false，因此任意類型的 switch 值都與逐個比較結果一致。
+ * @param typed switch 值已證明是 int，使用不檢查標籤的 LT_INT / EQ_INT
+ */
+static void compile_switch_search(CompilerState* compiler, int val_reg, SwitchKey* keys, int lo, int hi,
+                                  bool typed, SwitchJumps* jumps) {
+    int tmp = alloc_reg(compiler);
+    if (hi - lo <= SWITCH_SEARCH_LEAF) {
+        for (int i = lo; i < hi; i++) {
+            emit_load_int(compiler, tmp, keys[i].key);
+            emit_instruction(compiler, typed ? KOP_EQ_INT : KOP_EQ, tmp, val_reg, tmp);
+            switch_jump(compiler, jumps, KOP_JNZ, tmp, keys[i].case_index);
+        }
+        switch_jump(compiler, jumps, KOP_JMP, 0, -1);
+        free_reg(compiler, tmp);
+        return;
+    }
+
+    int mid = lo + (hi - lo) / 2;
+    emit_load_int(compiler, tmp, keys[mid].key);
+    emit_instruction(compiler, typed ? KOP_LT_INT : KOP_LT, tmp, val_reg, tmp);
+    int to_lower = emit_jump(compiler, KOP_JNZ, tmp);
+    free_reg(compiler, tmp);
+    compile_switch_search(compiler, val_reg, keys, mid, hi, typed, jumps);
+    patch_jump(compiler, to_lower, compiler->chunk->count);
+    compile_switch_search(compiler, val_reg, keys, lo, mid, typed, jumps);
+}
+
+/**
+ * @brief 字符串 case：JHASH 按 switch_hash 分桶，桶內逐個比較
+ * 非字符串的值走落空槽。
+ */
+static void compile_switch_hash(CompilerState* compiler, int val_reg, SwitchKey* keys, int key_count, SwitchJumps* jumps) {
+    int buckets = 1;
+    while (buckets < key_count) buckets <<= 1;
+    for (int i = 0; i < key_count; i++) keys[i].key = switch_hash(keys[i].str) % (uint32_t)buckets;
+    qsort(keys, (size_t)key_count, sizeof(SwitchKey), compare_int_keys);
+
+    emit_byte(compiler, KOP_JHASH);
+    emit_byte(compiler, (uint8_t)val_reg);
+    emit_byte(compiler, (uint8_t)(buckets >> 8));
+    emit_byte(compiler, (uint8_t)(buckets & 0xFF));
+    int* slots = (int*)malloc((size_t)buckets * sizeof(int));
+    for (int b = 0; b < buckets; b++) slots[b] = emit_jump(compiler, KOP_JMP, 0);
+    switch_jump(compiler, jumps, KOP_JMP, 0, -1);
+
+    int tmp = alloc_reg(compiler);
+    int k = 0;
+    for (int b = 0; b < buckets; b++) {
+        if (k >= key_count || keys[k].key != b) {
+            switch_add_jump(jumps, slots[b], -1);
+            continue;
+        }
+        patch_jump(compiler, slots[b], compiler->chunk->count);
+        for (; k < key_count && keys[k].key == b; k++) {
+            int idx = add_string_constant(compiler, keys[k].str);
+            emit_byte(compiler, KOP_LDC);
+            emit_byte(compiler, (uint8_t)tmp);
+            emit_byte(compiler, (uint8_t)(idx >> 8));
+            emit_byte(compiler, (uint8_t)(idx & 0xFF));
+            emit_instruction(compiler, KOP_EQ, tmp, val_reg, tmp);
+            switch_jump(compiler, jumps, KOP_JNZ, tmp, keys[k].case_index);
+        }
+        switch_jump(compiler, jumps, KOP_JMP, 0, -1);
+    }
+    free_reg(compiler, tmp);
+    free(slots);
+}
+
+/**
+ * @brief 生成 switch 的分派代碼
+ * 全部 case 為整數字面量時，稠密的用跳轉表、稀疏的用二分查找；全部為字符串字面量時用哈希分桶；
+ * 其他情況或 case 很少時逐個比較。
+ */
+static void compile_switch_dispatch(CompilerState* compiler, KastSwitch* kswitch, int val_reg, SwitchJumps* jumps) {
+    SwitchKey* keys = NULL;
+    bool strings = false;
+    int key_count = kswitch->case_count >= SWITCH_MIN_CASES ? collect_switch_keys(kswitch, &strings, &keys) : -1;
+
+    if (key_count >= SWITCH_MIN_CASES && strings) {
+        compile_switch_hash(compiler, val_reg, keys, key_count, jumps);
+    } else if (key_count >= SWITCH_MIN_CASES && key_count * SWITCH_TABLE_DENSITY < UINT16_MAX &&
+               keys[0].key >= INT16_MIN && keys[0].key <= INT16_MAX &&
+               keys[key_count - 1].key < keys[0].key + (int64_t)key_count * SWITCH_TABLE_DENSITY) {
+        compile_switch_table(compiler, val_reg, keys, key_count, jumps);
+    } else if (key_count >= SWITCH_MIN_CASES && keys[0].key >= -SWITCH_SEARCH_LIMIT &&
+               keys[key_count - 1].key <= SWITCH_SEARCH_LIMIT) {
+        bool typed = expression_type(compiler, kswitch->condition) == KTYPE_INT;
+        compile_switch_search(compiler, val_reg, keys, 0, key_count, typed, jumps);
+    } else {
+        compile_switch_chain(compiler, kswitch, val_reg, jumps);
+    }
+    free(keys);
+}
+
+static void compile_statement_body(CompilerState* compiler, KastStatement* stmt) {
     switch (stmt->base.type) {
         case KAST_NODE_IMPORT: {
             KastImport* imp = (KastImport*)stmt;
@@ -1139,7 +2707,7 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
             }
             
             int idx = add_string_constant(compiler, full_path);
-            int reg = compiler->current_reg_count++; // Temp reg
+            int reg = alloc_reg(compiler); // Temp reg
             
             // IMPORT Rd, NameIdx
             emit_byte(compiler, KOP_IMPORT);
@@ -1152,7 +2720,7 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
             // For `import os`, we bind `os`.
             // Usually the last part is the name unless alias is used (AST has alias field but we check logic)
             
-            char* bind_name = imp->alias ? imp->alias : imp->path_parts[imp->part_count - 1];
+            const char* bind_name = imp->alias ? imp->alias : imp->path_parts[imp->part_count - 1];
             int bind_idx = add_string_constant(compiler, bind_name);
             
             // SET_GLOBAL Reg, NameIdx
@@ -1161,7 +2729,7 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
             emit_byte(compiler, (uint8_t)(bind_idx >> 8));
             emit_byte(compiler, (uint8_t)(bind_idx & 0xFF));
             
-            compiler->current_reg_count--; // Free reg
+            free_reg(compiler, reg); // Free reg
             free(full_path);
             break;
         }
@@ -1173,7 +2741,7 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
                 add_local(compiler, decl->name);
                 reg = resolve_local(compiler, decl->name);
             } else {
-                reg = compiler->current_reg_count++;
+                reg = alloc_reg(compiler);
             }
 
             if (decl->init_value) {
@@ -1191,6 +2759,13 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
                     emit_byte(compiler, (uint8_t)(type_idx >> 8));
                     emit_byte(compiler, (uint8_t)(type_idx & 0xFF));
                     emit_byte(compiler, 0); // arg_count = 0
+                } else if (strcmp(t, "int") == 0 && !decl->is_array) {
+                    // Registers are reused, so primitives must not inherit a stale value
+                    emit_instruction(compiler, KOP_LDI, reg, 0, 0);
+                } else if (strcmp(t, "bool") == 0 && !decl->is_array) {
+                    emit_instruction(compiler, KOP_LDB, reg, 0, 0);
+                } else {
+                    emit_instruction(compiler, KOP_LDN, reg, 0, 0);
                 }
             }
             
@@ -1200,19 +2775,29 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
                 emit_byte(compiler, reg);
                 emit_byte(compiler, (uint8_t)(idx >> 8));
                 emit_byte(compiler, (uint8_t)(idx & 0xFF));
-                compiler->current_reg_count--;
+                free_reg(compiler, reg);
             }
             break;
         }
         case KAST_NODE_RETURN: {
             KastReturn* ret = (KastReturn*)stmt;
+            InlineFrame* frame = compiler->inline_frame;
+            if (frame) {
+                compile_expression(compiler, (KastExpression*)ret->value, frame->result_reg);
+                if (frame->exit_count == frame->exit_capacity) {
+                    frame->exit_capacity = frame->exit_capacity ? frame->exit_capacity * 2 : 4;
+                    frame->exits = (int*)realloc(frame->exits, frame->exit_capacity * sizeof(int));
+                }
+                frame->exits[frame->exit_count++] = emit_jump(compiler, KOP_JMP, 0);
+                break;
+            }
             if (ret->value) {
-                int res_reg = compiler->current_reg_count++;
+                int res_reg = alloc_reg(compiler);
                 compile_expression(compiler, (KastExpression*)ret->value, res_reg);
                 if (res_reg != 0) {
                      emit_instruction(compiler, KOP_LOAD, 0, res_reg, 0);
                 }
-                compiler->current_reg_count--;
+                free_reg(compiler, res_reg);
             }
             emit_byte(compiler, KOP_RET);
             emit_byte(compiler, 0); emit_byte(compiler, 0); emit_byte(compiler, 0);
@@ -1222,9 +2807,9 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
         case KAST_NODE_ASSIGNMENT:
         case KAST_NODE_BINARY_OP:
         case KAST_NODE_MEMBER_ACCESS: {
-            int reg = compiler->current_reg_count++;
+            int reg = alloc_reg(compiler);
             compile_expression(compiler, (KastExpression*)stmt, reg);
-            compiler->current_reg_count--;
+            free_reg(compiler, reg);
             break;
         }
         case KAST_NODE_TRY_CATCH: {
@@ -1239,7 +2824,7 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
             
             patch_jump(compiler, try_instr, compiler->chunk->count);
             
-            int ex_reg = compiler->current_reg_count++;
+            int ex_reg = alloc_reg(compiler);
             emit_byte(compiler, KOP_GETEXCEPTION);
             emit_byte(compiler, ex_reg);
             
@@ -1251,18 +2836,18 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
                 
                 int type_name_idx = add_string_constant(compiler, catch_block->error_type);
                 
-                int class_reg = compiler->current_reg_count++;
+                int class_reg = alloc_reg(compiler);
                 emit_byte(compiler, KOP_GET_GLOBAL);
                 emit_byte(compiler, class_reg);
                 emit_byte(compiler, (uint8_t)(type_name_idx >> 8));
                 emit_byte(compiler, (uint8_t)(type_name_idx & 0xFF));
                 
-                int result_reg = compiler->current_reg_count++;
+                int result_reg = alloc_reg(compiler);
                 emit_instruction(compiler, KOP_INSTANCEOF, result_reg, ex_reg, class_reg);
                 
                 int jump_next = emit_jump(compiler, KOP_JZ, result_reg);
                 
-                compiler->current_reg_count -= 2; 
+                free_reg(compiler, class_reg); free_reg(compiler, result_reg);
                 
                 // Bind exception variable if present
                 if (catch_block->variable_name) {
@@ -1278,8 +2863,9 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
                 compile_statement(compiler, (KastStatement*)catch_block->body);
                 
                 if (catch_block->variable_name) {
-                    compiler->local_count--;
-                    compiler->current_reg_count--; // Free local register
+                    Local* local = &compiler->locals[--compiler->local_count];
+                    if (!local->released) free_reg(compiler, local->reg_index); // Free local register
+                    free(local->name);
                 }
                 
                 if (exit_jump_count < 16) {
@@ -1292,7 +2878,7 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
             emit_byte(compiler, KOP_THROW);
             emit_byte(compiler, ex_reg);
             
-            compiler->current_reg_count--; 
+            free_reg(compiler, ex_reg);
             
             int end_offset = compiler->chunk->count;
             patch_jump(compiler, jump_over_catches, end_offset);
@@ -1303,32 +2889,25 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
         }
         case KAST_NODE_THROW: {
             KastThrow* thr = (KastThrow*)stmt;
-            int reg = compiler->current_reg_count++;
+            int reg = alloc_reg(compiler);
             compile_expression(compiler, (KastExpression*)thr->value, reg);
             emit_byte(compiler, KOP_THROW);
             emit_byte(compiler, reg);
-            compiler->current_reg_count--;
+            free_reg(compiler, reg);
             break;
         }
         case KAST_NODE_BLOCK: {
             KastBlock* block = (KastBlock*)stmt;
             compiler->scope_depth++; // Enter scope
             for (size_t i = 0; i < block->statement_count; i++) {
-                compile_statement(compiler, block->statements[i]);
+                if (!compile_scalar_object(compiler, block, i)) compile_statement(compiler, block->statements[i]);
+                // Locals not referenced by the remaining statements are dead: reuse their registers
+                release_dead_locals(compiler, block->statements + i + 1, block->statement_count - i - 1);
             }
             compiler->scope_depth--; // Exit scope
             
             // Pop locals defined in this scope
-            while (compiler->local_count > 0 && 
-                   compiler->locals[compiler->local_count - 1].depth > compiler->scope_depth) {
-                // For register-based VM, we effectively free the register by decrementing count
-                // provided the local was at the top.
-                // In this simple register allocator, locals are allocated sequentially.
-                // So popping the last local frees the last register.
-                compiler->current_reg_count--;
-                free(compiler->locals[compiler->local_count - 1].name);
-                compiler->local_count--;
-            }
+            pop_locals(compiler);
             break;
         }
         case KAST_NODE_FUNCTION_DECL: {
@@ -1349,6 +2928,18 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
             emit_byte(compiler, (uint8_t)(name_idx >> 8));
             emit_byte(compiler, (uint8_t)(name_idx & 0xFF));
             
+            // 字段按聲明順序登記，數組據此內聯存放元素
+            for (size_t i = 0; i < st->member_count; i++) {
+                KastClassMember* member = st->members[i];
+                if (member->member_type != KAST_MEMBER_PROPERTY || member->is_static) continue;
+                int field_idx = add_string_constant(compiler, member->name);
+                emit_byte(compiler, KOP_FIELD);
+                emit_byte(compiler, (uint8_t)(name_idx >> 8));
+                emit_byte(compiler, (uint8_t)(name_idx & 0xFF));
+                emit_byte(compiler, (uint8_t)(field_idx >> 8));
+                emit_byte(compiler, (uint8_t)(field_idx & 0xFF));
+            }
+            
             // 2. Compile inline variable declaration if exists
             if (st->init_var) {
                 compile_statement(compiler, st->init_var);
@@ -1357,7 +2948,7 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
         }
         case KAST_NODE_IF: {
              KastIf* kif = (KastIf*)stmt;
-             int reg = compiler->current_reg_count++;
+             int reg = alloc_reg(compiler);
              compile_expression(compiler, (KastExpression*)kif->condition, reg);
              int jump_else = emit_jump(compiler, KOP_JZ, reg);
              compile_statement(compiler, (KastStatement*)kif->then_branch);
@@ -1370,42 +2961,50 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
              } else {
                  patch_jump(compiler, jump_else, compiler->chunk->count);
              }
-             compiler->current_reg_count--;
+             free_reg(compiler, reg);
              break;
         }
         case KAST_NODE_WHILE: {
             KastWhile* kwhile = (KastWhile*)stmt;
             
-            int loop_start = compiler->chunk->count;
-            enter_loop(compiler, loop_start);
+            enter_loop(compiler, -1);
+            int hoist_mark = begin_loop_hoisting(compiler, (KastNode*)stmt, kwhile->condition, true);
 
-            int cond_reg = compiler->current_reg_count++;
-            
-            // Compile condition
+            // Guard: the first test, which also fills the hoisted registers
+            int cond_reg = alloc_reg(compiler);
+            compiler->hoist_guard = true;
             compile_expression(compiler, (KastExpression*)kwhile->condition, cond_reg);
-            
-            // Jump if false
+            compiler->hoist_guard = false;
             int jump_exit = emit_jump(compiler, KOP_JZ, cond_reg);
-            compiler->current_reg_count--; // Free cond_reg
+            free_reg(compiler, cond_reg);
+            enter_hoisted_body(compiler, hoist_mark);
             
             // Compile body
+            int body_start = compiler->chunk->count;
             compile_statement(compiler, kwhile->body);
+            resolve_continue(compiler, compiler->chunk->count);
             
-            // Jump back to start
-            int jump_loop = emit_jump(compiler, KOP_JMP, 0);
-            patch_jump(compiler, jump_loop, loop_start);
+            // Test again at the bottom and jump back while true
+            cond_reg = alloc_reg(compiler);
+            compile_expression(compiler, (KastExpression*)kwhile->condition, cond_reg);
+            int jump_loop = emit_jump(compiler, KOP_JNZ, cond_reg);
+            patch_jump(compiler, jump_loop, body_start);
+            free_reg(compiler, cond_reg);
             
             // Patch exit
             patch_jump(compiler, jump_exit, compiler->chunk->count);
             
             exit_loop(compiler);
+            end_loop_hoisting(compiler, hoist_mark);
             break;
         }
         case KAST_NODE_DO_WHILE: {
             KastDoWhile* kdo = (KastDoWhile*)stmt;
             
-            int loop_start = compiler->chunk->count;
             enter_loop(compiler, -1);
+            int hoist_mark = begin_loop_hoisting(compiler, (KastNode*)stmt, kdo->condition, false);
+            enter_hoisted_body(compiler, hoist_mark);
+            int loop_start = compiler->chunk->count;
             
             // Compile body
             compile_statement(compiler, kdo->body);
@@ -1414,52 +3013,37 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
             resolve_continue(compiler, cond_start);
             
             // Compile condition
-            int cond_reg = compiler->current_reg_count++;
+            int cond_reg = alloc_reg(compiler);
             compile_expression(compiler, (KastExpression*)kdo->condition, cond_reg);
             
             // Jump if true (continue loop)
             int jump_loop = emit_jump(compiler, KOP_JNZ, cond_reg);
             patch_jump(compiler, jump_loop, loop_start);
             
-            compiler->current_reg_count--;
+            free_reg(compiler, cond_reg);
             
             exit_loop(compiler);
+            end_loop_hoisting(compiler, hoist_mark);
             break;
         }
         case KAST_NODE_SWITCH: {
             KastSwitch* kswitch = (KastSwitch*)stmt;
             
             // Evaluate Condition
-            int val_reg = compiler->current_reg_count++;
+            int val_reg = alloc_reg(compiler);
             compile_expression(compiler, (KastExpression*)kswitch->condition, val_reg);
             
             // Enter breakable scope
             enter_loop(compiler, -1);
             
-            // Prepare jumps
-            int* body_jumps = (int*)malloc(kswitch->case_count * sizeof(int));
-            
-            for (size_t i = 0; i < kswitch->case_count; i++) {
-                // Compile Case Value
-                int case_reg = compiler->current_reg_count++;
-                compile_expression(compiler, (KastExpression*)kswitch->cases[i].value, case_reg);
-                
-                // Compare (val == case)
-                // Note: val_reg is 1st operand, case_reg is 2nd.
-                emit_instruction(compiler, KOP_EQ, case_reg, val_reg, case_reg); 
-                
-                // Jump to Body if Equal (JNZ)
-                body_jumps[i] = emit_jump(compiler, KOP_JNZ, case_reg);
-                
-                compiler->current_reg_count--; // Free case_reg
-            }
-            
-            // Default jump (if no match, go to default)
-            int default_jump = emit_jump(compiler, KOP_JMP, 0);
+            // Dispatch to bodies (patched once the bodies are placed)
+            SwitchJumps jumps = {NULL, 0, 0};
+            compile_switch_dispatch(compiler, kswitch, val_reg, &jumps);
             
             // Compile Bodies
+            int* body_start = (int*)malloc((kswitch->case_count + 1) * sizeof(int));
             for (size_t i = 0; i < kswitch->case_count; i++) {
-                patch_jump(compiler, body_jumps[i], compiler->chunk->count);
+                body_start[i] = compiler->chunk->count;
                 if (kswitch->cases[i].body) {
                     compile_statement(compiler, kswitch->cases[i].body);
                 }
@@ -1467,14 +3051,20 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
             }
             
             // Default Body
-            patch_jump(compiler, default_jump, compiler->chunk->count);
+            int default_start = compiler->chunk->count;
             if (kswitch->default_branch) {
                 compile_statement(compiler, kswitch->default_branch);
             }
             
+            for (size_t i = 0; i < jumps.count; i++) {
+                int case_index = jumps.items[i].case_index;
+                patch_jump(compiler, jumps.items[i].patch, case_index < 0 ? default_start : body_start[case_index]);
+            }
+            
             // Cleanup
-            free(body_jumps);
-            compiler->current_reg_count--; // Free val_reg
+            free(body_start);
+            free(jumps.items);
+            free_reg(compiler, val_reg); // Free val_reg
             
             exit_loop(compiler); // Patches breaks to here
             break;
@@ -1490,51 +3080,68 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
                 compile_statement(compiler, kfor->init);
             }
             
-            int loop_start = compiler->chunk->count;
             enter_loop(compiler, -1);
+            int hoist_mark = begin_loop_hoisting(compiler, (KastNode*)stmt, kfor->condition, true);
 
             int jump_exit = -1;
             
-            // Condition
+            // Guard: the first test, which also fills the hoisted registers
             if (kfor->condition) {
-                int cond_reg = compiler->current_reg_count++;
+                int cond_reg = alloc_reg(compiler);
+                compiler->hoist_guard = true;
                 compile_expression(compiler, (KastExpression*)kfor->condition, cond_reg);
+                compiler->hoist_guard = false;
                 jump_exit = emit_jump(compiler, KOP_JZ, cond_reg);
-                compiler->current_reg_count--;
+                free_reg(compiler, cond_reg);
             }
+            enter_hoisted_body(compiler, hoist_mark);
+            CountedLoop counted;
+            bool is_counted = begin_counted_loop(compiler, kfor, &counted);
+            bool in_bounds = begin_bounds_proof(compiler, kfor);
             
             // Body
+            int body_start = compiler->chunk->count;
             compile_statement(compiler, kfor->body);
+            if (in_bounds) end_bounds_proof(compiler);
             
             int increment_start = compiler->chunk->count;
             resolve_continue(compiler, increment_start);
             
-            // Increment
-            if (kfor->increment) {
-                int temp_reg = compiler->current_reg_count++;
-                compile_expression(compiler, (KastExpression*)kfor->increment, temp_reg);
-                compiler->current_reg_count--;
+            if (is_counted) {
+                // Increment, test and jump back in one instruction
+                end_counted_loop(compiler, &counted, body_start);
+            } else {
+                // Increment
+                if (kfor->increment) {
+                    int temp_reg = alloc_reg(compiler);
+                    compile_expression(compiler, (KastExpression*)kfor->increment, temp_reg);
+                    free_reg(compiler, temp_reg);
+                }
+                
+                // Test again at the bottom and jump back while true
+                if (kfor->condition) {
+                    int cond_reg = alloc_reg(compiler);
+                    compile_expression(compiler, (KastExpression*)kfor->condition, cond_reg);
+                    int back_jump_patch = emit_jump(compiler, KOP_JNZ, cond_reg);
+                    patch_jump(compiler, back_jump_patch, body_start);
+                    free_reg(compiler, cond_reg);
+                } else {
+                    int back_jump_patch = emit_jump(compiler, KOP_JMP, 0);
+                    patch_jump(compiler, back_jump_patch, body_start);
+                }
             }
             
-            // Jump back
-            int back_jump_patch = emit_jump(compiler, KOP_JMP, 0);
-            patch_jump(compiler, back_jump_patch, loop_start);
-            
             // Patch exit
             if (jump_exit != -1) {
                 patch_jump(compiler, jump_exit, compiler->chunk->count);
             }
             
             exit_loop(compiler);
+            end_loop_hoisting(compiler, hoist_mark);
             
             // Exit scope
             compiler->scope_depth--;
-            while (compiler->local_count > 0 && 
-                   compiler->locals[compiler->local_count - 1].depth > compiler->scope_depth) {
-                free(compiler->locals[compiler->local_count - 1].name);
-                compiler->local_count--;
-                compiler->current_reg_count--;
-            }
+            pop_locals(compiler);
             break;
         }
         case KAST_NODE_BREAK: {
@@ -1559,24 +3166,53 @@ static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
     }
 }
 
+static void compile_statement(CompilerState* compiler, KastStatement* stmt) {
+    if (!stmt) return;
+    // 語句結束後恢復外層語句的行號，循環回跳等收尾指令仍歸屬外層語句
+    int outer_line = compiler->line;
+    if (stmt->base.line > 0) compiler->line = stmt->base.line;
+    compile_statement_body(compiler, stmt);
+    compiler->line = outer_line;
+}
+
 int compile_ast(KastProgram* program, KBytecodeChunk* chunk) {
     // printf("[DEBUG] compile_ast start. Statements: %zu\n", program->statement_count);
     CompilerState* compiler = (CompilerState*)malloc(sizeof(CompilerState));
     if (!compiler) return 1;
     
     init_compiler(compiler, chunk);
+    kopt_fold_constants(program);
+    kopt_find_inline_candidates(program, &compiler->inlines);
+    kopt_find_stable_globals(program, &compiler->globals);
+    kopt_find_scalar_classes(program, &compiler->scalar_classes);
+    compiler->array_builtins = kopt_array_methods_builtin(program);
+
+    KTypeEnv types;
+    kopt_infer_local_types(&types, NULL, 0, (KastNode*)program);
+    compiler->types = &types;
     
     for (int i = 0; i < program->statement_count; i++) {
+        KastNode* node = (KastNode*)program->statements[i];
+        if (node && (node->type == KAST_NODE_FUNCTION_DECL || node->type == KAST_NODE_CLASS_DECL)) {
+            mark_global_ready(compiler, node); // 函數體與方法只會在聲明執行之後運行
+        }
         compile_statement(compiler, program->statements[i]);
+        if (node) mark_global_ready(compiler, node);
     }
     
     emit_byte(compiler, KOP_RET); 
     emit_byte(compiler, 0); emit_byte(compiler, 0); emit_byte(compiler, 0);
+    kopt_peephole(chunk);
     
     // Cleanup compiler resources if any (locals names are strdup'ed)
     for(int i=0; i<compiler->local_count; i++) {
         free(compiler->locals[i].name);
     }
+    for (int i = 0; i < 3; i++) free(compiler->pools[i].slots);
+    kopt_free_type_env(&types);
+    kopt_free_inline_set(&compiler->inlines);
+    kopt_free_global_set(&compiler->globals);
+    kopt_free_scalar_class_set(&compiler->scalar_classes);
     free(compiler);
     
     return 0;
@@ -9,6 +9,12 @@
 #include <stddef.h>
 #include "kparser.h"
 
+/**
+ * @brief 代碼生成版本號
+ * 改變同一源碼生成的字節碼 (指令語義、寄存器約定、常量池佈局等) 時遞增，使舊的字節碼緩存失效。
+ */
+#define KCODE_VERSION 2
+
 /**
  * @brief 基於 doc/字節碼理論.md 的操作碼定義
  */
@@ -25,7 +31,7 @@ typedef enum {
 
     KOP_ADDI = 0x10, KOP_SUBI = 0x11, KOP_MULI = 0x12, KOP_DIVI = 0x13, KOP_MODI = 0x14,
     KOP_LDI = 0x15,   /**< LDI Rd, Imm8 (Load Immediate Integer) */
-    KOP_LDI64 = 0x16, /**< LDI64 Rd, Imm64 (Load Immediate Integer 64bit) */
+    KOP_LDI64 = 0x16, /**< LDI64 Rd, Idx16 (Load Integer 64bit from int_constants) */
     KOP_LDB = 0x17,   /**< LDB Rd, Imm8 (Load Bool) */
 
     KOP_AND = 0x18, KOP_OR = 0x19, KOP_XOR = 0x1A, KOP_NOT = 0x1B,
@@ -71,7 +77,9 @@ typedef enum {
     KOP_MEMBAR = 0x6E, KOP_PREFETCH = 0x6F,
 
     /* --- 2.4 控制流 (0x70-0x8F) --- */
-    KOP_JMP = 0x70, KOP_JMPR = 0x71, KOP_JREL = 0x72,
+    KOP_JMP = 0x70,
+    KOP_JTAB = 0x71,  /**< JTAB Ra, Low16, Count16：整數跳轉表，之後緊跟 Count + 1 條 JMP 槽 */
+    KOP_JHASH = 0x72, /**< JHASH Ra, Buckets16：字符串按 switch_hash 分桶，之後緊跟 Buckets + 1 條 JMP 槽 */
 
     KOP_JEQ = 0x73, KOP_JNE = 0x74, KOP_JGT = 0x75, KOP_JGE = 0x76,
     KOP_JLT = 0x77, KOP_JLE = 0x78, KOP_JGTU = 0x79, KOP_JGEU = 0x7A,
@@ -87,21 +95,31 @@ typedef enum {
     KOP_CMOVL = 0x8E, KOP_CMOVLE = 0x8F,
 
     /* --- 2.5 對象 (0x90-0xAF) --- */
-    KOP_NEW = 0x90, KOP_NEWA = 0x91, KOP_NEWM = 0x92, KOP_DEL = 0x93, KOP_DELA = 0x94,
+    KOP_NEW = 0x90, KOP_NEWA = 0x91, KOP_NEWM = 0x92,
+    KOP_GETFA_U = 0x93, /**< GETFA_U Rd, Arr, Idx：編譯器已證明 Idx 是 Arr 界內的整數，只檢查 Arr 是數組 */
+    KOP_PUTFA_U = 0x94, /**< PUTFA_U Arr, Idx, Val：同 GETFA_U */
 
-    KOP_GETF = 0x95, KOP_PUTF = 0x96, KOP_GETS = 0x97, KOP_PUTS = 0x98,
+    KOP_GETF = 0x95, KOP_PUTF = 0x96,
+    KOP_GETAF = 0x97, /**< GETAF Rd, Arr, Idx, Field16：讀取 Arr[Idx].Field，Field16 為 KGETAF_CHECK 時只檢查數組與下標 */
+    KOP_PUTAF = 0x98, /**< PUTAF Arr, Idx, Val, Field16：Arr[Idx].Field = Val */
     KOP_GETFA = 0x99, KOP_PUTFA = 0x9A, KOP_ARRAYLEN = 0x9B,
 
     KOP_CLASS = 0x9C, KOP_METHOD = 0x9D, 
-    KOP_FUNCTION = 0x9E, /**< Create function object */
+    KOP_FUNCTION = 0x9E, /**< Create function object: NameIdx16, Entry24, Arity8, Access8, FrameSize16 */
     
-    KOP_INVOKE = 0x9F, KOP_INVOKESPECIAL = 0xA0, KOP_INVOKESTATIC = 0xA1,
-    KOP_INVOKEINTERFACE = 0xA2, KOP_INVOKEDYNAMIC = 0xA3,
+    KOP_INVOKE = 0x9F,
+    /* 數組的內建方法：Arr 是數組時原地修改，否則與 INVOKE 一樣按名字調用方法 (見 kvm_array_push 等) */
+    KOP_APUSH = 0xA0,   /**< APUSH Rd, Arr, Val：Rd = Arr.push(Val) */
+    KOP_APOP = 0xA1,    /**< APOP Rd, Arr, _：Rd = Arr.pop() */
+    KOP_AINSERT = 0xA2, /**< AINSERT Rd, Arr, Idx, Val：Rd = Arr.insert(Idx, Val) */
+    KOP_AREMOVE = 0xA3, /**< AREMOVE Rd, Arr, Idx：Rd = Arr.removeAt(Idx) */
 
     KOP_CAST = 0xAC, KOP_CHECKCAST = 0xAD, KOP_INSTANCEOF = 0xAE,
+    KOP_FORLOOP = 0xAF, /**< FORLOOP Ri, Rlimit, Cmp, Off16：計數循環的回邊，見 KFORLOOP_INT_LIMIT */
     KOP_GETCLASS = 0xA4, KOP_GETSUPER = 0xA5, KOP_GETINTERFACES = 0xA6,
 
-    KOP_GETFIELDID = 0xA7, KOP_GETMETHODID = 0xA8, KOP_GETCONSTRUCTOR = 0xA9,
+    KOP_FIELD = 0xA7, /**< FIELD Class16, Name16：按聲明順序登記結構體的字段 */
+    KOP_GETMETHODID = 0xA8, KOP_GETCONSTRUCTOR = 0xA9,
     KOP_GETANNOTATION = 0xAA, KOP_SETACCESSIBLE = 0xAB,
 
     KOP_MOVE = 0xB4, KOP_LDN = 0xB5, KOP_INHERIT = 0xB6,
@@ -111,7 +129,8 @@ typedef enum {
     /* KOP_REQUIRES = 0xB4, KOP_PROVIDES = 0xB5, KOP_USES = 0xB6, // Overwritten */
     KOP_REQUIRES = 0xC7, KOP_PROVIDES = 0xC8, KOP_USES = 0xC9, /**< Moved */
 
-    KOP_LDC = 0xB7, KOP_LDS = 0xB8, KOP_LDCF = 0xB9, KOP_LDCD = 0xBA,
+    KOP_LDC = 0xB7, KOP_LDS = 0xB8, KOP_LDCF = 0xB9,
+    KOP_LDCD = 0xBA, /**< LDCD Rd, Idx16 (Load Double from double_constants) */
     KOP_LDCW = 0xBB, KOP_LDCMP = 0xBC,
 
     KOP_PACKAGE = 0xBD, KOP_IMPORT_PKG = 0xBE, KOP_EXPORT_PKG = 0xBF, KOP_OPENS = 0xC0,
@@ -122,6 +141,11 @@ typedef enum {
     KOP_GET_GLOBAL = 0xC5, /**< GET_GLOBAL Rd, StringIndex */
     KOP_SET_GLOBAL = 0xC6, /**< SET_GLOBAL Ra, StringIndex */
 
+    /* --- 類型特化的整數運算 (0xCA-0xCF)：編譯器已證明兩個操作數均為 VAL_INT，不檢查標籤 --- */
+    KOP_ADD_INT = 0xCA, KOP_SUB_INT = 0xCB, KOP_MUL_INT = 0xCC,
+    KOP_LT_INT = 0xCD, KOP_LE_INT = 0xCE, /**< 與 KOP_LT / KOP_LE 一樣轉換為 double 比較 */
+    KOP_EQ_INT = 0xCF,
+
     /* --- 2.7 異常 (0xD0-0xDF) --- */
     KOP_THROW = 0xD0, KOP_THROWS = 0xD1, KOP_RETHROW = 0xD2, KOP_THROWU = 0xD3,
     KOP_TRY = 0xD4, KOP_CATCH = 0xD5, KOP_FINALLY = 0xD6, KOP_ENDTRY = 0xD7, KOP_CATCHALL = 0xD8,
@@ -150,6 +174,63 @@ typedef enum {
 
 } KOpcodes;
 
+/**
+ * @brief FORLOOP 的 Cmp 字節
+ * 低 7 位是比較操作碼 KOP_LT / KOP_LE (Ri 加 1) 或 KOP_GT / KOP_GE (Ri 減 1)。
+ * 編譯器已證明 Ri 為 VAL_INT；步進後 Ri Cmp Rlimit 成立時跳轉，比較語義與對應的比較指令一致。
+ * 設置該標誌位表示 Rlimit 也已證明為 VAL_INT，無需檢查類型標籤 (仍與 CMP_OP_NUM 一樣按 double 比較)。
+ */
+#define KFORLOOP_INT_LIMIT 0x80
+
+/**
+ * @brief GETAF 的 Field16 取該值時不讀取字段
+ * 只做與 GETFA 相同的數組與下標檢查，Rd 不變；用於在計算賦值右側之前報告 Arr[Idx] 的錯誤。
+ */
+#define KGETAF_CHECK 0xFFFF
+
+/**
+ * @brief GETAF / PUTAF 的內聯緩存項，每個字符串常量 (字段名) 一項
+ * 記錄最近一次訪問的結構體布局中該字段的槽位，解釋器與 JIT 代碼共用。
+ */
+typedef struct {
+    int64_t stride;     /**< 每個元素的槽位數 */
+    int64_t index;      /**< 字段在元素中的槽位 */
+    uint32_t layout_id; /**< 結構體類的 layout_id，0 表示空項 */
+    uint32_t reserved;
+} KFieldCache;
+
+/**
+ * @brief 行號表
+ * 只記錄行號改變的位置：每一項是 (字節碼偏移增量, 行號增量) 兩個 LEB128 變長整數，
+ * 行號增量用 zigzag 編碼。起始狀態為偏移 0、行號 0 (未知)。
+ * 查詢需要從頭解碼，只在報告錯誤時使用，執行字節碼時不訪問行號表。
+ */
+typedef struct {
+    uint8_t* data;
+    size_t size;        /**< 字節數 */
+    size_t capacity;
+    size_t last_offset; /**< 由 line_table_add 維護：最後一項的偏移 */
+    int last_line;      /**< 由 line_table_add 維護：最後一項的行號 */
+} KLineTable;
+
+/**
+ * @brief 函數表項，對應字節碼中的一條 KOP_FUNCTION 指令
+ * 編譯器把函數體緊接在 KOP_FUNCTION 之前生成，函數體佔 [entry, insn)。
+ */
+typedef struct {
+    uint32_t name;  /**< 函數名在 string_table 中的索引 */
+    uint32_t insn;  /**< KOP_FUNCTION 指令的偏移 */
+    uint32_t entry; /**< 函數體入口偏移 */
+    uint32_t arity;
+} KFunctionInfo;
+
+/** @brief 延遲生成機器碼的函數體 (只含最外層函數，嵌套函數隨外層一起生成) */
+typedef struct {
+    uint32_t entry;
+    uint32_t end;   /**< 函數體之後的 KOP_FUNCTION 指令偏移 */
+    struct JitCodeBlock* jit_block; /**< 函數體自己的代碼塊，尚未執行到或已被驅逐時為 NULL */
+} KLazyBody;
+
 /**
  * @brief 字節碼容器
  */
@@ -159,18 +240,42 @@ typedef struct {
     size_t count;
 
     /**
-     * @brief 常量池（目前簡化版）
-     * 在實際實現中，這將存儲字符串、數字、類引用等。
-     * 對於 v1.0，我們可能只是嵌入立即數或擁有一個簡單的字符串表
+     * @brief 常量池
+     * 按類型分池，指令通過 16 位索引引用；同一模塊內相同的常量只存一份。
      */
     char** string_table;
     size_t string_count;
+    int64_t* int_constants;    /**< LDI64 引用的整數常量 */
+    size_t int_count;
+    double* double_constants;  /**< LDCD 引用的浮點常量 */
+    size_t double_count;
     
-    int* lines;     /**< 用於調試的行號映射 */
+    KLineTable lines; /**< 用於調試的行號映射 */
     
     void* jit_code; /**< JIT 緩存: 指向編譯後的機器碼 */
+    struct JitCodeBlock* jit_block; /**< jit_code 所在的代碼塊 (jit_compile / jit_install 設置，驅逐時清空) */
+    struct ComeOnJIT* jit;    /**< 持有本塊機器碼的 JIT 實例，free_chunk 時歸還其代碼緩存 */
+    int jit_active;           /**< 正在執行本塊機器碼的 kvm_run 層數，大於 0 時其代碼塊不會被驅逐 */
+    KLazyBody* lazy_bodies;   /**< 延遲編譯狀態 (jit_compile_lazy)，按入口排序；NULL 表示機器碼覆蓋整個塊 */
+    size_t lazy_body_count;
+    uint8_t** jit_entries;    /**< 延遲編譯時每個字節碼偏移在本塊各代碼塊中的機器碼入口 (count 項，NULL 表示沒有) */
+    
+    KFieldCache* field_cache;  /**< 字段內聯緩存，首次使用時按 string_count 分配 */
+    size_t field_cache_count;
     
     char* filename; /**< 調試信息: 文件名 */
+
+    const KFunctionInfo* functions; /**< 函數表 (build_function_table 生成或從緩存加載)，沒有時為 NULL */
+    size_t function_count;
+
+    /**
+     * @brief 只讀映像 (kcache_load 映射的緩存文件)
+     * 非 NULL 時 code、lines、字符串、數值常量與函數表都指向映像內部，
+     * free_chunk 調用 image_release 整體釋放映像，只單獨釋放 string_table 指針數組。
+     */
+    void* image;
+    size_t image_size;
+    void (*image_release)(void* image, size_t size);
 } KBytecodeChunk;
 
 /**
@@ -195,6 +300,62 @@ void init_chunk(KBytecodeChunk* chunk);
  */
 void free_chunk(KBytecodeChunk* chunk);
 
+/**
+ * @brief 獲取字段內聯緩存
+ * 首次調用時分配，之後地址不變 (JIT 代碼直接引用)。
+ * @return 分配失敗時返回 NULL
+ */
+KFieldCache* chunk_field_cache(KBytecodeChunk* chunk);
+
+/**
+ * @brief 獲取指令長度 (含操作碼)
+ * @param opcode 操作碼
+ * @return 指令字節數，未知操作碼返回 0
+ */
+int opcode_length(uint8_t opcode);
+
+/**
+ * @brief 掃描字節碼中的 KOP_FUNCTION 指令生成函數表，遇到無法識別的指令時停止
+ * @param count 輸出表項數
+ * @return 新分配的表，由調用者 free；沒有函數或分配失敗時返回 NULL
+ */
+KFunctionInfo* build_function_table(const KBytecodeChunk* chunk, size_t* count);
+
+/**
+ * @brief 跳轉表指令之後的槽數
+ * JTAB / JHASH 按索引跳到其後的第 i 條 JMP，最後一條是落空 (default) 槽。
+ * @param insn 指令起始地址
+ * @return 槽數，其他指令返回 0
+ */
+int switch_slot_count(const uint8_t* insn);
+
+/**
+ * @brief JHASH 使用的字符串哈希 (FNV-1a 32 位)，編譯器與虛擬機必須一致
+ */
+uint32_t switch_hash(const char* str);
+
+/**
+ * @brief 記錄從 offset 開始的字節碼屬於 line
+ * offset 必須不小於上一次記錄的偏移；行號不變時不增加表項。
+ */
+void line_table_add(KLineTable* table, size_t offset, int line);
+
+/**
+ * @brief 查詢字節碼偏移所在的行號
+ * @return 行號，未知時返回 0
+ */
+int line_table_lookup(const KLineTable* table, size_t offset);
+
+/**
+ * @brief 把行號表展開為每個字節碼字節一項的數組
+ * @param count 字節碼字節數
+ * @return 新分配的數組，由調用者 free；分配失敗返回 NULL
+ */
+int* line_table_expand(const KLineTable* table, size_t count);
+
+/** @brief 清空行號表，保留已分配的內存 */
+void line_table_reset(KLineTable* table);
+
 /**
  * @brief 寫入 Chunk
  */
@@ -544,16 +544,6 @@ void editorDrawSyntaxHighlighted(struct abuf *ab, ERow* row, int col_offset, int
         }
         
         current_idx = token_offset + token_len;
-        
-        // Free token value if dynamic
-        if (token.type == KORELIN_TOKEN_IDENT || 
-            token.type == KORELIN_TOKEN_STRING || 
-            token.type == KORELIN_TOKEN_INT || 
-            token.type == KORELIN_TOKEN_FLOAT ||
-            (token.type >= KORELIN_TOKEN_LET && token.type <= KORELIN_TOKEN_NEW) ||
-            token.type == KORELIN_TOKEN_VOID || token.type == KORELIN_TOKEN_BOOL) {
-             if (token.value) free((void*)token.value);
-        }
     }
     
     // 剩餘部分 (註釋等)
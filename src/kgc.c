@@ -65,6 +65,8 @@ void kgc_free(KGC* gc) {
                 KObjClass* cls = (KObjClass*)obj;
                 free_table(&cls->methods);
                 if (cls->name) free(cls->name);
+                for (int i = 0; i < cls->field_count; i++) free(cls->fields[i]);
+                free(cls->fields);
                 break;
             }
             case OBJ_FUNCTION: {
@@ -219,8 +221,8 @@ static void mark_roots(KGC* gc) {
         kgc_mark_value(gc, *slot);
     }
 
-    // 2. 標記寄存器中的值
-    for (int i = 0; i < KVM_REGISTERS_MAX; i++) {
+    // 2. 標記寄存器中的值 (窗口可能小於 KVM_REGISTERS_MAX，不能越過棧末端)
+    for (int i = 0; i < KVM_REGISTERS_MAX && vm->registers + i < vm->stack + KVM_STACK_SIZE; i++) {
         kgc_mark_value(gc, vm->registers[i]);
     }
 
@@ -265,6 +267,13 @@ static void blacken_object(KGC* gc, KObjHeader* obj) {
         }
         case OBJ_ARRAY: {
             KObjArray* array = (KObjArray*)obj;
+            if (array->kind == ARRAY_STRUCT) { // 未賦值的槽位不是 VAL_OBJ，不會被標記
+                kgc_mark_obj(gc, (KObjHeader*)array->klass);
+                size_t slot_count = (size_t)array->length * array->klass->field_count;
+                for (size_t i = 0; i < slot_count; i++) kgc_mark_value(gc, array->slots[i]);
+                break;
+            }
+            if (array->kind != ARRAY_VALUES) break; // 無標籤存儲不含引用
             for (int i = 0; i < array->length; i++) {
                 kgc_mark_value(gc, array->elements[i]);
             }
@@ -339,6 +348,8 @@ static void sweep(KGC* gc) {
                     KObjClass* cls = (KObjClass*)unreached;
                     free_table(&cls->methods);
                     if (cls->name) free(cls->name);
+                    for (int i = 0; i < cls->field_count; i++) free(cls->fields[i]);
+                    free(cls->fields);
                     break;
                 }
                 case OBJ_FUNCTION: {
@@ -0,0 +1,413 @@
+#include "kjitdebug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+// --- GDB JIT 接口 ---
+// 以下符號名與佈局由 GDB 規定 (見 GDB 手冊 "JIT Compilation Interface")，不可修改。
+
+typedef enum {
+    JIT_NOACTION = 0,
+    JIT_REGISTER_FN,
+    JIT_UNREGISTER_FN
+} jit_actions_t;
+
+struct jit_code_entry {
+    struct jit_code_entry* next_entry;
+    struct jit_code_entry* prev_entry;
+    const char* symfile_addr;
+    uint64_t symfile_size;
+};
+
+struct jit_descriptor {
+    uint32_t version;
+    uint32_t action_flag;
+    struct jit_code_entry* relevant_entry;
+    struct jit_code_entry* first_entry;
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline, used))
+#endif
+void __jit_debug_register_code(void) {
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ volatile("");
+#endif
+}
+
+struct jit_descriptor __jit_debug_descriptor = { 1, JIT_NOACTION, NULL, NULL };
+
+// --- 內存 ELF 鏡像 ---
+// 只包含 .text (NOBITS，地址指向 RX 視圖)、符號表與字符串表，足夠 GDB 解析函數名。
+
+typedef struct {
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} ElfHeader;
+
+typedef struct {
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t addralign;
+    uint64_t entsize;
+} ElfSection;
+
+typedef struct {
+    uint32_t name;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+} ElfSymbol;
+
+enum { SECT_NULL, SECT_TEXT, SECT_SYMTAB, SECT_STRTAB, SECT_SHSTRTAB, SECT_COUNT };
+
+static const char k_shstrtab[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+/** @brief 構建描述代碼塊的 ELF 目標文件，每個範圍一個函數符號 */
+static char* build_elf_symfile(JitCodeBlock* block, char** symbols, const JitDebugRange* ranges, size_t count,
+                               const char* file, size_t* out_size) {
+    size_t file_len = strlen(file) + 1;
+    size_t strtab_size = 1 + file_len;
+    for (size_t i = 0; i < count; i++) strtab_size += strlen(symbols[i]) + 1;
+    size_t sym_count = 2 + count; // 空符號、文件符號、各函數
+
+    size_t off_shstr = sizeof(ElfHeader);
+    size_t off_str = off_shstr + sizeof(k_shstrtab);
+    size_t off_sym = ALIGN8(off_str + strtab_size);
+    size_t off_sh = ALIGN8(off_sym + sym_count * sizeof(ElfSymbol));
+    size_t total = off_sh + SECT_COUNT * sizeof(ElfSection);
+
+    char* image = (char*)calloc(1, total);
+    if (!image) return NULL;
+
+    ElfHeader* eh = (ElfHeader*)image;
+    memcpy(eh->ident, "\x7f" "ELF", 4);
+    eh->ident[4] = 2; // ELFCLASS64
+    eh->ident[5] = 1; // ELFDATA2LSB
+    eh->ident[6] = 1; // EV_CURRENT
+    eh->type = 1;     // ET_REL
+#if defined(__aarch64__) || defined(_M_ARM64)
+    eh->machine = 183; // EM_AARCH64
+#else
+    eh->machine = 62;  // EM_X86_64
+#endif
+    eh->version = 1;
+    eh->shoff = off_sh;
+    eh->ehsize = sizeof(ElfHeader);
+    eh->shentsize = sizeof(ElfSection);
+    eh->shnum = SECT_COUNT;
+    eh->shstrndx = SECT_SHSTRTAB;
+
+    memcpy(image + off_shstr, k_shstrtab, sizeof(k_shstrtab));
+
+    char* strtab = image + off_str;
+    memcpy(strtab + 1, file, file_len);
+
+    ElfSymbol* syms = (ElfSymbol*)(image + off_sym);
+    syms[1].name = 1;
+    syms[1].info = 0x04;                 // STB_LOCAL, STT_FILE
+    syms[1].shndx = 0xFFF1;              // SHN_ABS
+    size_t name = 1 + file_len;
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(symbols[i]) + 1;
+        memcpy(strtab + name, symbols[i], len);
+        syms[2 + i].name = (uint32_t)name;
+        syms[2 + i].info = 0x12;         // STB_GLOBAL, STT_FUNC
+        syms[2 + i].shndx = SECT_TEXT;
+        syms[2 + i].value = ranges[i].offset; // 相對 .text 起始
+        syms[2 + i].size = ranges[i].size;
+        name += len;
+    }
+
+    ElfSection* sh = (ElfSection*)(image + off_sh);
+    sh[SECT_TEXT].name = 1;
+    sh[SECT_TEXT].type = 8;              // SHT_NOBITS
+    sh[SECT_TEXT].flags = 0x2 | 0x4;     // SHF_ALLOC | SHF_EXECINSTR
+    sh[SECT_TEXT].addr = (uint64_t)(uintptr_t)block->code;
+    sh[SECT_TEXT].size = block->size;
+    sh[SECT_TEXT].addralign = 16;
+
+    sh[SECT_SYMTAB].name = 7;
+    sh[SECT_SYMTAB].type = 2;            // SHT_SYMTAB
+    sh[SECT_SYMTAB].offset = off_sym;
+    sh[SECT_SYMTAB].size = sym_count * sizeof(ElfSymbol);
+    sh[SECT_SYMTAB].link = SECT_STRTAB;
+    sh[SECT_SYMTAB].info = 2;            // 第一個非局部符號
+    sh[SECT_SYMTAB].addralign = 8;
+    sh[SECT_SYMTAB].entsize = sizeof(ElfSymbol);
+
+    sh[SECT_STRTAB].name = 15;
+    sh[SECT_STRTAB].type = 3;            // SHT_STRTAB
+    sh[SECT_STRTAB].offset = off_str;
+    sh[SECT_STRTAB].size = strtab_size;
+    sh[SECT_STRTAB].addralign = 1;
+
+    sh[SECT_SHSTRTAB].name = 23;
+    sh[SECT_SHSTRTAB].type = 3;
+    sh[SECT_SHSTRTAB].offset = off_shstr;
+    sh[SECT_SHSTRTAB].size = sizeof(k_shstrtab);
+    sh[SECT_SHSTRTAB].addralign = 1;
+
+    *out_size = total;
+    return image;
+}
+
+static void gdb_register(JitCodeBlock* block, char** symbols, const JitDebugRange* ranges, size_t count,
+                         const char* file) {
+    size_t size = 0;
+    char* image = build_elf_symfile(block, symbols, ranges, count, file, &size);
+    if (!image) return;
+
+    struct jit_code_entry* entry = (struct jit_code_entry*)calloc(1, sizeof(struct jit_code_entry));
+    if (!entry) { free(image); return; }
+    entry->symfile_addr = image;
+    entry->symfile_size = size;
+
+    entry->next_entry = __jit_debug_descriptor.first_entry;
+    if (entry->next_entry) entry->next_entry->prev_entry = entry;
+    __jit_debug_descriptor.first_entry = entry;
+    __jit_debug_descriptor.relevant_entry = entry;
+    __jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
+    __jit_debug_register_code();
+
+    block->debug_entry = entry;
+}
+
+static void gdb_unregister(JitCodeBlock* block) {
+    struct jit_code_entry* entry = (struct jit_code_entry*)block->debug_entry;
+    if (!entry) return;
+
+    if (entry->prev_entry) entry->prev_entry->next_entry = entry->next_entry;
+    else __jit_debug_descriptor.first_entry = entry->next_entry;
+    if (entry->next_entry) entry->next_entry->prev_entry = entry->prev_entry;
+
+    __jit_debug_descriptor.relevant_entry = entry;
+    __jit_debug_descriptor.action_flag = JIT_UNREGISTER_FN;
+    __jit_debug_register_code();
+
+    free((void*)entry->symfile_addr);
+    free(entry);
+    block->debug_entry = NULL;
+}
+
+// --- jitdump (perf inject --jit) ---
+
+#if defined(__linux__)
+
+#define JITDUMP_MAGIC   0x4A695444
+#define JITDUMP_VERSION 1
+#define JIT_CODE_LOAD   0
+#define JIT_FREED_SYMBOL "korelin::<freed>"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} JitDumpHeader;
+
+typedef struct {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+} JitDumpCodeLoad;
+
+static uint64_t jitdump_timestamp(void) {
+    // perf 要求與 perf record -k mono 相同的時鐘源
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void jitdump_open(ComeOnJIT* jit) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/jit-%d.dump", (int)getpid());
+    FILE* fp = fopen(path, "w+b");
+    if (!fp) return;
+
+    // perf 通過該文件的可執行映射記錄定位 jitdump
+    long page = sysconf(_SC_PAGESIZE);
+    void* marker = mmap(NULL, (size_t)page, PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(fp), 0);
+    if (marker == MAP_FAILED) {
+        fclose(fp);
+        return;
+    }
+
+    JitDumpHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = JITDUMP_MAGIC;
+    header.version = JITDUMP_VERSION;
+    header.total_size = sizeof(header);
+#if defined(__aarch64__)
+    header.elf_mach = 183;
+#else
+    header.elf_mach = 62;
+#endif
+    header.pid = (uint32_t)getpid();
+    header.timestamp = jitdump_timestamp();
+    fwrite(&header, sizeof(header), 1, fp);
+    fflush(fp);
+
+    jit->jitdump = fp;
+    jit->jitdump_marker = marker;
+}
+
+static void jitdump_write(ComeOnJIT* jit, const uint8_t* code, size_t size, const char* symbol) {
+    FILE* fp = (FILE*)jit->jitdump;
+    size_t name_len = strlen(symbol) + 1;
+
+    JitDumpCodeLoad rec;
+    rec.id = JIT_CODE_LOAD;
+    rec.total_size = (uint32_t)(sizeof(rec) + name_len + size);
+    rec.timestamp = jitdump_timestamp();
+    rec.pid = (uint32_t)getpid();
+    rec.tid = (uint32_t)syscall(SYS_gettid);
+    rec.vma = (uint64_t)(uintptr_t)code;
+    rec.code_addr = rec.vma;
+    rec.code_size = size;
+    rec.code_index = jit->code_index++;
+
+    fwrite(&rec, sizeof(rec), 1, fp);
+    fwrite(symbol, name_len, 1, fp);
+    fwrite(code, size, 1, fp);
+    fflush(fp);
+}
+
+static void jitdump_close(ComeOnJIT* jit) {
+    if (jit->jitdump_marker) munmap(jit->jitdump_marker, (size_t)sysconf(_SC_PAGESIZE));
+    fclose((FILE*)jit->jitdump);
+    jit->jitdump = NULL;
+    jit->jitdump_marker = NULL;
+}
+
+#endif
+
+// --- API ---
+
+void jit_debug_init(ComeOnJIT* jit) {
+    jit->profile_flags = 0;
+    jit->perf_map = NULL;
+    jit->jitdump = NULL;
+    jit->jitdump_marker = NULL;
+    jit->code_index = 0;
+
+    const char* env = getenv("KORELIN_JIT_PROFILE");
+    if (!env) return;
+    if (strstr(env, "perfmap")) jit->profile_flags |= JIT_PROFILE_PERF_MAP;
+    if (strstr(env, "jitdump")) jit->profile_flags |= JIT_PROFILE_JITDUMP;
+    if (strstr(env, "gdb")) jit->profile_flags |= JIT_PROFILE_GDB;
+
+#ifndef _WIN32
+    if (jit->profile_flags & JIT_PROFILE_PERF_MAP) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+        jit->perf_map = fopen(path, "a");
+    }
+#endif
+#if defined(__linux__)
+    if (jit->profile_flags & JIT_PROFILE_JITDUMP) jitdump_open(jit);
+#endif
+}
+
+void jit_debug_cleanup(ComeOnJIT* jit) {
+    if (jit->profile_flags & JIT_PROFILE_GDB) {
+        for (JitCodeBlock* b = jit->blocks; b; b = b->next) gdb_unregister(b);
+    }
+    if (jit->perf_map) {
+        fclose((FILE*)jit->perf_map);
+        jit->perf_map = NULL;
+    }
+#if defined(__linux__)
+    if (jit->jitdump) jitdump_close(jit);
+#endif
+    jit->profile_flags = 0;
+}
+
+void jit_debug_register(ComeOnJIT* jit, JitCodeBlock* block, const char* file,
+                        const JitDebugRange* ranges, size_t count) {
+    if (!jit->profile_flags || !block || count == 0) return;
+
+    const char* base = file ? file : "<unknown>";
+    char** symbols = (char**)calloc(count, sizeof(char*));
+    if (!symbols) return;
+    for (size_t i = 0; i < count; i++) {
+        const char* name = ranges[i].name ? ranges[i].name : "<anonymous>";
+        char symbol[512];
+        if (ranges[i].line > 0) {
+            snprintf(symbol, sizeof(symbol), "korelin::%s [%s:%d]", name, base, ranges[i].line);
+        } else {
+            snprintf(symbol, sizeof(symbol), "korelin::%s [%s]", name, base);
+        }
+        symbols[i] = strdup(symbol);
+        if (!symbols[i]) count = i; // 內存不足時只註冊已格式化的範圍
+    }
+
+    for (size_t i = 0; jit->perf_map && i < count; i++) {
+        fprintf((FILE*)jit->perf_map, "%llx %zx %s\n",
+                (unsigned long long)(uintptr_t)(block->code + ranges[i].offset), ranges[i].size, symbols[i]);
+    }
+    if (jit->perf_map) fflush((FILE*)jit->perf_map);
+#if defined(__linux__)
+    for (size_t i = 0; jit->jitdump && i < count; i++) {
+        jitdump_write(jit, block->code + ranges[i].offset, ranges[i].size, symbols[i]);
+    }
+#endif
+    if ((jit->profile_flags & JIT_PROFILE_GDB) && count > 0) gdb_register(block, symbols, ranges, count, base);
+
+    for (size_t i = 0; i < count; i++) free(symbols[i]);
+    free(symbols);
+}
+
+void jit_debug_unregister(ComeOnJIT* jit, JitCodeBlock* block) {
+    if (!block) return;
+    if (block->debug_entry) gdb_unregister(block);
+#if defined(__linux__)
+    // jitdump 沒有卸載記錄：寫入覆蓋整個代碼塊的佔位記錄，perf inject 按時間順序以它取代舊函數
+    if (jit->jitdump) jitdump_write(jit, block->code, block->size, JIT_FREED_SYMBOL);
+#else
+    (void)jit;
+#endif
+}
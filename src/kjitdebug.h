@@ -0,0 +1,59 @@
+#ifndef KORELIN_KJITDEBUG_H
+#define KORELIN_KJITDEBUG_H
+
+#include "comeonjit.h"
+
+/**
+ * @brief ComeOnJIT 的性能分析器與調試器集成
+ * - perf map: 追加 /tmp/perf-<pid>.map，供 perf 解析 JIT 幀
+ * - jitdump:  寫入 /tmp/jit-<pid>.dump，供 perf inject --jit 使用
+ * - GDB JIT 接口: 為每段機器碼生成內存 ELF 並通知調試器
+ *
+ * 通過環境變量 KORELIN_JIT_PROFILE 開啟，值為逗號分隔的
+ * perfmap / jitdump / gdb 之一或多個，例如 "perfmap,gdb"。
+ */
+
+#define JIT_PROFILE_PERF_MAP 0x1 /**< 輸出 perf map */
+#define JIT_PROFILE_JITDUMP  0x2 /**< 輸出 jitdump */
+#define JIT_PROFILE_GDB      0x4 /**< 向 GDB 註冊代碼 */
+
+/**
+ * @brief 根據環境變量初始化分析器輸出
+ */
+void jit_debug_init(ComeOnJIT* jit);
+
+/**
+ * @brief 關閉分析器輸出並註銷所有代碼
+ */
+void jit_debug_cleanup(ComeOnJIT* jit);
+
+/**
+ * @brief 代碼塊中屬於同一個腳本函數的一段機器碼
+ */
+typedef struct {
+    size_t offset;    /**< 相對代碼塊起始的偏移 */
+    size_t size;
+    const char* name; /**< 腳本函數名 */
+    int line;         /**< 起始行號 (0 表示未知) */
+} JitDebugRange;
+
+/**
+ * @brief 註冊一段已寫入緩存的機器碼
+ * 每個範圍分別寫入 perf map / jitdump，GDB 收到一個帶全部函數符號的 ELF。
+ * @param jit JIT 實例
+ * @param block 代碼塊
+ * @param file 源文件名 (可為 NULL)
+ * @param ranges 按偏移排序、互不重疊的函數範圍
+ * @param count 範圍數量
+ */
+void jit_debug_register(ComeOnJIT* jit, JitCodeBlock* block, const char* file,
+                        const JitDebugRange* ranges, size_t count);
+
+/**
+ * @brief 註銷代碼塊 (代碼被釋放或驅逐前調用)
+ * GDB 條目被移除；jitdump 為該地址寫入 korelin::<freed> 記錄，之後的採樣不再歸到舊函數，
+ * 地址被新代碼重用時由新的註冊覆蓋。perf map 沒有時間信息，只能依靠後寫入的條目。
+ */
+void jit_debug_unregister(ComeOnJIT* jit, JitCodeBlock* block);
+
+#endif //KORELIN_KJITDEBUG_H
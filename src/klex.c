@@ -16,7 +16,7 @@ static void advance(Lexer* lexer) {
         lexer->column = 0;
     }
 
-    if (lexer->read_position >= strlen(lexer->input)) {
+    if (lexer->read_position >= lexer->length) {
         lexer->current_char = '\0'; // 到達文件末尾，使用空字符標記
     } else {
         lexer->current_char = lexer->input[lexer->read_position];
@@ -33,7 +33,7 @@ static void advance(Lexer* lexer) {
  * @return char 下一個字符，如果到達末尾則返回 '\0'
  */
 static char peek(const Lexer* lexer) {
-    if (lexer->read_position >= strlen(lexer->input)) {
+    if (lexer->read_position >= lexer->length) {
         return '\0';
     }
     return lexer->input[lexer->read_position];
@@ -69,19 +69,10 @@ static Token read_identifier(Lexer* lexer) {
         advance(lexer);
     }
     
-    size_t len = lexer->position - start_pos;
-    char* literal = (char*)malloc(len + 1);
-    if (!literal) {
-        fprintf(stderr, "Critical Error: Memory allocation failed in read_identifier\n");
-        exit(EXIT_FAILURE);
-    }
-    strncpy(literal, lexer->input + start_pos, len);
-    literal[len] = '\0';
-    
     Token token;
     token.type = KORELIN_TOKEN_IDENT; // 默認爲標識符，後續會檢查是否爲關鍵字
-    token.value = literal;
-    token.length = len;
+    token.value = lexer->input + start_pos;
+    token.length = lexer->position - start_pos;
     return token;
 }
 
@@ -108,138 +99,129 @@ static Token read_number(Lexer* lexer) {
         }
     }
 
-    size_t len = lexer->position - start_pos;
-    char* literal = (char*)malloc(len + 1);
-    if (!literal) {
-        fprintf(stderr, "Critical Error: Memory allocation failed in read_number\n");
-        exit(EXIT_FAILURE);
-    }
-    strncpy(literal, lexer->input + start_pos, len);
-    literal[len] = '\0';
-    
     Token token;
     token.type = is_float ? KORELIN_TOKEN_FLOAT : KORELIN_TOKEN_INT;
-    token.value = literal;
-    token.length = len;
+    token.value = lexer->input + start_pos;
+    token.length = lexer->position - start_pos;
     return token;
 }
 
 /**
  * @brief 读取字符串字面量
- * 
+ * Token 覆蓋包括引號在內的整段源碼，轉義序列留給 decode_string_token 處理。
+ *
  * @param lexer 指向词法分析器实例的指针
  * @return Token 解析出的字符串 Token
  */
 static Token read_string(Lexer* lexer, char quote_char) {
-    size_t start_pos = lexer->position + 1; // 跳過開頭的引號 (Only used for fallback/debug?)
-    
-    // Dynamic buffer
-    int capacity = 32;
-    int len = 0;
-    char* literal = (char*)malloc(capacity);
-    
+    size_t start_pos = lexer->position;
+
     advance(lexer); // 消耗開頭的引號
 
     while (lexer->current_char != quote_char && lexer->current_char != '\0') {
-        char c = lexer->current_char;
-        if (c == '\\') {
-            advance(lexer);
+        if (lexer->current_char == '\\') {
+            advance(lexer); // 轉義字符之後的引號不結束字符串
             if (lexer->current_char == '\0') break; // Unexpected EOF
-            char next = lexer->current_char;
-            switch (next) {
-                case 'n': c = '\n'; break;
-                case 't': c = '\t'; break;
-                case 'r': c = '\r'; break;
-                case '0': c = '\0'; break;
-                case '\\': c = '\\'; break;
-                case '"': c = '"'; break;
-                case '\'': c = '\''; break;
-                default: c = next; break; // Keep original char if not special
-            }
         }
-        
-        // Check capacity for current char AND potential null terminator
-        if (len + 2 > capacity) {
-            capacity *= 2;
-            char* new_literal = (char*)realloc(literal, capacity);
-            if (!new_literal) { free(literal); exit(1); }
-            literal = new_literal;
-        }
-        literal[len++] = c;
         advance(lexer);
     }
-    
-    // Ensure null terminator space (should be guaranteed by loop check, but double check)
-    if (len >= capacity) {
-        capacity += 1;
-        char* new_literal = (char*)realloc(literal, capacity);
-        if (!new_literal) { free(literal); exit(1); }
-        literal = new_literal;
-    }
-    literal[len] = '\0';
 
     if (lexer->current_char == quote_char) {
         advance(lexer); // 消耗結尾的引號
-    } else {
-        // EOF handling
     }
 
     Token token;
     token.type = KORELIN_TOKEN_STRING;
-    token.value = literal;
-    token.length = len;
+    token.value = lexer->input + start_pos;
+    token.length = lexer->position - start_pos;
     return token;
 }
 
+/** @brief ident 與關鍵字 word (長度均為 length) 相同時返回 type，否則為普通標識符 */
+static KorelinToken match_keyword(const char* ident, const char* word, size_t length, KorelinToken type) {
+    return memcmp(ident, word, length) == 0 ? type : KORELIN_TOKEN_IDENT;
+}
+
 /**
  * @brief 根据标识符的字面量查找其对应的 Token 类型（区分关键字和普通标识符）
  * 
  * @param ident 标识符字符串
+ * @param length 标识符长度
  * @return KorelinToken 对应的 Token 类型
  */
-static KorelinToken lookup_ident(const char* ident) {
-    // printf("DEBUG LOOKUP: '%s'\n", ident);
-    // 關鍵字映射
-    if (strcmp(ident, "let") == 0) return KORELIN_TOKEN_LET;
-    if (strcmp(ident, "function") == 0) return KORELIN_TOKEN_FUNCTION;
-    if (strcmp(ident, "var") == 0) return KORELIN_TOKEN_VAR;
-    if (strcmp(ident, "const") == 0) return KORELIN_TOKEN_CONST;
-    if (strcmp(ident, "if") == 0) return KORELIN_TOKEN_IF;
-    if (strcmp(ident, "else") == 0) return KORELIN_TOKEN_ELSE;
-    if (strcmp(ident, "for") == 0) return KORELIN_TOKEN_FOR;
-    if (strcmp(ident, "while") == 0) return KORELIN_TOKEN_WHILE;
-    if (strcmp(ident, "do") == 0) return KORELIN_TOKEN_DO;
-    if (strcmp(ident, "return") == 0) return KORELIN_TOKEN_RETURN;
-    if (strcmp(ident, "try") == 0) return KORELIN_TOKEN_TRY;
-    if (strcmp(ident, "catch") == 0) return KORELIN_TOKEN_CATCH;
-    if (strcmp(ident, "import") == 0) return KORELIN_TOKEN_IMPORT;
-    if (strcmp(ident, "struct") == 0) return KORELIN_TOKEN_STRUCT;
-    if (strcmp(ident, "true") == 0) return KORELIN_TOKEN_TRUE;
-    if (strcmp(ident, "false") == 0) return KORELIN_TOKEN_FALSE;
-    if (strcmp(ident, "nil") == 0) return KORELIN_TOKEN_NIL;
-    if (strcmp(ident, "break") == 0) return KORELIN_TOKEN_BREAK;
-    if (strcmp(ident, "continue") == 0) return KORELIN_TOKEN_CONTINUE;
-    if (strcmp(ident, "switch") == 0) return KORELIN_TOKEN_SWITCH;
-    if (strcmp(ident, "case") == 0) return KORELIN_TOKEN_CASE;
-    if (strcmp(ident, "default") == 0) return KORELIN_TOKEN_DEFAULT;
-    if (strcmp(ident, "class") == 0) return KORELIN_TOKEN_CLASS;
-    if (strcmp(ident, "struct") == 0) return KORELIN_TOKEN_STRUCT;
-    if (strcmp(ident, "Map") == 0) return KORELIN_TOKEN_MAP;
-    if (strcmp(ident, "public") == 0) return KORELIN_TOKEN_PUBLIC;
-    if (strcmp(ident, "private") == 0) return KORELIN_TOKEN_PRIVATE;
-    if (strcmp(ident, "protected") == 0) return KORELIN_TOKEN_PROTECTED;
-    if (strcmp(ident, "extends") == 0) return KORELIN_TOKEN_EXTENDS;
-    if (strcmp(ident, "super") == 0) return KORELIN_TOKEN_SUPER;
-    if (strcmp(ident, "new") == 0) return KORELIN_TOKEN_NEW;
-    if (strcmp(ident, "throw") == 0) return KORELIN_TOKEN_THROW;
-    
-    // 類型關鍵字（根據 klex.h 定義，這些也作爲 Token 類型存在）
-    if (strcmp(ident, "void") == 0) return KORELIN_TOKEN_VOID;
-    if (strcmp(ident, "int") == 0) return KORELIN_TOKEN_INT;
-    if (strcmp(ident, "float") == 0) return KORELIN_TOKEN_FLOAT;
-    if (strcmp(ident, "bool") == 0) return KORELIN_TOKEN_BOOL;
-    if (strcmp(ident, "string") == 0) return KORELIN_TOKEN_KEYWORD_STRING;
-
+static KorelinToken lookup_ident(const char* ident, size_t length) {
+    // 關鍵字映射：先按長度、再按首字符分派，每個標識符最多與兩個關鍵字比較
+    switch (length) {
+        case 2:
+            switch (ident[0]) {
+                case 'i': return match_keyword(ident, "if", length, KORELIN_TOKEN_IF);
+                case 'd': return match_keyword(ident, "do", length, KORELIN_TOKEN_DO);
+            }
+            break;
+        case 3:
+            switch (ident[0]) {
+                case 'l': return match_keyword(ident, "let", length, KORELIN_TOKEN_LET);
+                case 'v': return match_keyword(ident, "var", length, KORELIN_TOKEN_VAR);
+                case 'f': return match_keyword(ident, "for", length, KORELIN_TOKEN_FOR);
+                case 't': return match_keyword(ident, "try", length, KORELIN_TOKEN_TRY);
+                case 'n':
+                    if (ident[1] == 'i') return match_keyword(ident, "nil", length, KORELIN_TOKEN_NIL);
+                    return match_keyword(ident, "new", length, KORELIN_TOKEN_NEW);
+                case 'M': return match_keyword(ident, "Map", length, KORELIN_TOKEN_MAP);
+                case 'i': return match_keyword(ident, "int", length, KORELIN_TOKEN_INT);
+            }
+            break;
+        case 4:
+            switch (ident[0]) {
+                case 'e': return match_keyword(ident, "else", length, KORELIN_TOKEN_ELSE);
+                case 't': return match_keyword(ident, "true", length, KORELIN_TOKEN_TRUE);
+                case 'c': return match_keyword(ident, "case", length, KORELIN_TOKEN_CASE);
+                case 'v': return match_keyword(ident, "void", length, KORELIN_TOKEN_VOID);
+                case 'b': return match_keyword(ident, "bool", length, KORELIN_TOKEN_BOOL);
+            }
+            break;
+        case 5:
+            switch (ident[0]) {
+                case 'c':
+                    if (ident[1] == 'o') return match_keyword(ident, "const", length, KORELIN_TOKEN_CONST);
+                    if (ident[1] == 'a') return match_keyword(ident, "catch", length, KORELIN_TOKEN_CATCH);
+                    return match_keyword(ident, "class", length, KORELIN_TOKEN_CLASS);
+                case 'w': return match_keyword(ident, "while", length, KORELIN_TOKEN_WHILE);
+                case 'f':
+                    if (ident[1] == 'a') return match_keyword(ident, "false", length, KORELIN_TOKEN_FALSE);
+                    return match_keyword(ident, "float", length, KORELIN_TOKEN_FLOAT);
+                case 'b': return match_keyword(ident, "break", length, KORELIN_TOKEN_BREAK);
+                case 's': return match_keyword(ident, "super", length, KORELIN_TOKEN_SUPER);
+                case 't': return match_keyword(ident, "throw", length, KORELIN_TOKEN_THROW);
+            }
+            break;
+        case 6:
+            switch (ident[0]) {
+                case 'r': return match_keyword(ident, "return", length, KORELIN_TOKEN_RETURN);
+                case 'i': return match_keyword(ident, "import", length, KORELIN_TOKEN_IMPORT);
+                case 'p': return match_keyword(ident, "public", length, KORELIN_TOKEN_PUBLIC);
+                case 's':
+                    if (ident[1] == 'w') return match_keyword(ident, "switch", length, KORELIN_TOKEN_SWITCH);
+                    if (ident[3] == 'u') return match_keyword(ident, "struct", length, KORELIN_TOKEN_STRUCT);
+                    return match_keyword(ident, "string", length, KORELIN_TOKEN_KEYWORD_STRING);
+            }
+            break;
+        case 7:
+            switch (ident[0]) {
+                case 'd': return match_keyword(ident, "default", length, KORELIN_TOKEN_DEFAULT);
+                case 'p': return match_keyword(ident, "private", length, KORELIN_TOKEN_PRIVATE);
+                case 'e': return match_keyword(ident, "extends", length, KORELIN_TOKEN_EXTENDS);
+            }
+            break;
+        case 8:
+            switch (ident[0]) {
+                case 'f': return match_keyword(ident, "function", length, KORELIN_TOKEN_FUNCTION);
+                case 'c': return match_keyword(ident, "continue", length, KORELIN_TOKEN_CONTINUE);
+            }
+            break;
+        case 9:
+            return match_keyword(ident, "protected", length, KORELIN_TOKEN_PROTECTED);
+    }
     return KORELIN_TOKEN_IDENT;
 }
 
@@ -255,6 +237,7 @@ static KorelinToken lookup_ident(const char* ident) {
  */
 void init_lexer(Lexer* lexer, const char* input) {
     lexer->input = input;
+    lexer->length = strlen(input);
     lexer->position = 0;
     lexer->read_position = 0;
     lexer->current_char = '\0';
@@ -286,11 +269,12 @@ void init_lexer(Lexer* lexer, const char* input) {
  */
 Token next_token(Lexer* lexer) {
     Token token;
-    token.value = NULL;
     token.length = 0;
 
     skip_whitespace(lexer);
 
+    token.value = lexer->input + lexer->position; // 符號 Token 同樣指向源碼
+
     int start_line = lexer->line;
     int start_column = lexer->column;
 
@@ -299,11 +283,9 @@ Token next_token(Lexer* lexer) {
             if (peek(lexer) == '=') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_EQ;
-                token.value = "==";
                 token.length = 2;
             } else {
                 token.type = KORELIN_TOKEN_ASSIGN;
-                token.value = "=";
                 token.length = 1;
             }
             break;
@@ -311,16 +293,13 @@ Token next_token(Lexer* lexer) {
             if (peek(lexer) == '+') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_INC;
-                token.value = "++";
                 token.length = 2;
             } else if (peek(lexer) == '=') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_ADD_ASSIGN;
-                token.value = "+=";
                 token.length = 2;
             } else {
                 token.type = KORELIN_TOKEN_ADD;
-                token.value = "+";
                 token.length = 1;
             }
             break;
@@ -328,16 +307,13 @@ Token next_token(Lexer* lexer) {
             if (peek(lexer) == '-') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_DEC;
-                token.value = "--";
                 token.length = 2;
             } else if (peek(lexer) == '=') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_SUB_ASSIGN;
-                token.value = "-=";
                 token.length = 2;
             } else {
                 token.type = KORELIN_TOKEN_SUB;
-                token.value = "-";
                 token.length = 1;
             }
             break;
@@ -345,11 +321,9 @@ Token next_token(Lexer* lexer) {
              if (peek(lexer) == '=') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_MUL_ASSIGN;
-                token.value = "*=";
                 token.length = 2;
             } else {
                 token.type = KORELIN_TOKEN_MUL;
-                token.value = "*";
                 token.length = 1;
             }
             break;
@@ -377,11 +351,9 @@ Token next_token(Lexer* lexer) {
              } else if (peek(lexer) == '=') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_DIV_ASSIGN;
-                token.value = "/=";
                 token.length = 2;
             } else {
                 token.type = KORELIN_TOKEN_DIV;
-                token.value = "/";
                 token.length = 1;
             }
             break;
@@ -389,11 +361,9 @@ Token next_token(Lexer* lexer) {
              if (peek(lexer) == '=') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_MOD_ASSIGN;
-                token.value = "%=";
                 token.length = 2;
             } else {
                 token.type = KORELIN_TOKEN_MOD;
-                token.value = "%";
                 token.length = 1;
             }
             break;
@@ -401,11 +371,9 @@ Token next_token(Lexer* lexer) {
             if (peek(lexer) == '=') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_NE;
-                token.value = "!=";
                 token.length = 2;
             } else {
                 token.type = KORELIN_TOKEN_NOT;
-                token.value = "!";
                 token.length = 1;
             }
             break;
@@ -413,13 +381,11 @@ Token next_token(Lexer* lexer) {
              if (peek(lexer) == '=') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_LE;
-                token.value = "<=";
                 token.length = 2;
             } else {
                 // 上下文未定時，默認返回 LT (小於號)
                 // 在語法分析階段可能需要根據語境判斷是否爲 LANGLE (泛型左括號)
                 token.type = KORELIN_TOKEN_LT; 
-                token.value = "<";
                 token.length = 1;
             }
             break;
@@ -427,13 +393,11 @@ Token next_token(Lexer* lexer) {
              if (peek(lexer) == '=') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_GE;
-                token.value = ">=";
                 token.length = 2;
             } else {
                 // 上下文未定時，默認返回 GT (大於號)
                 // 在語法分析階段可能需要根據語境判斷是否爲 RANGLE (泛型右括號)
                 token.type = KORELIN_TOKEN_GT; 
-                token.value = ">";
                 token.length = 1;
             }
             break;
@@ -441,13 +405,11 @@ Token next_token(Lexer* lexer) {
             if (peek(lexer) == '&') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_AND;
-                token.value = "&&";
                 token.length = 2;
             } else {
                 // 如果 klex.h 中未定義位運算符，則暫視爲錯誤或需要擴展定義
                 // 暫時返回 ERROR
                 token.type = KORELIN_TOKEN_ERROR;
-                token.value = "&";
                 token.length = 1;
             }
             break;
@@ -455,12 +417,10 @@ Token next_token(Lexer* lexer) {
             if (peek(lexer) == '|') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_OR;
-                token.value = "||";
                 token.length = 2;
             } else {
                 // 同上，未定義位運算符 OR
                 token.type = KORELIN_TOKEN_ERROR;
-                token.value = "|";
                 token.length = 1;
             }
             break;
@@ -468,62 +428,50 @@ Token next_token(Lexer* lexer) {
             if (peek(lexer) == ':') {
                 advance(lexer);
                 token.type = KORELIN_TOKEN_SCOPE;
-                token.value = "::";
                 token.length = 2;
             } else {
                 token.type = KORELIN_TOKEN_COLON;
-                token.value = ":";
                 token.length = 1;
             }
             break;
         case ';':
             token.type = KORELIN_TOKEN_SEMICOLON;
-            token.value = ";";
             token.length = 1;
             break;
         case '(':
             token.type = KORELIN_TOKEN_LPAREN;
-            token.value = "(";
             token.length = 1;
             break;
         case ')':
             token.type = KORELIN_TOKEN_RPAREN;
-            token.value = ")";
             token.length = 1;
             break;
         case ',':
             token.type = KORELIN_TOKEN_COMMA;
-            token.value = ",";
             token.length = 1;
             break;
         case '{':
             token.type = KORELIN_TOKEN_LBRACE;
-            token.value = "{";
             token.length = 1;
             break;
         case '}':
             token.type = KORELIN_TOKEN_RBRACE;
-            token.value = "}";
             token.length = 1;
             break;
         case '[':
             token.type = KORELIN_TOKEN_LBRACKET;
-            token.value = "[";
             token.length = 1;
             break;
         case ']':
             token.type = KORELIN_TOKEN_RBRACKET;
-            token.value = "]";
             token.length = 1;
             break;
         case '.':
             token.type = KORELIN_TOKEN_DOT;
-            token.value = ".";
             token.length = 1;
             break;
         case '@':
             token.type = KORELIN_TOKEN_AT;
-            token.value = "@";
             token.length = 1;
             break;
         case '"':
@@ -538,13 +486,13 @@ Token next_token(Lexer* lexer) {
             return token;
         case '\0':
             token.type = KORELIN_TOKEN_EOF;
-            token.value = "";
+            token.value = ""; // 文件結束之後 position 會越過輸入末尾
             token.length = 0;
             break;
         default:
             if (isalpha(lexer->current_char) || lexer->current_char == '_') {
                 token = read_identifier(lexer);
-                token.type = lookup_ident(token.value);
+                token.type = lookup_ident(token.value, token.length);
                 token.line = start_line;
                 token.column = start_column;
                 return token;
@@ -555,7 +503,6 @@ Token next_token(Lexer* lexer) {
                 return token;
             } else {
                 token.type = KORELIN_TOKEN_ERROR;
-                token.value = "UNKNOWN"; 
                 token.length = 1;
             }
             break;
@@ -567,54 +514,38 @@ Token next_token(Lexer* lexer) {
     return token;
 }
 
-/**
- * @brief 释放 Token 中动态分配的内存
- * 
- * @param token 需要释放的 Token 指针
- */
-void free_token(Token* token) {
-    // 檢查是否爲動態分配的類型
-    // 注意：如果是關鍵字（如 func, let），lookup_ident 返回的類型是特定的（如 KORELIN_TOKEN_FUNC），
-    // 但 token.value 仍然指向 read_identifier 分配的堆內存，因此也需要釋放。
-    // read_identifier 總是分配內存，不管它最後被判定爲什麼類型。
-    // read_number 和 read_string 同理。
-    // 
-    // 只有那些在 next_token switch 中直接賦值字面量（如 "="）的 token 不需要釋放。
-    // 如何區分？ 
-    // 方法1: 根據 token.type。但關鍵字類型（如 KORELIN_TOKEN_FUNC）的 value 也是動態分配的。
-    // 方法2: 我們約定，凡是通過 read_identifier, read_number, read_string 返回的，value 都是 malloc 的。
-    //       凡是在 switch 中直接設置的，value 是字符串常量。
-    // 
-    // 這裏的邏輯需要修正：
-    // 在 next_token 中，如果是符號（如 + - * /），value 指向常量區，不能 free。
-    // 如果是 identifier/keyword/number/string，value 指向堆內存，必須 free。
-    
-    // 我們可以列出所有可能來自 identifier/number/string 的類型
-    bool is_dynamic = false;
+bool token_equals(const Token* token, const char* word) {
+    size_t length = strlen(word);
+    return token->length == length && memcmp(token->value, word, length) == 0;
+}
 
-    // 1. 標識符和字面量
-    if (token->type == KORELIN_TOKEN_IDENT || 
-        token->type == KORELIN_TOKEN_STRING || 
-        token->type == KORELIN_TOKEN_INT || 
-        token->type == KORELIN_TOKEN_FLOAT) {
-        is_dynamic = true;
-    }
-    // 2. 所有關鍵字類型（因爲它們是由 read_identifier 讀取並分配內存的）
-    else if (token->type >= KORELIN_TOKEN_LET && token->type <= KORELIN_TOKEN_THROW) {
-        is_dynamic = true;
-    }
-    // 3. 類型關鍵字 (int, void, bool 等) 如果被 lookup_ident 識別
-    else if (token->type == KORELIN_TOKEN_VOID ||
-             token->type == KORELIN_TOKEN_BOOL) {
-             // 注意：KORELIN_TOKEN_INT 和 KORELIN_TOKEN_STRING 已經在上面覆蓋了
-             // 但如果是 type keyword 如 'int'，lookup_ident 返回 KORELIN_TOKEN_INT，value 是 malloc 的 "int"
-             // 如果是 literal '123'，read_number 返回 KORELIN_TOKEN_INT，value 是 malloc 的 "123"
-             // 所以是一致的。
-        is_dynamic = true;
-    }
+char* decode_string_token(const Token* token) {
+    char quote_char = token->value[0];
+    const char* text = token->value + 1; // 跳過開頭的引號
+    size_t length = token->length > 0 ? token->length - 1 : 0;
 
-    if (is_dynamic && token->value != NULL) {
-        free((void*)token->value);
-        token->value = NULL;
+    char* literal = (char*)malloc(length + 1);
+    if (!literal) {
+        fprintf(stderr, "Critical Error: Memory allocation failed in decode_string_token\n");
+        exit(EXIT_FAILURE);
     }
+    size_t len = 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        if (c == quote_char) break; // 結尾的引號 (未閉合的字符串沒有)
+        if (c == '\\') {
+            if (i + 1 >= length) break; // Unexpected EOF
+            char next = text[++i];
+            switch (next) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '0': c = '\0'; break;
+                default: c = next; break; // \\ \" \' 以及非特殊字符保留原字符
+            }
+        }
+        literal[len++] = c;
+    }
+    literal[len] = '\0';
+    return literal;
 }
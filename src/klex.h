@@ -109,11 +109,13 @@ typedef enum {
 /**
  * @brief Token 結構體
  * 表示源代碼中的一個詞法單元。
+ * value 指向源碼緩衝區，不以空字符結尾，只能與 length 一起使用；
+ * Token 不持有內存，源碼緩衝區需在 Token 使用期間保持有效。
  */
 typedef struct {
     KorelinToken type;  /**< Token 的類型 */
-    const char* value;  /**< Token 的字面值 (字符串) */
-    size_t length;      /**< 值的長度 */
+    const char* value;  /**< Token 在源碼中的起始位置 (字符串字面量包括引號) */
+    size_t length;      /**< Token 在源碼中的長度 */
     int line;           /**< Token 所在的行號 */
     int column;         /**< Token 所在的列號 */
 } Token;
@@ -124,6 +126,7 @@ typedef struct {
  */
 typedef struct {
     const char* input;    /**< 源代碼輸入字符串 */
+    size_t length;        /**< 輸入長度 (init_lexer 時計算一次) */
     size_t position;      /**< 當前正在檢查的字符的索引 (指向 current_char) */
     size_t read_position; /**< 下一個要檢查的字符的索引 (用於前瞻) */
     char current_char;    /**< 當前正在檢查的字符 */
@@ -145,7 +148,7 @@ void init_lexer(Lexer* lexer, const char* input);
  * @brief 從 Lexer 中獲取下一個 Token
  * 
  * 此函數會推進 Lexer 的狀態，並返回解析出的下一個 Token。
- * 調用者負責在不再需要 Token 時調用 free_token 釋放相關內存。
+ * 返回的 Token 指向 lexer->input，不分配內存。
  * 
  * @param lexer 指向 Lexer 實例的指針
  * @return 解析出的 Token
@@ -153,13 +156,17 @@ void init_lexer(Lexer* lexer, const char* input);
 Token next_token(Lexer* lexer);
 
 /**
- * @brief 釋放 Token 中動態分配的內存
- * 
- * 某些 Token (如標識符、字符串字面量) 的 value 字段是動態分配的。
- * 此函數用於釋放這些內存，防止內存泄漏。
- * 
- * @param token 指向需要釋放的 Token 的指針
+ * @brief 判斷 Token 的文本是否與 word 相同
+ */
+bool token_equals(const Token* token, const char* word);
+
+/**
+ * @brief 取得字符串字面量 Token 的值
+ * 去掉引號並處理轉義序列。
+ *
+ * @param token KORELIN_TOKEN_STRING 類型的 Token
+ * @return 新分配的以空字符結尾的字符串，由調用者釋放
  */
-void free_token(Token* token);
+char* decode_string_token(const Token* token);
 
 #endif //KORELIN_KLEX_H
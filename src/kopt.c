@@ -0,0 +1,2429 @@
+#include "kopt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+/** @brief 字面量求值後的常量 */
+typedef enum {
+    CONST_INT,
+    CONST_DOUBLE,
+    CONST_BOOL,
+    CONST_NIL,
+    CONST_STRING
+} ConstKind;
+
+typedef struct {
+    ConstKind kind;
+    long long integer;
+    double number;
+    bool boolean;
+    const char* string;
+} ConstValue;
+
+/** @brief 作用域中的名字綁定，value 為 NULL 表示遮蔽外層常量 */
+typedef struct {
+    const char* name;
+    KastLiteral* value;
+} ConstBinding;
+
+typedef struct {
+    ConstBinding* bindings;
+    size_t count;
+    size_t capacity;
+    char** assigned;          /**< 程序中被賦值過的名字 (永不傳播) */
+    size_t assigned_count;
+    size_t assigned_capacity;
+    char** assigned_members;  /**< 程序中被賦值過的成員名 (obj.name = ...) */
+    size_t assigned_member_count;
+    size_t assigned_member_capacity;
+    char** declared;          /**< 函數、類、結構體聲明與 import 綁定的全局名字 (每次聲明記錄一次) */
+    size_t declared_count;
+    size_t declared_capacity;
+    bool calls;               /**< 含有調用、new 或 import (會執行其他代碼) */
+} FoldContext;
+
+static void fold_node(FoldContext* ctx, KastNode** slot);
+static void fold_statement(FoldContext* ctx, KastStatement** slot);
+
+// --- 名字綁定 ---
+
+static void bind_name(FoldContext* ctx, const char* name, KastLiteral* value) {
+    if (!name) return;
+    if (ctx->count == ctx->capacity) {
+        ctx->capacity = ctx->capacity ? ctx->capacity * 2 : 32;
+        ctx->bindings = (ConstBinding*)realloc(ctx->bindings, ctx->capacity * sizeof(ConstBinding));
+    }
+    ctx->bindings[ctx->count].name = name;
+    ctx->bindings[ctx->count].value = value;
+    ctx->count++;
+}
+
+static KastLiteral* lookup_name(FoldContext* ctx, const char* name) {
+    for (size_t i = ctx->count; i > 0; i--) {
+        if (strcmp(ctx->bindings[i - 1].name, name) == 0) return ctx->bindings[i - 1].value;
+    }
+    return NULL;
+}
+
+static bool name_listed(char** names, size_t count, const char* name) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) return true;
+    }
+    return false;
+}
+
+static void list_name(char*** names, size_t* count, size_t* capacity, const char* name) {
+    if (!name || name_listed(*names, *count, name)) return;
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        *names = (char**)realloc(*names, *capacity * sizeof(char*));
+    }
+    (*names)[(*count)++] = (char*)name;
+}
+
+static void mark_declared(FoldContext* ctx, const char* name) {
+    if (!name) return;
+    if (ctx->declared_count == ctx->declared_capacity) {
+        ctx->declared_capacity = ctx->declared_capacity ? ctx->declared_capacity * 2 : 16;
+        ctx->declared = (char**)realloc(ctx->declared, ctx->declared_capacity * sizeof(char*));
+    }
+    ctx->declared[ctx->declared_count++] = (char*)name;
+}
+
+static bool is_assigned(FoldContext* ctx, const char* name) {
+    return name_listed(ctx->assigned, ctx->assigned_count, name);
+}
+
+static void mark_assigned(FoldContext* ctx, KastNode* lvalue) {
+    if (!lvalue) return;
+    if (lvalue->type == KAST_NODE_IDENTIFIER) {
+        list_name(&ctx->assigned, &ctx->assigned_count, &ctx->assigned_capacity,
+                  ((KastIdentifier*)lvalue)->name);
+    } else if (lvalue->type == KAST_NODE_MEMBER_ACCESS) {
+        list_name(&ctx->assigned_members, &ctx->assigned_member_count, &ctx->assigned_member_capacity,
+                  ((KastMemberAccess*)lvalue)->member_name);
+    } else if (lvalue->type == KAST_NODE_SCOPE_ACCESS) {
+        list_name(&ctx->assigned_members, &ctx->assigned_member_count, &ctx->assigned_member_capacity,
+                  ((KastScopeAccess*)lvalue)->member_name);
+    }
+}
+
+/** @brief 沒有初始值的類或結構體變量聲明會創建實例 (調用構造函數)，與 kcode 的生成規則一致 */
+static bool auto_instantiates(KastVarDecl* decl) {
+    static const char* primitives[] = {"int", "float", "bool", "string", "any", "void"};
+    if (decl->init_value || !decl->type_name) return false;
+    for (size_t i = 0; i < sizeof(primitives) / sizeof(primitives[0]); i++) {
+        if (strcmp(decl->type_name, primitives[i]) == 0) return false;
+    }
+    return true;
+}
+
+/** @brief 收集所有被賦值或自增自減的標識符 */
+static void collect_assigned(FoldContext* ctx, KastNode* node) {
+    if (!node) return;
+    switch (node->type) {
+        case KAST_NODE_ASSIGNMENT: {
+            KastAssignment* assign = (KastAssignment*)node;
+            mark_assigned(ctx, assign->lvalue);
+            collect_assigned(ctx, assign->lvalue);
+            collect_assigned(ctx, assign->value);
+            break;
+        }
+        case KAST_NODE_POSTFIX_OP:
+            mark_assigned(ctx, ((KastPostfixOp*)node)->operand);
+            collect_assigned(ctx, ((KastPostfixOp*)node)->operand);
+            break;
+        case KAST_NODE_UNARY_OP:
+            collect_assigned(ctx, ((KastUnaryOp*)node)->operand);
+            break;
+        case KAST_NODE_BINARY_OP:
+            collect_assigned(ctx, ((KastBinaryOp*)node)->left);
+            collect_assigned(ctx, ((KastBinaryOp*)node)->right);
+            break;
+        case KAST_NODE_VAR_DECL: {
+            KastVarDecl* decl = (KastVarDecl*)node;
+            if (auto_instantiates(decl)) ctx->calls = true;
+            collect_assigned(ctx, decl->init_value);
+            break;
+        }
+        case KAST_NODE_BLOCK: {
+            KastBlock* block = (KastBlock*)node;
+            for (size_t i = 0; i < block->statement_count; i++) {
+                collect_assigned(ctx, (KastNode*)block->statements[i]);
+            }
+            break;
+        }
+        case KAST_NODE_PROGRAM: {
+            KastProgram* program = (KastProgram*)node;
+            for (size_t i = 0; i < program->statement_count; i++) {
+                collect_assigned(ctx, (KastNode*)program->statements[i]);
+            }
+            break;
+        }
+        case KAST_NODE_IF: {
+            KastIf* stmt = (KastIf*)node;
+            collect_assigned(ctx, stmt->condition);
+            collect_assigned(ctx, (KastNode*)stmt->then_branch);
+            collect_assigned(ctx, (KastNode*)stmt->else_branch);
+            break;
+        }
+        case KAST_NODE_SWITCH: {
+            KastSwitch* stmt = (KastSwitch*)node;
+            collect_assigned(ctx, stmt->condition);
+            for (size_t i = 0; i < stmt->case_count; i++) {
+                collect_assigned(ctx, stmt->cases[i].value);
+                collect_assigned(ctx, (KastNode*)stmt->cases[i].body);
+            }
+            collect_assigned(ctx, (KastNode*)stmt->default_branch);
+            break;
+        }
+        case KAST_NODE_FOR: {
+            KastFor* stmt = (KastFor*)node;
+            collect_assigned(ctx, (KastNode*)stmt->init);
+            collect_assigned(ctx, stmt->condition);
+            collect_assigned(ctx, stmt->increment);
+            collect_assigned(ctx, (KastNode*)stmt->body);
+            break;
+        }
+        case KAST_NODE_WHILE:
+            collect_assigned(ctx, ((KastWhile*)node)->condition);
+            collect_assigned(ctx, (KastNode*)((KastWhile*)node)->body);
+            break;
+        case KAST_NODE_DO_WHILE:
+            collect_assigned(ctx, (KastNode*)((KastDoWhile*)node)->body);
+            collect_assigned(ctx, ((KastDoWhile*)node)->condition);
+            break;
+        case KAST_NODE_RETURN:
+            collect_assigned(ctx, ((KastReturn*)node)->value);
+            break;
+        case KAST_NODE_THROW:
+            collect_assigned(ctx, ((KastThrow*)node)->value);
+            break;
+        case KAST_NODE_TRY_CATCH: {
+            KastTryCatch* stmt = (KastTryCatch*)node;
+            collect_assigned(ctx, (KastNode*)stmt->try_block);
+            for (size_t i = 0; i < stmt->catch_count; i++) {
+                collect_assigned(ctx, (KastNode*)stmt->catch_blocks[i].body);
+            }
+            break;
+        }
+        case KAST_NODE_FUNCTION_DECL: {
+            KastFunctionDecl* decl = (KastFunctionDecl*)node;
+            if (!decl->parent_class_name) mark_declared(ctx, decl->name);
+            collect_assigned(ctx, (KastNode*)decl->body);
+            break;
+        }
+        case KAST_NODE_IMPORT: {
+            KastImport* imp = (KastImport*)node;
+            mark_declared(ctx, imp->alias ? imp->alias : imp->path_parts[imp->part_count - 1]);
+            ctx->calls = true;
+            break;
+        }
+        case KAST_NODE_CLASS_DECL: {
+            KastClassDecl* decl = (KastClassDecl*)node;
+            mark_declared(ctx, decl->name);
+            for (size_t i = 0; i < decl->member_count; i++) {
+                collect_assigned(ctx, (KastNode*)decl->members[i]);
+            }
+            break;
+        }
+        case KAST_NODE_STRUCT_DECL: {
+            KastStructDecl* decl = (KastStructDecl*)node;
+            mark_declared(ctx, decl->name);
+            for (size_t i = 0; i < decl->member_count; i++) {
+                collect_assigned(ctx, (KastNode*)decl->members[i]);
+            }
+            collect_assigned(ctx, (KastNode*)decl->init_var);
+            break;
+        }
+        case KAST_NODE_MEMBER_DECL: {
+            KastClassMember* member = (KastClassMember*)node;
+            if (member->member_type == KAST_MEMBER_PROPERTY) {
+                collect_assigned(ctx, member->init_value);
+            } else {
+                collect_assigned(ctx, (KastNode*)member->body);
+            }
+            break;
+        }
+        case KAST_NODE_NEW: {
+            KastNew* n = (KastNew*)node;
+            ctx->calls = true;
+            for (size_t i = 0; i < n->arg_count; i++) collect_assigned(ctx, n->args[i]);
+            break;
+        }
+        case KAST_NODE_CALL: {
+            KastCall* call = (KastCall*)node;
+            ctx->calls = true;
+            collect_assigned(ctx, call->callee);
+            for (size_t i = 0; i < call->arg_count; i++) collect_assigned(ctx, call->args[i]);
+            break;
+        }
+        case KAST_NODE_MEMBER_ACCESS:
+            collect_assigned(ctx, ((KastMemberAccess*)node)->object);
+            break;
+        case KAST_NODE_ARRAY_ACCESS:
+            collect_assigned(ctx, ((KastArrayAccess*)node)->array);
+            collect_assigned(ctx, ((KastArrayAccess*)node)->index);
+            break;
+        case KAST_NODE_ARRAY_LITERAL: {
+            KastArrayLiteral* arr = (KastArrayLiteral*)node;
+            for (size_t i = 0; i < arr->element_count; i++) collect_assigned(ctx, arr->elements[i]);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// --- 字面量 ---
+
+/** @brief 讀取字面量的值，解析方式與 kcode 生成 LDI/LDCD 時一致 */
+static bool literal_value(KastNode* node, ConstValue* out) {
+    if (!node || node->type != KAST_NODE_LITERAL) return false;
+    KastLiteral* lit = (KastLiteral*)node;
+    switch (lit->token.type) {
+        case KORELIN_TOKEN_INT:
+            out->kind = CONST_INT;
+            out->integer = atoll(lit->token.value);
+            return true;
+        case KORELIN_TOKEN_FLOAT:
+            out->kind = CONST_DOUBLE;
+            out->number = atof(lit->token.value);
+            return true;
+        case KORELIN_TOKEN_TRUE:
+        case KORELIN_TOKEN_FALSE:
+            out->kind = CONST_BOOL;
+            out->boolean = lit->token.type == KORELIN_TOKEN_TRUE;
+            return true;
+        case KORELIN_TOKEN_NIL:
+            out->kind = CONST_NIL;
+            return true;
+        case KORELIN_TOKEN_STRING:
+            out->kind = CONST_STRING;
+            out->string = lit->token.value;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static KastLiteral* new_literal(KorelinToken type, char* text, const Token* origin) {
+    KastLiteral* lit = (KastLiteral*)malloc(sizeof(KastLiteral));
+    lit->base.type = KAST_NODE_LITERAL;
+    lit->base.line = origin->line;
+    lit->token = *origin;
+    lit->token.type = type;
+    lit->token.value = text;
+    lit->token.length = strlen(text);
+    return lit;
+}
+
+/** @brief 把常量轉換為字面量節點，無法精確表示時返回 NULL */
+static KastLiteral* make_literal(const ConstValue* value, const Token* origin) {
+    char buffer[64];
+    switch (value->kind) {
+        case CONST_INT:
+            snprintf(buffer, sizeof(buffer), "%lld", value->integer);
+            return new_literal(KORELIN_TOKEN_INT, strdup(buffer), origin);
+        case CONST_DOUBLE:
+            if (!isfinite(value->number)) return NULL;
+            snprintf(buffer, sizeof(buffer), "%.17g", value->number);
+            return new_literal(KORELIN_TOKEN_FLOAT, strdup(buffer), origin);
+        case CONST_BOOL:
+            return new_literal(value->boolean ? KORELIN_TOKEN_TRUE : KORELIN_TOKEN_FALSE,
+                               strdup(value->boolean ? "true" : "false"), origin);
+        case CONST_NIL:
+            return new_literal(KORELIN_TOKEN_NIL, strdup("nil"), origin);
+        case CONST_STRING:
+            return new_literal(KORELIN_TOKEN_STRING, strdup(value->string), origin);
+    }
+    return NULL;
+}
+
+static void replace_node(KastNode** slot, KastLiteral* lit) {
+    if (!lit) return;
+    free_ast_node(*slot);
+    *slot = (KastNode*)lit;
+}
+
+// --- 運算 (與 kvm.c 中對應指令的語義保持一致) ---
+
+static bool is_number(const ConstValue* v) {
+    return v->kind == CONST_INT || v->kind == CONST_DOUBLE;
+}
+
+static double as_double(const ConstValue* v) {
+    return v->kind == CONST_INT ? (double)v->integer : v->number;
+}
+
+/** @brief 整數運算按 64 位回繞，避免編譯器中的有符號溢出 */
+static long long wrap_int(uint64_t value) {
+    return (long long)value;
+}
+
+static bool fold_binary(KorelinToken op, const ConstValue* a, const ConstValue* b, ConstValue* out) {
+    bool both_int = a->kind == CONST_INT && b->kind == CONST_INT;
+    bool both_num = is_number(a) && is_number(b);
+
+    switch (op) {
+        case KORELIN_TOKEN_ADD:
+            if (a->kind == CONST_STRING && b->kind == CONST_STRING) {
+                size_t len_a = strlen(a->string);
+                size_t len_b = strlen(b->string);
+                char* joined = (char*)malloc(len_a + len_b + 1);
+                memcpy(joined, a->string, len_a);
+                memcpy(joined + len_a, b->string, len_b + 1);
+                out->kind = CONST_STRING;
+                out->string = joined; /**< 由調用者釋放 */
+                return true;
+            }
+            // fallthrough
+        case KORELIN_TOKEN_SUB:
+        case KORELIN_TOKEN_MUL:
+            if (both_int) {
+                uint64_t x = (uint64_t)a->integer;
+                uint64_t y = (uint64_t)b->integer;
+                out->kind = CONST_INT;
+                out->integer = wrap_int(op == KORELIN_TOKEN_ADD ? x + y : op == KORELIN_TOKEN_SUB ? x - y : x * y);
+                return true;
+            }
+            if (!both_num) return false;
+            out->kind = CONST_DOUBLE;
+            out->number = op == KORELIN_TOKEN_ADD ? as_double(a) + as_double(b)
+                        : op == KORELIN_TOKEN_SUB ? as_double(a) - as_double(b)
+                        : as_double(a) * as_double(b);
+            return true;
+        case KORELIN_TOKEN_DIV:
+        case KORELIN_TOKEN_MOD:
+            if (both_int) {
+                // 除零在運行時拋出 DivisionByZeroError，INT64_MIN / -1 在硬件上陷入，都留給運行時
+                if (b->integer == 0 || (a->integer == INT64_MIN && b->integer == -1)) return false;
+                out->kind = CONST_INT;
+                out->integer = op == KORELIN_TOKEN_DIV ? a->integer / b->integer : a->integer % b->integer;
+                return true;
+            }
+            if (!both_num || as_double(b) == 0.0) return false;
+            out->kind = CONST_DOUBLE;
+            out->number = op == KORELIN_TOKEN_DIV ? as_double(a) / as_double(b) : fmod(as_double(a), as_double(b));
+            return true;
+        case KORELIN_TOKEN_LT:
+        case KORELIN_TOKEN_LE:
+        case KORELIN_TOKEN_GT:
+        case KORELIN_TOKEN_GE: {
+            // 非數值比較在運行時恆為 false
+            out->kind = CONST_BOOL;
+            if (!both_num) {
+                out->boolean = false;
+                return true;
+            }
+            double x = as_double(a), y = as_double(b);
+            out->boolean = op == KORELIN_TOKEN_LT ? x < y : op == KORELIN_TOKEN_LE ? x <= y
+                         : op == KORELIN_TOKEN_GT ? x > y : x >= y;
+            return true;
+        }
+        case KORELIN_TOKEN_EQ:
+        case KORELIN_TOKEN_NE: {
+            bool equal;
+            if (both_int) equal = a->integer == b->integer;
+            else if (both_num) equal = as_double(a) == as_double(b);
+            else if (a->kind == CONST_BOOL && b->kind == CONST_BOOL) equal = a->boolean == b->boolean;
+            else if (a->kind == CONST_NIL && b->kind == CONST_NIL) equal = true;
+            else if (a->kind == CONST_STRING && b->kind == CONST_STRING) equal = strcmp(a->string, b->string) == 0;
+            else return false;
+            out->kind = CONST_BOOL;
+            out->boolean = op == KORELIN_TOKEN_EQ ? equal : !equal;
+            return true;
+        }
+        case KORELIN_TOKEN_AND:
+        case KORELIN_TOKEN_OR:
+            // 與 KOP_AND / KOP_OR 一致：兩邊都會求值，按位運算
+            if (a->kind == CONST_BOOL && b->kind == CONST_BOOL) {
+                out->kind = CONST_BOOL;
+                out->boolean = op == KORELIN_TOKEN_AND ? (a->boolean & b->boolean) : (a->boolean | b->boolean);
+                return true;
+            }
+            if (both_int) {
+                out->kind = CONST_INT;
+                out->integer = op == KORELIN_TOKEN_AND ? (a->integer & b->integer) : (a->integer | b->integer);
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+static bool fold_unary(KorelinToken op, const ConstValue* a, ConstValue* out) {
+    if (op == KORELIN_TOKEN_SUB) {
+        if (a->kind == CONST_INT) {
+            out->kind = CONST_INT;
+            out->integer = wrap_int(0 - (uint64_t)a->integer);
+            return true;
+        }
+        if (a->kind == CONST_DOUBLE) {
+            out->kind = CONST_DOUBLE;
+            out->number = -a->number;
+            return true;
+        }
+    } else if (op == KORELIN_TOKEN_NOT) {
+        if (a->kind == CONST_BOOL) {
+            out->kind = CONST_BOOL;
+            out->boolean = !a->boolean;
+            return true;
+        }
+        if (a->kind == CONST_INT) {
+            out->kind = CONST_INT;
+            out->integer = ~a->integer;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 判斷常量條件的真假
+ * JZ 只把 false 和整數 0 視為假，其它類型的常量條件不做判斷。
+ * @return 1 真, 0 假, -1 非常量條件
+ */
+static int constant_truth(KastNode* condition) {
+    ConstValue value;
+    if (!literal_value(condition, &value)) return -1;
+    if (value.kind == CONST_BOOL) return value.boolean ? 1 : 0;
+    if (value.kind == CONST_INT) return value.integer != 0 ? 1 : 0;
+    return -1;
+}
+
+/** @brief 顯式類型與字面量一致時才允許傳播，避免繞過聲明處的類型轉換 */
+static bool literal_fits_type(KastVarDecl* decl, KastLiteral* lit) {
+    if (decl->is_array) return false;
+    if (!decl->type_name) return true;
+    switch (lit->token.type) {
+        case KORELIN_TOKEN_INT: return strcmp(decl->type_name, "int") == 0;
+        case KORELIN_TOKEN_FLOAT: return strcmp(decl->type_name, "float") == 0; // 與 declared_type 一致，float 即雙精度
+        case KORELIN_TOKEN_STRING: return strcmp(decl->type_name, "string") == 0;
+        case KORELIN_TOKEN_TRUE:
+        case KORELIN_TOKEN_FALSE: return strcmp(decl->type_name, "bool") == 0;
+        default: return false;
+    }
+}
+
+// --- 語法樹遍歷 ---
+
+static KastBlock* new_block(KastStatement* only) {
+    KastBlock* block = (KastBlock*)malloc(sizeof(KastBlock));
+    block->base.type = KAST_NODE_BLOCK;
+    block->base.line = only ? only->base.line : 0;
+    block->statements = NULL;
+    block->statement_count = 0;
+    if (only) {
+        block->statements = (KastStatement**)malloc(sizeof(KastStatement*));
+        block->statements[0] = only;
+        block->statement_count = 1;
+    }
+    return block;
+}
+
+/** @brief 用分支替換整個語句；單獨的聲明包進塊中，保持其作用域不外洩 */
+static void replace_statement(KastStatement** slot, KastStatement* branch) {
+    KastStatement* old = *slot;
+    if (branch && ((KastNode*)branch)->type == KAST_NODE_VAR_DECL) {
+        branch = (KastStatement*)new_block(branch);
+    }
+    *slot = branch ? branch : (KastStatement*)new_block(NULL);
+    free_ast_node((KastNode*)old);
+}
+
+static void bind_declaration(FoldContext* ctx, KastVarDecl* decl) {
+    KastLiteral* value = NULL;
+    if (decl->is_constant && decl->init_value && decl->init_value->type == KAST_NODE_LITERAL &&
+        !is_assigned(ctx, decl->name) && literal_fits_type(decl, (KastLiteral*)decl->init_value)) {
+        value = (KastLiteral*)decl->init_value;
+    }
+    bind_name(ctx, decl->name, value);
+}
+
+static void fold_nodes(FoldContext* ctx, KastNode** nodes, size_t count) {
+    for (size_t i = 0; i < count; i++) fold_node(ctx, &nodes[i]);
+}
+
+static void fold_block(FoldContext* ctx, KastBlock* block) {
+    if (!block) return;
+    size_t mark = ctx->count;
+    for (size_t i = 0; i < block->statement_count; i++) {
+        fold_statement(ctx, &block->statements[i]);
+    }
+    ctx->count = mark;
+}
+
+static void fold_function(FoldContext* ctx, KastNode** args, size_t arg_count, KastBlock* body) {
+    size_t mark = ctx->count;
+    for (size_t i = 0; i < arg_count; i++) {
+        if (args[i] && args[i]->type == KAST_NODE_VAR_DECL) bind_name(ctx, ((KastVarDecl*)args[i])->name, NULL);
+    }
+    fold_block(ctx, body);
+    ctx->count = mark;
+}
+
+/** @brief 類成員在方法體內可直接以名字訪問，需要遮蔽同名常量 */
+static void fold_members(FoldContext* ctx, KastClassMember** members, size_t count) {
+    size_t mark = ctx->count;
+    for (size_t i = 0; i < count; i++) bind_name(ctx, members[i]->name, NULL);
+    for (size_t i = 0; i < count; i++) {
+        KastClassMember* member = members[i];
+        if (member->member_type == KAST_MEMBER_PROPERTY) {
+            fold_node(ctx, &member->init_value);
+        } else {
+            fold_function(ctx, member->args, member->arg_count, member->body);
+        }
+    }
+    ctx->count = mark;
+}
+
+static void fold_node(FoldContext* ctx, KastNode** slot) {
+    KastNode* node = *slot;
+    if (!node) return;
+
+    switch (node->type) {
+        case KAST_NODE_IDENTIFIER: {
+            KastLiteral* value = lookup_name(ctx, ((KastIdentifier*)node)->name);
+            if (value) replace_node(slot, new_literal(value->token.type, strdup(value->token.value), &value->token));
+            break;
+        }
+        case KAST_NODE_BINARY_OP: {
+            KastBinaryOp* bin = (KastBinaryOp*)node;
+            fold_node(ctx, &bin->left);
+            fold_node(ctx, &bin->right);
+            ConstValue a, b, result;
+            if (literal_value(bin->left, &a) && literal_value(bin->right, &b) &&
+                fold_binary(bin->operator, &a, &b, &result)) {
+                KastLiteral* lit = make_literal(&result, &((KastLiteral*)bin->left)->token);
+                if (result.kind == CONST_STRING) free((void*)result.string);
+                replace_node(slot, lit);
+            }
+            break;
+        }
+        case KAST_NODE_UNARY_OP: {
+            KastUnaryOp* unary = (KastUnaryOp*)node;
+            fold_node(ctx, &unary->operand);
+            ConstValue a, result;
+            if (literal_value(unary->operand, &a) && fold_unary(unary->operator, &a, &result)) {
+                replace_node(slot, make_literal(&result, &((KastLiteral*)unary->operand)->token));
+            }
+            break;
+        }
+        case KAST_NODE_POSTFIX_OP:
+        case KAST_NODE_LITERAL:
+        case KAST_NODE_SCOPE_ACCESS:
+            break;
+        case KAST_NODE_ASSIGNMENT: {
+            KastAssignment* assign = (KastAssignment*)node;
+            if (assign->lvalue && assign->lvalue->type != KAST_NODE_IDENTIFIER) fold_node(ctx, &assign->lvalue);
+            fold_node(ctx, &assign->value);
+            break;
+        }
+        case KAST_NODE_CALL: {
+            KastCall* call = (KastCall*)node;
+            if (call->callee && call->callee->type != KAST_NODE_IDENTIFIER) fold_node(ctx, &call->callee);
+            fold_nodes(ctx, call->args, call->arg_count);
+            break;
+        }
+        case KAST_NODE_NEW:
+            fold_nodes(ctx, ((KastNew*)node)->args, ((KastNew*)node)->arg_count);
+            break;
+        case KAST_NODE_MEMBER_ACCESS:
+            fold_node(ctx, &((KastMemberAccess*)node)->object);
+            break;
+        case KAST_NODE_ARRAY_ACCESS:
+            fold_node(ctx, &((KastArrayAccess*)node)->array);
+            fold_node(ctx, &((KastArrayAccess*)node)->index);
+            break;
+        case KAST_NODE_ARRAY_LITERAL:
+            fold_nodes(ctx, ((KastArrayLiteral*)node)->elements, ((KastArrayLiteral*)node)->element_count);
+            break;
+        default:
+            fold_statement(ctx, (KastStatement**)slot);
+            break;
+    }
+}
+
+static void fold_statement(FoldContext* ctx, KastStatement** slot) {
+    KastNode* node = (KastNode*)*slot;
+    if (!node) return;
+
+    switch (node->type) {
+        case KAST_NODE_VAR_DECL: {
+            KastVarDecl* decl = (KastVarDecl*)node;
+            fold_node(ctx, &decl->init_value);
+            bind_declaration(ctx, decl);
+            break;
+        }
+        case KAST_NODE_BLOCK:
+            fold_block(ctx, (KastBlock*)node);
+            break;
+        case KAST_NODE_IF: {
+            KastIf* stmt = (KastIf*)node;
+            fold_node(ctx, &stmt->condition);
+            fold_statement(ctx, &stmt->then_branch);
+            fold_statement(ctx, &stmt->else_branch);
+            int truth = constant_truth(stmt->condition);
+            if (truth == 1) {
+                KastStatement* branch = stmt->then_branch;
+                stmt->then_branch = NULL;
+                replace_statement(slot, branch);
+            } else if (truth == 0) {
+                KastStatement* branch = stmt->else_branch;
+                stmt->else_branch = NULL;
+                replace_statement(slot, branch);
+            }
+            break;
+        }
+        case KAST_NODE_WHILE: {
+            KastWhile* stmt = (KastWhile*)node;
+            fold_node(ctx, &stmt->condition);
+            fold_statement(ctx, &stmt->body);
+            if (constant_truth(stmt->condition) == 0) replace_statement(slot, NULL);
+            break;
+        }
+        case KAST_NODE_DO_WHILE: {
+            KastDoWhile* stmt = (KastDoWhile*)node;
+            fold_statement(ctx, &stmt->body);
+            fold_node(ctx, &stmt->condition);
+            break;
+        }
+        case KAST_NODE_FOR: {
+            KastFor* stmt = (KastFor*)node;
+            size_t mark = ctx->count;
+            fold_statement(ctx, &stmt->init);
+            fold_node(ctx, &stmt->condition);
+            fold_node(ctx, &stmt->increment);
+            fold_statement(ctx, &stmt->body);
+            ctx->count = mark;
+            if (constant_truth(stmt->condition) == 0) {
+                // 循環體不可達，但初始化語句仍要執行
+                KastStatement* init = stmt->init;
+                stmt->init = NULL;
+                replace_statement(slot, init ? (KastStatement*)new_block(init) : NULL);
+            }
+            break;
+        }
+        case KAST_NODE_SWITCH: {
+            KastSwitch* stmt = (KastSwitch*)node;
+            fold_node(ctx, &stmt->condition);
+            for (size_t i = 0; i < stmt->case_count; i++) {
+                fold_node(ctx, &stmt->cases[i].value);
+                size_t mark = ctx->count;
+                fold_statement(ctx, &stmt->cases[i].body);
+                ctx->count = mark;
+            }
+            size_t mark = ctx->count;
+            fold_statement(ctx, &stmt->default_branch);
+            ctx->count = mark;
+            break;
+        }
+        case KAST_NODE_TRY_CATCH: {
+            KastTryCatch* stmt = (KastTryCatch*)node;
+            fold_block(ctx, stmt->try_block);
+            for (size_t i = 0; i < stmt->catch_count; i++) {
+                size_t mark = ctx->count;
+                if (stmt->catch_blocks[i].variable_name) bind_name(ctx, stmt->catch_blocks[i].variable_name, NULL);
+                fold_block(ctx, stmt->catch_blocks[i].body);
+                ctx->count = mark;
+            }
+            break;
+        }
+        case KAST_NODE_RETURN:
+            fold_node(ctx, &((KastReturn*)node)->value);
+            break;
+        case KAST_NODE_THROW:
+            fold_node(ctx, &((KastThrow*)node)->value);
+            break;
+        case KAST_NODE_FUNCTION_DECL: {
+            KastFunctionDecl* func = (KastFunctionDecl*)node;
+            fold_function(ctx, func->args, func->arg_count, func->body);
+            break;
+        }
+        case KAST_NODE_CLASS_DECL:
+            fold_members(ctx, ((KastClassDecl*)node)->members, ((KastClassDecl*)node)->member_count);
+            break;
+        case KAST_NODE_STRUCT_DECL: {
+            KastStructDecl* decl = (KastStructDecl*)node;
+            fold_members(ctx, decl->members, decl->member_count);
+            fold_statement(ctx, &decl->init_var);
+            break;
+        }
+        case KAST_NODE_LITERAL:
+        case KAST_NODE_IDENTIFIER:
+        case KAST_NODE_ASSIGNMENT:
+        case KAST_NODE_NEW:
+        case KAST_NODE_MEMBER_ACCESS:
+        case KAST_NODE_SCOPE_ACCESS:
+        case KAST_NODE_CALL:
+        case KAST_NODE_ARRAY_ACCESS:
+        case KAST_NODE_ARRAY_LITERAL:
+        case KAST_NODE_BINARY_OP:
+        case KAST_NODE_UNARY_OP:
+        case KAST_NODE_POSTFIX_OP:
+            // 表達式語句
+            fold_node(ctx, (KastNode**)slot);
+            break;
+        default:
+            break;
+    }
+}
+
+/** @brief 頂層名字是否只聲明過一次 */
+static bool declared_once(KastProgram* program, const char* name) {
+    int count = 0;
+    for (size_t i = 0; i < program->statement_count; i++) {
+        KastNode* node = (KastNode*)program->statements[i];
+        if (node && node->type == KAST_NODE_VAR_DECL && strcmp(((KastVarDecl*)node)->name, name) == 0) count++;
+    }
+    return count == 1;
+}
+
+void kopt_fold_constants(KastProgram* program) {
+    if (!program) return;
+
+    FoldContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    collect_assigned(&ctx, (KastNode*)program);
+
+    // 頂層常量對所有函數可見 (函數可能寫在常量聲明之前)，先單獨折疊並綁定
+    for (size_t i = 0; i < program->statement_count; i++) {
+        KastNode* node = (KastNode*)program->statements[i];
+        if (!node || node->type != KAST_NODE_VAR_DECL) continue;
+        KastVarDecl* decl = (KastVarDecl*)node;
+        if (!decl->is_constant || !declared_once(program, decl->name)) continue;
+        fold_node(&ctx, &decl->init_value);
+        bind_declaration(&ctx, decl);
+    }
+    size_t globals = ctx.count;
+
+    for (size_t i = 0; i < program->statement_count; i++) {
+        KastNode* node = (KastNode*)program->statements[i];
+        if (node && node->type == KAST_NODE_VAR_DECL) {
+            // 頂層聲明已處理 (或不可傳播)，只折疊初始化表達式
+            fold_node(&ctx, &((KastVarDecl*)node)->init_value);
+            continue;
+        }
+        fold_statement(&ctx, &program->statements[i]);
+        ctx.count = globals;
+    }
+
+    free(ctx.bindings);
+    free(ctx.assigned);
+    free(ctx.assigned_members);
+    free(ctx.declared);
+}
+
+// --- 局部變量類型推斷 ---
+
+typedef struct {
+    KTypeEnv* env;
+    const char** visible;     /**< 當前可見的局部變量名 (按聲明順序) */
+    size_t visible_count;
+    size_t visible_capacity;
+    int depth;                /**< 對應編譯器的 scope_depth，0 為頂層 */
+    bool collecting;          /**< true: 收集聲明；false: 檢查每一次寫入 */
+    bool changed;
+    bool unknown_node;        /**< 遇到無法分析的節點，放棄推斷 */
+} InferContext;
+
+static KTypedName* find_typed_name(const KTypeEnv* env, const char* name) {
+    for (size_t i = 0; i < env->count; i++) {
+        if (strcmp(env->names[i].name, name) == 0) return &env->names[i];
+    }
+    return NULL;
+}
+
+/** @brief 登記聲明；同名但類型不同的聲明使該名字失去類型 */
+static void declare_typed_name(KTypeEnv* env, const char* name, KStaticType type) {
+    KTypedName* entry = find_typed_name(env, name);
+    if (entry) {
+        if (entry->type != type) entry->type = KTYPE_UNKNOWN;
+        return;
+    }
+    if (env->count == env->capacity) {
+        env->capacity = env->capacity ? env->capacity * 2 : 16;
+        env->names = (KTypedName*)realloc(env->names, env->capacity * sizeof(KTypedName));
+    }
+    env->names[env->count].name = name;
+    env->names[env->count].type = type;
+    env->count++;
+}
+
+static KStaticType declared_type(const KastVarDecl* decl) {
+    if (!decl->type_name || decl->is_array) return KTYPE_UNKNOWN;
+    if (strcmp(decl->type_name, "int") == 0) return KTYPE_INT;
+    if (strcmp(decl->type_name, "float") == 0) return KTYPE_DOUBLE; // 浮點字面量均為雙精度
+    if (strcmp(decl->type_name, "bool") == 0) return KTYPE_BOOL;
+    if (strcmp(decl->type_name, "string") == 0) return KTYPE_STRING;
+    return KTYPE_UNKNOWN;
+}
+
+static void push_visible(InferContext* ctx, const char* name) {
+    if (ctx->visible_count == ctx->visible_capacity) {
+        ctx->visible_capacity = ctx->visible_capacity ? ctx->visible_capacity * 2 : 32;
+        ctx->visible = (const char**)realloc(ctx->visible, ctx->visible_capacity * sizeof(const char*));
+    }
+    ctx->visible[ctx->visible_count++] = name;
+}
+
+static bool is_visible(const InferContext* ctx, const char* name) {
+    for (size_t i = ctx->visible_count; i > 0; i--) {
+        if (strcmp(ctx->visible[i - 1], name) == 0) return true;
+    }
+    return false;
+}
+
+static KStaticType visible_type(void* opaque, const char* name) {
+    InferContext* ctx = (InferContext*)opaque;
+    return is_visible(ctx, name) ? kopt_type_of(ctx->env, name) : KTYPE_UNKNOWN;
+}
+
+/** @brief 局部變量被寫入 value_type 類型的值，與推斷結果不符時降級 */
+static void check_write(InferContext* ctx, const char* name, KStaticType value_type) {
+    if (ctx->collecting || !is_visible(ctx, name)) return;
+    KTypedName* entry = find_typed_name(ctx->env, name);
+    if (entry && entry->type != KTYPE_UNKNOWN && entry->type != value_type) {
+        entry->type = KTYPE_UNKNOWN;
+        ctx->changed = true;
+    }
+}
+
+/** @brief 表達式是否引用了名字 (未知節點保守地視為引用) */
+static bool expression_mentions(KastNode* node, const char* name) {
+    if (!node) return false;
+    switch (node->type) {
+        case KAST_NODE_LITERAL:
+            return false;
+        case KAST_NODE_IDENTIFIER:
+            return strcmp(((KastIdentifier*)node)->name, name) == 0;
+        case KAST_NODE_BINARY_OP:
+            return expression_mentions(((KastBinaryOp*)node)->left, name) ||
+                   expression_mentions(((KastBinaryOp*)node)->right, name);
+        case KAST_NODE_UNARY_OP:
+            return expression_mentions(((KastUnaryOp*)node)->operand, name);
+        case KAST_NODE_POSTFIX_OP:
+            return expression_mentions(((KastPostfixOp*)node)->operand, name);
+        case KAST_NODE_MEMBER_ACCESS:
+            return expression_mentions(((KastMemberAccess*)node)->object, name);
+        case KAST_NODE_CALL: {
+            KastCall* call = (KastCall*)node;
+            if (expression_mentions(call->callee, name)) return true;
+            for (size_t i = 0; i < call->arg_count; i++) {
+                if (expression_mentions(call->args[i], name)) return true;
+            }
+            return false;
+        }
+        default:
+            return true;
+    }
+}
+
+static void infer_node(InferContext* ctx, KastNode* node);
+
+static void infer_node(InferContext* ctx, KastNode* node) {
+    if (!node) return;
+    switch (node->type) {
+        case KAST_NODE_LITERAL:
+        case KAST_NODE_IDENTIFIER:
+        case KAST_NODE_SCOPE_ACCESS:
+        case KAST_NODE_BREAK:
+        case KAST_NODE_CONTINUE:
+        case KAST_NODE_IMPORT:
+        case KAST_NODE_FUNCTION_DECL: // 函數體單獨推斷
+        case KAST_NODE_CLASS_DECL:
+            break;
+        case KAST_NODE_VAR_DECL: {
+            KastVarDecl* decl = (KastVarDecl*)node;
+            if (ctx->collecting) {
+                // 頂層聲明是全局變量，任何函數都可能改寫
+                declare_typed_name(ctx->env, decl->name, ctx->depth > 0 ? declared_type(decl) : KTYPE_UNKNOWN);
+            }
+            // 與編譯器一致：先登記局部變量，再計算初始值
+            push_visible(ctx, decl->name);
+            if (decl->init_value) {
+                KStaticType type = kopt_expression_type(decl->init_value, visible_type, ctx);
+                if (expression_mentions(decl->init_value, decl->name)) type = KTYPE_UNKNOWN; // 讀到未初始化的寄存器
+                check_write(ctx, decl->name, type);
+                infer_node(ctx, decl->init_value);
+            } else {
+                check_write(ctx, decl->name, KTYPE_INT); // 編譯器只把無初值的 int 清零
+            }
+            break;
+        }
+        case KAST_NODE_ASSIGNMENT: {
+            KastAssignment* assign = (KastAssignment*)node;
+            if (assign->lvalue && assign->lvalue->type == KAST_NODE_IDENTIFIER) {
+                check_write(ctx, ((KastIdentifier*)assign->lvalue)->name,
+                            kopt_expression_type(assign->value, visible_type, ctx));
+            }
+            infer_node(ctx, assign->lvalue);
+            infer_node(ctx, assign->value);
+            break;
+        }
+        case KAST_NODE_POSTFIX_OP: {
+            KastPostfixOp* post = (KastPostfixOp*)node;
+            if (post->operand && post->operand->type == KAST_NODE_IDENTIFIER) {
+                const char* name = ((KastIdentifier*)post->operand)->name;
+                KStaticType type = visible_type(ctx, name);
+                check_write(ctx, name, (type == KTYPE_INT || type == KTYPE_DOUBLE) ? type : KTYPE_UNKNOWN);
+            }
+            infer_node(ctx, post->operand);
+            break;
+        }
+        case KAST_NODE_UNARY_OP:
+            infer_node(ctx, ((KastUnaryOp*)node)->operand);
+            break;
+        case KAST_NODE_BINARY_OP:
+            infer_node(ctx, ((KastBinaryOp*)node)->left);
+            infer_node(ctx, ((KastBinaryOp*)node)->right);
+            break;
+        case KAST_NODE_CALL: {
+            KastCall* call = (KastCall*)node;
+            infer_node(ctx, call->callee);
+            for (size_t i = 0; i < call->arg_count; i++) infer_node(ctx, call->args[i]);
+            break;
+        }
+        case KAST_NODE_NEW: {
+            KastNew* n = (KastNew*)node;
+            for (size_t i = 0; i < n->arg_count; i++) infer_node(ctx, n->args[i]);
+            break;
+        }
+        case KAST_NODE_MEMBER_ACCESS:
+            infer_node(ctx, ((KastMemberAccess*)node)->object);
+            break;
+        case KAST_NODE_ARRAY_ACCESS:
+            infer_node(ctx, ((KastArrayAccess*)node)->array);
+            infer_node(ctx, ((KastArrayAccess*)node)->index);
+            break;
+        case KAST_NODE_ARRAY_LITERAL: {
+            KastArrayLiteral* lit = (KastArrayLiteral*)node;
+            for (size_t i = 0; i < lit->element_count; i++) infer_node(ctx, lit->elements[i]);
+            break;
+        }
+        case KAST_NODE_BLOCK: {
+            KastBlock* block = (KastBlock*)node;
+            size_t mark = ctx->visible_count;
+            ctx->depth++;
+            for (size_t i = 0; i < block->statement_count; i++) {
+                infer_node(ctx, (KastNode*)block->statements[i]);
+            }
+            ctx->depth--;
+            ctx->visible_count = mark;
+            break;
+        }
+        case KAST_NODE_PROGRAM: {
+            KastProgram* program = (KastProgram*)node;
+            for (size_t i = 0; i < program->statement_count; i++) {
+                infer_node(ctx, (KastNode*)program->statements[i]);
+            }
+            break;
+        }
+        case KAST_NODE_IF: {
+            KastIf* stmt = (KastIf*)node;
+            infer_node(ctx, stmt->condition);
+            infer_node(ctx, (KastNode*)stmt->then_branch);
+            infer_node(ctx, (KastNode*)stmt->else_branch);
+            break;
+        }
+        case KAST_NODE_SWITCH: {
+            KastSwitch* stmt = (KastSwitch*)node;
+            infer_node(ctx, stmt->condition);
+            for (size_t i = 0; i < stmt->case_count; i++) {
+                infer_node(ctx, stmt->cases[i].value);
+                infer_node(ctx, (KastNode*)stmt->cases[i].body);
+            }
+            infer_node(ctx, (KastNode*)stmt->default_branch);
+            break;
+        }
+        case KAST_NODE_FOR: {
+            // for 的初始化部分單獨成一個作用域
+            KastFor* stmt = (KastFor*)node;
+            size_t mark = ctx->visible_count;
+            ctx->depth++;
+            infer_node(ctx, (KastNode*)stmt->init);
+            infer_node(ctx, stmt->condition);
+            infer_node(ctx, (KastNode*)stmt->body);
+            infer_node(ctx, stmt->increment);
+            ctx->depth--;
+            ctx->visible_count = mark;
+            break;
+        }
+        case KAST_NODE_WHILE:
+            infer_node(ctx, ((KastWhile*)node)->condition);
+            infer_node(ctx, (KastNode*)((KastWhile*)node)->body);
+            break;
+        case KAST_NODE_DO_WHILE:
+            infer_node(ctx, (KastNode*)((KastDoWhile*)node)->body);
+            infer_node(ctx, ((KastDoWhile*)node)->condition);
+            break;
+        case KAST_NODE_RETURN:
+            infer_node(ctx, ((KastReturn*)node)->value);
+            break;
+        case KAST_NODE_THROW:
+            infer_node(ctx, ((KastThrow*)node)->value);
+            break;
+        case KAST_NODE_TRY_CATCH: {
+            KastTryCatch* stmt = (KastTryCatch*)node;
+            infer_node(ctx, (KastNode*)stmt->try_block);
+            for (size_t i = 0; i < stmt->catch_count; i++) {
+                KorelinCatchBlock* catch_block = &stmt->catch_blocks[i];
+                size_t mark = ctx->visible_count;
+                if (catch_block->variable_name) {
+                    if (ctx->collecting) declare_typed_name(ctx->env, catch_block->variable_name, KTYPE_UNKNOWN);
+                    push_visible(ctx, catch_block->variable_name);
+                }
+                infer_node(ctx, (KastNode*)catch_block->body);
+                ctx->visible_count = mark;
+            }
+            break;
+        }
+        case KAST_NODE_STRUCT_DECL:
+            infer_node(ctx, (KastNode*)((KastStructDecl*)node)->init_var);
+            break;
+        default:
+            ctx->unknown_node = true;
+            break;
+    }
+}
+
+void kopt_infer_local_types(KTypeEnv* env, KastNode** params, size_t param_count, KastNode* body) {
+    memset(env, 0, sizeof(*env));
+    InferContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.env = env;
+    int base_depth = (body && body->type == KAST_NODE_PROGRAM) ? 0 : 1;
+
+    for (size_t i = 0; i < param_count; i++) {
+        declare_typed_name(env, ((KastVarDecl*)params[i])->name, KTYPE_UNKNOWN);
+    }
+    ctx.collecting = true;
+    ctx.depth = base_depth;
+    infer_node(&ctx, body);
+
+    // 降級只會讓更多表達式變為未知，反復檢查直到不再變化
+    ctx.collecting = false;
+    do {
+        ctx.changed = false;
+        ctx.visible_count = 0;
+        ctx.depth = base_depth;
+        for (size_t i = 0; i < param_count; i++) push_visible(&ctx, ((KastVarDecl*)params[i])->name);
+        infer_node(&ctx, body);
+    } while (ctx.changed && !ctx.unknown_node);
+
+    if (ctx.unknown_node) {
+        for (size_t i = 0; i < env->count; i++) env->names[i].type = KTYPE_UNKNOWN;
+    }
+    free(ctx.visible);
+}
+
+KStaticType kopt_type_of(const KTypeEnv* env, const char* name) {
+    KTypedName* entry = env ? find_typed_name(env, name) : NULL;
+    return entry ? entry->type : KTYPE_UNKNOWN;
+}
+
+static bool is_numeric_type(KStaticType type) {
+    return type == KTYPE_INT || type == KTYPE_DOUBLE;
+}
+
+KStaticType kopt_expression_type(KastNode* expr, KTypeLookup lookup, void* ctx) {
+    if (!expr) return KTYPE_UNKNOWN;
+    switch (expr->type) {
+        case KAST_NODE_LITERAL:
+            switch (((KastLiteral*)expr)->token.type) {
+                case KORELIN_TOKEN_INT: return KTYPE_INT;
+                case KORELIN_TOKEN_FLOAT: return KTYPE_DOUBLE;
+                case KORELIN_TOKEN_STRING: return KTYPE_STRING;
+                case KORELIN_TOKEN_BOOL: case KORELIN_TOKEN_TRUE: case KORELIN_TOKEN_FALSE: return KTYPE_BOOL;
+                default: return KTYPE_UNKNOWN;
+            }
+        case KAST_NODE_IDENTIFIER:
+            return lookup(ctx, ((KastIdentifier*)expr)->name);
+        case KAST_NODE_ASSIGNMENT:
+            return kopt_expression_type(((KastAssignment*)expr)->value, lookup, ctx);
+        case KAST_NODE_POSTFIX_OP: { // 結果是自增前的值
+            KastNode* operand = ((KastPostfixOp*)expr)->operand;
+            if (!operand || operand->type != KAST_NODE_IDENTIFIER) return KTYPE_UNKNOWN;
+            KStaticType type = lookup(ctx, ((KastIdentifier*)operand)->name);
+            return is_numeric_type(type) ? type : KTYPE_UNKNOWN;
+        }
+        case KAST_NODE_UNARY_OP: {
+            KastUnaryOp* unary = (KastUnaryOp*)expr;
+            KStaticType type = kopt_expression_type(unary->operand, lookup, ctx);
+            if (unary->operator == KORELIN_TOKEN_NOT) {
+                return (type == KTYPE_BOOL || type == KTYPE_INT) ? type : KTYPE_UNKNOWN;
+            }
+            return is_numeric_type(type) ? type : KTYPE_UNKNOWN; // NEG 對其他類型不寫入目標
+        }
+        case KAST_NODE_BINARY_OP: {
+            KastBinaryOp* bin = (KastBinaryOp*)expr;
+            KStaticType a = kopt_expression_type(bin->left, lookup, ctx);
+            KStaticType b = kopt_expression_type(bin->right, lookup, ctx);
+            switch (bin->operator) {
+                case KORELIN_TOKEN_ADD:
+                    if (a == KTYPE_STRING || b == KTYPE_STRING) return KTYPE_STRING;
+                    // fallthrough
+                case KORELIN_TOKEN_SUB: case KORELIN_TOKEN_MUL:
+                case KORELIN_TOKEN_DIV: case KORELIN_TOKEN_MOD:
+                    if (!is_numeric_type(a) || !is_numeric_type(b)) return KTYPE_UNKNOWN;
+                    return (a == KTYPE_INT && b == KTYPE_INT) ? KTYPE_INT : KTYPE_DOUBLE;
+                case KORELIN_TOKEN_EQ: case KORELIN_TOKEN_NE:
+                case KORELIN_TOKEN_LT: case KORELIN_TOKEN_LE:
+                case KORELIN_TOKEN_GT: case KORELIN_TOKEN_GE:
+                    return KTYPE_BOOL;
+                case KORELIN_TOKEN_AND: case KORELIN_TOKEN_OR:
+                    return (a == b && (a == KTYPE_BOOL || a == KTYPE_INT)) ? a : KTYPE_UNKNOWN;
+                default:
+                    return KTYPE_UNKNOWN;
+            }
+        }
+        default:
+            return KTYPE_UNKNOWN;
+    }
+}
+
+void kopt_free_type_env(KTypeEnv* env) {
+    free(env->names);
+    memset(env, 0, sizeof(*env));
+}
+
+// --- 內聯候選 ---
+
+#define INLINE_BUDGET 24 /**< 可內聯函數體的語法樹節點數上限 */
+
+/** @brief 掃描函數體時收集的信息 */
+typedef struct {
+    const char* name; /**< 被掃描的函數名 */
+    bool method;      /**< 私有方法：自身調用的形式為 obj.name(...) */
+    bool invokes;     /**< 函數體中有方法調用 */
+    bool recursive;   /**< 函數體中調用了自身 */
+} InlineScan;
+
+/** @brief 累加代價，任一部分不可內聯 (-1) 則整體不可內聯 */
+static int add_cost(int total, int part) {
+    return (total < 0 || part < 0) ? -1 : total + part;
+}
+
+static int expression_cost(KastNode* node, InlineScan* scan) {
+    if (!node) return 0;
+    switch (node->type) {
+        case KAST_NODE_LITERAL:
+            return 1;
+        case KAST_NODE_IDENTIFIER: // super 依賴調用者的類上下文
+            return strcmp(((KastIdentifier*)node)->name, "super") == 0 ? -1 : 1;
+        case KAST_NODE_BINARY_OP:
+            return add_cost(add_cost(1, expression_cost(((KastBinaryOp*)node)->left, scan)),
+                            expression_cost(((KastBinaryOp*)node)->right, scan));
+        case KAST_NODE_UNARY_OP:
+            return add_cost(1, expression_cost(((KastUnaryOp*)node)->operand, scan));
+        case KAST_NODE_POSTFIX_OP:
+            return add_cost(1, expression_cost(((KastPostfixOp*)node)->operand, scan));
+        case KAST_NODE_ASSIGNMENT:
+            return add_cost(add_cost(1, expression_cost(((KastAssignment*)node)->lvalue, scan)),
+                            expression_cost(((KastAssignment*)node)->value, scan));
+        case KAST_NODE_MEMBER_ACCESS:
+            return add_cost(1, expression_cost(((KastMemberAccess*)node)->object, scan));
+        case KAST_NODE_ARRAY_ACCESS:
+            return add_cost(add_cost(1, expression_cost(((KastArrayAccess*)node)->array, scan)),
+                            expression_cost(((KastArrayAccess*)node)->index, scan));
+        case KAST_NODE_CALL: {
+            KastCall* call = (KastCall*)node;
+            if (call->callee->type == KAST_NODE_MEMBER_ACCESS) {
+                KastMemberAccess* acc = (KastMemberAccess*)call->callee;
+                scan->invokes = true;
+                if (scan->method && strcmp(acc->member_name, scan->name) == 0) scan->recursive = true;
+            } else if (!scan->method && call->callee->type == KAST_NODE_IDENTIFIER &&
+                       strcmp(((KastIdentifier*)call->callee)->name, scan->name) == 0) {
+                scan->recursive = true;
+            }
+            int cost = add_cost(1, expression_cost(call->callee, scan));
+            for (size_t i = 0; i < call->arg_count; i++) cost = add_cost(cost, expression_cost(call->args[i], scan));
+            return cost;
+        }
+        case KAST_NODE_NEW: {
+            KastNew* n = (KastNew*)node;
+            int cost = 1;
+            for (size_t i = 0; i < n->arg_count; i++) cost = add_cost(cost, expression_cost(n->args[i], scan));
+            return cost;
+        }
+        default:
+            return -1;
+    }
+}
+
+/**
+ * @brief 語句的內聯代價
+ * @param returns 輸出：執行完該語句時一定已經 return
+ */
+static int statement_cost(KastNode* node, bool* returns, InlineScan* scan) {
+    *returns = false;
+    if (!node) return 0;
+    switch (node->type) {
+        case KAST_NODE_BLOCK: {
+            KastBlock* block = (KastBlock*)node;
+            int cost = 0;
+            for (size_t i = 0; i < block->statement_count; i++) {
+                bool stmt_returns = false;
+                cost = add_cost(cost, statement_cost((KastNode*)block->statements[i], &stmt_returns, scan));
+                if (stmt_returns) *returns = true;
+            }
+            return cost;
+        }
+        case KAST_NODE_VAR_DECL:
+            return add_cost(1, expression_cost(((KastVarDecl*)node)->init_value, scan));
+        case KAST_NODE_IF: {
+            KastIf* stmt = (KastIf*)node;
+            bool then_returns = false, else_returns = false;
+            int cost = add_cost(1, expression_cost(stmt->condition, scan));
+            cost = add_cost(cost, statement_cost((KastNode*)stmt->then_branch, &then_returns, scan));
+            cost = add_cost(cost, statement_cost((KastNode*)stmt->else_branch, &else_returns, scan));
+            *returns = then_returns && else_returns;
+            return cost;
+        }
+        case KAST_NODE_RETURN: {
+            KastNode* value = ((KastReturn*)node)->value;
+            *returns = true;
+            return value ? add_cost(1, expression_cost(value, scan)) : -1;
+        }
+        case KAST_NODE_CALL:
+        case KAST_NODE_ASSIGNMENT:
+        case KAST_NODE_BINARY_OP:
+        case KAST_NODE_MEMBER_ACCESS: // 與 compile_statement 接受的表達式語句一致
+            return expression_cost(node, scan);
+        default:
+            return -1;
+    }
+}
+
+/**
+ * @brief 函數體是否可以內聯
+ * 只允許變量聲明、表達式語句、if/else 與帶值的 return，並且每條路徑都以 return 結束：
+ * 函數末尾的隱式 RET 返回的是 R0 中的殘值，調用處無法重現。
+ * 遞歸函數不內聯。
+ * @param scan 輸入函數名，輸出掃描結果
+ */
+static bool inlinable_body(KastBlock* body, InlineScan* scan) {
+    bool returns = false;
+    int cost = statement_cost((KastNode*)body, &returns, scan);
+    return cost >= 0 && cost <= INLINE_BUDGET && returns && !scan->recursive;
+}
+
+/**
+ * @brief 全局名字只被一條聲明綁定，並且程序中沒有對它的賦值
+ * 函數、類聲明在任何位置都綁定全局名字；變量聲明只有在頂層才是全局的。
+ */
+static bool global_bound_once(FoldContext* ctx, KastProgram* program, const char* name) {
+    if (is_assigned(ctx, name)) return false;
+    int count = 0;
+    for (size_t i = 0; i < ctx->declared_count; i++) {
+        if (strcmp(ctx->declared[i], name) == 0) count++;
+    }
+    for (size_t i = 0; i < program->statement_count; i++) {
+        KastNode* node = (KastNode*)program->statements[i];
+        if (node && node->type == KAST_NODE_STRUCT_DECL) node = (KastNode*)((KastStructDecl*)node)->init_var;
+        if (node && node->type == KAST_NODE_VAR_DECL && strcmp(((KastVarDecl*)node)->name, name) == 0) count++;
+    }
+    return count == 1;
+}
+
+/**
+ * @brief 私有方法的目標是否唯一
+ * 方法按名字在運行時查找 (實例字段優先)，只有當程序中沒有其他同名成員 (任何類的方法或屬性、
+ * 類外定義的方法) 且從未給同名成員賦值時，self.name(...) 才一定調用這個方法。
+ */
+static bool member_name_unique(FoldContext* ctx, KastProgram* program, const char* name) {
+    if (name_listed(ctx->assigned_members, ctx->assigned_member_count, name)) return false;
+    int count = 0;
+    for (size_t i = 0; i < program->statement_count; i++) {
+        KastNode* node = (KastNode*)program->statements[i];
+        if (!node) continue;
+        KastClassMember** members = NULL;
+        size_t member_count = 0;
+        if (node->type == KAST_NODE_CLASS_DECL) {
+            members = ((KastClassDecl*)node)->members;
+            member_count = ((KastClassDecl*)node)->member_count;
+        } else if (node->type == KAST_NODE_STRUCT_DECL) {
+            members = ((KastStructDecl*)node)->members;
+            member_count = ((KastStructDecl*)node)->member_count;
+        } else if (node->type == KAST_NODE_FUNCTION_DECL) {
+            KastFunctionDecl* func = (KastFunctionDecl*)node;
+            if (func->parent_class_name && strcmp(func->name, name) == 0) return false;
+        }
+        for (size_t j = 0; j < member_count; j++) {
+            if (strcmp(members[j]->name, name) == 0) count++;
+        }
+    }
+    return count == 1;
+}
+
+static void add_candidate(KInlineSet* set, const char* name, const char* class_name, KastNode* decl,
+                          KastNode** params, size_t param_count, KastBlock* body, bool invokes) {
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity ? set->capacity * 2 : 16;
+        set->items = (KInlineCandidate*)realloc(set->items, set->capacity * sizeof(KInlineCandidate));
+    }
+    KInlineCandidate* candidate = &set->items[set->count++];
+    candidate->name = name;
+    candidate->class_name = class_name;
+    candidate->decl = decl;
+    candidate->params = params;
+    candidate->param_count = param_count;
+    candidate->body = body;
+    candidate->invokes = invokes;
+    candidate->ready = false;
+    candidate->active = false;
+}
+
+void kopt_find_inline_candidates(KastProgram* program, KInlineSet* set) {
+    memset(set, 0, sizeof(*set));
+    if (!program) return;
+
+    FoldContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    collect_assigned(&ctx, (KastNode*)program);
+
+    for (size_t i = 0; i < program->statement_count; i++) {
+        KastNode* node = (KastNode*)program->statements[i];
+        if (!node) continue;
+        if (node->type == KAST_NODE_FUNCTION_DECL) {
+            KastFunctionDecl* func = (KastFunctionDecl*)node;
+            InlineScan scan = { func->name, false, false, false };
+            if (func->parent_class_name || !func->body || !inlinable_body(func->body, &scan) ||
+                !global_bound_once(&ctx, program, func->name)) continue;
+            add_candidate(set, func->name, NULL, node, func->args, func->arg_count, func->body, scan.invokes);
+        } else if (node->type == KAST_NODE_CLASS_DECL) {
+            KastClassDecl* cls = (KastClassDecl*)node;
+            for (size_t j = 0; j < cls->member_count; j++) {
+                KastClassMember* member = cls->members[j];
+                InlineScan scan = { member->name, true, false, false };
+                if (member->member_type != KAST_MEMBER_METHOD || member->access != KAST_ACCESS_PRIVATE ||
+                    member->is_static || !member->body || member->arg_count == 0 ||
+                    strcmp(((KastVarDecl*)member->args[0])->name, "self") != 0 ||
+                    !inlinable_body(member->body, &scan) ||
+                    !member_name_unique(&ctx, program, member->name)) continue;
+                add_candidate(set, member->name, cls->name, (KastNode*)member, member->args,
+                              member->arg_count, member->body, scan.invokes);
+            }
+        }
+    }
+    free(ctx.assigned);
+    free(ctx.assigned_members);
+    free(ctx.declared);
+}
+
+void kopt_free_inline_set(KInlineSet* set) {
+    free(set->items);
+    memset(set, 0, sizeof(*set));
+}
+
+// --- 循環不變量 ---
+
+void kopt_collect_writes(KastNode* node, KWriteSet* writes) {
+    FoldContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    collect_assigned(&ctx, node);
+    for (size_t i = 0; i < ctx.declared_count; i++) {
+        list_name(&ctx.assigned, &ctx.assigned_count, &ctx.assigned_capacity, ctx.declared[i]);
+    }
+    writes->names = ctx.assigned;
+    writes->name_count = ctx.assigned_count;
+    writes->members = ctx.assigned_members;
+    writes->member_count = ctx.assigned_member_count;
+    writes->calls = ctx.calls;
+    free(ctx.declared);
+}
+
+bool kopt_writes_name(const KWriteSet* writes, const char* name) {
+    return name_listed(writes->names, writes->name_count, name);
+}
+
+bool kopt_writes_member(const KWriteSet* writes, const char* member) {
+    return name_listed(writes->members, writes->member_count, member);
+}
+
+void kopt_free_write_set(KWriteSet* writes) {
+    free(writes->names);
+    free(writes->members);
+    memset(writes, 0, sizeof(*writes));
+}
+
+/** @brief 頂層語句綁定的全局名字，不綁定時返回 NULL */
+static const char* top_level_binding(KastNode* node) {
+    switch (node->type) {
+        case KAST_NODE_FUNCTION_DECL: {
+            KastFunctionDecl* func = (KastFunctionDecl*)node;
+            return func->parent_class_name ? NULL : func->name;
+        }
+        case KAST_NODE_CLASS_DECL: return ((KastClassDecl*)node)->name;
+        case KAST_NODE_STRUCT_DECL: return ((KastStructDecl*)node)->name;
+        case KAST_NODE_VAR_DECL: return ((KastVarDecl*)node)->name;
+        case KAST_NODE_IMPORT: {
+            KastImport* imp = (KastImport*)node;
+            return imp->alias ? imp->alias : imp->path_parts[imp->part_count - 1];
+        }
+        default: return NULL;
+    }
+}
+
+void kopt_find_stable_globals(KastProgram* program, KGlobalSet* set) {
+    memset(set, 0, sizeof(*set));
+    if (!program) return;
+
+    FoldContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    collect_assigned(&ctx, (KastNode*)program);
+
+    for (size_t i = 0; i < program->statement_count; i++) {
+        KastNode* node = (KastNode*)program->statements[i];
+        const char* name = node ? top_level_binding(node) : NULL;
+        if (!name || !global_bound_once(&ctx, program, name)) continue;
+        if (set->count == set->capacity) {
+            set->capacity = set->capacity ? set->capacity * 2 : 16;
+            set->items = (KStableGlobal*)realloc(set->items, set->capacity * sizeof(KStableGlobal));
+        }
+        KStableGlobal* global = &set->items[set->count++];
+        global->name = name;
+        global->decl = node;
+        global->ready = false;
+    }
+    free(ctx.assigned);
+    free(ctx.assigned_members);
+    free(ctx.declared);
+}
+
+void kopt_free_global_set(KGlobalSet* set) {
+    free(set->items);
+    memset(set, 0, sizeof(*set));
+}
+
+bool kopt_array_methods_builtin(KastProgram* program) {
+    if (!program) return false;
+    for (size_t i = 0; i < program->statement_count; i++) {
+        KastNode* node = (KastNode*)program->statements[i];
+        if (node && node->type == KAST_NODE_FUNCTION_DECL) {
+            const char* owner = ((KastFunctionDecl*)node)->parent_class_name;
+            if (owner && strcmp(owner, "Array") == 0) return false;
+        }
+    }
+    KWriteSet writes;
+    kopt_collect_writes((KastNode*)program, &writes);
+    bool rebound = kopt_writes_name(&writes, "Array");
+    kopt_free_write_set(&writes);
+    return !rebound;
+}
+
+// --- 逃逸分析 ---
+
+#define SCALAR_MAX_FIELDS 16 /**< 標量替換的對象最多佔用的字段寄存器數 */
+
+/** @brief 掃描對象變量的使用 */
+typedef struct {
+    const char* name;     /**< 對象變量名 (構造函數中為 self 參數名) */
+    char** assigned;      /**< 一定已經賦值的字段 */
+    size_t assigned_count;
+    size_t assigned_capacity;
+    char** fields;        /**< 用到的字段 */
+    size_t field_count;
+    size_t field_capacity;
+    bool in_init;         /**< 掃描構造函數：不允許方法調用與 super */
+    bool escapes;
+} EscapeScan;
+
+/** @brief 節點是否為 `對象變量.字段` */
+static bool is_object_field(EscapeScan* scan, KastNode* node) {
+    if (node->type != KAST_NODE_MEMBER_ACCESS) return false;
+    KastNode* object = ((KastMemberAccess*)node)->object;
+    return object->type == KAST_NODE_IDENTIFIER && strcmp(((KastIdentifier*)object)->name, scan->name) == 0;
+}
+
+static void use_field(EscapeScan* scan, const char* field, bool read) {
+    if (read && !name_listed(scan->assigned, scan->assigned_count, field)) scan->escapes = true;
+    if (!name_listed(scan->fields, scan->field_count, field)) {
+        list_name(&scan->fields, &scan->field_count, &scan->field_capacity, field);
+    }
+}
+
+static void assign_field(EscapeScan* scan, const char* field) {
+    use_field(scan, field, false);
+    if (!name_listed(scan->assigned, scan->assigned_count, field)) {
+        list_name(&scan->assigned, &scan->assigned_count, &scan->assigned_capacity, field);
+    }
+}
+
+static void scan_escape(EscapeScan* scan, KastNode* node) {
+    if (!node || scan->escapes) return;
+    switch (node->type) {
+        case KAST_NODE_LITERAL:
+            break;
+        case KAST_NODE_IDENTIFIER: {
+            const char* name = ((KastIdentifier*)node)->name;
+            if (strcmp(name, scan->name) == 0 || (scan->in_init && strcmp(name, "super") == 0)) scan->escapes = true;
+            break;
+        }
+        case KAST_NODE_SCOPE_ACCESS:
+            if (strcmp(((KastScopeAccess*)node)->class_name, scan->name) == 0) scan->escapes = true;
+            break;
+        case KAST_NODE_MEMBER_ACCESS:
+            if (is_object_field(scan, node)) {
+                use_field(scan, ((KastMemberAccess*)node)->member_name, true);
+            } else {
+                scan_escape(scan, ((KastMemberAccess*)node)->object);
+            }
+            break;
+        case KAST_NODE_ASSIGNMENT: {
+            KastAssignment* assign = (KastAssignment*)node;
+            if (is_object_field(scan, assign->lvalue)) {
+                scan_escape(scan, assign->value);
+                use_field(scan, ((KastMemberAccess*)assign->lvalue)->member_name, false);
+            } else {
+                scan_escape(scan, assign->lvalue);
+                scan_escape(scan, assign->value);
+            }
+            break;
+        }
+        case KAST_NODE_POSTFIX_OP: {
+            KastNode* operand = ((KastPostfixOp*)node)->operand;
+            if (is_object_field(scan, operand)) scan->escapes = true;
+            scan_escape(scan, operand);
+            break;
+        }
+        case KAST_NODE_UNARY_OP:
+            scan_escape(scan, ((KastUnaryOp*)node)->operand);
+            break;
+        case KAST_NODE_BINARY_OP:
+            scan_escape(scan, ((KastBinaryOp*)node)->left);
+            scan_escape(scan, ((KastBinaryOp*)node)->right);
+            break;
+        case KAST_NODE_ARRAY_ACCESS:
+            scan_escape(scan, ((KastArrayAccess*)node)->array);
+            scan_escape(scan, ((KastArrayAccess*)node)->index);
+            break;
+        case KAST_NODE_ARRAY_LITERAL: {
+            KastArrayLiteral* arr = (KastArrayLiteral*)node;
+            for (size_t i = 0; i < arr->element_count; i++) scan_escape(scan, arr->elements[i]);
+            break;
+        }
+        case KAST_NODE_CALL: {
+            KastCall* call = (KastCall*)node;
+            // 方法調用以對象為接收者；構造函數中的方法調用的訪問檢查取決於所在的類
+            if (call->callee->type == KAST_NODE_MEMBER_ACCESS &&
+                (scan->in_init || is_object_field(scan, call->callee))) scan->escapes = true;
+            scan_escape(scan, call->callee);
+            for (size_t i = 0; i < call->arg_count; i++) scan_escape(scan, call->args[i]);
+            break;
+        }
+        case KAST_NODE_NEW: {
+            KastNew* n = (KastNew*)node;
+            for (size_t i = 0; i < n->arg_count; i++) scan_escape(scan, n->args[i]);
+            break;
+        }
+        case KAST_NODE_VAR_DECL: {
+            KastVarDecl* decl = (KastVarDecl*)node;
+            if (strcmp(decl->name, scan->name) == 0) scan->escapes = true;
+            scan_escape(scan, decl->init_value);
+            break;
+        }
+        case KAST_NODE_BLOCK: {
+            KastBlock* block = (KastBlock*)node;
+            for (size_t i = 0; i < block->statement_count; i++) scan_escape(scan, (KastNode*)block->statements[i]);
+            break;
+        }
+        case KAST_NODE_IF: {
+            KastIf* stmt = (KastIf*)node;
+            scan_escape(scan, stmt->condition);
+            scan_escape(scan, (KastNode*)stmt->then_branch);
+            scan_escape(scan, (KastNode*)stmt->else_branch);
+            break;
+        }
+        case KAST_NODE_SWITCH: {
+            KastSwitch* stmt = (KastSwitch*)node;
+            scan_escape(scan, stmt->condition);
+            for (size_t i = 0; i < stmt->case_count; i++) {
+                scan_escape(scan, stmt->cases[i].value);
+                scan_escape(scan, (KastNode*)stmt->cases[i].body);
+            }
+            scan_escape(scan, (KastNode*)stmt->default_branch);
+            break;
+        }
+        case KAST_NODE_FOR: {
+            KastFor* stmt = (KastFor*)node;
+            scan_escape(scan, (KastNode*)stmt->init);
+            scan_escape(scan, stmt->condition);
+            scan_escape(scan, stmt->increment);
+            scan_escape(scan, (KastNode*)stmt->body);
+            break;
+        }
+        case KAST_NODE_WHILE:
+            scan_escape(scan, ((KastWhile*)node)->condition);
+            scan_escape(scan, (KastNode*)((KastWhile*)node)->body);
+            break;
+        case KAST_NODE_DO_WHILE:
+            scan_escape(scan, (KastNode*)((KastDoWhile*)node)->body);
+            scan_escape(scan, ((KastDoWhile*)node)->condition);
+            break;
+        case KAST_NODE_RETURN:
+            scan_escape(scan, ((KastReturn*)node)->value);
+            break;
+        case KAST_NODE_THROW:
+            scan_escape(scan, ((KastThrow*)node)->value);
+            break;
+        case KAST_NODE_TRY_CATCH: {
+            KastTryCatch* stmt = (KastTryCatch*)node;
+            scan_escape(scan, (KastNode*)stmt->try_block);
+            for (size_t i = 0; i < stmt->catch_count; i++) {
+                const char* variable = stmt->catch_blocks[i].variable_name;
+                if (variable && strcmp(variable, scan->name) == 0) scan->escapes = true;
+                scan_escape(scan, (KastNode*)stmt->catch_blocks[i].body);
+            }
+            break;
+        }
+        case KAST_NODE_STRUCT_DECL: // 內聯變量聲明在函數中是局部變量
+            scan_escape(scan, (KastNode*)((KastStructDecl*)node)->init_var);
+            break;
+        case KAST_NODE_BREAK:
+        case KAST_NODE_CONTINUE:
+        case KAST_NODE_IMPORT:
+        case KAST_NODE_FUNCTION_DECL: // 函數體看不到外層的局部變量
+        case KAST_NODE_CLASS_DECL:
+            break;
+        default:
+            scan->escapes = true;
+            break;
+    }
+}
+
+/** @brief 構造函數體是否只由 `self.字段 = 表達式;` 組成，是則記錄賦值的字段 */
+static bool scalar_init_body(KastClassMember* init, KScalarClass* klass) {
+    // 私有或受保護的構造函數在 new 時做訪問檢查
+    if (init->is_static || !init->body || init->arg_count == 0 ||
+        init->access == KAST_ACCESS_PRIVATE || init->access == KAST_ACCESS_PROTECTED) return false;
+    EscapeScan scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.name = ((KastVarDecl*)init->args[0])->name;
+    scan.in_init = true;
+    for (size_t i = 0; i < init->body->statement_count && !scan.escapes; i++) {
+        KastNode* stmt = (KastNode*)init->body->statements[i];
+        if (!stmt || stmt->type != KAST_NODE_ASSIGNMENT ||
+            !is_object_field(&scan, ((KastAssignment*)stmt)->lvalue)) {
+            scan.escapes = true;
+            break;
+        }
+        scan_escape(&scan, ((KastAssignment*)stmt)->value);
+        assign_field(&scan, ((KastMemberAccess*)((KastAssignment*)stmt)->lvalue)->member_name);
+    }
+    bool ok = !scan.escapes && scan.field_count <= SCALAR_MAX_FIELDS;
+    klass->fields = ok ? scan.assigned : NULL;
+    klass->field_count = ok ? scan.assigned_count : 0;
+    if (!ok) free(scan.assigned);
+    free(scan.fields);
+    return ok;
+}
+
+/** @brief 類的構造過程是否可以展開，可以時填寫 klass */
+static bool scalar_class(KastProgram* program, KastClassDecl* cls, KScalarClass* klass) {
+    if (cls->parent_name) return false;
+    klass->init = NULL;
+    for (size_t i = 0; i < cls->member_count; i++) {
+        KastClassMember* member = cls->members[i];
+        if (member->member_type == KAST_MEMBER_PROPERTY) {
+            // 帶初始值的屬性會生成一個替換 _init 的初始化方法
+            if (member->init_value) return false;
+        } else if (strcmp(member->name, "_init") == 0) {
+            if (klass->init) return false;
+            klass->init = member;
+        }
+    }
+    for (size_t i = 0; i < program->statement_count; i++) {
+        KastNode* node = (KastNode*)program->statements[i];
+        if (node && node->type == KAST_NODE_FUNCTION_DECL && ((KastFunctionDecl*)node)->parent_class_name &&
+            strcmp(((KastFunctionDecl*)node)->parent_class_name, cls->name) == 0) return false;
+    }
+    return !klass->init || scalar_init_body(klass->init, klass);
+}
+
+void kopt_find_scalar_classes(KastProgram* program, KScalarClassSet* set) {
+    memset(set, 0, sizeof(*set));
+    if (!program) return;
+
+    FoldContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    collect_assigned(&ctx, (KastNode*)program);
+
+    for (size_t i = 0; i < program->statement_count; i++) {
+        KastNode* node = (KastNode*)program->statements[i];
+        if (!node || (node->type != KAST_NODE_CLASS_DECL && node->type != KAST_NODE_STRUCT_DECL)) continue;
+        KScalarClass klass = { top_level_binding(node), NULL, NULL, 0 };
+        if (!global_bound_once(&ctx, program, klass.name)) continue;
+        // 結構體沒有方法，實例只有之後賦值的字段
+        if (node->type == KAST_NODE_CLASS_DECL && !scalar_class(program, (KastClassDecl*)node, &klass)) continue;
+        if (set->count == set->capacity) {
+            set->capacity = set->capacity ? set->capacity * 2 : 8;
+            set->items = (KScalarClass*)realloc(set->items, set->capacity * sizeof(KScalarClass));
+        }
+        set->items[set->count++] = klass;
+    }
+    free(ctx.assigned);
+    free(ctx.assigned_members);
+    free(ctx.declared);
+}
+
+void kopt_free_scalar_class_set(KScalarClassSet* set) {
+    for (size_t i = 0; i < set->count; i++) free(set->items[i].fields);
+    free(set->items);
+    memset(set, 0, sizeof(*set));
+}
+
+bool kopt_object_stays_local(KastBlock* block, size_t index, const KScalarClass* klass,
+                             char*** fields, size_t* field_count) {
+    KastNode* node = (KastNode*)block->statements[index];
+    if (!node || node->type != KAST_NODE_VAR_DECL) return false;
+    KastVarDecl* decl = (KastVarDecl*)node;
+    if (decl->is_array) return false;
+
+    size_t params = klass->init ? klass->init->arg_count - 1 : 0;
+    KastNode** args = NULL;
+    size_t arg_count = 0;
+    if (decl->init_value) {
+        if (decl->init_value->type != KAST_NODE_NEW) return false;
+        KastNew* n = (KastNew*)decl->init_value;
+        // 實參個數不符時運行時報錯，保持原樣
+        if (n->is_array || strcmp(n->class_name, klass->name) != 0 || n->arg_count != params) return false;
+        args = n->args;
+        arg_count = n->arg_count;
+    } else if (!auto_instantiates(decl) || strcmp(decl->type_name, klass->name) != 0 || params != 0) {
+        return false;
+    }
+
+    EscapeScan scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.name = decl->name;
+    // 實參在變量聲明之後求值，其中的同名標識符已經指向新變量
+    for (size_t i = 0; i < arg_count; i++) scan_escape(&scan, args[i]);
+    for (size_t i = 0; i < klass->field_count; i++) assign_field(&scan, klass->fields[i]);
+
+    for (size_t i = index + 1; i < block->statement_count && !scan.escapes; i++) {
+        KastNode* stmt = (KastNode*)block->statements[i];
+        if (stmt && stmt->type == KAST_NODE_ASSIGNMENT && is_object_field(&scan, ((KastAssignment*)stmt)->lvalue)) {
+            // 塊中順序執行的賦值之後，字段一定已有值
+            scan_escape(&scan, ((KastAssignment*)stmt)->value);
+            assign_field(&scan, ((KastMemberAccess*)((KastAssignment*)stmt)->lvalue)->member_name);
+        } else {
+            scan_escape(&scan, stmt);
+        }
+    }
+
+    bool stays = !scan.escapes && scan.field_count <= SCALAR_MAX_FIELDS;
+    free(scan.assigned);
+    if (stays) {
+        *fields = scan.fields;
+        *field_count = scan.field_count;
+    } else {
+        free(scan.fields);
+    }
+    return stays;
+}
+
+// --- 字節碼窺孔優化 ---
+
+#define PEEP_MAX_ROUNDS 16
+#define PEEP_MAX_THREAD 16
+
+/** @brief 寄存器集合 (256 位) */
+typedef struct {
+    uint64_t bits[4];
+} RegSet;
+
+/** @brief 解碼後的指令 */
+typedef struct {
+    uint8_t bytes[10];
+    uint8_t length;
+    int line;
+    size_t offset;    /**< 原字節碼中的偏移 */
+    int target;       /**< 跳轉目標/函數入口的指令下標，無則 -1，n 表示字節碼末尾 */
+    bool deleted;
+    bool reachable;
+    bool leader;      /**< 是某條跳轉或入口的目標 */
+    bool in_try;      /**< 可能在 try 塊內執行，異常時轉到處理器 */
+    bool touched;     /**< 本輪已被改寫，活躍性信息已過期 */
+    bool pinned;      /**< JTAB / JHASH 之後的跳轉槽，按位置索引，不能刪除 */
+    RegSet live_in;
+    RegSet live_out;
+} PeepInsn;
+
+/** @brief 指令對寄存器的讀寫 */
+typedef struct {
+    int def;          /**< 一定會寫入的寄存器 (異常除外)，無則 -1 */
+    int may_def;      /**< 可能寫入的寄存器，無則 -1 */
+    int uses[3];
+    int use_pos[3];   /**< 讀操作數在指令中的字節位置，0 表示隱式讀取 */
+    int use_count;
+    bool reads_all;   /**< 未建模的指令，保守地視為讀寫所有寄存器 */
+    bool pure;        /**< 無副作用且不會拋出異常 */
+} InsnEffect;
+
+static void regset_add(RegSet* set, int reg) {
+    set->bits[reg >> 6] |= 1ULL << (reg & 63);
+}
+
+static void regset_remove(RegSet* set, int reg) {
+    set->bits[reg >> 6] &= ~(1ULL << (reg & 63));
+}
+
+static bool regset_has(const RegSet* set, int reg) {
+    return (set->bits[reg >> 6] >> (reg & 63)) & 1;
+}
+
+static void regset_union(RegSet* set, const RegSet* other) {
+    for (int i = 0; i < 4; i++) set->bits[i] |= other->bits[i];
+}
+
+static void add_use(InsnEffect* e, const uint8_t* b, int pos) {
+    e->uses[e->use_count] = b[pos];
+    e->use_pos[e->use_count] = pos;
+    e->use_count++;
+}
+
+static void insn_effect(const uint8_t* b, InsnEffect* e) {
+    e->def = -1;
+    e->may_def = -1;
+    e->use_count = 0;
+    e->reads_all = false;
+    e->pure = false;
+    switch (b[0]) {
+        case KOP_LDI: case KOP_LDB: case KOP_LDN: case KOP_LDI64: case KOP_LDCD:
+        case KOP_LDC: case KOP_LDS:
+            e->def = b[1];
+            e->pure = true;
+            break;
+        case KOP_LOAD: case KOP_MOVE:
+            e->def = b[1];
+            add_use(e, b, 2);
+            e->pure = true;
+            break;
+        case KOP_ADD_INT: case KOP_SUB_INT: case KOP_MUL_INT:
+        case KOP_LT_INT: case KOP_LE_INT: case KOP_EQ_INT:
+        case KOP_FEQ_D: case KOP_FLT_D: case KOP_FLE_D:
+            e->def = b[1];
+            add_use(e, b, 2);
+            add_use(e, b, 3);
+            e->pure = true;
+            break;
+        case KOP_ADD: case KOP_SUB: case KOP_MUL: case KOP_DIV: case KOP_MOD:
+        case KOP_EQ: case KOP_NE: case KOP_LT: case KOP_LE: case KOP_GT: case KOP_GE:
+        case KOP_AND: case KOP_OR: case KOP_XOR:
+        case KOP_FADD_D: case KOP_FSUB_D: case KOP_FMUL_D: case KOP_FDIV_D:
+        case KOP_GETFA: case KOP_GETFA_U: case KOP_INSTANCEOF:
+            e->def = b[1];
+            add_use(e, b, 2);
+            add_use(e, b, 3);
+            break;
+        case KOP_ADDI: case KOP_NOT: case KOP_ARRAYLEN: case KOP_NEWA:
+            e->def = b[1];
+            add_use(e, b, 2);
+            break;
+        case KOP_GETAF:
+            if (((b[4] << 8) | b[5]) != KGETAF_CHECK) e->may_def = b[1]; // 只檢查時不寫入
+            add_use(e, b, 2);
+            add_use(e, b, 3);
+            break;
+        case KOP_NEG:    // 非數值操作數時不寫入目標寄存器
+        case KOP_GETF:
+        case KOP_INVOKE: // 結果在被調函數返回時才寫入
+            e->may_def = b[1];
+            add_use(e, b, 2);
+            break;
+        case KOP_APUSH: case KOP_APOP: case KOP_AINSERT: case KOP_AREMOVE: // 不是數組時同 INVOKE
+            e->may_def = b[1];
+            add_use(e, b, 2);
+            if (b[0] != KOP_APOP) add_use(e, b, 3);
+            if (b[0] == KOP_AINSERT) add_use(e, b, 4);
+            break;
+        case KOP_PUSH:
+            add_use(e, b, 2);
+            break;
+        case KOP_GET_GLOBAL: case KOP_POP: case KOP_GETEXCEPTION:
+            e->def = b[1];
+            break;
+        case KOP_SET_GLOBAL: case KOP_JZ: case KOP_JNZ: case KOP_THROW:
+        case KOP_JTAB: case KOP_JHASH:
+            add_use(e, b, 1);
+            break;
+        case KOP_PUTFA: case KOP_PUTFA_U: case KOP_PUTAF:
+            add_use(e, b, 1);
+            add_use(e, b, 2);
+            add_use(e, b, 3);
+            break;
+        case KOP_PUTF:
+            add_use(e, b, 1);
+            add_use(e, b, 2);
+            break;
+        case KOP_FORLOOP: // 循環變量原地讀寫，讀操作數不能單獨替換
+            e->def = b[1];
+            e->uses[0] = b[1];
+            e->use_pos[0] = 0;
+            e->use_count = 1;
+            add_use(e, b, 2);
+            break;
+        case KOP_RET:
+            e->uses[0] = 0; // 返回值約定在 R0
+            e->use_pos[0] = 0;
+            e->use_count = 1;
+            break;
+        case KOP_JMP: case KOP_TRY: case KOP_ENDTRY: case KOP_FUNCTION: case KOP_FIELD:
+            break;
+        default:
+            e->reads_all = true;
+            break;
+    }
+    if (e->def >= 0) e->may_def = e->def;
+}
+
+/** @brief 指令是否有相對跳轉目標 (16 位偏移在指令末尾，相對於下一條指令) */
+static bool is_relative_branch(uint8_t op) {
+    return op == KOP_JMP || op == KOP_JZ || op == KOP_JNZ || op == KOP_TRY || op == KOP_FORLOOP;
+}
+
+/** @brief 指令結束後不會順序執行下一條 */
+static bool ends_flow(uint8_t op) {
+    return op == KOP_JMP || op == KOP_RET || op == KOP_THROW || op == KOP_HALT;
+}
+
+/** @brief 指令結束當前基本塊 */
+static bool ends_block(uint8_t op) {
+    return ends_flow(op) || op == KOP_JZ || op == KOP_JNZ || op == KOP_TRY || op == KOP_ENDTRY ||
+           op == KOP_JTAB || op == KOP_JHASH || op == KOP_FORLOOP;
+}
+
+static int next_insn(PeepInsn* insns, int n, int i) {
+    for (i++; i < n && insns[i].deleted; i++) {}
+    return i;
+}
+
+/** @brief 目標指令被刪除時順延到下一條保留的指令 */
+static int resolve_target(PeepInsn* insns, int n, int target) {
+    while (target < n && insns[target].deleted) target++;
+    return target;
+}
+
+/**
+ * @brief 把字節碼解碼為指令數組
+ * @return 成功返回指令數，遇到無法識別的指令或不在指令邊界上的跳轉目標返回 -1
+ */
+static int decode_chunk(KBytecodeChunk* chunk, PeepInsn** out) {
+    size_t count = chunk->count;
+    int n = 0;
+    size_t offset = 0;
+    while (offset < count) {
+        int length = opcode_length(chunk->code[offset]);
+        if (length <= 0 || offset + (size_t)length > count) return -1;
+        offset += (size_t)length;
+        n++;
+    }
+
+    int* index_of = (int*)malloc((count + 1) * sizeof(int));
+    int* lines = line_table_expand(&chunk->lines, count);
+    PeepInsn* insns = (PeepInsn*)malloc((size_t)(n + 1) * sizeof(PeepInsn));
+    for (size_t i = 0; i <= count; i++) index_of[i] = -1;
+    n = 0;
+    offset = 0;
+    while (offset < count) {
+        int length = opcode_length(chunk->code[offset]);
+        PeepInsn* insn = &insns[n];
+        memset(insn, 0, sizeof(PeepInsn));
+        memcpy(insn->bytes, chunk->code + offset, (size_t)length);
+        insn->length = (uint8_t)length;
+        insn->line = lines ? lines[offset] : 0;
+        insn->offset = offset;
+        insn->target = -1;
+        index_of[offset] = n++;
+        offset += (size_t)length;
+    }
+    index_of[count] = n;
+    free(lines);
+
+    // 把字節偏移形式的目標轉換為指令下標
+    offset = 0;
+    for (int i = 0; i < n; i++) {
+        const uint8_t* b = insns[i].bytes;
+        long target = -1;
+        if (b[0] == KOP_TRY) {
+            target = (long)offset + 4 + (uint16_t)((b[2] << 8) | b[3]);
+        } else if (is_relative_branch(b[0])) {
+            int length = insns[i].length;
+            target = (long)offset + length + (int16_t)((b[length - 2] << 8) | b[length - 1]);
+        } else if (b[0] == KOP_FUNCTION) {
+            target = ((long)b[3] << 16) | (b[4] << 8) | b[5];
+        } else if (b[0] == KOP_CALL) {
+            target = ((long)b[1] << 16) | (b[2] << 8) | b[3];
+        }
+        if (target != -1) {
+            if (target < 0 || (size_t)target > count || index_of[target] < 0) {
+                free(index_of);
+                free(insns);
+                return -1;
+            }
+            insns[i].target = index_of[target];
+        }
+        offset += insns[i].length;
+    }
+
+    // 跳轉表之後必須緊跟對應數量的 JMP 槽
+    for (int i = 0; i < n; i++) {
+        int slots = switch_slot_count(insns[i].bytes);
+        for (int k = 1; k <= slots; k++) {
+            if (i + k >= n || insns[i + k].bytes[0] != KOP_JMP) {
+                free(index_of);
+                free(insns);
+                return -1;
+            }
+            insns[i + k].pinned = true;
+        }
+    }
+
+    free(index_of);
+    *out = insns;
+    return n;
+}
+
+/** @brief 從所有入口 (程序開頭、函數入口、異常處理器) 標記可達指令 */
+static void mark_reachable(PeepInsn* insns, int n) {
+    int* worklist = (int*)malloc((size_t)(n + 1) * sizeof(int));
+    int top = 0;
+    for (int i = 0; i < n; i++) {
+        insns[i].reachable = false;
+        insns[i].leader = false;
+        insns[i].in_try = false;
+    }
+
+    int first = resolve_target(insns, n, 0);
+    if (first < n) {
+        insns[first].reachable = true;
+        insns[first].leader = true;
+        worklist[top++] = first;
+    }
+    while (top > 0) {
+        int i = worklist[--top];
+        uint8_t op = insns[i].bytes[0];
+        int succ[2];
+        int succ_count = 0;
+        if (!ends_flow(op)) succ[succ_count++] = next_insn(insns, n, i);
+        if (insns[i].target >= 0) {
+            int target = resolve_target(insns, n, insns[i].target);
+            insns[i].target = target;
+            succ[succ_count++] = target;
+            if (target < n) insns[target].leader = true;
+        }
+        for (int s = 0; s < succ_count; s++) {
+            if (succ[s] < n && !insns[succ[s]].reachable) {
+                insns[succ[s]].reachable = true;
+                worklist[top++] = succ[s];
+            }
+        }
+        // 跳轉表可以跳到其後的任意一個槽
+        int slots = switch_slot_count(insns[i].bytes);
+        for (int k = 1; k <= slots; k++) {
+            insns[i + k].leader = true;
+            if (!insns[i + k].reachable) {
+                insns[i + k].reachable = true;
+                worklist[top++] = i + k;
+            }
+        }
+    }
+
+    // TRY 之後順序可達的指令都可能把異常交給處理器
+    for (int i = 0; i < n; i++) {
+        if (insns[i].deleted || !insns[i].reachable || insns[i].bytes[0] != KOP_TRY) continue;
+        int start = next_insn(insns, n, i);
+        if (start >= n || insns[start].in_try) continue;
+        insns[start].in_try = true;
+        worklist[top++] = start;
+        while (top > 0) {
+            int j = worklist[--top];
+            uint8_t op = insns[j].bytes[0];
+            int succ[2];
+            int succ_count = 0;
+            if (!ends_flow(op)) succ[succ_count++] = next_insn(insns, n, j);
+            if (insns[j].target >= 0 && op != KOP_FUNCTION) succ[succ_count++] = insns[j].target;
+            for (int s = 0; s < succ_count; s++) {
+                if (succ[s] < n && !insns[succ[s]].in_try) {
+                    insns[succ[s]].in_try = true;
+                    worklist[top++] = succ[s];
+                }
+            }
+            int slots = switch_slot_count(insns[j].bytes);
+            for (int k = 1; k <= slots; k++) {
+                if (!insns[j + k].in_try) {
+                    insns[j + k].in_try = true;
+                    worklist[top++] = j + k;
+                }
+            }
+        }
+    }
+    free(worklist);
+}
+
+/** @brief 後向迭代求每條指令的活躍寄存器 */
+static void compute_liveness(PeepInsn* insns, int n) {
+    RegSet all;
+    memset(&all, 0xFF, sizeof(all));
+    for (int i = 0; i < n; i++) {
+        memset(&insns[i].live_in, 0, sizeof(RegSet));
+        memset(&insns[i].live_out, 0, sizeof(RegSet));
+        insns[i].touched = false;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        // 所有處理器入口處活躍的寄存器，在 try 範圍內的每條指令處都活躍
+        RegSet handlers;
+        memset(&handlers, 0, sizeof(handlers));
+        for (int i = 0; i < n; i++) {
+            if (!insns[i].deleted && insns[i].reachable && insns[i].bytes[0] == KOP_TRY &&
+                insns[i].target < n) {
+                regset_union(&handlers, &insns[insns[i].target].live_in);
+            }
+        }
+
+        for (int i = n - 1; i >= 0; i--) {
+            PeepInsn* insn = &insns[i];
+            if (insn->deleted || !insn->reachable) continue;
+            uint8_t op = insn->bytes[0];
+
+            RegSet out;
+            memset(&out, 0, sizeof(out));
+            if (!ends_flow(op)) {
+                int next = next_insn(insns, n, i);
+                if (next < n) regset_union(&out, &insns[next].live_in);
+            }
+            if (insn->target >= 0 && insn->target < n && op != KOP_TRY && op != KOP_FUNCTION) {
+                regset_union(&out, &insns[insn->target].live_in);
+            }
+            int slots = switch_slot_count(insn->bytes);
+            for (int k = 1; k <= slots; k++) regset_union(&out, &insns[i + k].live_in);
+            // 異常邊：指令拋出時尚未寫入目標寄存器，處理器需要的值在指令前後都活躍
+            if (insn->in_try) regset_union(&out, &handlers);
+
+            InsnEffect e;
+            insn_effect(insn->bytes, &e);
+            RegSet in;
+            if (e.reads_all) {
+                in = all;
+            } else {
+                in = out;
+                if (e.def >= 0) regset_remove(&in, e.def);
+                for (int u = 0; u < e.use_count; u++) regset_add(&in, e.uses[u]);
+            }
+            if (insn->in_try) regset_union(&in, &handlers);
+
+            insn->live_out = out;
+            if (memcmp(&in, &insn->live_in, sizeof(RegSet)) != 0) {
+                insn->live_in = in;
+                changed = true;
+            }
+        }
+    }
+}
+
+/** @brief 跳轉串接、跳到 RET 的 JMP 改寫、刪除跳到下一條的跳轉 */
+static bool simplify_branches(PeepInsn* insns, int n) {
+    bool changed = false;
+    for (int i = 0; i < n; i++) {
+        PeepInsn* insn = &insns[i];
+        uint8_t op = insn->bytes[0];
+        if (insn->deleted || (op != KOP_JMP && op != KOP_JZ && op != KOP_JNZ)) continue;
+
+        int target = resolve_target(insns, n, insn->target);
+        for (int hops = 0; hops < PEEP_MAX_THREAD && target < n && insns[target].bytes[0] == KOP_JMP; hops++) {
+            int next = resolve_target(insns, n, insns[target].target);
+            // 壓縮只會縮短距離，按原偏移確認仍在 16 位相對跳轉範圍內
+            long distance = (long)(next < n ? insns[next].offset : insns[n - 1].offset + insns[n - 1].length) -
+                            (long)(insn->offset + 4);
+            if (next == target || distance < INT16_MIN || distance > INT16_MAX) break;
+            target = next;
+        }
+        if (target != insn->target) {
+            insn->target = target;
+            changed = true;
+        }
+
+        if (target == next_insn(insns, n, i) && !insn->pinned) {
+            insn->deleted = true;
+            changed = true;
+        } else if (op == KOP_JMP && target < n && insns[target].bytes[0] == KOP_RET) {
+            memcpy(insn->bytes, insns[target].bytes, 4);
+            insn->target = -1;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static bool is_copy(uint8_t op) {
+    return op == KOP_LOAD || op == KOP_MOVE;
+}
+
+/**
+ * @brief 複製傳播
+ * 從 start 開始在同一基本塊內尋找第一個讀 rt 的指令，途中 rt 與 rs 都不能被改寫；
+ * 若該指令之後 rt 的複製值不再需要，就把它的讀操作數換成 rs。
+ */
+static bool forward_copy(PeepInsn* insns, int n, int start, int rt, int rs) {
+    for (int k = start; k < n; k = next_insn(insns, n, k)) {
+        PeepInsn* user = &insns[k];
+        if ((k != start && user->leader) || user->touched || !user->reachable) return false;
+        InsnEffect e;
+        insn_effect(user->bytes, &e);
+        if (e.reads_all) return false;
+
+        bool reads_rt = false;
+        for (int u = 0; u < e.use_count; u++) {
+            if (e.uses[u] != rt) continue;
+            if (e.use_pos[u] == 0) return false; // 隱式讀取無法改寫
+            reads_rt = true;
+        }
+        if (reads_rt) {
+            if (e.def != rt && regset_has(&user->live_out, rt)) return false;
+            for (int u = 0; u < e.use_count; u++) {
+                if (e.uses[u] == rt) user->bytes[e.use_pos[u]] = (uint8_t)rs;
+            }
+            user->touched = true;
+            return true;
+        }
+        if (e.may_def == rt || e.may_def == rs || ends_block(user->bytes[0])) return false;
+    }
+    return false;
+}
+
+/** @brief 基於活躍性的局部改寫 */
+static bool rewrite_insns(PeepInsn* insns, int n) {
+    bool changed = false;
+    for (int i = 0; i < n; i++) {
+        PeepInsn* insn = &insns[i];
+        if (insn->deleted || !insn->reachable || insn->touched) continue;
+        InsnEffect e;
+        insn_effect(insn->bytes, &e);
+        uint8_t op = insn->bytes[0];
+
+        // 結果無人使用的純指令
+        if (e.pure && (e.def < 0 || !regset_has(&insn->live_out, e.def) ||
+                       (is_copy(op) && insn->bytes[1] == insn->bytes[2]))) {
+            insn->deleted = true;
+            changed = true;
+            continue;
+        }
+
+        int j = next_insn(insns, n, i);
+        if (j >= n || ends_block(op)) continue;
+        PeepInsn* next = &insns[j];
+        if (next->leader || next->touched || !next->reachable) continue;
+
+        // LDI rX, imm; ADD rD, rA, rX  ->  ADDI rD, rA, imm
+        // SUB_INT 的操作數已知為整數，減去 imm 等價於加上 -imm
+        uint8_t next_op = next->bytes[0];
+        bool negate = next_op == KOP_SUB_INT;
+        if (op == KOP_LDI && (next_op == KOP_ADD || next_op == KOP_ADD_INT || negate) &&
+            next->bytes[3] == insn->bytes[1] && next->bytes[2] != insn->bytes[1] &&
+            !(negate && insn->bytes[2] == 0x80) &&
+            (next->bytes[1] == insn->bytes[1] || !regset_has(&next->live_out, insn->bytes[1]))) {
+            next->bytes[0] = KOP_ADDI;
+            next->bytes[3] = negate ? (uint8_t)(-(int8_t)insn->bytes[2]) : insn->bytes[2];
+            next->touched = true;
+            insn->deleted = true;
+            changed = true;
+            continue;
+        }
+
+        // op rT, ...; LOAD rD, rT  ->  op rD, ...
+        if (e.def >= 0 && is_copy(next->bytes[0]) && next->bytes[2] == e.def &&
+            (next->bytes[1] == e.def || !regset_has(&next->live_out, e.def))) {
+            insn->bytes[1] = next->bytes[1];
+            insn->touched = true;
+            next->deleted = true;
+            changed = true;
+            continue;
+        }
+
+        // LOAD rT, rS 之後塊內第一個讀 rT 的指令改為直接讀 rS，LOAD 隨後成為死代碼
+        if (is_copy(op) && insn->bytes[1] != insn->bytes[2] &&
+            forward_copy(insns, n, j, insn->bytes[1], insn->bytes[2])) {
+            insn->touched = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/** @brief 壓縮指令並重新編碼所有跳轉與入口地址 */
+static void encode_chunk(KBytecodeChunk* chunk, PeepInsn* insns, int n) {
+    size_t* new_offset = (size_t*)malloc((size_t)(n + 1) * sizeof(size_t));
+    size_t offset = 0;
+    for (int i = 0; i < n; i++) {
+        new_offset[i] = offset;
+        if (!insns[i].deleted) offset += insns[i].length;
+    }
+    new_offset[n] = offset;
+
+    line_table_reset(&chunk->lines);
+    size_t pos = 0;
+    for (int i = 0; i < n; i++) {
+        PeepInsn* insn = &insns[i];
+        if (insn->deleted) continue;
+        uint8_t* b = insn->bytes;
+        if (insn->target >= 0) {
+            size_t target = new_offset[resolve_target(insns, n, insn->target)];
+            if (is_relative_branch(b[0])) {
+                int length = insn->length;
+                int jump = (int)target - (int)(new_offset[i] + length);
+                b[length - 2] = (uint8_t)((jump >> 8) & 0xFF);
+                b[length - 1] = (uint8_t)(jump & 0xFF);
+            } else if (b[0] == KOP_FUNCTION) {
+                b[3] = (uint8_t)(target >> 16);
+                b[4] = (uint8_t)(target >> 8);
+                b[5] = (uint8_t)(target & 0xFF);
+            } else if (b[0] == KOP_CALL) {
+                b[1] = (uint8_t)(target >> 16);
+                b[2] = (uint8_t)(target >> 8);
+                b[3] = (uint8_t)(target & 0xFF);
+            }
+        }
+        memcpy(chunk->code + pos, b, insn->length);
+        line_table_add(&chunk->lines, pos, insn->line);
+        pos += insn->length;
+    }
+    chunk->count = pos;
+    free(new_offset);
+}
+
+void kopt_peephole(KBytecodeChunk* chunk) {
+    if (!chunk || chunk->count == 0) return;
+
+    PeepInsn* insns = NULL;
+    int n = decode_chunk(chunk, &insns);
+    if (n < 0) return;
+
+    for (int round = 0; round < PEEP_MAX_ROUNDS; round++) {
+        mark_reachable(insns, n);
+        bool changed = false;
+        for (int i = 0; i < n; i++) {
+            if (!insns[i].deleted && !insns[i].reachable) {
+                insns[i].deleted = true;
+                changed = true;
+            }
+        }
+        if (simplify_branches(insns, n)) {
+            changed = true;
+            mark_reachable(insns, n);
+        }
+        compute_liveness(insns, n);
+        if (rewrite_insns(insns, n)) changed = true;
+        if (!changed) break;
+    }
+
+    encode_chunk(chunk, insns, n);
+    free(insns);
+}
@@ -0,0 +1,205 @@
+#ifndef KORELIN_KOPT_H
+#define KORELIN_KOPT_H
+
+#include "kparser.h"
+#include "kcode.h"
+
+/**
+ * @brief 編譯期優化
+ * 在生成字節碼之前對語法樹、生成之後對字節碼做與運行時語義等價的改寫。
+ */
+
+/**
+ * @brief 常量折疊與常量傳播
+ * - 折疊字面量之間的算術、比較、邏輯運算以及字符串字面量拼接，
+ *   結果與虛擬機逐條執行完全一致 (整數溢出回繞、除零等會拋錯的表達式保持原樣)；
+ * - 把初始化為字面量且從未被賦值的 const 變量的引用替換為該字面量；
+ * - 刪除條件為常量的 if / while / for 中不可達的分支。
+ * 被替換的節點會原地釋放。
+ * @param program 語法樹根節點
+ */
+void kopt_fold_constants(KastProgram* program);
+
+/**
+ * @brief 編譯期可證明的值類型
+ * 聲明類型在運行時不做檢查，只有能證明的類型才會用於選擇無標籤檢查的指令。
+ */
+typedef enum {
+    KTYPE_UNKNOWN,
+    KTYPE_INT,    /**< VAL_INT */
+    KTYPE_DOUBLE, /**< VAL_DOUBLE */
+    KTYPE_BOOL,   /**< VAL_BOOL */
+    KTYPE_STRING  /**< 字符串常量或拼接結果 */
+} KStaticType;
+
+typedef struct {
+    const char* name; /**< 借用語法樹中的名字 */
+    KStaticType type;
+} KTypedName;
+
+/** @brief 一個函數 (或頂層代碼) 內按名字推斷出的局部變量類型 */
+typedef struct {
+    KTypedName* names;
+    size_t count;
+    size_t capacity;
+} KTypeEnv;
+
+/** @brief 按名字查詢變量類型的回調，ctx 由調用者傳入 */
+typedef KStaticType (*KTypeLookup)(void* ctx, const char* name);
+
+/**
+ * @brief 推斷局部變量類型
+ * 以 int / float / bool / string 聲明的局部變量，只有在初始化與每一次賦值、自增自減
+ * 都能證明得到聲明類型時才保留該類型；同名變量共用一個結果，任何一處不符即為 KTYPE_UNKNOWN。
+ * 參數、catch 變量與頂層 (全局) 變量總是 KTYPE_UNKNOWN。
+ * @param env 輸出，用 kopt_free_type_env 釋放
+ * @param params 參數聲明 (KastVarDecl*)，可為 NULL
+ * @param param_count 參數個數
+ * @param body 函數體，或 KAST_NODE_PROGRAM 表示頂層代碼
+ */
+void kopt_infer_local_types(KTypeEnv* env, KastNode** params, size_t param_count, KastNode* body);
+
+/** @brief 查詢 env 中名字的類型，不存在時返回 KTYPE_UNKNOWN */
+KStaticType kopt_type_of(const KTypeEnv* env, const char* name);
+
+/**
+ * @brief 表達式的靜態類型
+ * 規則與虛擬機指令的結果類型一致，例如 int + int 為 int、數值混合運算為 double、比較為 bool。
+ * @param lookup 標識符類型查詢
+ */
+KStaticType kopt_expression_type(KastNode* expr, KTypeLookup lookup, void* ctx);
+
+void kopt_free_type_env(KTypeEnv* env);
+
+/** @brief 可以在調用處內聯的頂層函數或私有方法 */
+typedef struct {
+    const char* name;
+    const char* class_name; /**< 私有方法所屬的類，頂層函數為 NULL */
+    KastNode* decl;         /**< KastFunctionDecl 或 KastClassMember */
+    KastNode** params;      /**< 參數聲明，方法的第一個參數為 self */
+    size_t param_count;
+    KastBlock* body;
+    bool invokes;           /**< 函數體中有方法調用：私有/受保護方法的訪問檢查取決於調用者所在的類 */
+    bool ready;             /**< 由代碼生成器維護：聲明已生成，調用處可以內聯 */
+    bool active;            /**< 由代碼生成器維護：正在展開該函數體 */
+} KInlineCandidate;
+
+typedef struct {
+    KInlineCandidate* items;
+    size_t count;
+    size_t capacity;
+} KInlineSet;
+
+/**
+ * @brief 查找可內聯的函數
+ * - 頂層函數：名字只被這一條聲明綁定且從未被賦值 (調用目標在編譯期確定)；
+ * - 私有實例方法：程序中沒有其他同名成員，self.name(...) 只能解析到它。
+ * 函數體必須很小 (語法樹節點數有預算)，只含變量聲明、表達式語句、if/else 與 return，
+ * 並且每條路徑都以帶值的 return 結束；不含循環、異常處理、super、嵌套聲明與對自身的調用。
+ * @param set 輸出，用 kopt_free_inline_set 釋放
+ */
+void kopt_find_inline_candidates(KastProgram* program, KInlineSet* set);
+
+void kopt_free_inline_set(KInlineSet* set);
+
+/** @brief 一段代碼中的寫入，用於判斷讀取在循環中是否不變 */
+typedef struct {
+    char** names;        /**< 被賦值、自增自減或被聲明重新綁定的標識符 (借用語法樹中的名字) */
+    size_t name_count;
+    char** members;      /**< 被賦值的成員名 (不區分對象) */
+    size_t member_count;
+    bool calls;          /**< 含有調用、new 或 import：被執行的代碼可能修改任何全局變量與字段 */
+} KWriteSet;
+
+/**
+ * @brief 收集語法樹中的寫入
+ * @param writes 輸出，用 kopt_free_write_set 釋放
+ */
+void kopt_collect_writes(KastNode* node, KWriteSet* writes);
+
+bool kopt_writes_name(const KWriteSet* writes, const char* name);
+
+bool kopt_writes_member(const KWriteSet* writes, const char* member);
+
+void kopt_free_write_set(KWriteSet* writes);
+
+/** @brief 綁定後不再改變的全局名字 */
+typedef struct {
+    const char* name;
+    KastNode* decl;   /**< 綁定它的頂層語句 */
+    bool ready;       /**< 由代碼生成器維護：之後生成的代碼運行時該名字一定已經綁定 */
+} KStableGlobal;
+
+typedef struct {
+    KStableGlobal* items;
+    size_t count;
+    size_t capacity;
+} KGlobalSet;
+
+/**
+ * @brief 查找穩定的全局名字
+ * 由頂層的函數、類、import 或變量聲明綁定，程序中只被這一條聲明綁定且從未被賦值。
+ * 聲明執行之後讀取它既不會失敗，也總是得到同一個值。
+ * @param set 輸出，用 kopt_free_global_set 釋放
+ */
+void kopt_find_stable_globals(KastProgram* program, KGlobalSet* set);
+
+void kopt_free_global_set(KGlobalSet* set);
+
+/**
+ * @brief 數組的 push / pop / insert / removeAt 是否一定是 Array 類的內建方法
+ * 程序沒有賦值或重新聲明 Array，也沒有在類外為 Array 定義方法時成立，
+ * 這些調用可以生成 KOP_APUSH 等指令。
+ */
+bool kopt_array_methods_builtin(KastProgram* program);
+
+/** @brief 構造過程可以在調用處展開的類或結構體，其實例可以做標量替換 */
+typedef struct {
+    const char* name;
+    KastClassMember* init; /**< 構造函數 _init，沒有時為 NULL */
+    char** fields;         /**< 構造函數依次賦值的字段 (借用語法樹中的名字) */
+    size_t field_count;
+} KScalarClass;
+
+typedef struct {
+    KScalarClass* items;
+    size_t count;
+    size_t capacity;
+} KScalarClassSet;
+
+/**
+ * @brief 查找實例可以標量替換的類
+ * 名字只被一條頂層的類或結構體聲明綁定且從未被賦值；類沒有父類、沒有帶初始值的屬性、
+ * 沒有類外定義的方法，構造函數 (若有) 唯一且只由 `self.字段 = 表達式;` 組成，
+ * 表達式中沒有方法調用，除讀取已賦值的字段外不引用 self。
+ * @param set 輸出，用 kopt_free_scalar_class_set 釋放
+ */
+void kopt_find_scalar_classes(KastProgram* program, KScalarClassSet* set);
+
+void kopt_free_scalar_class_set(KScalarClassSet* set);
+
+/**
+ * @brief 逃逸分析
+ * block->statements[index] 是用 new (或自動實例化) 創建 klass 實例的變量聲明時，判斷對象是否只經由
+ * `變量.字段` 讀寫：變量本身不作為值使用 (傳參、返回、賦值、比較、方法調用等)，在塊中不被重新聲明，
+ * 並且每次讀取字段之前該字段一定已由構造函數或塊中前面的 `變量.字段 = 表達式;` 語句賦值。
+ * @param fields 輸出用到的全部字段 (借用語法樹中的名字)，用 free 釋放數組
+ * @return 對象不逃逸時返回 true
+ */
+bool kopt_object_stays_local(KastBlock* block, size_t index, const KScalarClass* klass,
+                             char*** fields, size_t* field_count);
+
+/**
+ * @brief 字節碼窺孔優化
+ * 基於寄存器活躍性分析反復改寫，直到不再變化：
+ * - 刪除不可達指令與結果未被使用的 LOAD/MOVE/LDx；
+ * - 沿 LOAD/MOVE 鏈做複製傳播，並把 `op rT; LOAD rD, rT` 合併為 `op rD`；
+ * - `LDI rX, imm; ADD rD, rA, rX` 合併為 `ADDI rD, rA, imm`；
+ * - 跳轉串接 (跳到 JMP 的跳轉直接跳到最終目標)，跳到 RET 的 JMP 改寫為 RET，刪除跳到下一條的跳轉。
+ * 最後壓縮字節碼，重新計算所有相對跳轉、TRY 處理器偏移與 FUNCTION/CALL 入口地址，並同步行號表。
+ * 遇到無法識別的指令時保持字節碼不變。
+ * @param chunk 字節碼塊
+ */
+void kopt_peephole(KBytecodeChunk* chunk);
+
+#endif //KORELIN_KOPT_H
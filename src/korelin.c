@@ -8,13 +8,16 @@
 #include "kcode.h"
 #include "kvm.h"
 #include "kcache.h"
+#include "ksnapshot.h"
 #include "comeonjit.h"
+#include "kaot.h"
 #include "kgc.h"
 #include "kstd.h" /**< 引入標準庫頭文件 */
 #include "kapi.h" /**< 引入 KInit */
 #include "keditor.h" /**< 引入編輯器 */
 #include <sys/stat.h>
 #include <ctype.h>
+#include <time.h>
 
 /** @brief 檢查目錄是否存在 */
 static bool dir_exists(const char* path) {
@@ -57,6 +60,61 @@ static char* read_file(const char* path, bool silent) {
     return buffer;
 }
 
+/** @brief build_chunk 的結果 */
+typedef enum {
+    BUILD_OK,
+    BUILD_PARSE_ERROR,
+    BUILD_COMPILE_ERROR
+} BuildStatus;
+
+/** @brief 詞法、語法分析並編譯源碼，失敗時 chunk 保持初始狀態 */
+static BuildStatus compile_source(const char* source, KBytecodeChunk* chunk) {
+    Lexer lexer;
+    init_lexer(&lexer, source);
+    Parser parser;
+    init_parser(&parser, &lexer);
+    KastProgram* program = parse_program(&parser);
+    if (!program || parser.has_error) return BUILD_PARSE_ERROR;
+
+    init_chunk(chunk);
+    if (compile_ast(program, chunk) != 0) {
+        free_chunk(chunk);
+        return BUILD_COMPILE_ERROR;
+    }
+    return BUILD_OK;
+}
+
+/**
+ * @brief 得到源文件的字節碼塊
+ * 源文件旁的緩存 (path.kc) 與源碼內容、編譯器指紋都匹配時直接加載，跳過詞法、語法分析與編譯；
+ * 否則重新編譯並寫回緩存，寫入失敗不影響運行。設置環境變量 KORELIN_NO_CACHE 時不讀寫緩存。
+ * 兩種情況下塊都帶有函數表，JIT 據此延遲生成函數體的機器碼 (見 jit_compile_lazy)。
+ * @param path 源文件路徑
+ * @param source 源碼
+ * @param chunk 輸出
+ */
+static BuildStatus build_chunk(const char* path, const char* source, KBytecodeChunk* chunk) {
+    const char* no_cache = getenv("KORELIN_NO_CACHE");
+    bool use_cache = !no_cache || !*no_cache;
+    uint64_t size = strlen(source);
+    uint64_t hash = kcache_hash(source, size);
+    char* cache_path = use_cache ? kcache_path(path) : NULL;
+
+    init_chunk(chunk);
+    if (cache_path && kcache_load(cache_path, chunk, hash, size) == 0) {
+        free(cache_path);
+        return BUILD_OK;
+    }
+
+    BuildStatus status = compile_source(source, chunk);
+    if (status == BUILD_OK) {
+        chunk->functions = build_function_table(chunk, &chunk->function_count);
+        if (cache_path) kcache_save(cache_path, chunk, hash, size);
+    }
+    free(cache_path);
+    return status;
+}
+
 /** @brief 從文件加載模塊的輔助函數 */
 static KValue load_module_file(KVM* vm, const char* name, const char* path_override) {
     char path[1024];
@@ -142,20 +200,11 @@ static KValue load_module_file(KVM* vm, const char* name, const char* path_overr
         return (KValue){VAL_NULL};
     }
     
-    Lexer lexer; init_lexer(&lexer, source);
-    Parser parser; init_parser(&parser, &lexer);
-    KastProgram* program = parse_program(&parser);
-    if (parser.has_error) {
-        printf("Error parsing module %s\n", name);
-        free(source);
-        return (KValue){VAL_NULL};
-    }
-    
     KBytecodeChunk* chunk = (KBytecodeChunk*)malloc(sizeof(KBytecodeChunk));
-    init_chunk(chunk);
-    if (compile_ast(program, chunk) != 0) {
-        printf("Error compiling module %s\n", name);
-        free_chunk(chunk); free(chunk); free(source);
+    BuildStatus status = build_chunk(fullpath, source, chunk);
+    if (status != BUILD_OK) {
+        printf(status == BUILD_PARSE_ERROR ? "Error parsing module %s\n" : "Error compiling module %s\n", name);
+        free(chunk); free(source);
         return (KValue){VAL_NULL};
     }
     
@@ -399,57 +448,38 @@ KValue import_module_handler(KVM* vm, const char* name) {
     return (KValue){VAL_NULL};
 }
 
-// 運行文件
-static void run_file(const char* path, bool compile_only, const char* lib_arg) {
+/**
+ * @brief 編譯源文件到字節碼塊
+ * @return 源碼緩衝區 (調用者釋放)，失敗返回 NULL
+ */
+static char* compile_file(const char* path, KBytecodeChunk* chunk) {
     // 檢查文件後綴
     const char* ext = strrchr(path, '.');
     if (ext == NULL || (strcmp(ext, ".k") != 0 && strcmp(ext, ".kri") != 0)) {
         printf("Error: File extension must be .k or .kri\n");
-        return;
+        return NULL;
     }
 
     char* source = read_file(path, false); // Report error
-    if (source == NULL) return;
+    if (source == NULL) return NULL;
 
-    // 1. Lexer
-    // printf("Initializing Lexer...\n");
-    Lexer lexer;
-    init_lexer(&lexer, source);
-    
-    // 2. Parser
-    // printf("Initializing Parser...\n");
-    Parser parser;
-    init_parser(&parser, &lexer);
-    // printf("Parsing Program...\n");
-    KastProgram* program = parse_program(&parser);
-    if (!program) {
-        printf("Parsing failed.\n");
-        return;
-    }
-    // printf("Compiling Program...\n");
-    
-    if (parser.has_error) {
-        printf("Parsing failed.\n");
+    // 命中緩存時跳過詞法、語法分析與編譯
+    BuildStatus status = build_chunk(path, source, chunk);
+    if (status != BUILD_OK) {
+        printf(status == BUILD_PARSE_ERROR ? "Parsing failed.\n" : "Compilation failed.\n");
         free(source);
-        return;
+        return NULL;
     }
+    chunk->filename = strdup(path);
+    return source;
+}
 
-    // 3. Compile
-    // printf("Compiling...\n"); fflush(stdout);
+// 運行文件
+static void run_file(const char* path, bool compile_only, const char* lib_arg, const char* aot_arg,
+                     const char* image_arg) {
     KBytecodeChunk chunk;
-    init_chunk(&chunk);
-    chunk.filename = strdup(path);
-    
-    // printf("Compiling Program...\n"); fflush(stdout);
-    if (compile_ast(program, &chunk) != 0) {
-        printf("Compilation failed.\n");
-        free_chunk(&chunk);
-        free(source);
-        return;
-    }
-    
-    // 保存字節碼緩存
-    kcache_save("out.kc", &chunk, 0, 0);
+    char* source = compile_file(path, &chunk);
+    if (source == NULL) return;
 
     if (compile_only) {
         printf("Compilation successful.\n");
@@ -480,7 +510,18 @@ static void run_file(const char* path, bool compile_only, const char* lib_arg) {
     
     // Bind VM to API and register standard libraries
     KBindVM(&vm);
-    kstd_register();
+    if (image_arg) {
+        // 從堆快照恢復標準庫與預加載的模塊；失敗時照常註冊
+        KCollectNatives(kstd_register);
+        int status = ksnapshot_load(&vm, image_arg);
+        if (status != 0) {
+            printf("Warning: %s heap image \"%s\", registering standard libraries.\n",
+                   status == 1 ? "Outdated or invalid" : "Could not load", image_arg);
+            kstd_register();
+        }
+    } else {
+        kstd_register();
+    }
     vm.import_handler = import_module_handler;
     
     // Parse Library Map if provided
@@ -500,6 +541,16 @@ static void run_file(const char* path, bool compile_only, const char* lib_arg) {
     
     // Enable JIT (Handled in kvm_init)
     
+    // 綁定 AOT 機器碼；失敗時照常使用 JIT / 解釋器
+    if (aot_arg) {
+        int status = kaot_load(&vm, &chunk, aot_arg);
+        if (status == 1) {
+            printf("Warning: AOT library \"%s\" does not match this program, falling back to interpreter.\n", aot_arg);
+        } else if (status != 0) {
+            printf("Warning: Could not load AOT library \"%s\", falling back to interpreter.\n", aot_arg);
+        }
+    }
+    
     // 4. Run
     kvm_interpret(&vm, &chunk);
     
@@ -525,6 +576,215 @@ static void run_file(const char* path, bool compile_only, const char* lib_arg) {
     free(source);
 }
 
+/** @brief 當前時間 (秒) */
+static double now_seconds(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief 啟動基準
+ * 交替測量冷緩存 (刪除緩存後讀取、編譯並寫回) 與熱緩存 (讀取源碼並加載緩存) 得到字節碼塊的耗時。
+ * 不運行程序，也不包括程序導入的模塊。
+ */
+static void bench_startup(const char* path, int iterations) {
+    char* cache_path = kcache_path(path);
+    double cold = 0, warm = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        KBytecodeChunk chunk;
+        remove(cache_path);
+        double start = now_seconds();
+        char* source = compile_file(path, &chunk);
+        cold += now_seconds() - start;
+        if (source == NULL) {
+            free(cache_path);
+            return;
+        }
+        free_chunk(&chunk);
+        free(source);
+
+        start = now_seconds();
+        source = compile_file(path, &chunk);
+        warm += now_seconds() - start;
+        if (source == NULL) {
+            free(cache_path);
+            return;
+        }
+        free_chunk(&chunk);
+        free(source);
+    }
+
+    cold = cold * 1000 / iterations;
+    warm = warm * 1000 / iterations;
+    printf("Startup benchmark: %s (%d iterations)\n", path, iterations);
+    printf("    cold cache    %10.3f ms\n", cold);
+    printf("    warm cache    %10.3f ms\n", warm);
+    printf("    speedup       %10.1fx\n", warm > 0 ? cold / warm : 0.0);
+    free(cache_path);
+}
+
+/** @brief 生成約 size 字節的基準源碼：重複的類、函數與語句，標識符各不相同，可以完整通過語法分析 */
+static char* generate_lexer_source(size_t size) {
+    char* source = (char*)malloc(size + 1024);
+    if (!source) return NULL;
+    size_t length = 0;
+    for (int i = 0; length < size; i++) {
+        length += (size_t)sprintf(source + length,
+            "class Item%d extends Base {\n"
+            "    private int count_%d;\n"
+            "    public float ratio;\n"
+            "    int next(self, int step) {\n"
+            "        if (self.count_%d >= %d && step != 0) { return self.count_%d + step * 2; }\n"
+            "        else { self.ratio = self.ratio / 3.25; }\n"
+            "        return -1;\n"
+            "    }\n"
+            "}\n"
+            "string describe%d(bool verbose, string name) {\n"
+            "    // 註釋與字符串也計入吞吐量\n"
+            "    for (int k = 0; k < %d; k++) { name = name + \"item\\n\"; }\n"
+            "    while (verbose) { verbose = false; continue; }\n"
+            "    switch (name) { case \"a\": break; default: break; }\n"
+            "    try { throw new Error(\"x\"); } catch (Error e) { os.println(e); }\n"
+            "    if (verbose) { return name; }\n"
+            "    return \"\";\n"
+            "}\n\n",
+            i, i, i, i % 97, i, i, i % 13);
+    }
+    source[length] = '\0';
+    return source;
+}
+
+/**
+ * @brief 詞法與語法分析基準
+ * 對 path 的源碼 (為 NULL 時生成約 size 字節的源碼) 重複做完整的詞法分析與語法分析，報告吞吐量。
+ */
+static void bench_lexer(const char* path, size_t size, int iterations) {
+    char* source = path ? read_file(path, false) : generate_lexer_source(size);
+    if (!source) return;
+    size_t length = strlen(source);
+
+    size_t tokens = 0;
+    double start = now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        Lexer lexer;
+        init_lexer(&lexer, source);
+        for (;;) {
+            Token token = next_token(&lexer);
+            tokens++;
+            if (token.type == KORELIN_TOKEN_EOF) break;
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    size_t names = 0;
+    start = now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        Lexer lexer;
+        init_lexer(&lexer, source);
+        Parser parser;
+        init_parser(&parser, &lexer);
+        KastProgram* program = parse_program(&parser);
+        bool failed = parser.has_error;
+        if (failed) {
+            printf("[%s] %s\n", get_error_name(parser.error_type), parser.error_message);
+        }
+        names = program->names.count;
+        free_ast_node((KastNode*)program);
+        if (failed) {
+            free(source);
+            return;
+        }
+    }
+    double parse_elapsed = now_seconds() - start;
+
+    printf("Lexer benchmark: %s, %.2f MB (%d iterations)\n", path ? path : "generated source",
+           length / (1024.0 * 1024.0), iterations);
+    printf("    tokens        %10zu\n", tokens / iterations);
+    printf("    time          %10.3f ms\n", elapsed * 1000 / iterations);
+    printf("    throughput    %10.1f MB/s\n", elapsed > 0 ? length * (double)iterations / (1024.0 * 1024.0) / elapsed : 0.0);
+    printf("    parse time    %10.3f ms (lexing included)\n", parse_elapsed * 1000 / iterations);
+    printf("    parse rate    %10.1f MB/s\n", parse_elapsed > 0 ? length * (double)iterations / (1024.0 * 1024.0) / parse_elapsed : 0.0);
+    printf("    names         %10zu\n", names);
+    free(source);
+}
+
+/**
+ * @brief 生成堆快照
+ * 註冊標準庫並按順序導入 modules 之後保存虛擬機堆，之後可用 run -image 從快照啟動。
+ */
+static void snapshot_file(const char* output, char** modules, int module_count) {
+    KVM vm;
+    kvm_init(&vm);
+    vm.root_dir = strdup(".");
+    KBindVM(&vm);
+    kstd_register();
+    vm.import_handler = import_module_handler;
+
+    bool ok = true;
+    for (int i = 0; ok && i < module_count; i++) {
+        KValue module = import_module_handler(&vm, modules[i]);
+        if (module.type == VAL_NULL || vm.had_error) {
+            printf("Error: Could not preload module \"%s\".\n", modules[i]);
+            ok = false;
+        } else {
+            table_set(&vm.modules, modules[i], module);
+        }
+    }
+
+    if (ok && ksnapshot_save(&vm, output) == 0) {
+        printf("Heap image written: %s\n", output);
+    } else {
+        printf("Heap image generation failed.\n");
+    }
+    kvm_free(&vm);
+}
+
+// 預先編譯為本地共享庫
+static void aot_file(const char* path, const char* output) {
+    KBytecodeChunk chunk;
+    char* source = NULL;
+    const char* ext = strrchr(path, '.');
+
+    if (ext && strcmp(ext, ".kc") == 0) {
+        init_chunk(&chunk);
+        if (kcache_load(path, &chunk, 0, 0) != 0) {
+            printf("Error: Could not load bytecode cache \"%s\".\n", path);
+            free_chunk(&chunk);
+            return;
+        }
+    } else {
+        source = compile_file(path, &chunk);
+        if (source == NULL) return;
+    }
+
+    // 默認輸出：同名共享庫
+    char* default_output = NULL;
+    if (!output) {
+#ifdef _WIN32
+        const char* lib_ext = ".dll";
+#else
+        const char* lib_ext = ".so";
+#endif
+        size_t stem = ext ? (size_t)(ext - path) : strlen(path);
+        default_output = (char*)malloc(stem + strlen(lib_ext) + 1);
+        memcpy(default_output, path, stem);
+        strcpy(default_output + stem, lib_ext);
+        output = default_output;
+    }
+
+    if (kaot_build(&chunk, output) == 0) {
+        printf("AOT compilation successful: %s\n", output);
+    } else {
+        printf("AOT compilation failed.\n");
+    }
+
+    free(default_output);
+    free_chunk(&chunk);
+    free(source);
+}
+
 void print_help() {
     printf("* Welcome to Korelin\n"
            "* Korelin SDK version: %s\n"
@@ -535,6 +795,10 @@ void print_help() {
            "    version                Print Korelin SDK version.\n"
            "    run <file-name>        Compile into KC and run Korelin program.\n"
            "    compile <file-name>    Compile to KC and do not run the Korelin program.\n"
+           "    aot <file-name>        Compile a program or .kc cache into a native library.\n"
+           "    bench-startup <file-name>  Measure startup with a cold and a warm bytecode cache.\n"
+           "    bench-lex [file-name]  Measure lexer and parser throughput on a file or a generated source (-mb size).\n"
+           "    snapshot <image> [module...]  Save a heap image with the standard library and modules.\n"
            "    editor [file-name]     Open built-in text editor.\n"
            "    help                   For more information about a command.\n"
            "\nRungo usage:\n"
@@ -575,28 +839,84 @@ int main(int argc, char* argv[]) {
         print_help();
     } else if (strcmp(command, "run") == 0) {
         if (argc < 3) {
-            printf("Usage: korelin run <file-name> [-lib file>field]\n");
+            printf("Usage: korelin run <file-name> [-lib file>field] [-aot library] [-image heap-image]\n");
             return 1;
         }
         
         const char* filename = argv[2];
         const char* lib_arg = NULL;
+        const char* aot_arg = NULL;
+        const char* image_arg = NULL;
         
         // Parse extra args
         for (int i = 3; i < argc; i++) {
             if (strcmp(argv[i], "-lib") == 0 && i + 1 < argc) {
                 lib_arg = argv[i+1];
                 i++;
+            } else if (strcmp(argv[i], "-aot") == 0 && i + 1 < argc) {
+                aot_arg = argv[i+1];
+                i++;
+            } else if (strcmp(argv[i], "-image") == 0 && i + 1 < argc) {
+                image_arg = argv[i+1];
+                i++;
             }
         }
         
-        run_file(filename, false, lib_arg);
+        run_file(filename, false, lib_arg, aot_arg, image_arg);
     } else if (strcmp(command, "compile") == 0) {
         if (argc < 3) {
             printf("Usage: korelin compile <file-name>\n");
             return 1;
         }
-        run_file(argv[2], true, NULL);
+        run_file(argv[2], true, NULL, NULL, NULL);
+    } else if (strcmp(command, "aot") == 0) {
+        if (argc < 3) {
+            printf("Usage: korelin aot <file-name|out.kc> [-o library]\n");
+            return 1;
+        }
+        const char* output = NULL;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+                output = argv[i+1];
+                i++;
+            }
+        }
+        aot_file(argv[2], output);
+    } else if (strcmp(command, "bench-startup") == 0) {
+        if (argc < 3) {
+            printf("Usage: korelin bench-startup <file-name> [-n iterations]\n");
+            return 1;
+        }
+        int iterations = 20;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+                iterations = atoi(argv[i+1]);
+                i++;
+            }
+        }
+        bench_startup(argv[2], iterations > 0 ? iterations : 1);
+    } else if (strcmp(command, "bench-lex") == 0) {
+        const char* path = NULL;
+        int megabytes = 16;
+        int iterations = 5;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "-mb") == 0 && i + 1 < argc) {
+                megabytes = atoi(argv[i+1]);
+                i++;
+            } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+                iterations = atoi(argv[i+1]);
+                i++;
+            } else {
+                path = argv[i];
+            }
+        }
+        bench_lexer(path, (size_t)(megabytes > 0 ? megabytes : 1) * 1024 * 1024, iterations > 0 ? iterations : 1);
+    } else if (strcmp(command, "snapshot") == 0) {
+        if (argc < 3) {
+            printf("Usage: korelin snapshot <image> [module...]\n");
+            return 1;
+        }
+        snapshot_file(argv[2], argv + 3, argc - 3);
     } else if (strcmp(command, "editor") == 0) {
         keditor_run(argc >= 3 ? argv[2] : NULL);
     } else {
@@ -604,7 +924,7 @@ int main(int argc, char* argv[]) {
         // Check if file exists or extension matches
         const char* ext = strrchr(command, '.');
         if (ext && strcmp(ext, ".kri") == 0) {
-            run_file(command, false, NULL);
+            run_file(command, false, NULL, NULL, NULL);
         } else {
             printf("Unknown command: %s\n", command);
             print_help();
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 // 獲取錯誤名稱
 const char* get_error_name(KorelinErrorType type) {
@@ -29,6 +30,121 @@ const char* get_error_name(KorelinErrorType type) {
     }
 }
 
+// --- 標識符表 ---
+
+#define KAST_NAME_BLOCK_SIZE 16384
+
+struct KastNameBlock {
+    KastNameBlock* next;
+    size_t used;
+    size_t capacity;
+    char data[];
+};
+
+/** @brief FNV-1a 哈希 */
+static uint32_t hash_name(const char* text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void kast_init_names(KastNameTable* table) {
+    table->slots = NULL;
+    table->hashes = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->blocks = NULL;
+}
+
+void kast_free_names(KastNameTable* table) {
+    KastNameBlock* block = table->blocks;
+    while (block) {
+        KastNameBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    free(table->slots);
+    free(table->hashes);
+    kast_init_names(table);
+}
+
+/** @brief 在存儲塊中保存名字的副本，塊不移動，已返回的指針始終有效 */
+static const char* store_name(KastNameTable* table, const char* text, size_t length) {
+    KastNameBlock* block = table->blocks;
+    if (!block || block->capacity - block->used < length + 1) {
+        size_t capacity = length + 1 > KAST_NAME_BLOCK_SIZE ? length + 1 : KAST_NAME_BLOCK_SIZE;
+        block = (KastNameBlock*)malloc(sizeof(KastNameBlock) + capacity);
+        if (!block) {
+            fprintf(stderr, "Critical Error: Memory allocation failed in kast_intern\n");
+            exit(EXIT_FAILURE);
+        }
+        block->next = table->blocks;
+        block->used = 0;
+        block->capacity = capacity;
+        table->blocks = block;
+    }
+    char* name = block->data + block->used;
+    memcpy(name, text, length);
+    name[length] = '\0';
+    block->used += length + 1;
+    return name;
+}
+
+static void grow_names(KastNameTable* table) {
+    size_t capacity = table->capacity == 0 ? 256 : table->capacity * 2;
+    const char** slots = (const char**)calloc(capacity, sizeof(const char*));
+    uint32_t* hashes = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    if (!slots || !hashes) {
+        fprintf(stderr, "Critical Error: Memory allocation failed in kast_intern\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (!table->slots[i]) continue;
+        size_t index = table->hashes[i] & (capacity - 1);
+        while (slots[index]) index = (index + 1) & (capacity - 1);
+        slots[index] = table->slots[i];
+        hashes[index] = table->hashes[i];
+    }
+    free(table->slots);
+    free(table->hashes);
+    table->slots = slots;
+    table->hashes = hashes;
+    table->capacity = capacity;
+}
+
+const char* kast_intern(KastNameTable* table, const char* text, size_t length) {
+    if ((table->count + 1) * 4 > table->capacity * 3) grow_names(table);
+
+    uint32_t hash = hash_name(text, length);
+    size_t index = hash & (table->capacity - 1);
+    while (table->slots[index]) {
+        const char* name = table->slots[index];
+        if (table->hashes[index] == hash && strncmp(name, text, length) == 0 && name[length] == '\0') {
+            return name;
+        }
+        index = (index + 1) & (table->capacity - 1);
+    }
+
+    const char* name = store_name(table, text, length);
+    table->slots[index] = name;
+    table->hashes[index] = hash;
+    table->count++;
+    return name;
+}
+
+/** @brief 當前 Token 的文本在標識符表中的副本 */
+static const char* token_name(Parser* parser) {
+    return kast_intern(parser->names, parser->current_token.value, parser->current_token.length);
+}
+
+/** @brief 以空字符結尾的名字在標識符表中的副本 */
+static const char* intern_name(Parser* parser, const char* name) {
+    return kast_intern(parser->names, name, strlen(name));
+}
+
 // --- 前置聲明 ---
 static void advance_token(Parser* parser);
 static KastStatement* parse_statement(Parser* parser);
@@ -74,6 +190,7 @@ void init_parser(Parser* parser, Lexer* lexer) {
     parser->error_type = KORELIN_NO_ERROR;
     parser->error_message[0] = '\0';
     parser->has_main_function = false;
+    parser->names = NULL;
     // Read 6 tokens for lookahead
     parser->current_token = next_token(lexer);
     parser->peek_token = next_token(lexer);
@@ -84,9 +201,6 @@ void init_parser(Parser* parser, Lexer* lexer) {
 }
 
 static void advance_token(Parser* parser) {
-    // 釋放之前的 current_token 內存
-    free_token(&parser->current_token);
-
     parser->current_token = parser->peek_token;
     parser->peek_token = parser->peek_token_2;
     parser->peek_token_2 = parser->peek_token_3;
@@ -140,7 +254,7 @@ static KastNode* parse_term(Parser* parser);
 static KastNode* parse_factor(Parser* parser);
 static KastNode* parse_unary(Parser* parser);
 static KastNode* parse_primary(Parser* parser);
-static char* parse_type_definition(Parser* parser);
+static const char* parse_type_definition(Parser* parser);
 
 static KastNode* parse_expression(Parser* parser) {
     return parse_logic_or(parser);
@@ -158,6 +272,7 @@ static KastNode* parse_logic_or(Parser* parser) {
 
         KastBinaryOp* bin = (KastBinaryOp*)malloc(sizeof(KastBinaryOp));
         bin->base.type = KAST_NODE_BINARY_OP;
+        bin->base.line = parser->current_token.line;
         bin->operator = op;
         bin->left = left;
         bin->right = right;
@@ -178,6 +293,7 @@ static KastNode* parse_logic_and(Parser* parser) {
 
         KastBinaryOp* bin = (KastBinaryOp*)malloc(sizeof(KastBinaryOp));
         bin->base.type = KAST_NODE_BINARY_OP;
+        bin->base.line = parser->current_token.line;
         bin->operator = op;
         bin->left = left;
         bin->right = right;
@@ -198,6 +314,7 @@ static KastNode* parse_equality(Parser* parser) {
 
         KastBinaryOp* bin = (KastBinaryOp*)malloc(sizeof(KastBinaryOp));
         bin->base.type = KAST_NODE_BINARY_OP;
+        bin->base.line = parser->current_token.line;
         bin->operator = op;
         bin->left = left;
         bin->right = right;
@@ -219,6 +336,7 @@ static KastNode* parse_comparison(Parser* parser) {
 
         KastBinaryOp* bin = (KastBinaryOp*)malloc(sizeof(KastBinaryOp));
         bin->base.type = KAST_NODE_BINARY_OP;
+        bin->base.line = parser->current_token.line;
         bin->operator = op;
         bin->left = left;
         bin->right = right;
@@ -239,6 +357,7 @@ static KastNode* parse_term(Parser* parser) {
 
         KastBinaryOp* bin = (KastBinaryOp*)malloc(sizeof(KastBinaryOp));
         bin->base.type = KAST_NODE_BINARY_OP;
+        bin->base.line = parser->current_token.line;
         bin->operator = op;
         bin->left = left;
         bin->right = right;
@@ -259,6 +378,7 @@ static KastNode* parse_factor(Parser* parser) {
 
         KastBinaryOp* bin = (KastBinaryOp*)malloc(sizeof(KastBinaryOp));
         bin->base.type = KAST_NODE_BINARY_OP;
+        bin->base.line = parser->current_token.line;
         bin->operator = op;
         bin->left = left;
         bin->right = right;
@@ -276,6 +396,7 @@ static KastNode* parse_unary(Parser* parser) {
 
         KastUnaryOp* un = (KastUnaryOp*)malloc(sizeof(KastUnaryOp));
         un->base.type = KAST_NODE_UNARY_OP;
+        un->base.line = parser->current_token.line;
         un->operator = op;
         un->operand = operand;
         return (KastNode*)un;
@@ -286,10 +407,19 @@ static KastNode* parse_unary(Parser* parser) {
 static KastNode* parse_literal(Parser* parser) {
     KastLiteral* node = (KastLiteral*)malloc(sizeof(KastLiteral));
     node->base.type = KAST_NODE_LITERAL;
+    node->base.line = parser->current_token.line;
     
-    // 深度複製 Token
+    // 字面量持有自己的文本 (以空字符結尾，字符串已處理轉義)
     node->token = parser->current_token;
-    node->token.value = strdup(parser->current_token.value);
+    if (parser->current_token.type == KORELIN_TOKEN_STRING) {
+        node->token.value = decode_string_token(&parser->current_token);
+    } else {
+        char* text = (char*)malloc(parser->current_token.length + 1);
+        memcpy(text, parser->current_token.value, parser->current_token.length);
+        text[parser->current_token.length] = '\0';
+        node->token.value = text;
+    }
+    node->token.length = strlen(node->token.value);
     
     advance_token(parser);
     return (KastNode*)node;
@@ -312,7 +442,7 @@ static KastNode* parse_primary(Parser* parser) {
         // And standard `new Map<K,V>()` syntax works fine with it.
         // However, we need to be careful if it returns "Map<K,V>[]"
         
-        char* type_name = parse_type_definition(parser);
+        const char* type_name = parse_type_definition(parser);
         if (!type_name) {
              parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected type name after new");
              return NULL;
@@ -405,6 +535,7 @@ static KastNode* parse_primary(Parser* parser) {
         
         KastNew* node = (KastNew*)malloc(sizeof(KastNew));
         node->base.type = KAST_NODE_NEW;
+        node->base.line = parser->current_token.line;
         node->class_name = type_name;
         node->is_array = is_array;
         node->args = args;
@@ -426,32 +557,34 @@ static KastNode* parse_primary(Parser* parser) {
     if (check_token(parser, KORELIN_TOKEN_SUPER)) {
         KastIdentifier* ident = (KastIdentifier*)malloc(sizeof(KastIdentifier));
         ident->base.type = KAST_NODE_IDENTIFIER;
-        ident->name = strdup("super");
+        ident->base.line = parser->current_token.line;
+        ident->name = intern_name(parser, "super");
         advance_token(parser);
         current = (KastNode*)ident;
     } else if (check_token(parser, KORELIN_TOKEN_IDENT) || check_token(parser, KORELIN_TOKEN_KEYWORD_STRING)) {
          // Check for Class::Member (Static access)
          if (parser->peek_token.type == KORELIN_TOKEN_SCOPE) {
-              char* class_name = strdup(parser->current_token.value);
+              const char* class_name = token_name(parser);
               advance_token(parser); // ident
               advance_token(parser); // ::
               if (!check_token(parser, KORELIN_TOKEN_IDENT)) {
                   parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected member name");
-                  free(class_name);
                   return NULL;
               }
-              char* member_name = strdup(parser->current_token.value);
+              const char* member_name = token_name(parser);
               advance_token(parser);
               
               KastScopeAccess* node = (KastScopeAccess*)malloc(sizeof(KastScopeAccess));
               node->base.type = KAST_NODE_SCOPE_ACCESS;
+              node->base.line = parser->current_token.line;
               node->class_name = class_name;
               node->member_name = member_name;
               current = (KastNode*)node;
          } else {
               KastIdentifier* node = (KastIdentifier*)malloc(sizeof(KastIdentifier));
               node->base.type = KAST_NODE_IDENTIFIER;
-              node->name = strdup(parser->current_token.value);
+              node->base.line = parser->current_token.line;
+              node->name = token_name(parser);
               advance_token(parser);
               current = (KastNode*)node;
          }
@@ -471,6 +604,7 @@ static KastNode* parse_primary(Parser* parser) {
                    
                    KastPostfixOp* post = (KastPostfixOp*)malloc(sizeof(KastPostfixOp));
                    post->base.type = KAST_NODE_POSTFIX_OP;
+                   post->base.line = parser->current_token.line;
                    post->operator = op;
                    post->operand = current;
                    current = (KastNode*)post;
@@ -490,11 +624,12 @@ static KastNode* parse_primary(Parser* parser) {
                         parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected member name");
                         return current;
                    }
-                   char* member = strdup(parser->current_token.value);
+                   const char* member = token_name(parser);
                    advance_token(parser);
                    
                    KastMemberAccess* acc = (KastMemberAccess*)malloc(sizeof(KastMemberAccess));
                    acc->base.type = KAST_NODE_MEMBER_ACCESS;
+                   acc->base.line = parser->current_token.line;
                    acc->object = current;
                    acc->member_name = member;
                    current = (KastNode*)acc;
@@ -518,6 +653,7 @@ static KastNode* parse_primary(Parser* parser) {
                    
                    KastCall* call = (KastCall*)malloc(sizeof(KastCall));
                    call->base.type = KAST_NODE_CALL;
+                   call->base.line = parser->current_token.line;
                    call->callee = current;
                    call->args = args;
                    call->arg_count = arg_count;
@@ -530,6 +666,7 @@ static KastNode* parse_primary(Parser* parser) {
                    
                    KastArrayAccess* acc = (KastArrayAccess*)malloc(sizeof(KastArrayAccess));
                    acc->base.type = KAST_NODE_ARRAY_ACCESS;
+                   acc->base.line = parser->current_token.line;
                    acc->array = current;
                    acc->index = index;
                    current = (KastNode*)acc;
@@ -538,7 +675,8 @@ static KastNode* parse_primary(Parser* parser) {
            return current;
       }
     
-    parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected expression, but at '%s'", parser->current_token.value ? parser->current_token.value : "EOF");
+    parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected expression, but at '%.*s'",
+                 (int)parser->current_token.length, parser->current_token.value);
     return NULL;
 }
 
@@ -554,24 +692,26 @@ static KastStatement* parse_assignment(Parser* parser) {
     // Parse lvalue (identifier)
     KastIdentifier* ident = (KastIdentifier*)malloc(sizeof(KastIdentifier));
     ident->base.type = KAST_NODE_IDENTIFIER;
-    ident->name = strdup(parser->current_token.value);
+    ident->base.line = parser->current_token.line;
+    ident->name = token_name(parser);
     advance_token(parser);
     
     consume(parser, KORELIN_TOKEN_ASSIGN, "Assignment expects '='");
     
     KastNode* value = parse_expression(parser);
-    if (parser->panic_mode) { free(ident->name); free(ident); return NULL; }
+    if (parser->panic_mode) { free(ident); return NULL; }
     
     consume(parser, KORELIN_TOKEN_SEMICOLON, "Expected ';'");
-    if (value == NULL) { free(ident->name); free(ident); return NULL; }
+    if (value == NULL) { free(ident); return NULL; }
     
     KastAssignment* stmt = (KastAssignment*)malloc(sizeof(KastAssignment));
     if (stmt == NULL) {
         parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Memory allocation failed");
-        free(ident->name); free(ident);
+        free(ident);
         return NULL;
     }
     stmt->base.type = KAST_NODE_ASSIGNMENT;
+    stmt->base.line = parser->current_token.line;
     stmt->lvalue = (KastNode*)ident;
     stmt->value = value;
     return (KastStatement*)stmt;
@@ -583,6 +723,7 @@ static KastStatement* parse_assignment(Parser* parser) {
 static KastBlock* parse_block(Parser* parser) {
     KastBlock* block = (KastBlock*)malloc(sizeof(KastBlock));
     block->base.type = KAST_NODE_BLOCK;
+    block->base.line = parser->current_token.line;
     block->statements = NULL;
     block->statement_count = 0;
     
@@ -634,6 +775,7 @@ static KastBlock* parse_block(Parser* parser) {
 static KastStatement* parse_try_catch(Parser* parser) {
     KastTryCatch* stmt = (KastTryCatch*)malloc(sizeof(KastTryCatch));
     stmt->base.type = KAST_NODE_TRY_CATCH;
+    stmt->base.line = parser->current_token.line;
     stmt->try_block = NULL;
     stmt->catch_blocks = NULL;
     stmt->catch_count = 0;
@@ -662,25 +804,25 @@ static KastStatement* parse_try_catch(Parser* parser) {
             free_ast_node((KastNode*)stmt); return NULL;
         }
         
-        char* error_type = strdup(parser->current_token.value);
+        const char* error_type = token_name(parser);
         advance_token(parser);
         
         // Optional variable name
-        char* var_name = NULL;
+        const char* var_name = NULL;
         if (check_token(parser, KORELIN_TOKEN_IDENT)) {
-             var_name = strdup(parser->current_token.value);
+             var_name = token_name(parser);
              advance_token(parser);
         }
 
         consume(parser, KORELIN_TOKEN_RPAREN, "Catch block expects ')'");
         if (parser->panic_mode) { 
-            free(error_type); if(var_name) free(var_name); free_ast_node((KastNode*)stmt); return NULL; 
+            free_ast_node((KastNode*)stmt); return NULL; 
         }
 
         // 解析 catch 代碼塊
         KastBlock* catch_body = parse_block(parser);
         if (catch_body == NULL) {
-             free(error_type); if(var_name) free(var_name); free_ast_node((KastNode*)stmt); return NULL;
+             free_ast_node((KastNode*)stmt); return NULL;
         }
 
         // 添加到數組
@@ -700,15 +842,15 @@ static KastStatement* parse_try_catch(Parser* parser) {
 
 // 解析類型定義 (Type Definition)
 // 支持: int, MyClass, int[], MyClass[], Map<K,V>, Array<T>
-// 返回類型名字符串 (需要在外部 free)
-static char* parse_type_definition(Parser* parser);
+// 返回類型名字符串 (指向標識符表)
+static const char* parse_type_definition(Parser* parser);
 // 聲明 parse_parameter_list
 static KastNode** parse_parameter_list(Parser* parser, size_t* arg_count, bool enforce_self);
 
 // 解析函數聲明 (Type Name(...) {})
-static KastStatement* parse_function_declaration(Parser* parser, char* return_type, char* name) {
+static KastStatement* parse_function_declaration(Parser* parser, const char* return_type, const char* name) {
     // 1. 泛型參數 (可選) <T>
-    char** generic_params = NULL;
+    const char** generic_params = NULL;
     size_t generic_count = 0;
     
     if (check_token(parser, KORELIN_TOKEN_LT)) {
@@ -720,10 +862,10 @@ static KastStatement* parse_function_declaration(Parser* parser, char* return_ty
                 break;
             }
             
-            char* param = strdup(parser->current_token.value);
+            const char* param = token_name(parser);
             advance_token(parser);
             
-            generic_params = (char**)realloc(generic_params, (generic_count + 1) * sizeof(char*));
+            generic_params = (const char**)realloc(generic_params, (generic_count + 1) * sizeof(const char*));
             generic_params[generic_count++] = param;
             
             if (check_token(parser, KORELIN_TOKEN_COMMA)) {
@@ -753,6 +895,7 @@ static KastStatement* parse_function_declaration(Parser* parser, char* return_ty
     // 5. 構建節點
     KastFunctionDecl* func = (KastFunctionDecl*)malloc(sizeof(KastFunctionDecl));
     func->base.type = KAST_NODE_FUNCTION_DECL;
+    func->base.line = parser->current_token.line;
     func->name = name;
     func->return_type = return_type;
     func->args = args;
@@ -769,30 +912,27 @@ static KastStatement* parse_function_declaration(Parser* parser, char* return_ty
 // 解析類型化的聲明 (Type Name ... -> Func or Var)
 static KastStatement* parse_typed_declaration(Parser* parser) {
     // 1. 解析類型
-    char* type_name = parse_type_definition(parser);
+    const char* type_name = parse_type_definition(parser);
     if (!type_name) return NULL;
     
     // 2. 解析名稱
     if (!check_token(parser, KORELIN_TOKEN_IDENT)) {
         parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected identifier");
-        free(type_name);
         return NULL;
     }
-    char* name = strdup(parser->current_token.value);
+    const char* name = token_name(parser);
     advance_token(parser);
     
     // Check for :: (Out of class method definition)
     if (check_token(parser, KORELIN_TOKEN_SCOPE)) {
-        char* class_name = name; // Previous identifier is class name
+        const char* class_name = name; // Previous identifier is class name
         advance_token(parser); // eat ::
         
         if (!check_token(parser, KORELIN_TOKEN_IDENT)) {
              parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected method name after ::");
-             free(class_name);
-             free(type_name);
              return NULL;
         }
-        char* method_name = strdup(parser->current_token.value);
+        const char* method_name = token_name(parser);
         advance_token(parser);
         
         // Must be function definition
@@ -800,15 +940,10 @@ static KastStatement* parse_typed_declaration(Parser* parser) {
              KastStatement* decl = parse_function_declaration(parser, type_name, method_name);
              if (decl && decl->base.type == KAST_NODE_FUNCTION_DECL) {
                  ((KastFunctionDecl*)decl)->parent_class_name = class_name;
-             } else {
-                 free(class_name);
              }
              return decl;
         } else {
              parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected '(' after method name in definition");
-             free(class_name);
-             free(method_name);
-             free(type_name);
              return NULL;
         }
     }
@@ -831,6 +966,7 @@ static KastStatement* parse_typed_declaration(Parser* parser) {
     // 否則是變量聲明: Type Name [= ...] ;
     KastVarDecl* var_decl = (KastVarDecl*)malloc(sizeof(KastVarDecl));
     var_decl->base.type = KAST_NODE_VAR_DECL;
+    var_decl->base.line = parser->current_token.line;
     var_decl->is_global = false; // 默認爲 false，具體看上下文，但在 AST 中通常不區分 global/local 節點類型，而是由 scope 決定
     var_decl->is_constant = false; // 默認可變
     var_decl->type_name = type_name;
@@ -862,60 +998,48 @@ static KastStatement* parse_typed_declaration(Parser* parser) {
     return (KastStatement*)var_decl;
 }
 
-static char* parse_type_definition(Parser* parser) {
-    char* type_name = NULL;
+static const char* parse_type_definition(Parser* parser) {
+    const char* type_name = NULL;
+    char buffer[256];
     
     // 1. 基礎類型或標識符 (支持 dotted names: std.io.File)
     if (check_token(parser, KORELIN_TOKEN_IDENT) || 
         (parser->current_token.type >= KORELIN_TOKEN_KEYWORD_STRING && parser->current_token.type <= KORELIN_TOKEN_BOOL) ||
         parser->current_token.type == KORELIN_TOKEN_VOID) {
         
-        // Use a dynamic buffer for dotted names
-        char buffer[256];
-        buffer[0] = '\0';
-        strcat(buffer, parser->current_token.value);
+        type_name = token_name(parser);
         advance_token(parser);
         
         // Handle dotted names (e.g. std.io.File)
         while (check_token(parser, KORELIN_TOKEN_DOT)) {
-            strcat(buffer, ".");
             advance_token(parser); // .
             if (!check_token(parser, KORELIN_TOKEN_IDENT)) {
                  parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected type name part");
                  return NULL;
             }
-            strcat(buffer, parser->current_token.value);
+            snprintf(buffer, sizeof(buffer), "%s.%.*s", type_name,
+                     (int)parser->current_token.length, parser->current_token.value);
+            type_name = intern_name(parser, buffer);
             advance_token(parser);
         }
-        
-        type_name = strdup(buffer);
     } else if (check_token(parser, KORELIN_TOKEN_MAP)) {
         // Map<K, V>
         advance_token(parser);
         consume(parser, KORELIN_TOKEN_LT, "Expected '<'");
         
-        char* key_type = parse_type_definition(parser);
+        const char* key_type = parse_type_definition(parser);
         if (!key_type) return NULL;
         
         consume(parser, KORELIN_TOKEN_COMMA, "Expected ','");
         
-        char* value_type = parse_type_definition(parser);
-        if (!value_type) {
-            free(key_type);
-            return NULL;
-        }
+        const char* value_type = parse_type_definition(parser);
+        if (!value_type) return NULL;
         
         consume(parser, KORELIN_TOKEN_GT, "Expected '>'");
         
         // Construct "Map<Key,Value>" string
-        // Using fixed buffer for simplicity, better use dynamic string builder
-        // Assuming max length
-        size_t len = strlen("Map<") + strlen(key_type) + strlen(",") + strlen(value_type) + strlen(">") + 1;
-        type_name = (char*)malloc(len);
-        sprintf(type_name, "Map<%s,%s>", key_type, value_type);
-        
-        free(key_type);
-        free(value_type);
+        snprintf(buffer, sizeof(buffer), "Map<%s,%s>", key_type, value_type);
+        type_name = intern_name(parser, buffer);
     } else {
         return NULL;
     }
@@ -924,16 +1048,12 @@ static char* parse_type_definition(Parser* parser) {
     // E.g. Array<T>, MyClass<T>
     if (check_token(parser, KORELIN_TOKEN_LT)) {
         advance_token(parser);
-        char* param_type = parse_type_definition(parser);
+        const char* param_type = parse_type_definition(parser);
         consume(parser, KORELIN_TOKEN_GT, "Expected '>'");
         
         if (param_type) {
-            size_t len = strlen(type_name) + strlen("<") + strlen(param_type) + strlen(">") + 1;
-            char* new_name = (char*)malloc(len);
-            sprintf(new_name, "%s<%s>", type_name, param_type);
-            free(type_name);
-            free(param_type);
-            type_name = new_name;
+            snprintf(buffer, sizeof(buffer), "%s<%s>", type_name, param_type);
+            type_name = intern_name(parser, buffer);
         }
     }
     
@@ -945,11 +1065,8 @@ static char* parse_type_definition(Parser* parser) {
             advance_token(parser); // [
             advance_token(parser); // ]
             
-            size_t len = strlen(type_name) + strlen("[]") + 1;
-            char* new_name = (char*)malloc(len);
-            sprintf(new_name, "%s[]", type_name);
-            free(type_name);
-            type_name = new_name;
+            snprintf(buffer, sizeof(buffer), "%s[]", type_name);
+            type_name = intern_name(parser, buffer);
         } else {
             break; // 可能是 [10]，留給 new 處理
         }
@@ -964,6 +1081,7 @@ static char* parse_type_definition(Parser* parser) {
 static KastStatement* parse_var_declaration(Parser* parser) {
     KastVarDecl* stmt = (KastVarDecl*)malloc(sizeof(KastVarDecl));
     stmt->base.type = KAST_NODE_VAR_DECL;
+    stmt->base.line = parser->current_token.line;
     
     // 1. 確定作用域 (var -> local, let -> global)
     if (check_token(parser, KORELIN_TOKEN_LET)) {
@@ -986,7 +1104,7 @@ static KastStatement* parse_var_declaration(Parser* parser) {
 
     // 3. 類型聲明 (可選) - 使用 parse_type_definition 支持複雜類型
     // 需要預判下一個 token 是否是類型
-    char* type_name = parse_type_definition(parser);
+    const char* type_name = parse_type_definition(parser);
     stmt->type_name = type_name;
 
     // 4. 變量名 (必須是標識符)
@@ -1013,10 +1131,10 @@ static KastStatement* parse_var_declaration(Parser* parser) {
                               t == KORELIN_TOKEN_BOOL || t == KORELIN_TOKEN_VOID;
             
             // 針對 int/float/string 特殊處理 (區分關鍵字和字面量)
-            if (!is_keyword && parser->current_token.value) {
-                 if (t == KORELIN_TOKEN_INT && strcmp(parser->current_token.value, "int") == 0) is_keyword = true;
-                 else if (t == KORELIN_TOKEN_FLOAT && strcmp(parser->current_token.value, "float") == 0) is_keyword = true;
-                 else if (t == KORELIN_TOKEN_KEYWORD_STRING && strcmp(parser->current_token.value, "string") == 0) is_keyword = true;
+            if (!is_keyword) {
+                 if (t == KORELIN_TOKEN_INT && token_equals(&parser->current_token, "int")) is_keyword = true;
+                 else if (t == KORELIN_TOKEN_FLOAT && token_equals(&parser->current_token, "float")) is_keyword = true;
+                 else if (t == KORELIN_TOKEN_KEYWORD_STRING && token_equals(&parser->current_token, "string")) is_keyword = true;
             }
 
             if (is_keyword) {
@@ -1025,12 +1143,11 @@ static KastStatement* parse_var_declaration(Parser* parser) {
             }
 
             parser_error(parser, errType, msg);
-            if (stmt->type_name) free(stmt->type_name);
             free(stmt);
             return NULL;
         }
     } else {
-        stmt->name = strdup(parser->current_token.value);
+        stmt->name = token_name(parser);
         advance_token(parser);
     }
 
@@ -1063,9 +1180,8 @@ static KastStatement* parse_var_declaration(Parser* parser) {
         check_token(parser, KORELIN_TOKEN_BOOL) ||
         check_token(parser, KORELIN_TOKEN_VOID)) {
          
-         parser_error(parser, KORELIN_ERROR_INVALID_TYPE_POSITION, "Type declaration should be before variable name (e.g., var %s %s)", parser->current_token.value, stmt->name);
-         if (stmt->name) free(stmt->name);
-         if (stmt->type_name) free(stmt->type_name);
+         parser_error(parser, KORELIN_ERROR_INVALID_TYPE_POSITION, "Type declaration should be before variable name (e.g., var %.*s %s)",
+                      (int)parser->current_token.length, parser->current_token.value, stmt->name);
          free(stmt);
          return NULL;
     }
@@ -1077,8 +1193,6 @@ static KastStatement* parse_var_declaration(Parser* parser) {
         stmt->init_value = parse_expression(parser);
         if (stmt->init_value == NULL && parser->panic_mode) {
              // 表達式解析失敗
-             if (stmt->name) free(stmt->name);
-             if (stmt->type_name) free(stmt->type_name);
              free(stmt);
              return NULL;
         }
@@ -1090,8 +1204,6 @@ static KastStatement* parse_var_declaration(Parser* parser) {
     // 6. 分號 (必須)
     consume(parser, KORELIN_TOKEN_SEMICOLON, "Expected ';'");
     if (parser->panic_mode) {
-        if (stmt->name) free(stmt->name);
-        if (stmt->type_name) free(stmt->type_name);
         if (stmt->init_value) free_ast_node(stmt->init_value);
         free(stmt);
         return NULL;
@@ -1125,17 +1237,18 @@ static KastNode** parse_parameter_list(Parser* parser, size_t* arg_count, bool e
         // Check for self (as first param)
         if (enforce_self && first_param) {
         // printf("DEBUG: Checking self. Current type: %d, value: %s\n", parser->current_token.type, parser->current_token.value);
-        if (check_token(parser, KORELIN_TOKEN_IDENT) && strcmp(parser->current_token.value, "self") == 0) {
+        if (check_token(parser, KORELIN_TOKEN_IDENT) && token_equals(&parser->current_token, "self")) {
             // Found self
             advance_token(parser);
                 
                 KastVarDecl* param = (KastVarDecl*)malloc(sizeof(KastVarDecl));
                 param->base.type = KAST_NODE_VAR_DECL;
+                param->base.line = parser->current_token.line;
                 param->is_global = false;
                 param->is_constant = true; 
-                param->type_name = strdup("self"); 
+                param->type_name = intern_name(parser, "self"); 
                 param->is_array = false;
-                param->name = strdup("self");
+                param->name = intern_name(parser, "self");
                 param->init_value = NULL;
                 
                 args = (KastNode**)realloc(args, (*arg_count + 1) * sizeof(KastNode*));
@@ -1149,7 +1262,7 @@ static KastNode** parse_parameter_list(Parser* parser, size_t* arg_count, bool e
             }
         }
         
-        char* type_name = parse_type_definition(parser);
+        const char* type_name = parse_type_definition(parser);
         if (!type_name) {
             parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected parameter type");
             return args; 
@@ -1160,12 +1273,12 @@ static KastNode** parse_parameter_list(Parser* parser, size_t* arg_count, bool e
               // If static (enforce_self == false), we treat 'self' as a normal parameter named 'self'
               // instead of ignoring it. This allows user to define static methods with 'self' argument.
               
-              char* param_name = strdup("self");
-              free(type_name);
-              type_name = strdup("Any");
+              const char* param_name = intern_name(parser, "self");
+              type_name = intern_name(parser, "Any");
               
               KastVarDecl* param = (KastVarDecl*)malloc(sizeof(KastVarDecl));
               param->base.type = KAST_NODE_VAR_DECL;
+              param->base.line = parser->current_token.line;
               param->is_global = false;
               param->is_constant = false;
               param->type_name = type_name;
@@ -1185,14 +1298,14 @@ static KastNode** parse_parameter_list(Parser* parser, size_t* arg_count, bool e
         
         if (!check_token(parser, KORELIN_TOKEN_IDENT)) {
             parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected parameter name");
-            free(type_name);
             return args;
         }
-        char* param_name = strdup(parser->current_token.value);
+        const char* param_name = token_name(parser);
         advance_token(parser);
         
         KastVarDecl* param = (KastVarDecl*)malloc(sizeof(KastVarDecl));
         param->base.type = KAST_NODE_VAR_DECL;
+        param->base.line = parser->current_token.line;
         param->is_global = false;
         param->is_constant = false;
         param->type_name = type_name;
@@ -1249,6 +1362,7 @@ static KastStatement* parse_if_statement(Parser* parser) {
     
     KastIf* node = (KastIf*)malloc(sizeof(KastIf));
     node->base.type = KAST_NODE_IF;
+    node->base.line = parser->current_token.line;
     node->condition = condition;
     node->then_branch = then_branch;
     node->else_branch = else_branch;
@@ -1265,6 +1379,7 @@ static KastStatement* parse_switch_statement(Parser* parser) {
     
     KastSwitch* node = (KastSwitch*)malloc(sizeof(KastSwitch));
     node->base.type = KAST_NODE_SWITCH;
+    node->base.line = parser->current_token.line;
     node->condition = condition;
     node->cases = NULL;
     node->case_count = 0;
@@ -1290,6 +1405,7 @@ static KastStatement* parse_switch_statement(Parser* parser) {
             
             KastBlock* block = (KastBlock*)malloc(sizeof(KastBlock));
             block->base.type = KAST_NODE_BLOCK;
+            block->base.line = parser->current_token.line;
             block->statements = NULL;
             block->statement_count = 0;
             size_t block_cap = 0;
@@ -1329,6 +1445,7 @@ static KastStatement* parse_switch_statement(Parser* parser) {
             // 解析 default 体
              KastBlock* block = (KastBlock*)malloc(sizeof(KastBlock));
             block->base.type = KAST_NODE_BLOCK;
+            block->base.line = parser->current_token.line;
             block->statements = NULL;
             block->statement_count = 0;
             size_t block_cap = 0;
@@ -1384,6 +1501,7 @@ static KastStatement* parse_for_statement(Parser* parser) {
             KastNode* val = parse_expression(parser);
             KastAssignment* assign = (KastAssignment*)malloc(sizeof(KastAssignment));
             assign->base.type = KAST_NODE_ASSIGNMENT;
+            assign->base.line = parser->current_token.line;
             assign->lvalue = expr;
             assign->value = val;
             init = (KastStatement*)assign;
@@ -1418,6 +1536,7 @@ static KastStatement* parse_for_statement(Parser* parser) {
              
              KastAssignment* assign = (KastAssignment*)malloc(sizeof(KastAssignment));
              assign->base.type = KAST_NODE_ASSIGNMENT;
+             assign->base.line = parser->current_token.line;
              assign->lvalue = expr;
              assign->value = val;
              increment = (KastNode*)assign;
@@ -1432,6 +1551,7 @@ static KastStatement* parse_for_statement(Parser* parser) {
 
     KastFor* node = (KastFor*)malloc(sizeof(KastFor));
     node->base.type = KAST_NODE_FOR;
+    node->base.line = parser->current_token.line;
     node->init = init;
     node->condition = condition;
     node->increment = increment;
@@ -1452,6 +1572,7 @@ static KastStatement* parse_while_statement(Parser* parser) {
     
     KastWhile* node = (KastWhile*)malloc(sizeof(KastWhile));
     node->base.type = KAST_NODE_WHILE;
+    node->base.line = parser->current_token.line;
     node->condition = condition;
     node->body = body;
     return (KastStatement*)node;
@@ -1473,6 +1594,7 @@ static KastStatement* parse_do_while_statement(Parser* parser) {
     
     KastDoWhile* node = (KastDoWhile*)malloc(sizeof(KastDoWhile));
     node->base.type = KAST_NODE_DO_WHILE;
+    node->base.line = parser->current_token.line;
     node->body = body;
     node->condition = condition;
     return (KastStatement*)node;
@@ -1484,6 +1606,7 @@ static KastStatement* parse_return_statement(Parser* parser) {
     
     KastReturn* stmt = (KastReturn*)malloc(sizeof(KastReturn));
     stmt->base.type = KAST_NODE_RETURN;
+    stmt->base.line = parser->current_token.line;
     stmt->value = NULL;
     
     if (!check_token(parser, KORELIN_TOKEN_SEMICOLON)) {
@@ -1499,6 +1622,7 @@ static KastStatement* parse_break_statement(Parser* parser) {
     consume(parser, KORELIN_TOKEN_SEMICOLON, "Expected ';'");
     KastBreak* stmt = (KastBreak*)malloc(sizeof(KastBreak));
     stmt->base.type = KAST_NODE_BREAK;
+    stmt->base.line = parser->current_token.line;
     return (KastStatement*)stmt;
 }
 
@@ -1507,6 +1631,7 @@ static KastStatement* parse_continue_statement(Parser* parser) {
     consume(parser, KORELIN_TOKEN_SEMICOLON, "Expected ';'");
     KastContinue* stmt = (KastContinue*)malloc(sizeof(KastContinue));
     stmt->base.type = KAST_NODE_CONTINUE;
+    stmt->base.line = parser->current_token.line;
     return (KastStatement*)stmt;
 }
 
@@ -1517,13 +1642,14 @@ static KastStatement* parse_struct_declaration(Parser* parser) {
         parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected struct name");
         return NULL;
     }
-    char* struct_name = strdup(parser->current_token.value);
+    const char* struct_name = token_name(parser);
     advance_token(parser);
     
     consume(parser, KORELIN_TOKEN_LBRACE, "Expected '{'");
     
     KastStructDecl* struct_node = (KastStructDecl*)malloc(sizeof(KastStructDecl));
     struct_node->base.type = KAST_NODE_STRUCT_DECL;
+    struct_node->base.line = parser->current_token.line;
     struct_node->name = struct_name;
     struct_node->members = NULL;
     struct_node->member_count = 0;
@@ -1535,8 +1661,8 @@ static KastStatement* parse_struct_declaration(Parser* parser) {
         // Struct members are implicitly public (usually) and just fields
         // For simplicity, we reuse KastClassMember but ensure it's a property
         
-        char* type_name = NULL;
-        char* member_name = NULL;
+        const char* type_name = NULL;
+        const char* member_name = NULL;
         
         // Type
         type_name = parse_type_definition(parser);
@@ -1551,16 +1677,16 @@ static KastStatement* parse_struct_declaration(Parser* parser) {
         // Name
         if (!check_token(parser, KORELIN_TOKEN_IDENT)) {
              parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected member name");
-             if (type_name) free(type_name);
              while (!check_token(parser, KORELIN_TOKEN_SEMICOLON) && !check_token(parser, KORELIN_TOKEN_RBRACE)) advance_token(parser);
              if (check_token(parser, KORELIN_TOKEN_SEMICOLON)) advance_token(parser);
              continue;
         }
-        member_name = strdup(parser->current_token.value);
+        member_name = token_name(parser);
         advance_token(parser);
         
         KastClassMember* member = (KastClassMember*)malloc(sizeof(KastClassMember));
         member->base.type = KAST_NODE_MEMBER_DECL;
+        member->base.line = parser->current_token.line;
         member->access = KAST_ACCESS_PUBLIC; // Default public
         member->is_static = false;
         member->name = member_name;
@@ -1587,7 +1713,7 @@ static KastStatement* parse_struct_declaration(Parser* parser) {
     
     // Check for inline variable declaration: struct S { ... } s;
     if (check_token(parser, KORELIN_TOKEN_IDENT)) {
-        char* var_name = strdup(parser->current_token.value);
+        const char* var_name = token_name(parser);
         advance_token(parser);
         
         // Create a VarDecl for this instance
@@ -1598,9 +1724,10 @@ static KastStatement* parse_struct_declaration(Parser* parser) {
         
         KastVarDecl* var_decl = (KastVarDecl*)malloc(sizeof(KastVarDecl));
         var_decl->base.type = KAST_NODE_VAR_DECL;
+        var_decl->base.line = parser->current_token.line;
         var_decl->is_global = false; // or true if at top level? assume var semantics
         var_decl->is_constant = false;
-        var_decl->type_name = strdup(struct_name);
+        var_decl->type_name = struct_name;
         
         // Check for array declaration: struct S { ... } s[];
         if (check_token(parser, KORELIN_TOKEN_LBRACKET)) {
@@ -1633,7 +1760,7 @@ static KastStatement* parse_struct_declaration(Parser* parser) {
 static KastStatement* parse_import_statement(Parser* parser) {
     consume(parser, KORELIN_TOKEN_IMPORT, "Expected 'import'");
     
-    char** path_parts = NULL;
+    const char** path_parts = NULL;
     size_t part_count = 0;
     
     // Parse first part
@@ -1642,10 +1769,10 @@ static KastStatement* parse_import_statement(Parser* parser) {
         return NULL;
     }
     
-    char* part = strdup(parser->current_token.value);
+    const char* part = token_name(parser);
     advance_token(parser);
     
-    path_parts = (char**)realloc(path_parts, (part_count + 1) * sizeof(char*));
+    path_parts = (const char**)realloc(path_parts, (part_count + 1) * sizeof(const char*));
     path_parts[part_count++] = part;
     
     // Parse subsequent parts (.ident)
@@ -1656,10 +1783,10 @@ static KastStatement* parse_import_statement(Parser* parser) {
             parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected package path part");
             break;
         }
-        part = strdup(parser->current_token.value);
+        part = token_name(parser);
         advance_token(parser);
         
-        path_parts = (char**)realloc(path_parts, (part_count + 1) * sizeof(char*));
+        path_parts = (const char**)realloc(path_parts, (part_count + 1) * sizeof(const char*));
         path_parts[part_count++] = part;
     }
     
@@ -1667,16 +1794,17 @@ static KastStatement* parse_import_statement(Parser* parser) {
     
     KastImport* import_node = (KastImport*)malloc(sizeof(KastImport));
     import_node->base.type = KAST_NODE_IMPORT;
+    import_node->base.line = parser->current_token.line;
     import_node->path_parts = path_parts;
     import_node->part_count = part_count;
     // Default alias is last part
-    import_node->alias = strdup(path_parts[part_count - 1]);
+    import_node->alias = path_parts[part_count - 1];
     import_node->is_wildcard = false;
     
     return (KastStatement*)import_node;
 }
 
-static KastStatement* parse_statement(Parser* parser) {
+static KastStatement* parse_statement_body(Parser* parser) {
     if (check_token(parser, KORELIN_TOKEN_IMPORT)) {
         return parse_import_statement(parser);
     }
@@ -1702,6 +1830,7 @@ static KastStatement* parse_statement(Parser* parser) {
         
         KastThrow* node = (KastThrow*)malloc(sizeof(KastThrow));
         node->base.type = KAST_NODE_THROW;
+        node->base.line = parser->current_token.line;
         node->value = expr;
         return (KastStatement*)node;
     }
@@ -1803,31 +1932,27 @@ static KastStatement* parse_statement(Parser* parser) {
                }
 
                if (is_definition) {
-                   char* class_name = strdup(parser->current_token.value);
+                   const char* class_name = token_name(parser);
                    advance_token(parser); // Class
                    
                    // Ensure we consume ::
                    if (!check_token(parser, KORELIN_TOKEN_SCOPE)) {
                        parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected '::'");
-                       free(class_name);
                        return NULL;
                    }
                    advance_token(parser); // ::
                    
                    if (!check_token(parser, KORELIN_TOKEN_IDENT)) {
                        parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected method name");
-                       free(class_name);
                        return NULL;
                    }
-                   char* method_name = strdup(parser->current_token.value);
+                   const char* method_name = token_name(parser);
                    advance_token(parser); // Method
                    
                    // Default return type to "void" if not specified
-                   KastStatement* decl = parse_function_declaration(parser, strdup("void"), method_name);
+                   KastStatement* decl = parse_function_declaration(parser, intern_name(parser, "void"), method_name);
                    if (decl && decl->base.type == KAST_NODE_FUNCTION_DECL) {
                        ((KastFunctionDecl*)decl)->parent_class_name = class_name;
-                   } else {
-                       free(class_name);
                    }
                    return decl;
                }
@@ -1851,6 +1976,7 @@ static KastStatement* parse_statement(Parser* parser) {
               
               KastAssignment* assign = (KastAssignment*)malloc(sizeof(KastAssignment));
               assign->base.type = KAST_NODE_ASSIGNMENT;
+              assign->base.line = parser->current_token.line;
               assign->lvalue = expr;
               assign->value = value;
               return (KastStatement*)assign;
@@ -1882,6 +2008,14 @@ static KastStatement* parse_statement(Parser* parser) {
     return NULL;
 }
 
+// 語句節點在解析結束時才分配，此處以起始 token 的行號為準
+static KastStatement* parse_statement(Parser* parser) {
+    int line = parser->current_token.line;
+    KastStatement* stmt = parse_statement_body(parser);
+    if (stmt) stmt->base.line = line;
+    return stmt;
+}
+
 // --- Class Parsing ---
 static KastStatement* parse_class_declaration(Parser* parser) {
     consume(parser, KORELIN_TOKEN_CLASS, "Expected 'class'");
@@ -1889,11 +2023,11 @@ static KastStatement* parse_class_declaration(Parser* parser) {
         parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected class name");
         return NULL;
     }
-    char* class_name = strdup(parser->current_token.value);
+    const char* class_name = token_name(parser);
     advance_token(parser);
     
     // Generics
-    char** generic_params = NULL;
+    const char** generic_params = NULL;
     size_t generic_count = 0;
     
     if (check_token(parser, KORELIN_TOKEN_LT)) {
@@ -1903,10 +2037,10 @@ static KastStatement* parse_class_declaration(Parser* parser) {
                 parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected generic parameter name");
                 break;
             }
-            char* param_name = strdup(parser->current_token.value);
+            const char* param_name = token_name(parser);
             advance_token(parser);
             
-            generic_params = (char**)realloc(generic_params, (generic_count + 1) * sizeof(char*));
+            generic_params = (const char**)realloc(generic_params, (generic_count + 1) * sizeof(const char*));
             generic_params[generic_count++] = param_name;
             
             if (check_token(parser, KORELIN_TOKEN_COMMA)) {
@@ -1916,15 +2050,14 @@ static KastStatement* parse_class_declaration(Parser* parser) {
         consume(parser, KORELIN_TOKEN_GT, "Expected '>' after generic parameters");
     }
     
-    char* parent_name = NULL;
+    const char* parent_name = NULL;
     if (check_token(parser, KORELIN_TOKEN_EXTENDS)) {
         advance_token(parser);
         if (!check_token(parser, KORELIN_TOKEN_IDENT)) {
             parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected parent class name after extends");
-            free(class_name);
             return NULL;
         }
-        parent_name = strdup(parser->current_token.value);
+        parent_name = token_name(parser);
         advance_token(parser);
     }
     
@@ -1932,6 +2065,7 @@ static KastStatement* parse_class_declaration(Parser* parser) {
     
     KastClassDecl* class_node = (KastClassDecl*)malloc(sizeof(KastClassDecl));
     class_node->base.type = KAST_NODE_CLASS_DECL;
+    class_node->base.line = parser->current_token.line;
     class_node->name = class_name;
     class_node->parent_name = parent_name;
     class_node->members = NULL;
@@ -1955,7 +2089,7 @@ static KastStatement* parse_class_declaration(Parser* parser) {
         }
         
         bool is_static = false;
-        if (check_token(parser, KORELIN_TOKEN_IDENT) && strcmp(parser->current_token.value, "static") == 0) {
+        if (check_token(parser, KORELIN_TOKEN_IDENT) && token_equals(&parser->current_token, "static")) {
             is_static = true;
             advance_token(parser);
         }
@@ -1964,7 +2098,7 @@ static KastStatement* parse_class_declaration(Parser* parser) {
             advance_token(parser);
         }
 
-        char* member_type_str = NULL;
+        const char* member_type_str = NULL;
         bool has_var = false;
         if (check_token(parser, KORELIN_TOKEN_VAR)) {
             advance_token(parser);
@@ -1984,7 +2118,7 @@ static KastStatement* parse_class_declaration(Parser* parser) {
         // Heuristic: if next is ident and after that is another ident (name), then first is type.
         // Or if next is primitive type keyword (int, string, etc).
         
-        char* explicit_type = NULL;
+        const char* explicit_type = NULL;
         
         // Check if current token is a type start
         bool looks_like_type = false;
@@ -2008,7 +2142,7 @@ static KastStatement* parse_class_declaration(Parser* parser) {
              if (explicit_type) {
                  member_type_str = explicit_type;
              } else {
-                 member_type_str = strdup("var");
+                 member_type_str = intern_name(parser, "var");
              }
         } else {
              // No var, must have type (unless constructor/method?)
@@ -2018,7 +2152,7 @@ static KastStatement* parse_class_declaration(Parser* parser) {
              member_type_str = explicit_type;
         }
 
-        char* member_name = NULL;
+        const char* member_name = NULL;
         bool is_constructor = false;
         
         if (!member_type_str) {
@@ -2035,18 +2169,17 @@ static KastStatement* parse_class_declaration(Parser* parser) {
                      } else {
                          parser_error(parser, KORELIN_ERROR_ILLEGAL_SYNTAX, "Expected member name");
                      }
-                     free(member_type_str);
                  }
                  while (!check_token(parser, KORELIN_TOKEN_SEMICOLON) && !check_token(parser, KORELIN_TOKEN_RBRACE)) advance_token(parser);
                  if (check_token(parser, KORELIN_TOKEN_SEMICOLON)) advance_token(parser);
                  continue;
              }
              
-             if (strcmp(parser->current_token.value, "_init") == 0 || strcmp(parser->current_token.value, "_init_") == 0) {
+             if (token_equals(&parser->current_token, "_init") || token_equals(&parser->current_token, "_init_")) {
                  is_constructor = true;
-                 member_name = strdup("_init");
+                 member_name = intern_name(parser, "_init");
              } else {
-                 member_name = strdup(parser->current_token.value);
+                 member_name = token_name(parser);
              }
              
              advance_token(parser);
@@ -2054,6 +2187,7 @@ static KastStatement* parse_class_declaration(Parser* parser) {
         
         KastClassMember* member = (KastClassMember*)malloc(sizeof(KastClassMember));
         member->base.type = KAST_NODE_MEMBER_DECL;
+        member->base.line = parser->current_token.line;
         member->access = access;
         member->is_static = is_static;
         member->is_constant = is_constant;
@@ -2104,8 +2238,11 @@ static KastStatement* parse_class_declaration(Parser* parser) {
 KastProgram* parse_program(Parser* parser) {
     KastProgram* program = (KastProgram*)malloc(sizeof(KastProgram));
     program->base.type = KAST_NODE_PROGRAM;
+    program->base.line = parser->current_token.line;
     program->statements = NULL;
     program->statement_count = 0;
+    kast_init_names(&program->names);
+    parser->names = &program->names;
 
     // 动态数组的简单实现
     size_t capacity = 0;
@@ -2144,17 +2281,14 @@ KastProgram* parse_program(Parser* parser) {
 
 // --- 内存释放 ---
 
+// 節點中的名字指向標識符表，不單獨釋放；標識符表隨 KastProgram 一起釋放
 void free_ast_node(KastNode* node) {
     if (!node) return;
 
     switch (node->type) {
         case KAST_NODE_IMPORT: {
             KastImport* import_node = (KastImport*)node;
-            for (size_t i = 0; i < import_node->part_count; i++) {
-                free(import_node->path_parts[i]);
-            }
             if (import_node->path_parts) free(import_node->path_parts);
-            if (import_node->alias) free(import_node->alias);
             break;
         }
         case KAST_NODE_PROGRAM: {
@@ -2163,6 +2297,7 @@ void free_ast_node(KastNode* node) {
                 free_ast_node((KastNode*)prog->statements[i]);
             }
             if (prog->statements) free(prog->statements);
+            kast_free_names(&prog->names);
             break;
         }
         case KAST_NODE_RETURN: {
@@ -2175,23 +2310,16 @@ void free_ast_node(KastNode* node) {
             break;
         case KAST_NODE_FUNCTION_DECL: {
             KastFunctionDecl* func = (KastFunctionDecl*)node;
-            if (func->name) free(func->name);
-            if (func->return_type) free(func->return_type);
             for (size_t i = 0; i < func->arg_count; i++) {
                 free_ast_node((KastNode*)func->args[i]);
             }
             if (func->args) free(func->args);
             if (func->body) free_ast_node((KastNode*)func->body);
-            for (size_t i = 0; i < func->generic_count; i++) {
-                free(func->generic_params[i]);
-            }
             if (func->generic_params) free(func->generic_params);
             break;
         }
         case KAST_NODE_VAR_DECL: {
             KastVarDecl* decl = (KastVarDecl*)node;
-            if (decl->name) free(decl->name);
-            if (decl->type_name) free(decl->type_name);
             if (decl->init_value) free_ast_node(decl->init_value);
             break;
         }
@@ -2213,7 +2341,6 @@ void free_ast_node(KastNode* node) {
             KastTryCatch* stmt = (KastTryCatch*)node;
             if (stmt->try_block) free_ast_node((KastNode*)stmt->try_block);
             for (size_t i = 0; i < stmt->catch_count; i++) {
-                if (stmt->catch_blocks[i].error_type) free(stmt->catch_blocks[i].error_type);
                 if (stmt->catch_blocks[i].body) free_ast_node((KastNode*)stmt->catch_blocks[i].body);
             }
             if (stmt->catch_blocks) free(stmt->catch_blocks);
@@ -2259,7 +2386,6 @@ case KAST_NODE_FOR: {
         }
         case KAST_NODE_CLASS_DECL: {
             KastClassDecl* decl = (KastClassDecl*)node;
-            if (decl->name) free(decl->name);
             for (size_t i = 0; i < decl->member_count; i++) {
                 free_ast_node((KastNode*)decl->members[i]);
             }
@@ -2268,7 +2394,6 @@ case KAST_NODE_FOR: {
         }
         case KAST_NODE_STRUCT_DECL: {
             KastStructDecl* decl = (KastStructDecl*)node;
-            if (decl->name) free(decl->name);
             for (size_t i = 0; i < decl->member_count; i++) {
                 free_ast_node((KastNode*)decl->members[i]);
             }
@@ -2278,12 +2403,9 @@ case KAST_NODE_FOR: {
         }
         case KAST_NODE_MEMBER_DECL: {
             KastClassMember* member = (KastClassMember*)node;
-            if (member->name) free(member->name);
             if (member->member_type == KAST_MEMBER_PROPERTY) {
-                if (member->type_name) free(member->type_name);
                 if (member->init_value) free_ast_node(member->init_value);
             } else {
-                if (member->return_type) free(member->return_type);
                 if (member->body) free_ast_node((KastNode*)member->body);
                 for (size_t i = 0; i < member->arg_count; i++) {
                     free_ast_node((KastNode*)member->args[i]);
@@ -2294,7 +2416,6 @@ case KAST_NODE_FOR: {
         }
         case KAST_NODE_NEW: {
             KastNew* n = (KastNew*)node;
-            if (n->class_name) free(n->class_name);
             for (size_t i = 0; i < n->arg_count; i++) {
                 free_ast_node(n->args[i]);
             }
@@ -2304,13 +2425,6 @@ case KAST_NODE_FOR: {
         case KAST_NODE_MEMBER_ACCESS: {
             KastMemberAccess* acc = (KastMemberAccess*)node;
             if (acc->object) free_ast_node(acc->object);
-            if (acc->member_name) free(acc->member_name);
-            break;
-        }
-        case KAST_NODE_SCOPE_ACCESS: {
-            KastScopeAccess* acc = (KastScopeAccess*)node;
-            if (acc->class_name) free(acc->class_name);
-            if (acc->member_name) free(acc->member_name);
             break;
         }
         case KAST_NODE_CALL: {
@@ -2349,11 +2463,6 @@ case KAST_NODE_FOR: {
             if (lit->token.value) free((void*)lit->token.value);
             break;
         }
-        case KAST_NODE_IDENTIFIER: {
-            KastIdentifier* ident = (KastIdentifier*)node;
-            if (ident->name) free(ident->name);
-            break;
-        }
         default:
             break;
     }
@@ -7,6 +7,7 @@
 
 #include "klex.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 // 错误类型定义 (参考 e:\Korelin\korelin_v100\doc\错误异常处理.md)
 typedef enum {
@@ -71,6 +72,23 @@ typedef enum {
     KAST_NODE_PROGRAM       // 根节点
 } KastNodeType;
 
+// --- 標識符表 ---
+
+typedef struct KastNameBlock KastNameBlock;
+
+/**
+ * @brief 標識符表
+ * 語法樹中的名字 (變量名、類型名、成員名等) 都指向這張表，相同的名字只保存一份。
+ * 名字存放在成塊分配的內存中，不單獨分配也不單獨釋放；表由 KastProgram 持有，隨語法樹一起釋放。
+ */
+typedef struct {
+    const char** slots;     /**< 開放定址哈希表，容量為 2 的冪 */
+    uint32_t* hashes;       /**< 與 slots 對應的哈希值 */
+    size_t capacity;
+    size_t count;
+    KastNameBlock* blocks;  /**< 名字的存儲塊鏈表 */
+} KastNameTable;
+
 // --- AST 节点结构体前置声明 ---
 
 typedef struct KastNode KastNode;
@@ -81,6 +99,7 @@ typedef struct KastStatement KastStatement;
 
 struct KastNode {
     KastNodeType type;
+    int line; // 節點起始的源碼行號
 };
 
 // --- 表达式节点 ---
@@ -117,13 +136,13 @@ typedef struct {
 // 字面量节点
 typedef struct {
     KastNode base;
-    Token token; // 存储字面量的 Token (包含类型和值)
+    Token token; // 存储字面量的 Token (包含类型和值)，value 为节点自己持有的以空字符结尾的文本
 } KastLiteral;
 
 // 标识符节点
 typedef struct {
     KastNode base;
-    char* name; // 变量名
+    const char* name; // 变量名
 } KastIdentifier;
 
 // --- 语句节点 ---
@@ -209,9 +228,9 @@ typedef struct {
 // 对应语法: import path.to.package;
 typedef struct {
     KastNode base;
-    char** path_parts;     // 路径部分数组 (e.g. ["std", "io", "file"])
+    const char** path_parts;     // 路径部分数组 (e.g. ["std", "io", "file"])
     size_t part_count;     // 路径部分数量
-    char* alias;           // 别名/最终引入名 (e.g. "file")
+    const char* alias;           // 别名/最终引入名 (e.g. "file")
     bool is_wildcard;      // 是否是 .* (暂未实现，预留)
 } KastImport;
 
@@ -240,20 +259,20 @@ typedef struct {
     KastAccessModifier access;
     bool is_static;
     bool is_constant; // const 修饰符
-    char* name;
+    const char* name;
     
     // 属性特有
-    char* type_name;      // 属性类型
+    const char* type_name;      // 属性类型
     KastNode* init_value; // 初始值
     
     // 方法特有
-    char* return_type;    // 返回类型 (构造函数为 NULL 或 void)
+    const char* return_type;    // 返回类型 (构造函数为 NULL 或 void)
     KastNode** args;      // 参数列表 (更改为 KastNode** 以匹配 parse_parameter_list 返回类型，虽然实际存储的是 KastVarDecl*)
     size_t arg_count;     // 参数数量 (原名为 param_count，统一为 arg_count)
     KastBlock* body;      // 方法体
     
     // 泛型支持
-    char** generic_params; // 泛型参数列表
+    const char** generic_params; // 泛型参数列表
     size_t generic_count;
 } KastClassMember;
 
@@ -261,15 +280,15 @@ typedef struct {
 // 对应语法: [Type] Name [Generics] (Params) Body
 typedef struct {
     KastNode base;
-    char* name;
-    char* return_type;
+    const char* name;
+    const char* return_type;
     KastNode** args;
     size_t arg_count;
     KastBlock* body;
     // 泛型支持
-    char** generic_params;
+    const char** generic_params;
     size_t generic_count;
-    char* parent_class_name; // For method definition outside class
+    const char* parent_class_name; // For method definition outside class
     KastAccessModifier access; // Access modifier
 } KastFunctionDecl;
 
@@ -277,7 +296,7 @@ typedef struct {
 // 对应语法: struct Name { ... } [varName];
 typedef struct {
     KastNode base;
-    char* name;
+    const char* name;
     KastClassMember** members; // 复用 KastClassMember，但 struct 成员默认 public 且通常只有属性
     size_t member_count;
     KastStatement* init_var; // 可选的内联变量声明 (例如: struct S { ... } s;)
@@ -287,12 +306,12 @@ typedef struct {
 // 对应语法: class ClassName [extends ParentName] { ... }
 typedef struct {
     KastNode base;
-    char* name;
-    char* parent_name; // 父类名称 (NULL 表示无继承)
+    const char* name;
+    const char* parent_name; // 父类名称 (NULL 表示无继承)
     KastClassMember** members;
     size_t member_count;
     // Generics
-    char** generic_params;
+    const char** generic_params;
     size_t generic_count;
 } KastClassDecl;
 
@@ -300,7 +319,7 @@ typedef struct {
 // 对应语法: new ClassName(args)
 typedef struct {
     KastNode base;
-    char* class_name;
+    const char* class_name;
     bool is_array; // 新增
     KastNode** args;
     size_t arg_count;
@@ -311,15 +330,15 @@ typedef struct {
 typedef struct {
     KastNode base;
     KastNode* object;
-    char* member_name;
+    const char* member_name;
 } KastMemberAccess;
 
 // 作用域访问节点 (静态访问)
 // 对应语法: Class::member
 typedef struct {
     KastNode base;
-    char* class_name;
-    char* member_name;
+    const char* class_name;
+    const char* member_name;
 } KastScopeAccess;
 
 // 函数/方法调用节点
@@ -353,9 +372,9 @@ struct KastVarDecl {
     KastNode base;
     bool is_global;     // true: let, false: var
     bool is_constant;   // true: const
-    char* type_name;    // 显式类型，可为 NULL
+    const char* type_name;    // 显式类型，可为 NULL
     bool is_array;      // 是否为数组类型 (例如 var int a[])
-    char* name;
+    const char* name;
     KastNode* init_value; // 可为 NULL
 };
 
@@ -376,8 +395,8 @@ struct KastBlock {
 
 // Catch 块结构 (辅助结构，非 AST 节点)
 typedef struct {
-    char* error_type;      // 捕获的错误类型名
-    char* variable_name;   // 捕获的变量名 (可选)
+    const char* error_type;      // 捕获的错误类型名
+    const char* variable_name;   // 捕获的变量名 (可选)
     KastBlock* body;       // 处理代码块
 } KorelinCatchBlock;
 
@@ -401,6 +420,7 @@ typedef struct {
     KastNode base;
     KastStatement** statements; // 语句数组
     size_t statement_count;
+    KastNameTable names;        // 标识符表，树中所有节点的名字都指向这里
 } KastProgram;
 
 // --- Parser 结构体定义 ---
@@ -418,6 +438,7 @@ typedef struct {
     KorelinErrorType error_type;  // 错误类型
     char error_message[256];      // 错误信息
     bool has_main_function;       // 是否已解析主函数
+    KastNameTable* names;         // 正在构建的语法树的标识符表 (parse_program 时设置)
 } Parser;
 
 // --- 函数声明 ---
@@ -434,4 +455,13 @@ const char* get_error_name(KorelinErrorType type);
 // 释放 AST 内存
 void free_ast_node(KastNode* node);
 
+// 初始化空的标识符表
+void kast_init_names(KastNameTable* table);
+
+// 返回 text 的前 length 个字节在标识符表中的副本 (以空字符结尾，表释放前一直有效)
+const char* kast_intern(KastNameTable* table, const char* text, size_t length);
+
+// 释放标识符表及其中所有名字
+void kast_free_names(KastNameTable* table);
+
 #endif //KORELIN_KPARSER_H
\ No newline at end of file
@@ -0,0 +1,827 @@
+#include "ksnapshot.h"
+#include "kcache.h"
+#include "kapi.h"
+#include "kgc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** @brief 空引用 (NULL 對象、NULL 字符串、沒有字節碼塊) */
+#define SNAP_NONE 0xFFFFFFFFu
+
+// --- 寫出 ---
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} SnapBuffer;
+
+/** @brief 指針到編號的開放尋址哈希表 */
+typedef struct {
+    const void** keys;
+    uint32_t* values;
+    size_t capacity; /**< 2 的冪 */
+    size_t count;
+} PtrMap;
+
+typedef struct {
+    SnapBuffer out;
+    KObjHeader** objects;    /**< 按編號排列的可達對象 */
+    size_t object_count;
+    size_t object_capacity;
+    PtrMap object_ids;
+    KBytecodeChunk** chunks; /**< 按編號排列的字節碼塊 */
+    size_t chunk_count;
+    size_t chunk_capacity;
+    PtrMap chunk_ids;
+    bool ok;
+} SnapSaver;
+
+static size_t ptr_hash(const void* ptr, size_t capacity) {
+    uint64_t x = (uint64_t)(uintptr_t)ptr;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t)x & (capacity - 1);
+}
+
+static bool ptr_map_get(const PtrMap* map, const void* key, uint32_t* value) {
+    if (map->capacity == 0) return false;
+    for (size_t i = ptr_hash(key, map->capacity);; i = (i + 1) & (map->capacity - 1)) {
+        if (map->keys[i] == NULL) return false;
+        if (map->keys[i] == key) {
+            *value = map->values[i];
+            return true;
+        }
+    }
+}
+
+static bool ptr_map_put(PtrMap* map, const void* key, uint32_t value) {
+    if ((map->count + 1) * 2 > map->capacity) {
+        size_t capacity = map->capacity < 64 ? 64 : map->capacity * 2;
+        const void** keys = (const void**)calloc(capacity, sizeof(void*));
+        uint32_t* values = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+        if (!keys || !values) {
+            free(keys);
+            free(values);
+            return false;
+        }
+        for (size_t i = 0; i < map->capacity; i++) {
+            if (!map->keys[i]) continue;
+            size_t j = ptr_hash(map->keys[i], capacity);
+            while (keys[j]) j = (j + 1) & (capacity - 1);
+            keys[j] = map->keys[i];
+            values[j] = map->values[i];
+        }
+        free(map->keys);
+        free(map->values);
+        map->keys = keys;
+        map->values = values;
+        map->capacity = capacity;
+    }
+    size_t i = ptr_hash(key, map->capacity);
+    while (map->keys[i]) i = (i + 1) & (map->capacity - 1);
+    map->keys[i] = key;
+    map->values[i] = value;
+    map->count++;
+    return true;
+}
+
+static void ptr_map_free(PtrMap* map) {
+    free(map->keys);
+    free(map->values);
+    memset(map, 0, sizeof(*map));
+}
+
+static void put_bytes(SnapSaver* s, const void* data, size_t size) {
+    SnapBuffer* out = &s->out;
+    if (!s->ok || size == 0) return;
+    if (out->size + size > out->capacity) {
+        size_t capacity = out->capacity < 4096 ? 4096 : out->capacity;
+        while (capacity < out->size + size) capacity *= 2;
+        uint8_t* data_new = (uint8_t*)realloc(out->data, capacity);
+        if (!data_new) {
+            s->ok = false;
+            return;
+        }
+        out->data = data_new;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->size, data, size);
+    out->size += size;
+}
+
+static void put_u8(SnapSaver* s, uint8_t v) { put_bytes(s, &v, 1); }
+static void put_u32(SnapSaver* s, uint32_t v) { put_bytes(s, &v, 4); }
+static void put_u64(SnapSaver* s, uint64_t v) { put_bytes(s, &v, 8); }
+
+/** @brief 長度 + 內容 + '\0'，NULL 寫為 SNAP_NONE */
+static void put_string_n(SnapSaver* s, const char* str, size_t length) {
+    if (!str) {
+        put_u32(s, SNAP_NONE);
+        return;
+    }
+    put_u32(s, (uint32_t)length);
+    put_bytes(s, str, length);
+    put_u8(s, 0);
+}
+
+static void put_string(SnapSaver* s, const char* str) {
+    put_string_n(s, str, str ? strlen(str) : 0);
+}
+
+/** @brief 登記可達對象，首次遇到時分配編號 */
+static void visit_object(SnapSaver* s, void* obj) {
+    uint32_t id;
+    if (!obj || ptr_map_get(&s->object_ids, obj, &id)) return;
+    if (s->object_count == s->object_capacity) {
+        s->object_capacity = s->object_capacity < 64 ? 64 : s->object_capacity * 2;
+        KObjHeader** grown = (KObjHeader**)realloc(s->objects, s->object_capacity * sizeof(KObjHeader*));
+        if (!grown) {
+            s->ok = false;
+            return;
+        }
+        s->objects = grown;
+    }
+    if (!ptr_map_put(&s->object_ids, obj, (uint32_t)s->object_count)) {
+        s->ok = false;
+        return;
+    }
+    s->objects[s->object_count++] = (KObjHeader*)obj;
+}
+
+static void visit_value(SnapSaver* s, KValue value) {
+    if (value.type == VAL_OBJ) visit_object(s, value.as.obj);
+}
+
+static void visit_table(SnapSaver* s, const KTable* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->entries[i].key) visit_value(s, table->entries[i].value);
+    }
+}
+
+static void visit_chunk(SnapSaver* s, KBytecodeChunk* chunk) {
+    uint32_t id;
+    if (!chunk || ptr_map_get(&s->chunk_ids, chunk, &id)) return;
+    if (s->chunk_count == s->chunk_capacity) {
+        s->chunk_capacity = s->chunk_capacity < 8 ? 8 : s->chunk_capacity * 2;
+        KBytecodeChunk** grown = (KBytecodeChunk**)realloc(s->chunks, s->chunk_capacity * sizeof(KBytecodeChunk*));
+        if (!grown) {
+            s->ok = false;
+            return;
+        }
+        s->chunks = grown;
+    }
+    if (!ptr_map_put(&s->chunk_ids, chunk, (uint32_t)s->chunk_count)) {
+        s->ok = false;
+        return;
+    }
+    s->chunks[s->chunk_count++] = chunk;
+}
+
+/** @brief 登記對象引用的其他對象與字節碼塊 */
+static void visit_references(SnapSaver* s, KObjHeader* obj) {
+    switch (obj->type) {
+        case OBJ_CLASS: {
+            KObjClass* klass = (KObjClass*)obj;
+            visit_object(s, klass->parent);
+            visit_table(s, &klass->methods);
+            break;
+        }
+        case OBJ_CLASS_INSTANCE: {
+            KObjInstance* instance = (KObjInstance*)obj;
+            visit_object(s, instance->klass);
+            visit_table(s, &instance->fields);
+            break;
+        }
+        case OBJ_ARRAY: {
+            KObjArray* array = (KObjArray*)obj;
+            if (array->kind == ARRAY_VALUES) {
+                for (int i = 0; i < array->length; i++) visit_value(s, array->elements[i]);
+            } else if (array->kind == ARRAY_STRUCT) {
+                size_t slots = (size_t)array->length * (size_t)array->klass->field_count;
+                for (size_t i = 0; i < slots; i++) visit_value(s, array->slots[i]);
+            }
+            visit_object(s, array->klass);
+            break;
+        }
+        case OBJ_FUNCTION: {
+            KObjFunction* function = (KObjFunction*)obj;
+            visit_chunk(s, function->chunk);
+            visit_object(s, function->parent_class);
+            visit_object(s, function->module);
+            break;
+        }
+        case OBJ_BOUND_METHOD: {
+            KObjBoundMethod* bound = (KObjBoundMethod*)obj;
+            visit_value(s, bound->receiver);
+            visit_object(s, bound->method);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void put_ref(SnapSaver* s, const void* obj) {
+    uint32_t id = SNAP_NONE;
+    if (obj) ptr_map_get(&s->object_ids, obj, &id);
+    put_u32(s, id);
+}
+
+static void put_value(SnapSaver* s, KValue value) {
+    put_u8(s, (uint8_t)value.type);
+    switch (value.type) {
+        case VAL_NULL: break;
+        case VAL_BOOL: put_u8(s, value.as.boolean ? 1 : 0); break;
+        case VAL_OBJ: put_ref(s, value.as.obj); break;
+        case VAL_STRING: put_string(s, value.as.str); break;
+        default: put_u64(s, (uint64_t)value.as.integer); break; // 數值與 KFIELD_UNSET 按位保存
+    }
+}
+
+static void put_table(SnapSaver* s, const KTable* table) {
+    put_u32(s, (uint32_t)table->count);
+    for (int i = 0; i < table->capacity; i++) {
+        if (!table->entries[i].key) continue;
+        put_string(s, table->entries[i].key);
+        put_value(s, table->entries[i].value);
+    }
+}
+
+static void put_chunk(SnapSaver* s, const KBytecodeChunk* chunk) {
+    put_string(s, chunk->filename);
+    put_u32(s, (uint32_t)chunk->count);
+    put_bytes(s, chunk->code, chunk->count);
+    put_u32(s, (uint32_t)chunk->lines.size);
+    put_bytes(s, chunk->lines.data, chunk->lines.size);
+    put_u32(s, (uint32_t)chunk->string_count);
+    for (size_t i = 0; i < chunk->string_count; i++) put_string(s, chunk->string_table[i]);
+    put_u32(s, (uint32_t)chunk->int_count);
+    put_bytes(s, chunk->int_constants, chunk->int_count * sizeof(int64_t));
+    put_u32(s, (uint32_t)chunk->double_count);
+    put_bytes(s, chunk->double_constants, chunk->double_count * sizeof(double));
+}
+
+static void put_object(SnapSaver* s, KObjHeader* obj) {
+    switch (obj->type) {
+        case OBJ_STRING: {
+            KObjString* str = (KObjString*)obj;
+            put_string_n(s, str->chars, str->chars ? (size_t)str->length : 0);
+            put_u32(s, str->hash);
+            break;
+        }
+        case OBJ_CLASS: {
+            KObjClass* klass = (KObjClass*)obj;
+            put_string(s, klass->name);
+            put_ref(s, klass->parent);
+            put_u32(s, (uint32_t)klass->field_count);
+            for (int i = 0; i < klass->field_count; i++) put_string(s, klass->fields[i]);
+            put_u8(s, klass->layout_id != 0);
+            put_table(s, &klass->methods);
+            break;
+        }
+        case OBJ_CLASS_INSTANCE: {
+            KObjInstance* instance = (KObjInstance*)obj;
+            put_ref(s, instance->klass);
+            put_table(s, &instance->fields);
+            break;
+        }
+        case OBJ_ARRAY: {
+            KObjArray* array = (KObjArray*)obj;
+            put_u8(s, (uint8_t)array->kind);
+            put_u32(s, (uint32_t)array->length);
+            put_ref(s, array->klass);
+            switch (array->kind) {
+                case ARRAY_INT: put_bytes(s, array->ints, (size_t)array->length * sizeof(int64_t)); break;
+                case ARRAY_DOUBLE: put_bytes(s, array->doubles, (size_t)array->length * sizeof(double)); break;
+                case ARRAY_BOOL: put_bytes(s, array->bools, (size_t)array->length); break;
+                case ARRAY_STRUCT: {
+                    size_t slots = (size_t)array->length * (size_t)array->klass->field_count;
+                    for (size_t i = 0; i < slots; i++) put_value(s, array->slots[i]);
+                    break;
+                }
+                default:
+                    for (int i = 0; i < array->length; i++) put_value(s, array->elements[i]);
+                    break;
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            KObjFunction* function = (KObjFunction*)obj;
+            uint32_t chunk_id = SNAP_NONE;
+            if (function->chunk) ptr_map_get(&s->chunk_ids, function->chunk, &chunk_id);
+            put_string(s, function->name);
+            put_u32(s, (uint32_t)function->arity);
+            put_u32(s, chunk_id);
+            put_u32(s, function->entry_point);
+            put_u32(s, (uint32_t)function->frame_size);
+            put_u32(s, (uint32_t)function->access);
+            put_ref(s, function->parent_class);
+            put_ref(s, function->module);
+            break;
+        }
+        case OBJ_NATIVE: {
+            KObjNative* native = (KObjNative*)obj;
+            const char* qualified = KNativeName(native->function);
+            if (!qualified) {
+                printf("Snapshot Error: Native function \"%s\" is not registered.\n",
+                       native->name ? native->name : "<anonymous>");
+                s->ok = false;
+                return;
+            }
+            put_string(s, qualified);
+            put_string(s, native->name);
+            break;
+        }
+        case OBJ_BOUND_METHOD: {
+            KObjBoundMethod* bound = (KObjBoundMethod*)obj;
+            put_value(s, bound->receiver);
+            put_ref(s, bound->method);
+            break;
+        }
+        default:
+            printf("Snapshot Error: Unsupported object type %d.\n", (int)obj->type);
+            s->ok = false;
+            break;
+    }
+}
+
+int ksnapshot_save(KVM* vm, const char* path) {
+    if (!vm || !path) return -1;
+
+    SnapSaver s;
+    memset(&s, 0, sizeof(s));
+    s.ok = true;
+
+    // 從根出發按廣度優先為所有可達對象編號
+    visit_table(&s, &vm->globals);
+    visit_table(&s, &vm->modules);
+    for (size_t i = 0; s.ok && i < s.object_count; i++) visit_references(&s, s.objects[i]);
+
+    for (size_t i = 0; i < s.object_count; i++) put_u8(&s, (uint8_t)s.objects[i]->type);
+    for (size_t i = 0; i < s.chunk_count; i++) put_chunk(&s, s.chunks[i]);
+    // 類先於其他對象寫出，解碼結構體數組時元素類的字段數已知
+    for (size_t i = 0; s.ok && i < s.object_count; i++) {
+        if (s.objects[i]->type == OBJ_CLASS) put_object(&s, s.objects[i]);
+    }
+    for (size_t i = 0; s.ok && i < s.object_count; i++) {
+        if (s.objects[i]->type != OBJ_CLASS) put_object(&s, s.objects[i]);
+    }
+    put_table(&s, &vm->globals);
+    put_table(&s, &vm->modules);
+
+    KSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = KSNAPSHOT_MAGIC;
+    header.version = KSNAPSHOT_VERSION;
+    header.fingerprint = kcache_fingerprint();
+    header.object_count = (uint32_t)s.object_count;
+    header.chunk_count = (uint32_t)s.chunk_count;
+    header.payload_size = s.out.size;
+
+    int result = -1;
+    if (s.ok) {
+        // 與字節碼緩存相同，寫入臨時文件後原子替換，正在讀取舊映像的進程不受影響
+        char* temp_path = NULL;
+        FILE* fp = kcache_create_temp(path, &temp_path);
+        if (fp) {
+            bool written = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                           fwrite(s.out.data, 1, s.out.size, fp) == s.out.size;
+            result = kcache_replace(fp, temp_path, path, written);
+        }
+    }
+
+    free(s.out.data);
+    free(s.objects);
+    free(s.chunks);
+    ptr_map_free(&s.object_ids);
+    ptr_map_free(&s.chunk_ids);
+    return result;
+}
+
+// --- 加載 ---
+
+/** @brief 快照持有的資源 (vm->snapshot) */
+typedef struct {
+    KBytecodeChunk** chunks;
+    size_t chunk_count;
+    char** strings;          /**< VAL_STRING 值引用的字符串 */
+    size_t string_count;
+    size_t string_capacity;
+} KSnapshot;
+
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok;
+} SnapReader;
+
+static void snapshot_release(void* ptr) {
+    KSnapshot* snapshot = (KSnapshot*)ptr;
+    for (size_t i = 0; i < snapshot->chunk_count; i++) {
+        if (!snapshot->chunks[i]) continue;
+        free_chunk(snapshot->chunks[i]);
+        free(snapshot->chunks[i]);
+    }
+    for (size_t i = 0; i < snapshot->string_count; i++) free(snapshot->strings[i]);
+    free(snapshot->chunks);
+    free(snapshot->strings);
+    free(snapshot);
+}
+
+static const uint8_t* get_bytes(SnapReader* r, size_t size) {
+    if (!r->ok || (size_t)(r->end - r->p) < size) {
+        r->ok = false;
+        return NULL;
+    }
+    const uint8_t* data = r->p;
+    r->p += size;
+    return data;
+}
+
+static uint8_t get_u8(SnapReader* r) {
+    const uint8_t* data = get_bytes(r, 1);
+    return data ? data[0] : 0;
+}
+
+static uint32_t get_u32(SnapReader* r) {
+    uint32_t v = 0;
+    const uint8_t* data = get_bytes(r, 4);
+    if (data) memcpy(&v, data, 4);
+    return v;
+}
+
+static uint64_t get_u64(SnapReader* r) {
+    uint64_t v = 0;
+    const uint8_t* data = get_bytes(r, 8);
+    if (data) memcpy(&v, data, 8);
+    return v;
+}
+
+/** @brief 讀取字符串，返回指向快照數據的指針 (以 '\0' 結尾)，NULL 字符串返回 NULL */
+static const char* get_string(SnapReader* r, uint32_t* length) {
+    uint32_t len = get_u32(r);
+    if (length) *length = 0;
+    if (len == SNAP_NONE) return NULL;
+    const uint8_t* data = get_bytes(r, (size_t)len + 1);
+    if (!data || data[len] != '\0') {
+        r->ok = false;
+        return NULL;
+    }
+    if (length) *length = len;
+    return (const char*)data;
+}
+
+static char* dup_string(const char* str) {
+    return str ? strdup(str) : NULL;
+}
+
+static void* copy_block(SnapReader* r, size_t size) {
+    if (size == 0) return NULL;
+    const uint8_t* data = get_bytes(r, size);
+    void* copy = data ? malloc(size) : NULL;
+    if (copy) memcpy(copy, data, size);
+    else r->ok = false;
+    return copy;
+}
+
+static KBytecodeChunk* get_chunk(SnapReader* r) {
+    KBytecodeChunk* chunk = (KBytecodeChunk*)malloc(sizeof(KBytecodeChunk));
+    if (!chunk) {
+        r->ok = false;
+        return NULL;
+    }
+    init_chunk(chunk);
+    chunk->filename = dup_string(get_string(r, NULL));
+
+    size_t count = get_u32(r);
+    chunk->code = (uint8_t*)copy_block(r, count);
+    if (chunk->code) chunk->count = chunk->capacity = count;
+
+    size_t lines_size = get_u32(r);
+    chunk->lines.data = (uint8_t*)copy_block(r, lines_size);
+    if (chunk->lines.data) chunk->lines.size = chunk->lines.capacity = lines_size;
+
+    size_t string_count = get_u32(r);
+    if (r->ok && string_count > 0) {
+        if (string_count > (size_t)(r->end - r->p) / 5) r->ok = false; // 每個字符串至少 5 字節
+        else chunk->string_table = (char**)malloc(string_count * sizeof(char*));
+        // string_count 隨讀取遞增，失敗時 free_chunk 只釋放已讀取的字符串
+        while (r->ok && chunk->string_table && chunk->string_count < string_count) {
+            const char* str = get_string(r, NULL);
+            if (r->ok) chunk->string_table[chunk->string_count++] = dup_string(str ? str : "");
+        }
+    }
+
+    size_t int_count = get_u32(r);
+    chunk->int_constants = (int64_t*)copy_block(r, int_count * sizeof(int64_t));
+    if (chunk->int_constants) chunk->int_count = int_count;
+
+    size_t double_count = get_u32(r);
+    chunk->double_constants = (double*)copy_block(r, double_count * sizeof(double));
+    if (chunk->double_constants) chunk->double_count = double_count;
+    return chunk;
+}
+
+typedef struct {
+    SnapReader r;
+    KVM* vm;
+    KSnapshot* snapshot;
+    KObjHeader** objects;
+    size_t object_count;
+} SnapLoader;
+
+static KObjHeader* get_ref(SnapLoader* l, KObjType expected) {
+    uint32_t id = get_u32(&l->r);
+    if (id == SNAP_NONE) return NULL;
+    if (id >= l->object_count || l->objects[id]->type != expected) {
+        l->r.ok = false;
+        return NULL;
+    }
+    return l->objects[id];
+}
+
+static KValue get_value(SnapLoader* l) {
+    KValue value;
+    value.type = (KValueType)get_u8(&l->r);
+    value.as.integer = 0;
+    switch (value.type) {
+        case VAL_NULL: break;
+        case VAL_BOOL: value.as.boolean = get_u8(&l->r) != 0; break;
+        case VAL_OBJ: {
+            uint32_t id = get_u32(&l->r);
+            if (id == SNAP_NONE) value.as.obj = NULL;
+            else if (id < l->object_count) value.as.obj = l->objects[id];
+            else l->r.ok = false;
+            break;
+        }
+        case VAL_STRING: {
+            const char* str = get_string(&l->r, NULL);
+            if (!str) {
+                value.as.str = NULL;
+                break;
+            }
+            KSnapshot* snapshot = l->snapshot;
+            if (snapshot->string_count == snapshot->string_capacity) {
+                snapshot->string_capacity = snapshot->string_capacity < 16 ? 16 : snapshot->string_capacity * 2;
+                char** grown = (char**)realloc(snapshot->strings, snapshot->string_capacity * sizeof(char*));
+                if (!grown) {
+                    l->r.ok = false;
+                    break;
+                }
+                snapshot->strings = grown;
+            }
+            value.as.str = strdup(str);
+            snapshot->strings[snapshot->string_count++] = value.as.str;
+            break;
+        }
+        default: value.as.integer = (int64_t)get_u64(&l->r); break;
+    }
+    return value;
+}
+
+static void get_table(SnapLoader* l, KTable* table) {
+    uint32_t count = get_u32(&l->r);
+    for (uint32_t i = 0; l->r.ok && i < count; i++) {
+        const char* key = get_string(&l->r, NULL);
+        KValue value = get_value(l);
+        if (!key) l->r.ok = false;
+        if (l->r.ok) table_set(table, key, value);
+    }
+}
+
+/** @brief 對象結構體的大小，不支持的類型返回 0 */
+static size_t object_size(KObjType type) {
+    switch (type) {
+        case OBJ_STRING: return sizeof(KObjString);
+        case OBJ_CLASS: return sizeof(KObjClass);
+        case OBJ_CLASS_INSTANCE: return sizeof(KObjInstance);
+        case OBJ_ARRAY: return sizeof(KObjArray);
+        case OBJ_FUNCTION: return sizeof(KObjFunction);
+        case OBJ_NATIVE: return sizeof(KObjNative);
+        case OBJ_BOUND_METHOD: return sizeof(KObjBoundMethod);
+        default: return 0;
+    }
+}
+
+static void fill_object(SnapLoader* l, KObjHeader* obj) {
+    SnapReader* r = &l->r;
+    switch (obj->type) {
+        case OBJ_STRING: {
+            KObjString* str = (KObjString*)obj;
+            uint32_t length;
+            const char* chars = get_string(r, &length);
+            if (chars) {
+                str->chars = (char*)malloc((size_t)length + 1);
+                if (str->chars) memcpy(str->chars, chars, (size_t)length + 1);
+                str->length = (int)length;
+            }
+            str->hash = get_u32(r);
+            break;
+        }
+        case OBJ_CLASS: {
+            KObjClass* klass = (KObjClass*)obj;
+            klass->name = dup_string(get_string(r, NULL));
+            klass->parent = (KObjClass*)get_ref(l, OBJ_CLASS);
+            uint32_t field_count = get_u32(r);
+            if (field_count > 0 && field_count <= (size_t)(r->end - r->p) / 5) {
+                klass->fields = (char**)calloc(field_count, sizeof(char*));
+                // field_count 隨讀取遞增，回收時只釋放已讀取的字段名
+                while (r->ok && klass->fields && (uint32_t)klass->field_count < field_count) {
+                    klass->fields[klass->field_count++] = dup_string(get_string(r, NULL));
+                }
+            } else if (field_count > 0) {
+                r->ok = false;
+            }
+            klass->layout_id = get_u8(r) ? kvm_next_layout_id() : 0;
+            get_table(l, &klass->methods);
+            break;
+        }
+        case OBJ_CLASS_INSTANCE: {
+            KObjInstance* instance = (KObjInstance*)obj;
+            instance->klass = (KObjClass*)get_ref(l, OBJ_CLASS);
+            get_table(l, &instance->fields);
+            break;
+        }
+        case OBJ_ARRAY: {
+            KObjArray* array = (KObjArray*)obj;
+            KArrayKind kind = (KArrayKind)get_u8(r);
+            uint32_t length = get_u32(r);
+            array->klass = (KObjClass*)get_ref(l, OBJ_CLASS);
+            if (length > INT32_MAX) r->ok = false;
+            size_t count = length;
+            switch (kind) {
+                case ARRAY_INT: array->ints = (int64_t*)copy_block(r, count * sizeof(int64_t)); break;
+                case ARRAY_DOUBLE: array->doubles = (double*)copy_block(r, count * sizeof(double)); break;
+                case ARRAY_BOOL: array->bools = (uint8_t*)copy_block(r, count); break;
+                case ARRAY_STRUCT:
+                case ARRAY_VALUES: {
+                    if (kind == ARRAY_STRUCT) {
+                        // 元素類已經解碼 (類先於其他對象)，布局編號隨類重新分配
+                        if (!array->klass || array->klass->layout_id == 0) {
+                            r->ok = false;
+                            break;
+                        }
+                        count *= (size_t)array->klass->field_count;
+                        array->layout_id = array->klass->layout_id;
+                    }
+                    if (!r->ok || count == 0) break;
+                    if (count > (size_t)(r->end - r->p)) { // 每個值至少 1 字節
+                        r->ok = false;
+                        break;
+                    }
+                    array->elements = (KValue*)malloc(count * sizeof(KValue));
+                    if (!array->elements) r->ok = false;
+                    for (size_t i = 0; r->ok && i < count; i++) array->elements[i] = get_value(l);
+                    break;
+                }
+                default:
+                    r->ok = false;
+                    break;
+            }
+            if (r->ok) {
+                array->kind = kind;
+                array->length = array->capacity = (int)length;
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            KObjFunction* function = (KObjFunction*)obj;
+            function->name = dup_string(get_string(r, NULL));
+            function->arity = (int)get_u32(r);
+            uint32_t chunk_id = get_u32(r);
+            if (chunk_id != SNAP_NONE && chunk_id >= l->snapshot->chunk_count) r->ok = false;
+            else function->chunk = chunk_id == SNAP_NONE ? NULL : l->snapshot->chunks[chunk_id];
+            function->entry_point = get_u32(r);
+            function->frame_size = (int)get_u32(r);
+            function->access = (int)get_u32(r);
+            function->parent_class = (KObjClass*)get_ref(l, OBJ_CLASS);
+            function->module = (KObjInstance*)get_ref(l, OBJ_CLASS_INSTANCE);
+            if (function->chunk && function->entry_point >= function->chunk->count) r->ok = false;
+            if (function->frame_size <= 0 || function->frame_size > KVM_REGISTERS_MAX) r->ok = false;
+            break;
+        }
+        case OBJ_NATIVE: {
+            KObjNative* native = (KObjNative*)obj;
+            const char* qualified = get_string(r, NULL);
+            native->name = dup_string(get_string(r, NULL));
+            native->function = qualified ? KNativeLookup(qualified) : NULL;
+            if (r->ok && !native->function) r->ok = false; // 本地函數已不存在，快照過期
+            break;
+        }
+        case OBJ_BOUND_METHOD: {
+            KObjBoundMethod* bound = (KObjBoundMethod*)obj;
+            bound->receiver = get_value(l);
+            bound->method = (KObjFunction*)get_ref(l, OBJ_FUNCTION);
+            break;
+        }
+        default:
+            r->ok = false;
+            break;
+    }
+}
+
+int ksnapshot_load(KVM* vm, const char* path) {
+    if (!vm || !path) return -1;
+
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return -1;
+    fseek(fp, 0L, SEEK_END);
+    long file_size = ftell(fp);
+    rewind(fp);
+    uint8_t* data = file_size > 0 ? (uint8_t*)malloc((size_t)file_size) : NULL;
+    bool read_ok = data && fread(data, 1, (size_t)file_size, fp) == (size_t)file_size;
+    fclose(fp);
+    if (!read_ok) {
+        free(data);
+        return -1;
+    }
+
+    KSnapshotHeader header;
+    if ((size_t)file_size < sizeof(header)) {
+        free(data);
+        return 1;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != KSNAPSHOT_MAGIC || header.version != KSNAPSHOT_VERSION ||
+        header.fingerprint != kcache_fingerprint() ||
+        header.payload_size != (uint64_t)file_size - sizeof(header) ||
+        header.object_count > header.payload_size || header.chunk_count > header.payload_size) {
+        free(data);
+        return 1; /**< 格式無效或編譯器已改變 */
+    }
+
+    SnapLoader l;
+    memset(&l, 0, sizeof(l));
+    l.r.p = data + sizeof(header);
+    l.r.end = data + file_size;
+    l.r.ok = true;
+    l.vm = vm;
+    l.snapshot = (KSnapshot*)calloc(1, sizeof(KSnapshot));
+    l.object_count = header.object_count;
+    l.objects = (KObjHeader**)malloc((header.object_count + 1) * sizeof(KObjHeader*));
+    if (l.snapshot) l.snapshot->chunks = (KBytecodeChunk**)calloc(header.chunk_count + 1, sizeof(KBytecodeChunk*));
+    if (!l.snapshot || !l.objects || !l.snapshot->chunks) {
+        if (l.snapshot) snapshot_release(l.snapshot);
+        free(l.objects);
+        free(data);
+        return -1;
+    }
+
+    // 解碼期間不回收：新對象在寫入根之前都不可達
+    size_t saved_threshold = vm->gc->next_gc_threshold;
+    vm->gc->next_gc_threshold = SIZE_MAX;
+
+    // 先按類型分配全部對象，引用可以指向後面的對象
+    const uint8_t* types = get_bytes(&l.r, header.object_count);
+    for (size_t i = 0; l.r.ok && i < header.object_count; i++) {
+        size_t size = object_size((KObjType)types[i]);
+        if (size == 0) l.r.ok = false;
+        else l.objects[i] = (KObjHeader*)kgc_alloc(vm->gc, size, (KObjType)types[i]);
+    }
+    for (size_t i = 0; l.r.ok && i < header.chunk_count; i++) {
+        l.snapshot->chunks[i] = get_chunk(&l.r);
+        l.snapshot->chunk_count = i + 1;
+    }
+    for (size_t i = 0; l.r.ok && i < header.object_count; i++) {
+        if (l.objects[i]->type == OBJ_CLASS) fill_object(&l, l.objects[i]);
+    }
+    for (size_t i = 0; l.r.ok && i < header.object_count; i++) {
+        if (l.objects[i]->type != OBJ_CLASS) fill_object(&l, l.objects[i]);
+    }
+
+    KTable globals, modules;
+    init_table(&globals);
+    init_table(&modules);
+    get_table(&l, &globals);
+    get_table(&l, &modules);
+    if (l.r.ok && l.r.p != l.r.end) l.r.ok = false;
+
+    int result = 1;
+    if (l.r.ok) {
+        for (int i = 0; i < globals.capacity; i++) {
+            if (globals.entries[i].key) table_set(&vm->globals, globals.entries[i].key, globals.entries[i].value);
+        }
+        for (int i = 0; i < modules.capacity; i++) {
+            if (modules.entries[i].key) table_set(&vm->modules, modules.entries[i].key, modules.entries[i].value);
+        }
+        if (vm->snapshot) vm->snapshot_release(vm->snapshot);
+        vm->snapshot = l.snapshot;
+        vm->snapshot_release = snapshot_release;
+        result = 0;
+    } else {
+        // 已分配的對象不可達，由下一次回收釋放；字節碼塊與字符串隨快照釋放
+        snapshot_release(l.snapshot);
+    }
+
+    vm->gc->next_gc_threshold = saved_threshold;
+    for (int i = 0; i < globals.capacity; i++) free(globals.entries[i].key);
+    for (int i = 0; i < modules.capacity; i++) free(modules.entries[i].key);
+    free_table(&globals);
+    free_table(&modules);
+    free(l.objects);
+    free(data);
+    return result;
+}
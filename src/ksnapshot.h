@@ -0,0 +1,50 @@
+#ifndef KORELIN_KSNAPSHOT_H
+#define KORELIN_KSNAPSHOT_H
+
+#include <stdint.h>
+#include "kvm.h"
+
+/**
+ * @brief 堆快照
+ * 把註冊完標準庫 (以及預先加載的模塊) 之後的虛擬機堆保存為映像文件，
+ * 啟動時直接從映像恢復全局變量與模塊，不再逐項執行 kstd_register 與模塊的頂層代碼。
+ *
+ * 快照從 vm->globals 與 vm->modules 出發保存所有可達的對象：字符串、類、實例、數組、
+ * 函數 (連同其字節碼塊)、綁定方法與本地函數。對象之間以編號互相引用；
+ * 本地函數按 KLibAdd 等登記的限定名保存，加載時用 KNativeLookup 重新鏈接。
+ */
+
+/** @brief 快照文件魔數 "KSNP" */
+#define KSNAPSHOT_MAGIC 0x504E534B
+/** @brief 快照版本號 */
+#define KSNAPSHOT_VERSION 1
+
+/** @brief 快照文件頭部 */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fingerprint;   /**< 編譯器指紋 (kcache_fingerprint)，字節碼塊隨快照保存 */
+    uint32_t object_count;
+    uint32_t chunk_count;
+    uint64_t payload_size;  /**< 頭部之後的字節數 */
+} KSnapshotHeader;
+
+/**
+ * @brief 保存堆快照
+ * 遇到無法保存的對象 (未登記的本地函數等) 時不生成文件。
+ * @param vm 已註冊標準庫的虛擬機，沒有正在執行的代碼
+ * @param path 輸出文件
+ * @return 0 成功，非 0 失敗
+ */
+int ksnapshot_save(KVM* vm, const char* path);
+
+/**
+ * @brief 從堆快照恢復全局變量與模塊
+ * 代替 kstd_register：vm 只需 kvm_init 與 KBindVM，本地函數登記表需已填充 (見 KCollectNatives)。
+ * 整個文件驗證並解碼完成後才寫入 vm->globals 與 vm->modules，失敗時 vm 不受影響。
+ * 快照中的字節碼塊與字符串由 vm 持有，kvm_free 時釋放。
+ * @return 0 成功，1 快照過期或格式無效，-1 讀取錯誤
+ */
+int ksnapshot_load(KVM* vm, const char* path);
+
+#endif //KORELIN_KSNAPSHOT_H
@@ -95,7 +95,9 @@ static KObjArray* get_arg_array(int index) {
     
     KValue val = vm->native_args[index];
     if (val.type == VAL_OBJ && ((KObj*)val.as.obj)->header.type == OBJ_ARRAY) {
-        return (KObjArray*)val.as.obj;
+        KObjArray* arr = (KObjArray*)val.as.obj;
+        kvm_array_materialize(vm, arr); // 本地函數按元素讀寫，不處理內聯的結構體
+        return arr;
     }
     return NULL;
 }
@@ -144,6 +146,10 @@ static KObjArray* alloc_array(KVM* vm, int length) {
     vm->objects = (KObjHeader*)arr;
     
     arr->length = length;
+    arr->capacity = length;
+    arr->kind = ARRAY_VALUES;
+    arr->klass = NULL;
+    arr->layout_id = 0;
     arr->elements = (KValue*)malloc(sizeof(KValue) * length);
     // Init with null
     for(int i=0; i<length; i++) arr->elements[i].type = VAL_NULL;
@@ -295,7 +301,7 @@ static void std_os_writeBytes() {
     FILE* f = fopen(path, "wb");
     if (f) {
         for (int i=0; i<arr->length; i++) {
-            KValue v = arr->elements[i];
+            KValue v = kvm_array_get(arr, i);
             uint8_t b = 0;
             if (v.type == VAL_INT) b = (uint8_t)v.as.integer;
             fwrite(&b, 1, 1, f);
@@ -796,7 +802,7 @@ static void std_string_join() {
     int len = 0;
     int seplen = strlen(sep);
     for(int i=0; i<arr->length; i++) {
-        char* s = to_string(arr->elements[i]);
+        char* s = to_string(kvm_array_get(arr, i));
         len += strlen(s);
         if (i < arr->length - 1) len += seplen;
         free(s);
@@ -805,7 +811,7 @@ static void std_string_join() {
     char* res = (char*)malloc(len + 1);
     res[0] = '\0';
     for(int i=0; i<arr->length; i++) {
-        char* s = to_string(arr->elements[i]);
+        char* s = to_string(kvm_array_get(arr, i));
         strcat(res, s);
         if (i < arr->length - 1) strcat(res, sep);
         free(s);
@@ -909,24 +915,44 @@ static int compare_values(const void* a, const void* b) {
     return 0;
 }
 
+static int compare_ints(const void* a, const void* b) {
+    int64_t va = *(const int64_t*)a;
+    int64_t vb = *(const int64_t*)b;
+    return (va > vb) - (va < vb);
+}
+
 static void std_algo_sort() {
     int start = get_arg_start();
     KObjArray* arr = get_arg_array(start);
-    if (arr) {
+    if (arr && arr->kind == ARRAY_INT) {
+        qsort(arr->ints, arr->length, sizeof(int64_t), compare_ints);
+    } else if (arr && arr->kind == ARRAY_VALUES) {
         qsort(arr->elements, arr->length, sizeof(KValue), compare_values);
     }
+    // 浮點與布爾數組的元素兩兩比較都相等，排序不改變順序
     KReturnVoid();
 }
 
+/** @brief 原地反轉 count 個大小為 size 的元素 */
+static void reverse_elements(void* data, int count, size_t size) {
+    uint8_t* bytes = (uint8_t*)data;
+    uint8_t tmp[sizeof(KValue)];
+    for (int i = 0; i < count / 2; i++) {
+        uint8_t* a = bytes + (size_t)i * size;
+        uint8_t* b = bytes + (size_t)(count - 1 - i) * size;
+        memcpy(tmp, a, size);
+        memcpy(a, b, size);
+        memcpy(b, tmp, size);
+    }
+}
+
 static void std_algo_reverse() {
     int start = get_arg_start();
     KObjArray* arr = get_arg_array(start);
     if (arr) {
-        for(int i=0; i<arr->length/2; i++) {
-            KValue tmp = arr->elements[i];
-            arr->elements[i] = arr->elements[arr->length - 1 - i];
-            arr->elements[arr->length - 1 - i] = tmp;
-        }
+        size_t size = arr->kind == ARRAY_INT ? sizeof(int64_t) : arr->kind == ARRAY_DOUBLE ? sizeof(double)
+                    : arr->kind == ARRAY_BOOL ? sizeof(uint8_t) : sizeof(KValue);
+        reverse_elements(arr->elements, arr->length, size);
     }
     KReturnVoid();
 }
@@ -935,7 +961,13 @@ static void std_algo_find() {
     int start = get_arg_start();
     KObjArray* arr = get_arg_array(start);
     KValue val = get_vm()->native_args[start + 1];
-    if (arr) {
+    if (arr && arr->kind == ARRAY_INT) {
+        if (val.type == VAL_INT) {
+            for (int i = 0; i < arr->length; i++) {
+                if (arr->ints[i] == val.as.integer) { KReturnInt(i); return; }
+            }
+        }
+    } else if (arr && arr->kind == ARRAY_VALUES) {
         for(int i=0; i<arr->length; i++) {
             if (arr->elements[i].type == val.type) {
                 if (val.type == VAL_INT && arr->elements[i].as.integer == val.as.integer) {
@@ -947,26 +979,32 @@ static void std_algo_find() {
     KReturnInt(-1);
 }
 
+/** @brief 整數元素之和，其他類型的元素不計入 (浮點與布爾數組為 0) */
+static long long sum_int_elements(KObjArray* arr) {
+    // 按無符號相加：溢出時回繞，與逐個相加的結果一致
+    uint64_t sum = 0;
+    if (arr->kind == ARRAY_INT) {
+        for (int i = 0; i < arr->length; i++) sum += (uint64_t)arr->ints[i];
+    } else if (arr->kind == ARRAY_VALUES) {
+        for (int i = 0; i < arr->length; i++) {
+            if (arr->elements[i].type == VAL_INT) sum += (uint64_t)arr->elements[i].as.integer;
+        }
+    }
+    return (long long)sum;
+}
+
 static void std_algo_sum() {
     int start = get_arg_start();
     KObjArray* arr = get_arg_array(start);
-    long long sum = 0;
-    if (arr) {
-        for(int i=0; i<arr->length; i++) {
-            if (arr->elements[i].type == VAL_INT) sum += arr->elements[i].as.integer;
-        }
-    }
+    long long sum = arr ? sum_int_elements(arr) : 0;
     KReturnInt(sum);
 }
 
 static void std_algo_average() {
     int start = get_arg_start();
     KObjArray* arr = get_arg_array(start);
-    long long sum = 0;
     if (arr && arr->length > 0) {
-        for(int i=0; i<arr->length; i++) {
-            if (arr->elements[i].type == VAL_INT) sum += arr->elements[i].as.integer;
-        }
+        long long sum = sum_int_elements(arr);
         KReturnFloat((float)sum / arr->length);
     } else {
         KReturnFloat(0);
@@ -1450,6 +1488,74 @@ static void std_dynlib_getLastError() {
     KReturnString("Unknown Error");
 }
 
+// -------------------------------------------------------------------------
+/** @brief Array 類 (數組的內建方法，第一個參數是數組本身) */
+// -------------------------------------------------------------------------
+
+/** @brief 第 index 個參數，缺少時為 null */
+static KValue get_arg_value(int index) {
+    KVM* vm = get_vm();
+    if (vm && vm->native_args && index < vm->native_argc) return vm->native_args[index];
+    KValue nullVal; nullVal.type = VAL_NULL;
+    return nullVal;
+}
+
+/** @brief 整數參數，不是整數時返回 false */
+static bool get_arg_index(int index, int64_t* out) {
+    KValue v = get_arg_value(index);
+    if (v.type != VAL_INT) return false;
+    *out = v.as.integer;
+    return true;
+}
+
+static void std_array_push() {
+    KObjArray* self = get_arg_array(0);
+    if (self) kvm_array_push(get_vm(), self, get_arg_value(1));
+    KReturnVoid();
+}
+
+static void std_array_pop() {
+    KObjArray* self = get_arg_array(0);
+    KValue val; val.type = VAL_NULL;
+    if (self) val = kvm_array_pop(get_vm(), self);
+    push_value(val);
+}
+
+static void std_array_insert() {
+    KObjArray* self = get_arg_array(0);
+    int64_t index;
+    if (self && get_arg_index(1, &index)) kvm_array_insert(get_vm(), self, index, get_arg_value(2));
+    KReturnVoid();
+}
+
+static void std_array_removeAt() {
+    KObjArray* self = get_arg_array(0);
+    int64_t index;
+    KValue val; val.type = VAL_NULL;
+    if (self && get_arg_index(1, &index)) val = kvm_array_remove(get_vm(), self, index);
+    push_value(val);
+}
+
+static void std_array_reserve() {
+    KObjArray* self = get_arg_array(0);
+    int64_t capacity;
+    if (self && get_arg_index(1, &capacity)) kvm_array_reserve(get_vm(), self, capacity);
+    KReturnVoid();
+}
+
+/** @brief slice(start) 或 slice(start, end) */
+static void std_array_slice() {
+    KObjArray* self = get_arg_array(0);
+    int64_t start, end;
+    KValue val; val.type = VAL_NULL;
+    if (self && get_arg_index(1, &start)) {
+        if (!get_arg_index(2, &end)) end = self->length;
+        val.type = VAL_OBJ;
+        val.as.obj = (KObj*)kvm_array_slice(get_vm(), self, start, end);
+    }
+    push_value(val);
+}
+
 // -------------------------------------------------------------------------
 /** @brief Map 類 */
 // -------------------------------------------------------------------------
@@ -1674,6 +1780,7 @@ static void std_global_bool() {
 
 static void register_exception(const char* name) {
     KVM* vm = get_vm();
+    if (!vm) return; // 只登記本地函數 (KCollectNatives)
     
     // Create class object
     KObjClass* klass = (KObjClass*)malloc(sizeof(KObjClass));
@@ -1686,6 +1793,9 @@ static void register_exception(const char* name) {
     klass->name = strdup(name);
     klass->parent = NULL; 
     init_table(&klass->methods);
+    klass->fields = NULL;
+    klass->field_count = 0;
+    klass->layout_id = 0; // 沒有字段，不會內聯存放
     
     // Set to globals
     KValue val;
@@ -1823,6 +1933,15 @@ void kstd_register() {
     KLibAdd("os", "function", "string", (void*)&std_global_string);
     KLibAdd("os", "function", "bool", (void*)&std_global_bool);
 
+    // Array Class
+    KLibNewClass("Array");
+    KLibAddMethod("Array", "push", (void*)&std_array_push);
+    KLibAddMethod("Array", "pop", (void*)&std_array_pop);
+    KLibAddMethod("Array", "insert", (void*)&std_array_insert);
+    KLibAddMethod("Array", "removeAt", (void*)&std_array_removeAt);
+    KLibAddMethod("Array", "reserve", (void*)&std_array_reserve);
+    KLibAddMethod("Array", "slice", (void*)&std_array_slice);
+
     // Map Class
     KLibNewClass("Map");
     KLibAddMethod("Map", "_init", (void*)&std_map_init);
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 
 // 宏定義
 #define REG(idx) (vm->registers[idx])
@@ -35,6 +36,7 @@ static void print_runtime_error_context(KVM* vm);
     { \
         if (!throw_runtime_error_obj(vm, type, msg)) { \
             printf("Runtime Error (%s): %s\n", type, msg); \
+            print_runtime_error_context(vm); \
             vm->had_error = true; \
             return 1; \
         } \
@@ -204,14 +206,16 @@ static bool call(KVM* vm, KObjFunction* function, int arg_count, int return_reg)
     vm->registers = vm->stack_top - arg_count;
     
     // Check stack overflow before moving stack_top
-    if (vm->registers + KVM_REGISTERS_MAX - vm->stack >= KVM_STACK_SIZE) {
+    int frame_size = function->frame_size > 0 ? function->frame_size : KVM_REGISTERS_MAX;
+    if (frame_size < arg_count) frame_size = arg_count;
+    if (vm->registers + frame_size - vm->stack >= KVM_STACK_SIZE) {
         printf("Runtime Error: Stack overflow (memory limit).\n");
         vm->had_error = true;
         return false;
     }
     
-    // Reserve space for locals
-    vm->stack_top = vm->registers + KVM_REGISTERS_MAX; 
+    // Reserve space for locals (frame sized by the compiler's register peak)
+    vm->stack_top = vm->registers + frame_size; 
 
     /* JIT Disabled
     // Try JIT Compilation for the called function
@@ -348,7 +352,7 @@ KValue kvm_pop(KVM* vm) {
 
 static void print_runtime_error_context(KVM* vm) {
     // printf("Debug: print_runtime_error_context called. vm=%p\n", vm);
-    if (!vm || !vm->chunk || !vm->chunk->lines || !vm->chunk->code) {
+    if (!vm || !vm->chunk || !vm->chunk->code) {
         // printf("Debug: Invalid vm state\n");
         return;
     }
@@ -361,7 +365,7 @@ static void print_runtime_error_context(KVM* vm) {
     
     if (offset >= vm->chunk->count) offset = vm->chunk->count > 0 ? vm->chunk->count - 1 : 0;
     
-    int line = vm->chunk->lines[offset];
+    int line = line_table_lookup(&vm->chunk->lines, offset);
     // printf("Debug: offset=%zu, line=%d\n", offset, line);
     if (line == 0) return; // Unknown line
     
@@ -462,6 +466,38 @@ static void print_runtime_error_context(KVM* vm) {
         REG(rd).as.double_prec = va op vb; \
     } while(0)
 
+// 類型特化指令：編譯器已證明兩個操作數均為 VAL_INT，不檢查標籤
+#define BINARY_OP_INT_TYPED(op) \
+    do { \
+        uint8_t rd = READ_REG_IDX(); \
+        uint8_t ra = READ_REG_IDX(); \
+        uint8_t rb = READ_REG_IDX(); \
+        REG(rd).as.integer = REG_AS_INT(ra) op REG_AS_INT(rb); \
+        REG(rd).type = VAL_INT; \
+    } while(0)
+
+// 與通用指令結果一致：大小比較同 CMP_OP_NUM 轉換為 double，相等判斷同 values_equal 精確比較
+#define CMP_OP_INT_TYPED(op, as_type) \
+    do { \
+        uint8_t rd = READ_REG_IDX(); \
+        uint8_t ra = READ_REG_IDX(); \
+        uint8_t rb = READ_REG_IDX(); \
+        bool result = (as_type)REG_AS_INT(ra) op (as_type)REG_AS_INT(rb); \
+        REG(rd).type = VAL_BOOL; \
+        REG(rd).as.boolean = result; \
+    } while(0)
+
+#define CMP_OP_DOUBLE(op) \
+    do { \
+        uint8_t rd = READ_REG_IDX(); \
+        uint8_t ra = READ_REG_IDX(); \
+        uint8_t rb = READ_REG_IDX(); \
+        double va = (REG(ra).type == VAL_FLOAT) ? REG(ra).as.single_prec : REG_AS_DOUBLE(ra); \
+        double vb = (REG(rb).type == VAL_FLOAT) ? REG(rb).as.single_prec : REG_AS_DOUBLE(rb); \
+        REG(rd).type = VAL_BOOL; \
+        REG(rd).as.boolean = va op vb; \
+    } while(0)
+
 // 比較運算宏 (通用)
 static bool values_equal(KValue a, KValue b) {
     if (a.type == VAL_INT && b.type == VAL_INT) {
@@ -525,6 +561,27 @@ static bool values_equal(KValue a, KValue b) {
 
 #define CMP_OP_INT(op) CMP_OP_NUM(op)
 
+/** @brief FORLOOP 的循環條件：與 CMP_OP_NUM 一致，數值 (包括整數上界) 按 double 比較，非數值不成立 */
+static bool forloop_test(int64_t counter, KValue limit, uint8_t cmp) {
+    double bound;
+    if (limit.type == VAL_INT) {
+        bound = (double)limit.as.integer;
+    } else if (limit.type == VAL_DOUBLE) {
+        bound = limit.as.double_prec;
+    } else if (limit.type == VAL_FLOAT) {
+        bound = limit.as.single_prec;
+    } else {
+        return false;
+    }
+    double value = (double)counter;
+    switch (cmp) {
+        case KOP_LT: return value < bound;
+        case KOP_LE: return value <= bound;
+        case KOP_GT: return value > bound;
+        default:     return value >= bound;
+    }
+}
+
 // Helper for string concat
 static KObjString* alloc_string(KVM* vm, const char* chars, int length) {
     KObjString* str = (KObjString*)kgc_alloc(vm->gc, sizeof(KObjString), OBJ_STRING);
@@ -542,6 +599,9 @@ KObjArray* alloc_array(KVM* vm, int length) {
     
     arr->length = length;
     arr->capacity = length;
+    arr->kind = ARRAY_VALUES;
+    arr->klass = NULL;
+    arr->layout_id = 0;
     if (length > 0) {
         arr->elements = (KValue*)malloc(sizeof(KValue) * length);
         // Init with NULL
@@ -552,6 +612,342 @@ KObjArray* alloc_array(KVM* vm, int length) {
     return arr;
 }
 
+KValue kvm_array_get(KObjArray* array, int index) {
+    KValue value;
+    switch (array->kind) {
+        case ARRAY_INT:
+            value.type = VAL_INT;
+            value.as.integer = array->ints[index];
+            return value;
+        case ARRAY_DOUBLE:
+            value.type = VAL_DOUBLE;
+            value.as.double_prec = array->doubles[index];
+            return value;
+        case ARRAY_BOOL:
+            value.type = VAL_BOOL;
+            value.as.boolean = array->bools[index] != 0;
+            return value;
+        default:
+            return array->elements[index];
+    }
+}
+
+/** @brief 把無標籤存儲轉換為 KValue 存儲，讀出的值不變 */
+static void box_array_elements(KObjArray* array) {
+    KValue* elements = (KValue*)malloc(sizeof(KValue) * (array->capacity > 0 ? array->capacity : 1));
+    for (int i = 0; i < array->length; i++) elements[i] = kvm_array_get(array, i);
+    free(array->elements);
+    array->elements = elements;
+    array->kind = ARRAY_VALUES;
+}
+
+void kvm_array_set(KObjArray* array, int index, KValue value) {
+    switch (array->kind) {
+        case ARRAY_VALUES:
+            array->elements[index] = value;
+            return;
+        case ARRAY_INT:
+            if (value.type == VAL_INT) { array->ints[index] = value.as.integer; return; }
+            break;
+        case ARRAY_DOUBLE:
+            if (value.type == VAL_DOUBLE) { array->doubles[index] = value.as.double_prec; return; }
+            break;
+        case ARRAY_BOOL:
+            if (value.type == VAL_BOOL) { array->bools[index] = value.as.boolean; return; }
+            break;
+        case ARRAY_STRUCT: // 調用者已用 kvm_array_materialize 轉換
+            break;
+    }
+    box_array_elements(array);
+    array->elements[index] = value;
+}
+
+/** @brief 結構體字段在內聯存儲中的下標，不是聲明的字段時返回 -1 */
+static int struct_field_index(KObjClass* klass, const char* name) {
+    for (int i = 0; i < klass->field_count; i++) {
+        if (strcmp(klass->fields[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+/** @brief 類布局編號計數器 (kvm_next_layout_id) */
+static uint32_t class_layout_counter = 0;
+
+uint32_t kvm_next_layout_id(void) {
+    if (++class_layout_counter == 0) class_layout_counter = 1; // 0 保留給空緩存項
+    return class_layout_counter;
+}
+
+/**
+ * @brief ARRAY_STRUCT 元素中字段 id (字符串常量) 的槽位
+ * 先查內聯緩存，未命中時按名字查找並更新緩存。
+ * @return 不是聲明的字段時返回 -1
+ */
+static int struct_field_slot(KBytecodeChunk* chunk, KObjArray* array, uint16_t id) {
+    KFieldCache* cache = chunk_field_cache(chunk);
+    if (cache && id < chunk->field_cache_count) {
+        if (cache[id].layout_id == array->layout_id) return (int)cache[id].index;
+    } else {
+        cache = NULL;
+    }
+    int field = struct_field_index(array->klass, chunk->string_table[id]);
+    if (field >= 0 && cache) {
+        cache[id].layout_id = array->layout_id;
+        cache[id].index = field;
+        cache[id].stride = array->klass->field_count;
+    }
+    return field;
+}
+
+void kvm_array_materialize(KVM* vm, KObjArray* array) {
+    if (array->kind != ARRAY_STRUCT) return;
+    KObjClass* klass = array->klass;
+    int stride = klass->field_count;
+    // 第 i 個元素寫入槽位 i，不晚於它自己的字段槽位 i * stride，按下標遞增原地轉換不會覆蓋未讀的字段；
+    // 轉換過程中 GC 仍按槽位掃描，已寫入的實例與未讀的字段都會被標記
+    for (int i = 0; i < array->length; i++) {
+        KObjInstance* inst = (KObjInstance*)kgc_alloc(vm->gc, sizeof(KObjInstance), OBJ_CLASS_INSTANCE);
+        init_table(&inst->fields);
+        inst->klass = klass;
+        KValue* slots = array->slots + (size_t)i * stride;
+        for (int f = 0; f < stride; f++) {
+            if (slots[f].type != KFIELD_UNSET) table_set(&inst->fields, klass->fields[f], slots[f]);
+        }
+        array->slots[i].type = VAL_OBJ;
+        array->slots[i].as.obj = (KObj*)inst;
+    }
+    if (array->length > 0) {
+        KValue* elements = (KValue*)realloc(array->slots, sizeof(KValue) * array->capacity);
+        if (elements) array->elements = elements;
+    }
+    array->kind = ARRAY_VALUES;
+    array->klass = NULL;
+    array->layout_id = 0;
+}
+
+/** @brief 元素在存儲中佔用的字節數 (ARRAY_STRUCT 除外) */
+static size_t array_element_size(KArrayKind kind) {
+    switch (kind) {
+        case ARRAY_INT: return sizeof(int64_t);
+        case ARRAY_DOUBLE: return sizeof(double);
+        case ARRAY_BOOL: return sizeof(uint8_t);
+        default: return sizeof(KValue);
+    }
+}
+
+/** @brief 把容量調整為 capacity (不小於 length)，縮小時分配失敗則保持原容量 */
+static void array_set_capacity(KObjArray* array, int capacity) {
+    if (capacity < 1) capacity = 1;
+    void* storage = realloc(array->elements, array_element_size(array->kind) * (size_t)capacity);
+    if (!storage) {
+        if (capacity < array->capacity) return;
+        fprintf(stderr, "Out of memory! Failed to grow array to %d elements.\n", capacity);
+        exit(1);
+    }
+    array->elements = (KValue*)storage;
+    array->capacity = capacity;
+}
+
+/** @brief 保證還能再放 extra 個元素，容量不足時至少翻倍；長度將超過 int 範圍時返回 false */
+static bool array_ensure_room(KObjArray* array, int extra) {
+    if (array->length > INT_MAX - extra) return false;
+    int needed = array->length + extra;
+    if (needed <= array->capacity) return true;
+    int capacity = array->capacity < 4 ? 4 : (array->capacity > INT_MAX / 2 ? INT_MAX : array->capacity * 2);
+    array_set_capacity(array, capacity < needed ? needed : capacity);
+    return true;
+}
+
+/** @brief 刪除元素之後，長度不足容量的 1/4 時把容量減半 */
+static void array_shrink(KObjArray* array) {
+    if (array->capacity > 8 && array->length < array->capacity / 4) {
+        array_set_capacity(array, array->capacity / 2);
+    }
+}
+
+/** @brief 元素 [from, length) 整體移動到 from + shift 處 */
+static void array_move_tail(KObjArray* array, int from, int shift) {
+    size_t size = array_element_size(array->kind);
+    uint8_t* base = (uint8_t*)array->elements;
+    memmove(base + (size_t)(from + shift) * size, base + (size_t)from * size,
+            (size_t)(array->length - from) * size);
+}
+
+void kvm_array_push(KVM* vm, KObjArray* array, KValue value) {
+    kvm_array_materialize(vm, array);
+    if (!array_ensure_room(array, 1)) return;
+    array->length++;
+    kvm_array_set(array, array->length - 1, value);
+}
+
+KValue kvm_array_pop(KVM* vm, KObjArray* array) {
+    KValue value;
+    value.type = VAL_NULL;
+    kvm_array_materialize(vm, array);
+    if (array->length == 0) return value;
+    value = kvm_array_get(array, array->length - 1);
+    array->length--;
+    array_shrink(array);
+    return value;
+}
+
+bool kvm_array_insert(KVM* vm, KObjArray* array, int64_t index, KValue value) {
+    kvm_array_materialize(vm, array);
+    if (index < 0 || index > array->length || !array_ensure_room(array, 1)) return false;
+    array_move_tail(array, (int)index, 1);
+    array->length++;
+    kvm_array_set(array, (int)index, value);
+    return true;
+}
+
+KValue kvm_array_remove(KVM* vm, KObjArray* array, int64_t index) {
+    KValue value;
+    value.type = VAL_NULL;
+    kvm_array_materialize(vm, array);
+    if (index < 0 || index >= array->length) return value;
+    value = kvm_array_get(array, (int)index);
+    array_move_tail(array, (int)index + 1, -1);
+    array->length--;
+    array_shrink(array);
+    return value;
+}
+
+void kvm_array_reserve(KVM* vm, KObjArray* array, int64_t capacity) {
+    kvm_array_materialize(vm, array);
+    if (capacity > array->capacity) array_set_capacity(array, capacity > INT_MAX ? INT_MAX : (int)capacity);
+}
+
+KObjArray* kvm_array_slice(KVM* vm, KObjArray* array, int64_t start, int64_t end) {
+    kvm_array_materialize(vm, array);
+    if (start < 0) start = 0;
+    if (end > array->length) end = array->length;
+    int length = start < end ? (int)(end - start) : 0;
+    KObjArray* slice = alloc_array(vm, 0);
+    slice->kind = array->kind;
+    if (length > 0) {
+        size_t size = array_element_size(array->kind);
+        slice->elements = (KValue*)malloc(size * (size_t)length);
+        memcpy(slice->elements, (uint8_t*)array->elements + (size_t)start * size, size * (size_t)length);
+        slice->length = length;
+        slice->capacity = length;
+    }
+    return slice;
+}
+
+/** @brief get_field 的結果：FIELD_RUNTIME_ERROR 與 FIELD_THROW 分別按 RUNTIME_ERROR 與 THROW_ERROR 報告 */
+typedef enum {
+    FIELD_OK,
+    FIELD_RUNTIME_ERROR,
+    FIELD_THROW
+} FieldStatus;
+
+static FieldStatus field_error(const char** error_type, const char** error, const char* type, const char* msg) {
+    *error_type = type;
+    *error = msg;
+    return type ? FIELD_THROW : FIELD_RUNTIME_ERROR;
+}
+
+/**
+ * @brief GETF 的語義
+ * 實例依次查找字段、類鏈上的方法 (綁定到 object) 與包的子模塊；類查找靜態成員；數組查找 length 與 Array 類的方法。
+ */
+static FieldStatus get_field(KVM* vm, KValue object, const char* key, KValue* out,
+                             const char** error_type, const char** error) {
+    if (object.type == VAL_NULL) {
+        return field_error(error_type, error, "NilReferenceError", "GETF target is nil");
+    }
+    if (object.type != VAL_OBJ) {
+        return field_error(error_type, error, "TypeMismatchError", "GETF target must be object");
+    }
+    
+    KObj* obj = (KObj*)object.as.obj;
+    
+    if (obj->header.type == OBJ_CLASS_INSTANCE) {
+        KObjInstance* inst = (KObjInstance*)obj;
+        KValue val;
+        
+        if (table_get(&inst->fields, key, &val)) {
+            *out = val;
+            return FIELD_OK;
+        }
+        // Look up method in class chain
+        KObjClass* curr = inst->klass;
+        while (curr) {
+            if (table_get(&curr->methods, key, &val)) {
+                // Create Bound Method
+                KObjBoundMethod* bound = (KObjBoundMethod*)kgc_alloc(vm->gc, sizeof(KObjBoundMethod), OBJ_BOUND_METHOD);
+                
+                bound->receiver = object;
+                bound->method = (KObjFunction*)val.as.obj;
+                
+                out->type = VAL_OBJ;
+                out->as.obj = bound;
+                return FIELD_OK;
+            }
+            curr = curr->parent;
+        }
+        
+        // Lazy loading for package submodules
+        if (table_get(&inst->fields, "__name__", &val) && val.type == VAL_STRING) {
+            char full_name[256];
+            snprintf(full_name, sizeof(full_name), "%s.%s", val.as.str, key);
+            
+            // Call import handler
+            if (vm->import_handler) {
+                KValue submod = vm->import_handler(vm, full_name);
+                if (submod.type != VAL_NULL) {
+                    // Cache it
+                    table_set(&inst->fields, key, submod);
+                    *out = submod;
+                    return FIELD_OK;
+                }
+            }
+        }
+        
+        printf("Undefined field: %s\n", key);
+        return field_error(error_type, error, NULL, "Undefined field");
+    } else if (obj->header.type == OBJ_CLASS) {
+        KObjClass* klass = (KObjClass*)obj;
+        // Look up static method in chain
+        for (KObjClass* curr = klass; curr; curr = curr->parent) {
+            if (table_get(&curr->methods, key, out)) return FIELD_OK;
+        }
+        printf("Undefined static member: %s\n", key);
+        return field_error(error_type, error, NULL, "Undefined static member");
+    } else if (obj->header.type == OBJ_ARRAY) {
+        if (strcmp(key, "length") == 0) {
+            KObjArray* arr = (KObjArray*)obj;
+            out->type = VAL_INT;
+            out->as.integer = arr->length;
+            return FIELD_OK;
+        }
+        // Look up methods in Array class
+        KValue class_val;
+        if (!table_get(&vm->globals, "Array", &class_val) || class_val.type != VAL_OBJ) {
+            return field_error(error_type, error, "NameDefineError", "Arrays only have 'length' property (Array class not found)");
+        }
+        KObjClass* klass = (KObjClass*)class_val.as.obj;
+        KValue val;
+        if (!table_get(&klass->methods, key, &val)) {
+            return field_error(error_type, error, "NameDefineError", "Undefined property/method on Array");
+        }
+        // Native functions are wrapped in OBJ_NATIVE; the bound method stores either kind
+        if (val.type != VAL_OBJ ||
+            (((KObj*)val.as.obj)->header.type != OBJ_FUNCTION &&
+             ((KObj*)val.as.obj)->header.type != OBJ_NATIVE)) {
+            return field_error(error_type, error, "TypeMismatchError", "Method is not a function");
+        }
+        // Found method, bind it
+        KObjBoundMethod* bound = (KObjBoundMethod*)kgc_alloc(vm->gc, sizeof(KObjBoundMethod), OBJ_BOUND_METHOD);
+        bound->receiver = object; // The array object
+        bound->method = (KObjFunction*)val.as.obj;
+        out->type = VAL_OBJ;
+        out->as.obj = bound;
+        return FIELD_OK;
+    }
+    return field_error(error_type, error, "TypeMismatchError", "GETF not supported on this type");
+}
+
 static char* value_to_string_kvm(KValue v) {
     char buf[64];
     if (v.type == VAL_INT) { sprintf(buf, "%lld", v.as.integer); return strdup(buf); }
@@ -568,6 +964,46 @@ static char* value_to_string_kvm(KValue v) {
     return strdup("");
 }
 
+static bool is_string_value(KValue v) {
+    return v.type == VAL_STRING || (v.type == VAL_OBJ && ((KObj*)v.as.obj)->header.type == OBJ_STRING);
+}
+
+/**
+ * @brief ADD 的通用語義 (字符串拼接 > 浮點 > 整數)
+ * @return 操作數類型不支持時返回 false
+ */
+static bool add_values(KVM* vm, KValue va, KValue vb, KValue* out) {
+    if (is_string_value(va) || is_string_value(vb)) {
+        // String concat (Highest priority for mixed types)
+        char* sa = value_to_string_kvm(va);
+        char* sb = value_to_string_kvm(vb);
+        
+        int len_a = strlen(sa);
+        int len_b = strlen(sb);
+        char* res = (char*)malloc(len_a + len_b + 1);
+        strcpy(res, sa);
+        strcat(res, sb);
+        
+        KObjString* ks = alloc_string(vm, res, len_a + len_b);
+        free(sa); free(sb); free(res);
+        
+        out->type = VAL_OBJ;
+        out->as.obj = ks;
+    } else if (va.type == VAL_DOUBLE || vb.type == VAL_DOUBLE || 
+               va.type == VAL_FLOAT || vb.type == VAL_FLOAT) {
+        double da = (va.type == VAL_INT) ? (double)va.as.integer : (va.type == VAL_FLOAT ? va.as.single_prec : va.as.double_prec);
+        double db = (vb.type == VAL_INT) ? (double)vb.as.integer : (vb.type == VAL_FLOAT ? vb.as.single_prec : vb.as.double_prec);
+        out->type = VAL_DOUBLE;
+        out->as.double_prec = da + db;
+    } else if (va.type == VAL_INT && vb.type == VAL_INT) {
+        out->type = VAL_INT;
+        out->as.integer = va.as.integer + vb.as.integer;
+    } else {
+        return false;
+    }
+    return true;
+}
+
 // --- 初始化與清理 ---
 
 void kvm_init(KVM* vm) {
@@ -599,11 +1035,13 @@ void kvm_init(KVM* vm) {
     vm->jit = (ComeOnJIT*)malloc(sizeof(ComeOnJIT));
     if (vm->jit) {
         jit_init(vm->jit);
-        vm->jit->enabled = false; // Disable for debugging
+        vm->jit->enabled = true;
     }
 
     vm->import_handler = NULL;
     vm->root_dir = NULL;
+    vm->snapshot = NULL;
+    vm->snapshot_release = NULL;
     
     // Init GC
     vm->objects = NULL;
@@ -621,6 +1059,7 @@ void kvm_free(KVM* vm) {
     free_table(&vm->lib_paths);
     
     if (vm->jit) {
+        if (getenv("KORELIN_JIT_STATS")) jit_print_stats(vm->jit);
         jit_cleanup(vm->jit);
         free(vm->jit);
     }
@@ -633,6 +1072,11 @@ void kvm_free(KVM* vm) {
         free(vm->gc);
         vm->gc = NULL;
     }
+
+    if (vm->snapshot) {
+        vm->snapshot_release(vm->snapshot);
+        vm->snapshot = NULL;
+    }
 }
 
 void kvm_print_value(KValue value) {
@@ -749,7 +1193,162 @@ static bool resolve_dotted_name(KVM* vm, const char* name, KValue* out_val) {
     return true;
 }
 
-int kvm_run(KVM* vm) {
+/** @brief invoke_method 的結果：INVOKE_FAILED 表示已報告的致命錯誤，解釋器停止執行 */
+typedef enum {
+    INVOKE_OK,
+    INVOKE_RUNTIME_ERROR,
+    INVOKE_THROW,
+    INVOKE_FAILED
+} InvokeStatus;
+
+/**
+ * @brief INVOKE 的語義：調用 receiver 的方法，結果寫入 rd
+ * 棧上依次是 receiver 與 arg_count 個參數；實例依次查找字段、類鏈上的方法與包的子模塊，
+ * 類查找靜態方法，數組查找 Array 類的方法。實例與數組的方法參數比 arg_count 多一個時傳入 receiver。
+ */
+static InvokeStatus invoke_method(KVM* vm, int rd, KValue receiver, const char* method_name, int arg_count,
+                                  const char** error_type, const char** error) {
+    if (receiver.type == VAL_NULL) {
+        *error_type = "NilReferenceError";
+        *error = "INVOKE target is nil";
+        return INVOKE_THROW;
+    }
+    if (receiver.type != VAL_OBJ) {
+        *error_type = "TypeMismatchError";
+        *error = "INVOKE target must be object";
+        return INVOKE_THROW;
+    }
+    KObj* obj = (KObj*)receiver.as.obj;
+    
+    KValue func_val;
+    bool found = false;
+    
+    // Lookup method/function
+    if (obj->header.type == OBJ_CLASS_INSTANCE) {
+        KObjInstance* inst = (KObjInstance*)obj;
+        if (table_get(&inst->fields, method_name, &func_val)) {
+            found = true;
+        } else {
+            // Method chain
+            KObjClass* curr = inst->klass;
+            while (curr) {
+                if (table_get(&curr->methods, method_name, &func_val)) {
+                    found = true;
+                    break;
+                }
+                curr = curr->parent;
+            }
+        }
+        
+        if (!found) {
+            // Lazy load submodule for packages
+            if (table_get(&inst->fields, "__name__", &func_val) && func_val.type == VAL_STRING) {
+                 char full_name[256];
+                 snprintf(full_name, sizeof(full_name), "%s.%s", func_val.as.str, method_name);
+                 if (vm->import_handler) {
+                     KValue submod = vm->import_handler(vm, full_name);
+                     if (submod.type != VAL_NULL) {
+                         table_set(&inst->fields, method_name, submod);
+                         func_val = submod; 
+                         found = true;
+                     }
+                 }
+            }
+        }
+    } else if (obj->header.type == OBJ_CLASS) {
+        KObjClass* klass = (KObjClass*)obj;
+        // Static methods chain
+        KObjClass* curr = klass;
+        while (curr) {
+            if (table_get(&curr->methods, method_name, &func_val)) {
+                found = true;
+                break;
+            }
+            curr = curr->parent;
+        }
+    } else if (obj->header.type == OBJ_ARRAY) {
+        // Array methods
+        KValue class_val;
+        if (table_get(&vm->globals, "Array", &class_val) && class_val.type == VAL_OBJ) {
+            KObjClass* klass = (KObjClass*)class_val.as.obj;
+            if (table_get(&klass->methods, method_name, &func_val)) {
+                found = true;
+            }
+        }
+    }
+    
+    if (!found) {
+        printf("Undefined method/field: %s\n", method_name);
+        *error = "Undefined method";
+        return INVOKE_RUNTIME_ERROR;
+    }
+    
+    int effective_arg_count = arg_count;
+    bool pass_self = false;
+    
+    if (func_val.type == VAL_OBJ) {
+        KObj* func_obj = (KObj*)func_val.as.obj;
+        if (func_obj->header.type == OBJ_FUNCTION) {
+            int arity = ((KObjFunction*)func_obj)->arity;
+            if (obj->header.type == OBJ_CLASS_INSTANCE || obj->header.type == OBJ_ARRAY) {
+                 if (arity == arg_count + 1) pass_self = true;
+                 else pass_self = false; 
+            } else {
+                 pass_self = false;
+            }
+        } else if (func_obj->header.type == OBJ_NATIVE) {
+            // Native method on instance: always pass self
+            if (obj->header.type == OBJ_CLASS_INSTANCE || obj->header.type == OBJ_ARRAY) {
+                pass_self = true;
+            }
+        }
+    }
+    
+    // Adjust stack for call
+    if (pass_self) {
+         if (vm->stack_top + 1 - vm->stack >= KVM_STACK_SIZE) {
+             printf("Stack overflow in INVOKE (Usage: %d)\n", (int)(vm->stack_top - vm->stack));
+             return INVOKE_FAILED;
+         }
+         vm->stack_top++;
+         for(int i=0; i<arg_count; i++) {
+             *(vm->stack_top - 1 - i) = *(vm->stack_top - 2 - i);
+         }
+         *(vm->stack_top - arg_count - 1) = receiver;
+         effective_arg_count = arg_count + 1;
+    }
+    
+    if (!call_value(vm, func_val, effective_arg_count, rd)) {
+         printf("Call failed\n");
+         vm->had_error = true;
+         return INVOKE_FAILED;
+    }
+    return INVOKE_OK;
+}
+
+/** @brief 按 invoke_method 的結果繼續執行或報告錯誤，用在指令的 case 中 */
+#define INVOKE_METHOD(rd, receiver, name, arg_count) \
+    { \
+        const char* error_type = NULL; \
+        const char* error = NULL; \
+        InvokeStatus status = invoke_method(vm, rd, receiver, name, arg_count, &error_type, &error); \
+        if (status == INVOKE_FAILED) return 0; \
+        if (status == INVOKE_RUNTIME_ERROR) RUNTIME_ERROR(error); \
+        if (status == INVOKE_THROW) THROW_ERROR(error_type, error); \
+    }
+
+/** @brief value 是數組時返回數組，否則返回 NULL */
+static KObjArray* as_array(KValue value) {
+    if (value.type != VAL_OBJ || ((KObj*)value.as.obj)->header.type != OBJ_ARRAY) return NULL;
+    return (KObjArray*)value.as.obj;
+}
+
+/**
+ * @brief 解釋器主循環
+ * @param single_step 為 true 時只執行一條指令 (供 JIT 慢路徑使用)
+ * @return 0 結束，1 錯誤，KVM_STEP_CONTINUE 單步完成
+ */
+static inline int kvm_execute(KVM* vm, bool single_step) {
     // 循環直到結束或錯誤
     for (;;) {
         uint8_t opcode = READ_BYTE();
@@ -767,35 +1366,10 @@ int kvm_run(KVM* vm) {
                 KValue va = REG(ra);
                 KValue vb = REG(rb);
                 
-                if (va.type == VAL_STRING || vb.type == VAL_STRING || 
-                          (va.type == VAL_OBJ && ((KObj*)va.as.obj)->header.type == OBJ_STRING) ||
-                          (vb.type == VAL_OBJ && ((KObj*)vb.as.obj)->header.type == OBJ_STRING)) {
-                    // String concat (Highest priority for mixed types)
-                    char* sa = value_to_string_kvm(va);
-                    char* sb = value_to_string_kvm(vb);
-                    
-                    int len_a = strlen(sa);
-                    int len_b = strlen(sb);
-                    char* res = (char*)malloc(len_a + len_b + 1);
-                    strcpy(res, sa);
-                    strcat(res, sb);
-                    
-                    KObjString* ks = alloc_string(vm, res, len_a + len_b);
-                    free(sa); free(sb); free(res);
-                    
-                    REG(rd).type = VAL_OBJ;
-                    REG(rd).as.obj = ks;
-                } else if (va.type == VAL_DOUBLE || vb.type == VAL_DOUBLE || 
-                           va.type == VAL_FLOAT || vb.type == VAL_FLOAT) {
-                    // Float add
-                    double da = (va.type == VAL_INT) ? (double)va.as.integer : (va.type == VAL_FLOAT ? va.as.single_prec : va.as.double_prec);
-                    double db = (vb.type == VAL_INT) ? (double)vb.as.integer : (vb.type == VAL_FLOAT ? vb.as.single_prec : vb.as.double_prec);
-                    REG(rd).type = VAL_DOUBLE;
-                    REG(rd).as.double_prec = da + db;
-                } else if (va.type == VAL_INT && vb.type == VAL_INT) {
+                if (va.type == VAL_INT && vb.type == VAL_INT) {
                     REG(rd).type = VAL_INT;
                     REG(rd).as.integer = va.as.integer + vb.as.integer;
-                } else {
+                } else if (!add_values(vm, va, vb, &REG(rd))) {
                     printf("Type Error: Ra=%d, Rb=%d\n", va.type, vb.type);
                     THROW_ERROR("TypeMismatchError", "Operands must be numbers or strings");
                 }
@@ -897,6 +1471,14 @@ int kvm_run(KVM* vm) {
                 if (REG(ra).type == VAL_INT) {
                     REG(rd).type = VAL_INT;
                     REG(rd).as.integer = REG_AS_INT(ra) + imm;
+                } else {
+                    // 窺孔優化把 LDI + ADD 合併為 ADDI，其餘類型必須保持 ADD 語義
+                    KValue vb;
+                    vb.type = VAL_INT;
+                    vb.as.integer = imm;
+                    if (!add_values(vm, REG(ra), vb, &REG(rd))) {
+                        THROW_ERROR("TypeMismatchError", "Operands must be numbers or strings");
+                    }
                 }
                 break;
             }
@@ -919,16 +1501,12 @@ int kvm_run(KVM* vm) {
                 break;
             }
 
-            case KOP_LDI64: { // LDI64 Rd, Imm64
+            case KOP_LDI64: { // LDI64 Rd, Index16
                 uint8_t rd = READ_REG_IDX();
-                
-                uint64_t bits = 0;
-                for(int i=0; i<8; i++) {
-                     bits = (bits << 8) | READ_BYTE();
-                }
-                
+                uint16_t index = READ_IMM16();
+                if (index >= vm->chunk->int_count) RUNTIME_ERROR("Integer constant index out of bounds");
                 REG(rd).type = VAL_INT;
-                REG(rd).as.integer = (int64_t)bits;
+                REG(rd).as.integer = vm->chunk->int_constants[index];
                 break;
             }
 
@@ -967,6 +1545,16 @@ int kvm_run(KVM* vm) {
             case KOP_FSUB_D: BINARY_OP_DOUBLE(-); break;
             case KOP_FMUL_D: BINARY_OP_DOUBLE(*); break;
             case KOP_FDIV_D: BINARY_OP_DOUBLE(/); break;
+            case KOP_FEQ_D: CMP_OP_DOUBLE(==); break;
+            case KOP_FLT_D: CMP_OP_DOUBLE(<); break;
+            case KOP_FLE_D: CMP_OP_DOUBLE(<=); break;
+
+            case KOP_ADD_INT: BINARY_OP_INT_TYPED(+); break;
+            case KOP_SUB_INT: BINARY_OP_INT_TYPED(-); break;
+            case KOP_MUL_INT: BINARY_OP_INT_TYPED(*); break;
+            case KOP_LT_INT: CMP_OP_INT_TYPED(<, double); break;
+            case KOP_LE_INT: CMP_OP_INT_TYPED(<=, double); break;
+            case KOP_EQ_INT: CMP_OP_INT_TYPED(==, int64_t); break;
             
             // --- 2.3 內存與棧 ---
             case KOP_LOAD: { // LOAD Rd, Ra (Move)
@@ -1028,6 +1616,54 @@ int kvm_run(KVM* vm) {
                 break;
             }
             
+            case KOP_FORLOOP: { // FORLOOP Ri, Rlimit, Cmp, Off16：Ri 已證明為整數，步進 1 後滿足條件則跳回循環體
+                uint8_t ri = READ_REG_IDX();
+                uint8_t rl = READ_REG_IDX();
+                uint8_t cmp = READ_BYTE();
+                int16_t offset = (int16_t)READ_IMM16();
+                uint8_t op = cmp & (uint8_t)~KFORLOOP_INT_LIMIT;
+                uint64_t step = (op == KOP_LT || op == KOP_LE) ? 1 : (uint64_t)-1;
+                int64_t counter = (int64_t)((uint64_t)REG_AS_INT(ri) + step);
+                REG(ri).as.integer = counter;
+                if (forloop_test(counter, REG(rl), op)) vm->ip += offset;
+                break;
+            }
+
+            case KOP_JTAB: { // JTAB Ra, Low16, Count16：值在 [Low, Low + Count) 內時跳到第 值 - Low 個槽
+                uint8_t ra = READ_REG_IDX();
+                int16_t low = (int16_t)READ_IMM16();
+                uint16_t count = READ_IMM16();
+                KValue v = REG(ra);
+                int64_t key = 0;
+                bool integral = false;
+                if (v.type == VAL_INT) {
+                    key = v.as.integer;
+                    integral = true;
+                } else if (v.type == VAL_FLOAT || v.type == VAL_DOUBLE) {
+                    // 與 EQ 一致：數值相等的浮點數也匹配整數 case
+                    double d = v.type == VAL_FLOAT ? v.as.single_prec : v.as.double_prec;
+                    if (d >= -9007199254740992.0 && d <= 9007199254740992.0 && d == (double)(int64_t)d) {
+                        key = (int64_t)d;
+                        integral = true;
+                    }
+                }
+                int64_t slot = count; // 落空槽
+                if (integral && key >= low && key < (int64_t)low + count) slot = key - low;
+                vm->ip += slot * 4;
+                break;
+            }
+            case KOP_JHASH: { // JHASH Ra, Buckets16：字符串跳到第 hash % Buckets 個槽，其他值走落空槽
+                uint8_t ra = READ_REG_IDX();
+                uint16_t buckets = READ_IMM16();
+                KValue v = REG(ra);
+                const char* str = NULL;
+                if (v.type == VAL_STRING) str = v.as.str;
+                else if (v.type == VAL_OBJ && ((KObj*)v.as.obj)->header.type == OBJ_STRING) str = ((KObjString*)v.as.obj)->chars;
+                uint32_t slot = (str && buckets) ? switch_hash(str) % buckets : buckets;
+                vm->ip += (size_t)slot * 4;
+                break;
+            }
+            
             case KOP_CALLR: { // CALLR Rd, ArgCount
                 uint8_t rd = READ_REG_IDX();
                 uint8_t arg_count = READ_BYTE();
@@ -1158,6 +1794,7 @@ int kvm_run(KVM* vm) {
                 uint32_t entry = READ_IMM24();
                 uint8_t arity = READ_BYTE();
                 uint8_t access = READ_BYTE();
+                uint16_t frame_size = READ_IMM16();
                 
                 char* name = vm->chunk->string_table[name_id];
                 
@@ -1167,6 +1804,7 @@ int kvm_run(KVM* vm) {
                 func->arity = arity;
                 func->chunk = vm->chunk; 
                 func->entry_point = entry;
+                func->frame_size = (frame_size > 0 && frame_size <= KVM_REGISTERS_MAX) ? frame_size : KVM_REGISTERS_MAX;
                 func->access = access;
                 func->parent_class = NULL;
                 func->module = vm->current_module;
@@ -1262,18 +1900,12 @@ int kvm_run(KVM* vm) {
                 break;
             }
 
-            case KOP_LDCD: { // LDCD Rd, Imm64
+            case KOP_LDCD: { // LDCD Rd, Index16
                 uint8_t rd = READ_REG_IDX();
-                
-                uint64_t bits = 0;
-                for(int i=0; i<8; i++) {
-                     bits = (bits << 8) | READ_BYTE();
-                }
-                
+                uint16_t index = READ_IMM16();
+                if (index >= vm->chunk->double_count) RUNTIME_ERROR("Double constant index out of bounds");
                 REG(rd).type = VAL_DOUBLE;
-                union { uint64_t i; double d; } u;
-                u.i = bits;
-                REG(rd).as.double_prec = u.d;
+                REG(rd).as.double_prec = vm->chunk->double_constants[index];
                 break;
             }
             
@@ -1372,21 +2004,7 @@ int kvm_run(KVM* vm) {
                 int size = (int)REG_AS_INT(rs);
                 if (size < 0) RUNTIME_ERROR("Negative array size");
                 
-                KObjArray* arr = (KObjArray*)kgc_alloc(vm->gc, sizeof(KObjArray), OBJ_ARRAY);
-                if (!arr) RUNTIME_ERROR("Memory allocation failed");
-                
-                // Init header
-                // kgc_alloc sets type, marked, size, next
-                
-                arr->length = size;
-                arr->capacity = size; // Initialize capacity!
-                arr->elements = (KValue*)calloc(size, sizeof(KValue));
-                if (!arr->elements && size > 0) {
-                    // free(arr); // Let GC handle it or HeapFree
-                    RUNTIME_ERROR("Memory allocation failed");
-                }
-                
-                // Initialize elements based on type
+                // Resolve the element type once
                 char* type_name = vm->chunk->string_table[type_id];
                 
                 KValue class_val;
@@ -1398,31 +2016,65 @@ int kvm_run(KVM* vm) {
                     klass = (KObjClass*)class_val.as.obj;
                 }
 
-                for (int i=0; i<size; i++) {
-                    if (klass) {
-                        // Instantiate Struct/Class
-                        KObjInstance* inst = (KObjInstance*)kgc_alloc(vm->gc, sizeof(KObjInstance), OBJ_CLASS_INSTANCE);
-                        init_table(&inst->fields);
-                        inst->klass = klass;
-                        
-                        arr->elements[i].type = VAL_OBJ;
-                        arr->elements[i].as.obj = (KObj*)inst;
-                    } else if (strcmp(type_name, "int") == 0) {
-                        arr->elements[i].type = VAL_INT;
-                        arr->elements[i].as.integer = 0;
+                // 基本類型使用無標籤存儲，calloc 清零即為 0 / 0.0 / false (KValue 清零為 null)
+                KArrayKind kind = ARRAY_VALUES;
+                size_t element_size = sizeof(KValue);
+                if (!klass) {
+                    if (strcmp(type_name, "int") == 0) {
+                        kind = ARRAY_INT;
+                        element_size = sizeof(int64_t);
                     } else if (strcmp(type_name, "float") == 0) {
-                        arr->elements[i].type = VAL_FLOAT;
-                        arr->elements[i].as.single_prec = 0.0f;
+                        kind = ARRAY_DOUBLE;
+                        element_size = sizeof(double);
                     } else if (strcmp(type_name, "bool") == 0) {
-                        arr->elements[i].type = VAL_BOOL;
-                        arr->elements[i].as.boolean = false;
-                    } else {
-                        arr->elements[i].type = VAL_NULL;
+                        kind = ARRAY_BOOL;
+                        element_size = sizeof(uint8_t);
                     }
+                } else if (klass->field_count > 0 && !klass->parent) {
+                    // 結構體的字段內聯存放，不為每個元素創建實例
+                    kind = ARRAY_STRUCT;
                 }
                 
+                KObjArray* arr = (KObjArray*)kgc_alloc(vm->gc, sizeof(KObjArray), OBJ_ARRAY);
+                if (!arr) RUNTIME_ERROR("Memory allocation failed");
+                
+                // Init header
+                // kgc_alloc sets type, marked, size, next
+                
+                arr->length = size;
+                arr->capacity = size; // Initialize capacity!
+                arr->kind = kind;
+                arr->klass = NULL;
+                arr->layout_id = 0;
+                if (kind == ARRAY_STRUCT) {
+                    size_t slot_count = (size_t)size * klass->field_count;
+                    arr->slots = (KValue*)malloc(sizeof(KValue) * (slot_count > 0 ? slot_count : 1));
+                    if (arr->slots) {
+                        for (size_t i = 0; i < slot_count; i++) arr->slots[i].type = KFIELD_UNSET;
+                        arr->klass = klass;
+                        arr->layout_id = klass->layout_id;
+                    }
+                } else {
+                    arr->elements = calloc(size, element_size);
+                }
+                if (!arr->elements && size > 0) {
+                    // free(arr); // Let GC handle it or HeapFree
+                    arr->kind = ARRAY_VALUES;
+                    RUNTIME_ERROR("Memory allocation failed");
+                }
+
+                // 先寫入目標寄存器：創建實例時可能觸發 GC，數組必須已經可達
                 REG(rd).type = VAL_OBJ;
                 REG(rd).as.obj = (void*)arr;
+                for (int i = 0; klass && kind != ARRAY_STRUCT && i < size; i++) {
+                    // Instantiate Struct/Class
+                    KObjInstance* inst = (KObjInstance*)kgc_alloc(vm->gc, sizeof(KObjInstance), OBJ_CLASS_INSTANCE);
+                    init_table(&inst->fields);
+                    inst->klass = klass;
+                    
+                    arr->elements[i].type = VAL_OBJ;
+                    arr->elements[i].as.obj = (KObj*)inst;
+                }
                 break;
             }
 
@@ -1440,7 +2092,8 @@ int kvm_run(KVM* vm) {
                 int index = (int)REG_AS_INT(rb);
                 if (index < 0 || index >= arr->length) THROW_ERROR("IndexOutOfBoundsError", "Index out of bounds");
                 
-                REG(rd) = arr->elements[index];
+                kvm_array_materialize(vm, arr);
+                REG(rd) = kvm_array_get(arr, index);
                 break;
             }
 
@@ -1458,7 +2111,112 @@ int kvm_run(KVM* vm) {
                 int index = (int)REG_AS_INT(rb);
                 if (index < 0 || index >= arr->length) THROW_ERROR("IndexOutOfBoundsError", "Index out of bounds");
                 
-                arr->elements[index] = REG(rc);
+                kvm_array_materialize(vm, arr);
+                kvm_array_set(arr, index, REG(rc));
+                break;
+            }
+
+            case KOP_GETFA_U: { // GETFA_U Rd, ArrayReg, IndexReg：下標已證明是界內的整數
+                uint8_t rd = READ_REG_IDX();
+                uint8_t ra = READ_REG_IDX();
+                uint8_t rb = READ_REG_IDX();
+                
+                if (REG(ra).type == VAL_NULL) THROW_ERROR("NilReferenceError", "Expected array");
+                if (REG(ra).type != VAL_OBJ) THROW_ERROR("TypeMismatchError", "Expected array");
+                KObjArray* arr = (KObjArray*)REG(ra).as.obj;
+                if (!arr || arr->header.type != OBJ_ARRAY) THROW_ERROR("TypeMismatchError", "Expected array object");
+                
+                kvm_array_materialize(vm, arr);
+                REG(rd) = kvm_array_get(arr, (int)REG_AS_INT(rb));
+                break;
+            }
+
+            case KOP_PUTFA_U: { // PUTFA_U ArrayReg, IndexReg, ValReg：下標已證明是界內的整數
+                uint8_t ra = READ_REG_IDX();
+                uint8_t rb = READ_REG_IDX();
+                uint8_t rc = READ_REG_IDX();
+                
+                if (REG(ra).type == VAL_NULL) THROW_ERROR("NilReferenceError", "Expected array");
+                if (REG(ra).type != VAL_OBJ) THROW_ERROR("TypeMismatchError", "Expected array");
+                KObjArray* arr = (KObjArray*)REG(ra).as.obj;
+                if (!arr || arr->header.type != OBJ_ARRAY) THROW_ERROR("TypeMismatchError", "Expected array object");
+                
+                kvm_array_materialize(vm, arr);
+                kvm_array_set(arr, (int)REG_AS_INT(rb), REG(rc));
+                break;
+            }
+
+            case KOP_GETAF: { // GETAF Rd, ArrayReg, IndexReg, Field16 (Rd = Arr[Idx].Field)
+                uint8_t rd = READ_REG_IDX();
+                uint8_t ra = READ_REG_IDX();
+                uint8_t rb = READ_REG_IDX();
+                uint16_t id = READ_IMM16();
+                
+                if (REG(ra).type == VAL_NULL) THROW_ERROR("NilReferenceError", "Expected array");
+                if (REG(ra).type != VAL_OBJ) THROW_ERROR("TypeMismatchError", "Expected array");
+                KObjArray* arr = (KObjArray*)REG(ra).as.obj;
+                if (!arr || arr->header.type != OBJ_ARRAY) THROW_ERROR("TypeMismatchError", "Expected array object");
+                
+                if (REG(rb).type != VAL_INT) THROW_ERROR("TypeMismatchError", "Index must be integer");
+                int index = (int)REG_AS_INT(rb);
+                if (index < 0 || index >= arr->length) THROW_ERROR("IndexOutOfBoundsError", "Index out of bounds");
+                if (id == KGETAF_CHECK) break;
+                
+                const char* key = vm->chunk->string_table[id];
+                if (arr->kind == ARRAY_STRUCT) {
+                    int field = struct_field_slot(vm->chunk, arr, id);
+                    if (field >= 0) {
+                        KValue slot = arr->slots[(size_t)index * arr->klass->field_count + field];
+                        if (slot.type != KFIELD_UNSET) {
+                            REG(rd) = slot;
+                            break;
+                        }
+                    }
+                    // 方法、未賦值的字段等需要實例本身
+                    kvm_array_materialize(vm, arr);
+                }
+                
+                KValue val;
+                const char* error_type = NULL;
+                const char* error = NULL;
+                FieldStatus status = get_field(vm, kvm_array_get(arr, index), key, &val, &error_type, &error);
+                if (status == FIELD_RUNTIME_ERROR) RUNTIME_ERROR(error);
+                if (status == FIELD_THROW) THROW_ERROR(error_type, error);
+                REG(rd) = val;
+                break;
+            }
+
+            case KOP_PUTAF: { // PUTAF ArrayReg, IndexReg, ValReg, Field16 (Arr[Idx].Field = Val)
+                uint8_t ra = READ_REG_IDX();
+                uint8_t rb = READ_REG_IDX();
+                uint8_t rc = READ_REG_IDX();
+                uint16_t id = READ_IMM16();
+                
+                if (REG(ra).type == VAL_NULL) THROW_ERROR("NilReferenceError", "Expected array");
+                if (REG(ra).type != VAL_OBJ) THROW_ERROR("TypeMismatchError", "Expected array");
+                KObjArray* arr = (KObjArray*)REG(ra).as.obj;
+                if (!arr || arr->header.type != OBJ_ARRAY) THROW_ERROR("TypeMismatchError", "Expected array object");
+                
+                if (REG(rb).type != VAL_INT) THROW_ERROR("TypeMismatchError", "Index must be integer");
+                int index = (int)REG_AS_INT(rb);
+                if (index < 0 || index >= arr->length) THROW_ERROR("IndexOutOfBoundsError", "Index out of bounds");
+                
+                const char* key = vm->chunk->string_table[id];
+                if (arr->kind == ARRAY_STRUCT) {
+                    int field = struct_field_slot(vm->chunk, arr, id);
+                    if (field >= 0) {
+                        arr->slots[(size_t)index * arr->klass->field_count + field] = REG(rc);
+                        break;
+                    }
+                    kvm_array_materialize(vm, arr);
+                }
+                
+                KValue target = kvm_array_get(arr, index);
+                if (target.type == VAL_NULL) THROW_ERROR("NilReferenceError", "PUTF target is nil");
+                if (target.type != VAL_OBJ) THROW_ERROR("TypeMismatchError", "PUTF target must be object");
+                KObj* obj = (KObj*)target.as.obj;
+                if (obj->header.type != OBJ_CLASS_INSTANCE) THROW_ERROR("TypeMismatchError", "PUTF not supported on this type");
+                table_set(&((KObjInstance*)obj)->fields, key, REG(rc));
                 break;
             }
             
@@ -1482,135 +2240,13 @@ int kvm_run(KVM* vm) {
                 uint8_t ra = READ_REG_IDX(); // Object
                 uint16_t id = READ_IMM16(); // String ID
                 
-                if (REG(ra).type == VAL_NULL) {
-                    THROW_ERROR("NilReferenceError", "GETF target is nil");
-                }
-                if (REG(ra).type != VAL_OBJ) {
-                    THROW_ERROR("TypeMismatchError", "GETF target must be object");
-                }
-                
-                char* key = vm->chunk->string_table[id];
-                KObj* obj = (KObj*)REG(ra).as.obj;
-                
-                if (obj->header.type == OBJ_CLASS_INSTANCE) {
-                    KObjInstance* inst = (KObjInstance*)obj;
-                    KValue val;
-                    // printf("DEBUG: GETF %s on Instance\n", key);
-                    
-                    if (table_get(&inst->fields, key, &val)) {
-                        // printf("DEBUG: Found in fields\n");
-                        REG(rd) = val;
-                    } else {
-                        // Look up method in class chain
-                        bool found = false;
-                        KObjClass* curr = inst->klass;
-                        while (curr) {
-                            if (table_get(&curr->methods, key, &val)) {
-                                found = true;
-                                break;
-                            }
-                            curr = curr->parent;
-                        }
-                        
-                        if (found) {
-                             // Create Bound Method
-                             KObjBoundMethod* bound = (KObjBoundMethod*)kgc_alloc(vm->gc, sizeof(KObjBoundMethod), OBJ_BOUND_METHOD);
-                             
-                             bound->receiver = REG(ra);
-                             bound->method = (KObjFunction*)val.as.obj;
-                             
-                             KValue res;
-                             res.type = VAL_OBJ;
-                             res.as.obj = bound;
-                             REG(rd) = res;
-                        } else {
-                            // Lazy loading for package submodules
-                            if (table_get(&inst->fields, "__name__", &val) && val.type == VAL_STRING) {
-                                char full_name[256];
-                                snprintf(full_name, sizeof(full_name), "%s.%s", val.as.str, key);
-                                
-                                // Call import handler
-                                if (vm->import_handler) {
-                                    KValue submod = vm->import_handler(vm, full_name);
-                                    if (submod.type != VAL_NULL) {
-                                        // Cache it
-                                        table_set(&inst->fields, key, submod);
-                                        REG(rd) = submod;
-                                        break;
-                                    }
-                                }
-                            }
-                            
-                            printf("Undefined field: %s\n", key);
-                            RUNTIME_ERROR("Undefined field");
-                        }
-                    }
-                } else if (obj->header.type == OBJ_CLASS) {
-                    KObjClass* klass = (KObjClass*)obj;
-                    KValue val;
-                    // Look up static method in chain
-                    bool found = false;
-                    KObjClass* curr = klass;
-                    while (curr) {
-                        if (table_get(&curr->methods, key, &val)) {
-                            found = true;
-                            break;
-                        }
-                        curr = curr->parent;
-                    }
-                    
-                    if (found) {
-                        REG(rd) = val;
-                    } else {
-                        printf("Undefined static member: %s\n", key);
-                        RUNTIME_ERROR("Undefined static member");
-                    }
-                } else if (obj->header.type == OBJ_ARRAY) {
-                    if (strcmp(key, "length") == 0) {
-                        KObjArray* arr = (KObjArray*)obj;
-                        REG(rd).type = VAL_INT;
-                        REG(rd).as.integer = arr->length;
-                    } else {
-                        // Look up methods in Array class
-                        KValue class_val;
-                        if (table_get(&vm->globals, "Array", &class_val) && class_val.type == VAL_OBJ) {
-                            KObjClass* klass = (KObjClass*)class_val.as.obj;
-                             KValue val;
-                             if (table_get(&klass->methods, key, &val)) {
-                                 // Found method, bind it
-                                KObjBoundMethod* bound = (KObjBoundMethod*)kgc_alloc(vm->gc, sizeof(KObjBoundMethod), OBJ_BOUND_METHOD);
-                                
-                                bound->receiver = REG(ra); // The array object
-                                 
-                                 // Ensure val is a function (Native or Script)
-                                 if (val.type == VAL_OBJ && 
-                                     (((KObj*)val.as.obj)->header.type == OBJ_FUNCTION || 
-                                      ((KObj*)val.as.obj)->header.type == OBJ_NATIVE)) {
-                                     // Native functions are wrapped in OBJ_NATIVE
-                                     // But BoundMethod expects KObjFunction* (for script) or KObjNative*?
-                                     // KObjBoundMethod struct definition: KObjFunction* method;
-                                     // Wait, bound method only supports script functions?
-                                     // If it's a native function, we might need a different handling or cast?
-                                     // Let's check KObjBoundMethod definition in kvm.h
-                                     bound->method = (KObjFunction*)val.as.obj; 
-                                     
-                                     KValue res;
-                                     res.type = VAL_OBJ;
-                                     res.as.obj = bound;
-                                     REG(rd) = res;
-                                 } else {
-                                     THROW_ERROR("TypeMismatchError", "Method is not a function");
-                                 }
-                             } else {
-                                 THROW_ERROR("NameDefineError", "Undefined property/method on Array");
-                             }
-                        } else {
-                            THROW_ERROR("NameDefineError", "Arrays only have 'length' property (Array class not found)");
-                        }
-                    }
-                } else {
-                     THROW_ERROR("TypeMismatchError", "GETF not supported on this type");
-                }
+                KValue val;
+                const char* error_type = NULL;
+                const char* error = NULL;
+                FieldStatus status = get_field(vm, REG(ra), vm->chunk->string_table[id], &val, &error_type, &error);
+                if (status == FIELD_RUNTIME_ERROR) RUNTIME_ERROR(error);
+                if (status == FIELD_THROW) THROW_ERROR(error_type, error);
+                REG(rd) = val;
                 break;
             }
             
@@ -1648,6 +2284,9 @@ int kvm_run(KVM* vm) {
                 klass->name = strdup(name);
                 klass->parent = NULL;
                 init_table(&klass->methods);
+                klass->fields = NULL;
+                klass->field_count = 0;
+                klass->layout_id = kvm_next_layout_id();
                 
                 KValue val;
                 val.type = VAL_OBJ;
@@ -1681,6 +2320,28 @@ int kvm_run(KVM* vm) {
                 break;
             }
 
+            case KOP_FIELD: {
+                uint16_t class_name_id = READ_IMM16();
+                uint16_t field_name_id = READ_IMM16();
+                
+                char* class_name = vm->chunk->string_table[class_name_id];
+                char* field_name = vm->chunk->string_table[field_name_id];
+                
+                KValue class_val;
+                if (!table_get(&vm->globals, class_name, &class_val) || class_val.type != VAL_OBJ ||
+                    ((KObj*)class_val.as.obj)->header.type != OBJ_CLASS) {
+                    RUNTIME_ERROR("Class not defined for field");
+                }
+                KObjClass* klass = (KObjClass*)class_val.as.obj;
+                if (struct_field_index(klass, field_name) >= 0) break;
+                
+                char** fields = (char**)realloc(klass->fields, sizeof(char*) * (klass->field_count + 1));
+                if (!fields) RUNTIME_ERROR("Memory allocation failed");
+                fields[klass->field_count++] = strdup(field_name);
+                klass->fields = fields;
+                break;
+            }
+
             case KOP_INHERIT: {
                 uint16_t sub_name_id = READ_IMM16();
                 uint16_t super_name_id = READ_IMM16();
@@ -1762,114 +2423,74 @@ int kvm_run(KVM* vm) {
                 uint8_t ra = READ_REG_IDX(); // Object Reg
                 uint16_t method_id = READ_IMM16();
                 uint8_t arg_count = READ_BYTE();
-                
-                if (REG(ra).type == VAL_NULL) THROW_ERROR("NilReferenceError", "INVOKE target is nil");
-                if (REG(ra).type != VAL_OBJ) THROW_ERROR("TypeMismatchError", "INVOKE target must be object");
-                KObj* obj = (KObj*)REG(ra).as.obj;
-                char* method_name = vm->chunk->string_table[method_id];
-                
-                KValue func_val;
-                bool found = false;
-                
-                // Lookup method/function
-                if (obj->header.type == OBJ_CLASS_INSTANCE) {
-                    KObjInstance* inst = (KObjInstance*)obj;
-                    if (table_get(&inst->fields, method_name, &func_val)) {
-                        found = true;
-                    } else {
-                        // Method chain
-                        KObjClass* curr = inst->klass;
-                        while (curr) {
-                            if (table_get(&curr->methods, method_name, &func_val)) {
-                                found = true;
-                                break;
-                            }
-                            curr = curr->parent;
-                        }
-                    }
-                    
-                    if (!found) {
-                        // Lazy load submodule for packages
-                        if (table_get(&inst->fields, "__name__", &func_val) && func_val.type == VAL_STRING) {
-                             char full_name[256];
-                             snprintf(full_name, sizeof(full_name), "%s.%s", func_val.as.str, method_name);
-                             if (vm->import_handler) {
-                                 KValue submod = vm->import_handler(vm, full_name);
-                                 if (submod.type != VAL_NULL) {
-                                     table_set(&inst->fields, method_name, submod);
-                                     func_val = submod; 
-                                     found = true;
-                                 }
-                             }
-                        }
-                    }
-                } else if (obj->header.type == OBJ_CLASS) {
-                    KObjClass* klass = (KObjClass*)obj;
-                    // Static methods chain
-                    KObjClass* curr = klass;
-                    while (curr) {
-                        if (table_get(&curr->methods, method_name, &func_val)) {
-                            found = true;
-                            break;
-                        }
-                        curr = curr->parent;
-                    }
-                } else if (obj->header.type == OBJ_ARRAY) {
-                    // Array methods
-                    KValue class_val;
-                    if (table_get(&vm->globals, "Array", &class_val) && class_val.type == VAL_OBJ) {
-                        KObjClass* klass = (KObjClass*)class_val.as.obj;
-                        if (table_get(&klass->methods, method_name, &func_val)) {
-                            found = true;
-                        }
-                    }
-                }
-                
-                if (!found) {
-                    printf("Undefined method/field: %s\n", method_name);
-                    RUNTIME_ERROR("Undefined method");
+                INVOKE_METHOD(rd, REG(ra), vm->chunk->string_table[method_id], arg_count);
+                break;
+            }
+
+            case KOP_APUSH: { // APUSH Rd, Arr, Val
+                uint8_t rd = READ_REG_IDX();
+                uint8_t ra = READ_REG_IDX();
+                uint8_t rb = READ_REG_IDX();
+                KObjArray* arr = as_array(REG(ra));
+                if (arr) {
+                    kvm_array_push(vm, arr, REG(rb));
+                    REG(rd).type = VAL_NULL;
+                    break;
                 }
-                
-                int effective_arg_count = arg_count;
-                bool pass_self = false;
-                
-                if (func_val.type == VAL_OBJ) {
-                    KObj* func_obj = (KObj*)func_val.as.obj;
-                    if (func_obj->header.type == OBJ_FUNCTION) {
-                        int arity = ((KObjFunction*)func_obj)->arity;
-                        if (obj->header.type == OBJ_CLASS_INSTANCE || obj->header.type == OBJ_ARRAY) {
-                             if (arity == arg_count + 1) pass_self = true;
-                             else pass_self = false; 
-                        } else {
-                             pass_self = false;
-                        }
-                    } else if (func_obj->header.type == OBJ_NATIVE) {
-                        // Native method on instance: always pass self
-                        if (obj->header.type == OBJ_CLASS_INSTANCE || obj->header.type == OBJ_ARRAY) {
-                            pass_self = true;
-                        }
-                    }
+                kvm_push(vm, REG(ra));
+                kvm_push(vm, REG(rb));
+                INVOKE_METHOD(rd, REG(ra), "push", 1);
+                break;
+            }
+
+            case KOP_APOP: { // APOP Rd, Arr, _
+                uint8_t rd = READ_REG_IDX();
+                uint8_t ra = READ_REG_IDX();
+                vm->ip++;
+                KObjArray* arr = as_array(REG(ra));
+                if (arr) {
+                    REG(rd) = kvm_array_pop(vm, arr);
+                    break;
                 }
-                
-                // Adjust stack for call
-                if (pass_self) {
-                     if (vm->stack_top + 1 - vm->stack >= KVM_STACK_SIZE) {
-                         printf("Stack overflow in INVOKE (Usage: %d)\n", (int)(vm->stack_top - vm->stack));
-                         return false;
-                     }
-                     vm->stack_top++;
-                     for(int i=0; i<arg_count; i++) {
-                         *(vm->stack_top - 1 - i) = *(vm->stack_top - 2 - i);
-                     }
-                     *(vm->stack_top - arg_count - 1) = REG(ra);
-                     effective_arg_count = arg_count + 1;
+                kvm_push(vm, REG(ra));
+                INVOKE_METHOD(rd, REG(ra), "pop", 0);
+                break;
+            }
+
+            case KOP_AINSERT: { // AINSERT Rd, Arr, Idx, Val
+                uint8_t rd = READ_REG_IDX();
+                uint8_t ra = READ_REG_IDX();
+                uint8_t rb = READ_REG_IDX();
+                uint8_t rc = READ_REG_IDX();
+                KObjArray* arr = as_array(REG(ra));
+                if (arr) {
+                    if (REG(rb).type == VAL_INT) kvm_array_insert(vm, arr, REG(rb).as.integer, REG(rc));
+                    REG(rd).type = VAL_NULL;
+                    break;
                 }
-                
-                if (!call_value(vm, func_val, effective_arg_count, rd)) {
-                     printf("Call failed\n");
-                     vm->had_error = true;
-                     return false;
+                kvm_push(vm, REG(ra));
+                kvm_push(vm, REG(rb));
+                kvm_push(vm, REG(rc));
+                INVOKE_METHOD(rd, REG(ra), "insert", 2);
+                break;
+            }
+
+            case KOP_AREMOVE: { // AREMOVE Rd, Arr, Idx
+                uint8_t rd = READ_REG_IDX();
+                uint8_t ra = READ_REG_IDX();
+                uint8_t rb = READ_REG_IDX();
+                KObjArray* arr = as_array(REG(ra));
+                if (arr) {
+                    if (REG(rb).type == VAL_INT) {
+                        REG(rd) = kvm_array_remove(vm, arr, REG(rb).as.integer);
+                    } else {
+                        REG(rd).type = VAL_NULL;
+                    }
+                    break;
                 }
+                kvm_push(vm, REG(ra));
+                kvm_push(vm, REG(rb));
+                INVOKE_METHOD(rd, REG(ra), "removeAt", 1);
                 break;
             }
 
@@ -1943,11 +2564,39 @@ int kvm_run(KVM* vm) {
                 RUNTIME_ERROR("Unknown or unimplemented opcode");
             }
         }
+
+        if (single_step) return KVM_STEP_CONTINUE;
     }
     
     return 0;
 }
 
+int kvm_run(KVM* vm) {
+    // 當前位置有機器碼時進入機器碼；控制流離開機器碼覆蓋的範圍 (進入其他字節碼塊或尚未生成的函數體) 時
+    // 返回 KVM_STEP_CONTINUE，在新位置取得機器碼後重新進入，沒有機器碼時由解釋器接手
+    while (vm->chunk && vm->chunk->jit_code) {
+        KBytecodeChunk* chunk = vm->chunk;
+        uint8_t* ip = vm->ip;
+        void* code = chunk->jit_code;
+        if (vm->jit) {
+            JitCodeBlock* block = jit_materialize(vm->jit, chunk, (size_t)(ip - chunk->code));
+            if (!block) break;
+            jit_touch(vm->jit, block);
+            code = block->code;
+        }
+        chunk->jit_active++; // 執行期間本塊的代碼不會被驅逐 (機器碼可經 jit_entries 跳入同一塊的其他代碼塊)
+        int res = ((JitFunction)code)(vm);
+        chunk->jit_active--;
+        if (res != KVM_STEP_CONTINUE) return res;
+        if (!vm->jit || (vm->chunk == chunk && vm->ip == ip)) break; // 入口處即離開機器碼
+    }
+    return kvm_execute(vm, false);
+}
+
+int kvm_step(KVM* vm) {
+    return kvm_execute(vm, true);
+}
+
 // Public wrapper for call
 bool kvm_call_function(KVM* vm, KObjFunction* function, int arg_count) {
     return call(vm, function, arg_count, 0);
@@ -1959,13 +2608,7 @@ int kvm_interpret(KVM* vm, KBytecodeChunk* chunk) {
 
     // Try JIT Compilation
     if (vm->jit && vm->jit->enabled && !chunk->jit_code) {
-        chunk->jit_code = jit_compile(vm->jit, chunk);
-    }
-
-    if (chunk->jit_code) {
-        JitFunction func = (JitFunction)chunk->jit_code;
-        int res = func(vm);
-        return res;
+        chunk->jit_code = jit_compile_lazy(vm->jit, chunk);
     }
 
     return kvm_run(vm);
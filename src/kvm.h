@@ -139,6 +139,9 @@ typedef struct KObjClass {
     char* name;
     struct KObjClass* parent;
     KTable methods;
+    char** fields;   /**< 結構體按聲明順序登記的字段 (KOP_FIELD)，決定數組內聯存儲的布局 */
+    int field_count;
+    uint32_t layout_id; /**< 類對象的唯一編號 (不因回收後地址復用而重複)，字段內聯緩存據此識別布局 */
 } KObjClass;
 
 /**
@@ -149,6 +152,7 @@ typedef struct {
     int arity;
     KBytecodeChunk* chunk; /**< 指向字節碼塊 */
     uint32_t entry_point;  /**< 字節碼塊中的入口點 */
+    int frame_size;        /**< 寄存器窗口大小 (編譯器統計的峰值) */
     char* name;
     int access;            /**< 0: private, 1: protected, 2: public */
     struct KObjClass* parent_class;
@@ -164,6 +168,23 @@ typedef struct {
     KObjFunction* method;
 } KObjBoundMethod;
 
+/**
+ * @brief 數組元素的存儲方式
+ * new int[n] / new float[n] / new bool[n] 創建無標籤的連續存儲，GC 不必掃描；
+ * 存入其他類型的值時整個數組轉換為 ARRAY_VALUES (見 kvm_array_set)。
+ * 結構體數組以 ARRAY_STRUCT 內聯存放字段，元素需要作為對象使用時轉換為 ARRAY_VALUES (見 kvm_array_materialize)。
+ */
+typedef enum {
+    ARRAY_VALUES, /**< KValue，可以存放任何值 */
+    ARRAY_INT,    /**< int64_t，元素讀出為 VAL_INT */
+    ARRAY_DOUBLE, /**< double，元素讀出為 VAL_DOUBLE */
+    ARRAY_BOOL,   /**< uint8_t，元素讀出為 VAL_BOOL */
+    ARRAY_STRUCT  /**< KValue，每個元素連續佔 klass->field_count 個槽位，字段按聲明順序排列 */
+} KArrayKind;
+
+/** @brief ARRAY_STRUCT 中尚未賦值的字段槽位的類型標記 */
+#define KFIELD_UNSET ((KValueType)0xFF)
+
 /**
  * @brief 數組對象
  */
@@ -171,7 +192,16 @@ typedef struct {
     KObjHeader header;
     int length;
     int capacity;
-    KValue* elements; /**< 指向 KValue 數組的指針 */
+    union {
+        KValue* elements; /**< ARRAY_VALUES：指向 KValue 數組的指針 */
+        int64_t* ints;    /**< ARRAY_INT */
+        double* doubles;  /**< ARRAY_DOUBLE */
+        uint8_t* bools;   /**< ARRAY_BOOL */
+        KValue* slots;    /**< ARRAY_STRUCT：length * klass->field_count 個槽位 */
+    };
+    KArrayKind kind;
+    uint32_t layout_id;      /**< ARRAY_STRUCT：klass->layout_id，JIT 代碼據此校驗內聯緩存 */
+    struct KObjClass* klass; /**< ARRAY_STRUCT 的元素類型，其他存儲方式為 NULL */
 } KObjArray;
 
 // --- VM Structure ---
@@ -246,6 +276,10 @@ typedef struct KVM {
     /* JIT (即時編譯) */
     ComeOnJIT* jit;
 
+    /* 堆快照 (ksnapshot_load)：持有快照中的字節碼塊與字符串，kvm_free 時調用 snapshot_release */
+    void* snapshot;
+    void (*snapshot_release)(void* snapshot);
+
 } KVM;
 
 // --- API ---
@@ -270,11 +304,74 @@ int kvm_interpret(KVM* vm, KBytecodeChunk* chunk);
  */
 int kvm_run(KVM* vm);
 
+#define KVM_STEP_CONTINUE 2 /**< kvm_step: 指令已執行，可繼續 */
+
+/**
+ * @brief 單步執行當前指令 (JIT 慢路徑輔助)
+ * @return 0 程序結束，1 錯誤，KVM_STEP_CONTINUE 繼續執行
+ */
+int kvm_step(KVM* vm);
+
 /**
  * @brief 輔助：打印值
  */
 void kvm_print_value(KValue value);
 
+/**
+ * @brief 讀取數組元素
+ * @param index 已檢查在界內
+ */
+KValue kvm_array_get(KObjArray* array, int index);
+
+/**
+ * @brief 寫入數組元素
+ * 值的類型與無標籤存儲不符時 (例如向 int[] 存入字符串)，先把數組轉換為 ARRAY_VALUES。
+ * @param index 已檢查在界內
+ */
+void kvm_array_set(KObjArray* array, int index, KValue value);
+
+/**
+ * @brief 把 ARRAY_STRUCT 數組轉換為 ARRAY_VALUES
+ * 每個元素創建一個實例並寫入已賦值的字段，之後元素按引用共享；其他存儲方式不變。
+ * 讀取或寫入元素本身 (而不是它的字段) 之前必須調用。
+ */
+void kvm_array_materialize(KVM* vm, KObjArray* array);
+
+/**
+ * @brief 數組的內建方法 (Array 類的本地方法與 KOP_APUSH 等指令共用)
+ * 容量不足時按倍數增長，長度降到容量的 1/4 以下時原地縮小一半，追加與刪除末尾元素均攤 O(1)。
+ * 存儲方式的規則與 kvm_array_set 相同；ARRAY_STRUCT 數組先轉換為 ARRAY_VALUES。
+ */
+void kvm_array_push(KVM* vm, KObjArray* array, KValue value);
+
+/** @brief 刪除並返回最後一個元素，數組為空時返回 null */
+KValue kvm_array_pop(KVM* vm, KObjArray* array);
+
+/**
+ * @brief 在 index 處插入元素，之後的元素後移
+ * @return index 不在 [0, length] 內時不修改數組並返回 false
+ */
+bool kvm_array_insert(KVM* vm, KObjArray* array, int64_t index, KValue value);
+
+/** @brief 刪除並返回 index 處的元素，之後的元素前移；index 不在界內時返回 null */
+KValue kvm_array_remove(KVM* vm, KObjArray* array, int64_t index);
+
+/** @brief 把容量擴大到至少 capacity，長度不變 */
+void kvm_array_reserve(KVM* vm, KObjArray* array, int64_t capacity);
+
+/**
+ * @brief 複製 [start, end) 中的元素到新數組，存儲方式不變
+ * start 與 end 截斷到 [0, length]，start >= end 時返回空數組。
+ */
+KObjArray* kvm_array_slice(KVM* vm, KObjArray* array, int64_t start, int64_t end);
+
+/**
+ * @brief 分配新的類布局編號
+ * KOP_CLASS 與堆快照恢復的類都從這裡取號，保證字段內聯緩存不會誤認布局。
+ * @return 不為 0 的編號
+ */
+uint32_t kvm_next_layout_id(void);
+
 /**
  * @brief 調用函數
  */
@@ -0,0 +1,184 @@
+#include "kcache.h"
+#include "kvm.h"
+#include "klex.h"
+#include "kparser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief 字節碼緩存測試
+ * 映射中的緩存文件被另一個進程重新寫入時，已加載的字節碼必須保持不變並能照常執行；
+ * 指紋不同的緩存不被加載；行號表經過編碼、保存和加載後仍能還原每條指令的源碼行。
+ */
+
+#define CACHE_FILE "kcache_test.kri.kc"
+
+static int failures = 0;
+
+#define CHECK(cond, message) do { \
+    if (!(cond)) { \
+        printf("FAIL: %s (%s:%d)\n", message, __FILE__, __LINE__); \
+        failures++; \
+    } \
+} while (0)
+
+static bool compile(const char* source, KBytecodeChunk* chunk) {
+    Lexer lexer;
+    init_lexer(&lexer, source);
+    Parser parser;
+    init_parser(&parser, &lexer);
+    KastProgram* program = parse_program(&parser);
+    if (!program || parser.has_error) return false;
+    init_chunk(chunk);
+    bool ok = compile_ast(program, chunk) == 0;
+    free_ast_node((KastNode*)program);
+    return ok;
+}
+
+static bool save(const char* source) {
+    KBytecodeChunk chunk;
+    if (!compile(source, &chunk)) return false;
+    int result = kcache_save(CACHE_FILE, &chunk, kcache_hash(source, strlen(source)), strlen(source));
+    free_chunk(&chunk);
+    return result == 0;
+}
+
+/** @brief 運行字節碼塊，返回全局變量 name 的整數值 */
+static int64_t run_global(KBytecodeChunk* chunk, const char* name) {
+    KVM vm;
+    kvm_init(&vm);
+    kvm_interpret(&vm, chunk);
+    KValue value;
+    int64_t result = -1;
+    if (!vm.had_error && table_get(&vm.globals, name, &value) && value.type == VAL_INT) {
+        result = value.as.integer;
+    }
+    kvm_free(&vm);
+    return result;
+}
+
+static void test_rewrite_while_mapped(void) {
+    const char* first = "int a = 5; int b = 8; int x = a * b;";
+    const char* second = "string a = \"p\"; string b = \"q\"; string pad = \"padding padding\"; string x = a + b;";
+
+    CHECK(save(first), "save first cache");
+    KBytecodeChunk chunk;
+    init_chunk(&chunk);
+    CHECK(kcache_load(CACHE_FILE, &chunk, 0, 0) == 0, "load first cache");
+    CHECK(chunk.image != NULL || chunk.code != NULL, "cache is loaded");
+
+    uint8_t* expected = (uint8_t*)malloc(chunk.count);
+    memcpy(expected, chunk.code, chunk.count);
+    size_t expected_count = chunk.count;
+
+    // 模擬另一個進程用不同的源碼重新生成同一個緩存文件
+    CHECK(save(second), "rewrite cache");
+
+    CHECK(chunk.count == expected_count && memcmp(chunk.code, expected, expected_count) == 0,
+          "mapped bytecode unchanged after rewrite");
+    CHECK(run_global(&chunk, "x") == 40, "mapped chunk runs after rewrite");
+    free(expected);
+    free_chunk(&chunk);
+
+    // 新文件完整可用
+    KBytecodeChunk fresh;
+    init_chunk(&fresh);
+    CHECK(kcache_load(CACHE_FILE, &fresh, kcache_hash(second, strlen(second)), strlen(second)) == 0,
+          "load rewritten cache");
+    free_chunk(&fresh);
+    remove(CACHE_FILE);
+}
+
+/** @brief 行號先增後減、跨度超過一個 LEB128 字節時，查詢與展開結果一致 */
+static void test_line_table_encoding(void) {
+    static const struct { size_t offset; int line; } entries[] = {
+        {0, 1}, {4, 2}, {12, 200}, {13, 3}, {40, 70000}, {41, 69999}, {300, 5},
+    };
+    size_t count = sizeof(entries) / sizeof(entries[0]);
+    KLineTable table = {0};
+    for (size_t i = 0; i < count; i++) {
+        line_table_add(&table, entries[i].offset, entries[i].line);
+    }
+    int* lines = line_table_expand(&table, 310);
+    for (size_t i = 0; i < count; i++) {
+        size_t end = i + 1 < count ? entries[i + 1].offset : 310;
+        for (size_t offset = entries[i].offset; offset < end; offset++) {
+            CHECK(line_table_lookup(&table, offset) == entries[i].line, "lookup returns the recorded line");
+            CHECK(lines && lines[offset] == entries[i].line, "expand returns the recorded line");
+        }
+    }
+    free(lines);
+    free(table.data);
+}
+
+static void test_line_table_round_trip(void) {
+    const char* source =
+        "int a = 1;\n"
+        "\n"
+        "int b = a + 2;\n"
+        "\n\n\n\n\n\n\n\n\n\n"
+        "int c = b * 3;\n";
+    KBytecodeChunk chunk;
+    CHECK(compile(source, &chunk), "compile multi-line source");
+    bool seen[15] = {false};
+    for (size_t offset = 0; offset < chunk.count; offset++) {
+        int line = line_table_lookup(&chunk.lines, offset);
+        CHECK(line >= 0 && line <= 14, "recorded line lies within the source");
+        if (line >= 0 && line <= 14) seen[line] = true;
+    }
+    CHECK(seen[1] && seen[3] && seen[14], "each statement keeps its own line");
+    int* expected = line_table_expand(&chunk.lines, chunk.count);
+    size_t expected_count = chunk.count;
+    CHECK(kcache_save(CACHE_FILE, &chunk, kcache_hash(source, strlen(source)), strlen(source)) == 0,
+          "save cache with line table");
+    free_chunk(&chunk);
+
+    KBytecodeChunk loaded;
+    init_chunk(&loaded);
+    CHECK(kcache_load(CACHE_FILE, &loaded, kcache_hash(source, strlen(source)), strlen(source)) == 0,
+          "load cache with line table");
+    CHECK(loaded.count == expected_count, "loaded code size matches");
+    int* lines = line_table_expand(&loaded.lines, loaded.count);
+    CHECK(expected && lines && memcmp(lines, expected, expected_count * sizeof(int)) == 0,
+          "line table survives the cache round trip");
+    free(lines);
+    free(expected);
+    free_chunk(&loaded);
+    remove(CACHE_FILE);
+}
+
+/** @brief 指紋不同的緩存 (其他編譯器或舊的文件格式生成) 被視為過期 */
+static void test_stale_fingerprint(void) {
+    const char* source = "int x = 3;";
+    CHECK(save(source), "save cache");
+    KCacheHeader header;
+    FILE* fp = fopen(CACHE_FILE, "r+b");
+    CHECK(fp && fread(&header, sizeof(header), 1, fp) == 1, "read cache header");
+    CHECK(header.fingerprint == kcache_fingerprint(), "cache carries the compiler fingerprint");
+    if (fp) {
+        header.fingerprint ^= 1;
+        fseek(fp, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, fp);
+        fclose(fp);
+    }
+    KBytecodeChunk chunk;
+    init_chunk(&chunk);
+    CHECK(kcache_load(CACHE_FILE, &chunk, kcache_hash(source, strlen(source)), strlen(source)) == 1,
+          "cache with another fingerprint is stale");
+    free_chunk(&chunk);
+    remove(CACHE_FILE);
+}
+
+int main(void) {
+    test_rewrite_while_mapped();
+    test_stale_fingerprint();
+    test_line_table_encoding();
+    test_line_table_round_trip();
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("kcache: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "kcode.h"
+#include "klex.h"
+#include "kparser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief 編譯期優化測試
+ * 檢查常量傳播與折疊後生成的字節碼：常量名的讀取和運算都在編譯時完成。
+ */
+
+static int failures = 0;
+
+#define CHECK(cond, message) do { \
+    if (!(cond)) { \
+        printf("FAIL: %s (%s:%d)\n", message, __FILE__, __LINE__); \
+        failures++; \
+    } \
+} while (0)
+
+static bool compile(const char* source, KBytecodeChunk* chunk) {
+    Lexer lexer;
+    init_lexer(&lexer, source);
+    Parser parser;
+    init_parser(&parser, &lexer);
+    KastProgram* program = parse_program(&parser);
+    if (!program || parser.has_error) return false;
+    init_chunk(chunk);
+    bool ok = compile_ast(program, chunk) == 0;
+    free_ast_node((KastNode*)program);
+    return ok;
+}
+
+/** @brief 字節碼中操作碼 op 出現的次數 */
+static int count_opcode(const KBytecodeChunk* chunk, uint8_t op) {
+    int count = 0;
+    for (size_t offset = 0; offset < chunk->count; offset += (size_t)opcode_length(chunk->code[offset])) {
+        if (chunk->code[offset] == op) count++;
+    }
+    return count;
+}
+
+/** @brief 是否有一條 LDCD 加載值為 value 的雙精度常量 */
+static bool loads_double(const KBytecodeChunk* chunk, double value) {
+    for (size_t offset = 0; offset < chunk->count; offset += (size_t)opcode_length(chunk->code[offset])) {
+        if (chunk->code[offset] != KOP_LDCD) continue;
+        size_t index = (size_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+        if (index < chunk->double_count && chunk->double_constants[index] == value) return true;
+    }
+    return false;
+}
+
+static void test_fold_int_constant(void) {
+    KBytecodeChunk chunk;
+    CHECK(compile("var const int N = 4; int x = N * 3;", &chunk), "compile int constant");
+    CHECK(count_opcode(&chunk, KOP_GET_GLOBAL) == 0, "int constant is propagated");
+    CHECK(count_opcode(&chunk, KOP_MUL) == 0 && count_opcode(&chunk, KOP_MUL_INT) == 0, "int product is folded");
+    free_chunk(&chunk);
+}
+
+static void test_fold_float_constant(void) {
+    KBytecodeChunk chunk;
+    CHECK(compile("var const float F = 2.5; float y = F * 2.0;", &chunk), "compile float constant");
+    CHECK(count_opcode(&chunk, KOP_GET_GLOBAL) == 0, "float constant is propagated");
+    CHECK(count_opcode(&chunk, KOP_MUL) == 0 && count_opcode(&chunk, KOP_FMUL_D) == 0, "float product is folded");
+    CHECK(loads_double(&chunk, 5.0), "folded float product is loaded as a constant");
+    free_chunk(&chunk);
+}
+
+/** @brief 類型不符的常量不傳播，保留聲明處的值 */
+static void test_keep_mismatched_constant(void) {
+    KBytecodeChunk chunk;
+    CHECK(compile("var const int N = 2.5; int x = N * 3;", &chunk), "compile mismatched constant");
+    CHECK(count_opcode(&chunk, KOP_GET_GLOBAL) == 1, "mismatched constant is read at run time");
+    free_chunk(&chunk);
+}
+
+int main(void) {
+    test_fold_int_constant();
+    test_fold_float_constant();
+    test_keep_mismatched_constant();
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("kopt: all checks passed\n");
+    return 0;
+}